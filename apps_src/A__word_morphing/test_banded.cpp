@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "ddynamicprogramming.h"
+
+//checks that DDynamicProgramming::findDPAlignmentBanded() gives bitwise the
+//same cost and the same path as findDPAlignment() with the same bandCost on
+//random feature vectors.  Some of the vectors have large values (like the
+//unnormalized vertical profiles) or a small bandCost, so the best path
+//often leaves the band and the banded version has to pay for that too.
+//Also checks that with a bandCost of HUGE_VAL (a hard band) the cost is the
+//same as findDPCostOnly().
+
+double randRange(double lo, double hi){
+  return lo + (hi - lo) * (rand() / (double)RAND_MAX);
+}
+
+bool sameBits(double a, double b){
+  return 0 == memcmp(&a, &b, sizeof(double));
+}
+
+//true if any cell on the path is outside of the band
+bool pathLeavesBand(int Wa, int Wb, int bandRadius, int pathLen,
+		    int *rgPath){
+  int i = 0, j = 0;
+  for(int p=0; p < pathLen; ++p){
+    if(1 == rgPath[p])
+      ++j;
+    else if(2 == rgPath[p])
+      ++i;
+    else{
+      ++i;
+      ++j;
+    }
+    if(0. != DDynamicProgramming::checkBandCost(i, j, Wa, Wb, bandRadius, 1.))
+      return true;
+  }
+  return false;
+}
+
+int main(int argc, char **argv){
+  if(2 != argc){
+    fprintf(stderr, "usage: %s <num_random_trials>\n", argv[0]);
+    return 1;
+  }
+  int numTrials = atoi(argv[1]);
+  int numBad = 0;
+  int numLeave = 0;
+  srand(4321);
+
+  for(int tt=0; tt < numTrials; ++tt){
+    DFeatureVector fv1, fv2;
+    int Wa, Wb, dims, bandRadius;
+    double bandCost, nonDiagonalCost, scale;
+    double *rgData;
+    int pathLenFull, pathLenBanded, pathLenCostOnly;
+    int *rgPathFull, *rgPathBanded;
+    double costFull, costBanded, costHard, costCostOnly;
+
+    Wa = 5 + rand() % 120;
+    Wb = 5 + rand() % 120;
+    dims = 1 + rand() % 4;
+    bandRadius = 2 + rand() % 15;
+    nonDiagonalCost = (0 == (tt & 1)) ? 0. : randRange(0., 5.);
+    switch(tt % 3){
+      case 0: scale = 1.; bandCost = 1000.; break;//usually stays in the band
+      case 1: scale = 100.; bandCost = 1000.; break;//unnormalized
+      default: scale = 10.; bandCost = randRange(0.5, 50.); break;
+    }
+    for(int vv=0; vv < 2; ++vv){
+      DFeatureVector &fv = (0 == vv) ? fv1 : fv2;
+      int len = (0 == vv) ? Wa : Wb;
+      rgData = new double[dims*len];
+      D_CHECKPTR(rgData);
+      for(int i=0; i < dims*len; ++i)
+	rgData[i] = randRange(0., scale);
+      fv.setData_dbl(rgData, len, dims, true, true, true);
+      delete [] rgData;
+    }
+    rgPathFull = new int[Wa+Wb+2];
+    D_CHECKPTR(rgPathFull);
+    rgPathBanded = new int[Wa+Wb+2];
+    D_CHECKPTR(rgPathBanded);
+
+    costFull = DDynamicProgramming::findDPAlignment(fv1, fv2, bandRadius,
+						    bandCost, nonDiagonalCost,
+						    &pathLenFull, rgPathFull);
+    costBanded =
+      DDynamicProgramming::findDPAlignmentBanded(fv1, fv2, bandRadius,
+						 bandCost, nonDiagonalCost,
+						 &pathLenBanded, rgPathBanded);
+    if(!sameBits(costFull, costBanded) || (pathLenFull != pathLenBanded) ||
+       (0 != memcmp(rgPathFull, rgPathBanded, sizeof(int)*pathLenFull))){
+      printf("trial %d (Wa=%d Wb=%d r=%d bandCost=%g): banded cost %.17g "
+	     "(path %d) != full %.17g (path %d)\n", tt, Wa, Wb, bandRadius,
+	     bandCost, costBanded, pathLenBanded, costFull, pathLenFull);
+      ++numBad;
+    }
+    if(pathLeavesBand(Wa, Wb, bandRadius, pathLenFull, rgPathFull))
+      ++numLeave;
+
+    costHard = DDynamicProgramming::findDPAlignmentBanded(fv1, fv2, bandRadius,
+							  HUGE_VAL,
+							  nonDiagonalCost);
+    costCostOnly = DDynamicProgramming::findDPCostOnly(fv1, fv2, bandRadius,
+						       nonDiagonalCost,
+						       HUGE_VAL,
+						       &pathLenCostOnly);
+    if(!sameBits(costHard, costCostOnly)){
+      printf("trial %d (Wa=%d Wb=%d r=%d): hard band cost %.17g != "
+	     "findDPCostOnly() %.17g\n", tt, Wa, Wb, bandRadius, costHard,
+	     costCostOnly);
+      ++numBad;
+    }
+    delete [] rgPathBanded;
+    delete [] rgPathFull;
+  }
+
+  printf("%d trials, best path left the band in %d\n", numTrials, numLeave);
+  if(numBad > 0){
+    printf("FAILED: %d differ\n", numBad);
+    return 1;
+  }
+  if(0 == numLeave){
+    printf("FAILED: no trial had a path that leaves the band\n");
+    return 1;
+  }
+  printf("PASSED\n");
+  return 0;
+}
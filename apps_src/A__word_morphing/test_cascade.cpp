@@ -0,0 +1,164 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "dmorphink.h"
+#include "dthresholder.h"
+
+//checks DMorphInk::getWordMorphCostCascade() against the uncascaded cost:
+//for each test word the threshold is the real K-th best cost to the
+//training words, every comparison the cascade accepts must give exactly
+//the uncascaded cost, and it must not reject any word whose real cost is
+//at or under the threshold (so the best K are the same).  The DP and
+//coarse stages are only approximations and are off by default; if scales
+//are given for them, the words they wrongly reject are counted but don't
+//fail the test.
+
+bool loadPrepared(const char *stPathIn, int wordNum, DImage &img){
+  char stTmp[1025];
+  int tval;
+  snprintf(stTmp, 1025, "%s/w_%08d.pgm", stPathIn, wordNum);
+  if(!img.load(stTmp)){
+    fprintf(stderr, "couldn't load image '%s'\n", stTmp);
+    return false;
+  }
+  tval = atoi(img.getCommentByIndex(0).c_str());
+  DThresholder::threshImage_(img, img, tval);
+  return true;
+}
+
+int compareDoubles(const void *p1, const void *p2){
+  if ( (*(double*)(p1)) < (*(double*)(p2)) )
+    return -1;
+  else if ( (*(double*)(p1)) > (*(double*)(p2)) )
+    return 1;
+  return 0;
+}
+
+int main(int argc, char **argv){
+  if((argc < 7) || (argc > 11)){
+    fprintf(stderr, "usage: %s <dataset_path> <first_training_num> "
+	    "<last_training_num> <first_test_num> <last_test_num> <K> "
+	    "[fFast=1] [lengthPenalty=0.] [cascadeDPScale=0.] "
+	    "[cascadeCoarseScale=0.]\n", argv[0]);
+    return 1;
+  }
+  const char *stPathIn = argv[1];
+  int trainFirst = atoi(argv[2]);
+  int trainLast = atoi(argv[3]);
+  int testFirst = atoi(argv[4]);
+  int testLast = atoi(argv[5]);
+  int K = atoi(argv[6]);
+  bool fFast = (argc > 7) ? (0 != atoi(argv[7])) : true;
+  double lengthPenalty = (argc > 8) ? atof(argv[8]) : 0.;
+  double dpScale = (argc > 9) ? atof(argv[9]) : 0.;
+  double coarseScale = (argc > 10) ? atof(argv[10]) : 0.;
+  bool fApprox = (0. != dpScale) || (0. != coarseScale);
+  int numTrain = trainLast - trainFirst + 1;
+  int numBad = 0;
+  int numFalseRejects = 0;
+  long rgNumStage[DMorphInk::CascadeNumStages];
+
+  if((numTrain < 1) || (K < 1) || (K > numTrain) || (testLast < testFirst)){
+    fprintf(stderr, "check the word ranges and K\n");
+    return 1;
+  }
+  for(int st=0; st < DMorphInk::CascadeNumStages; ++st)
+    rgNumStage[st] = 0;
+
+  DImage *rgImgs = new DImage[numTrain];
+  D_CHECKPTR(rgImgs);
+  DMorphInkPrepared *rgPrep = new DMorphInkPrepared[numTrain];
+  D_CHECKPTR(rgPrep);
+  for(int tr=0; tr < numTrain; ++tr){
+    if(!loadPrepared(stPathIn, trainFirst+tr, rgImgs[tr]))
+      return 1;
+    rgPrep[tr].prepare(rgImgs[tr], false);
+  }
+  double *rgCosts = new double[numTrain];
+  D_CHECKPTR(rgCosts);
+  double *rgSorted = new double[numTrain];
+  D_CHECKPTR(rgSorted);
+  double *rgCascadeCosts = new double[numTrain];
+  D_CHECKPTR(rgCascadeCosts);
+  double *rgThresholds = new double[numTrain];
+  D_CHECKPTR(rgThresholds);
+  int *rgStages = new int[numTrain];
+  D_CHECKPTR(rgStages);
+
+  DMorphInk mobj;
+  DMorphInkBatchOptions opts;
+  mobj.cascadeDPScale = dpScale;
+  mobj.cascadeCoarseScale = coarseScale;
+  opts.fFast = fFast;
+  opts.lengthMismatchPenalty = lengthPenalty;
+  for(int tt=testFirst; tt <= testLast; ++tt){
+    DImage imgTest;
+    if(!loadPrepared(stPathIn, tt, imgTest))
+      return 1;
+    DMorphInkPrepared prepTest(imgTest, false);
+
+    opts.rgThresholds = NULL;
+    opts.rgCascadeStage = NULL;
+    mobj.computeCostsOneToMany(prepTest, rgPrep, numTrain, rgCosts, opts);
+    memcpy(rgSorted, rgCosts, sizeof(double)*numTrain);
+    qsort((void*)rgSorted, numTrain, sizeof(double), compareDoubles);
+    for(int tr=0; tr < numTrain; ++tr)
+      rgThresholds[tr] = rgSorted[K-1];
+    opts.rgThresholds = rgThresholds;
+    opts.rgCascadeStage = rgStages;
+    mobj.computeCostsOneToMany(prepTest, rgPrep, numTrain, rgCascadeCosts,
+			       opts);
+    for(int tr=0; tr < numTrain; ++tr){
+      ++(rgNumStage[rgStages[tr]]);
+      if(DMorphInk::CascadeNotRejected == rgStages[tr]){
+	if(rgCascadeCosts[tr] != rgCosts[tr]){
+	  printf("test %d train %d: accepted cost %.17g != uncascaded %.17g\n",
+		 tt, trainFirst+tr, rgCascadeCosts[tr], rgCosts[tr]);
+	  ++numBad;
+	}
+      }
+      else{
+	if(!(rgCascadeCosts[tr] > rgThresholds[tr])){
+	  printf("test %d train %d: rejected at stage %d with %.17g, which "
+		 "isn't over the threshold %.17g\n", tt, trainFirst+tr,
+		 rgStages[tr], rgCascadeCosts[tr], rgThresholds[tr]);
+	  ++numBad;
+	}
+	if(rgCosts[tr] <= rgThresholds[tr]){
+	  printf("test %d train %d: rejected at stage %d but its cost %.17g "
+		 "is within the threshold %.17g\n", tt, trainFirst+tr,
+		 rgStages[tr], rgCosts[tr], rgThresholds[tr]);
+	  ++numFalseRejects;
+	}
+      }
+    }
+  }
+  printf("%s costs, K=%d: %ld completed, rejected by stage: length=%ld "
+	 "DP=%ld coarse=%ld oneWay=%ld\n", fFast ? "fast" : "full", K,
+	 rgNumStage[DMorphInk::CascadeNotRejected],
+	 rgNumStage[DMorphInk::CascadeLength],
+	 rgNumStage[DMorphInk::CascadeDP],
+	 rgNumStage[DMorphInk::CascadeCoarse],
+	 rgNumStage[DMorphInk::CascadeOneWay]);
+
+  delete [] rgStages;
+  delete [] rgThresholds;
+  delete [] rgCascadeCosts;
+  delete [] rgSorted;
+  delete [] rgCosts;
+  delete [] rgPrep;
+  delete [] rgImgs;
+  if(fApprox && (numFalseRejects > 0)){
+    printf("%d wrongly rejected by the approximate stages (DP scale %g, "
+	   "coarse scale %g)\n", numFalseRejects, dpScale, coarseScale);
+    numFalseRejects = 0;
+  }
+  if((numBad > 0) || (numFalseRejects > 0)){
+    printf("FAILED: %d wrong costs, %d wrongly rejected\n", numBad,
+	   numFalseRejects);
+    return 1;
+  }
+  printf("PASSED\n");
+  return 0;
+}
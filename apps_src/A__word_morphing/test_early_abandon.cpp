@@ -0,0 +1,167 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "dmorphink.h"
+#include "ddynamicprogramming.h"
+#include "dthresholder.h"
+
+//checks the early abandon of the DP cost (DDynamicProgramming::findDPCostOnly()
+//with an upperBound, and DMorphInk::getWordDPCost(), which also tries the
+//LB_Improved bound first): for each pair and each of several bounds around
+//the real cost, a cost that is within the bound must come back exactly
+//(bitwise) the same as without a bound, and a cost over the bound may come
+//back as a smaller value, but it must still be over the bound.  With a
+//negative nonDiagonalCost the table can decrease along a path, so nothing
+//may be abandoned and every bounded cost must be the real cost.
+
+bool loadPrepared(const char *stPathIn, int wordNum, DImage &img){
+  char stTmp[1025];
+  int tval;
+  snprintf(stTmp, 1025, "%s/w_%08d.pgm", stPathIn, wordNum);
+  if(!img.load(stTmp)){
+    fprintf(stderr, "couldn't load image '%s'\n", stTmp);
+    return false;
+  }
+  tval = atoi(img.getCommentByIndex(0).c_str());
+  DThresholder::threshImage_(img, img, tval);
+  return true;
+}
+
+//the bounds tried for a pair whose real cost is cost
+const double rgBoundScales[] = {0., 0.25, 0.5, 0.9, 0.999, 1., 1.001, 1.1,
+				2., 10.};
+const int numBoundScales = sizeof(rgBoundScales) / sizeof(double);
+
+//compare a bounded result to the real cost. returns false if it is wrong
+bool checkBounded(const char *stWhat, int pairNum, double cost,
+		  double upperBound, double boundedCost, long *pNumAbandoned){
+  if(cost <= upperBound){
+    if(0 != memcmp(&cost, &boundedCost, sizeof(double))){
+      printf("%s pair %d: bound %.17g: got %.17g, not the real cost %.17g\n",
+	     stWhat, pairNum, upperBound, boundedCost, cost);
+      return false;
+    }
+  }
+  else if(boundedCost != cost){
+    ++(*pNumAbandoned);
+    if(!(boundedCost > upperBound)){
+      printf("%s pair %d: bound %.17g: abandoned with %.17g, which isn't "
+	     "over the bound (real cost %.17g)\n", stWhat, pairNum, upperBound,
+	     boundedCost, cost);
+      return false;
+    }
+  }
+  return true;
+}
+
+int main(int argc, char **argv){
+  if((2 != argc) && (5 != argc)){
+    fprintf(stderr, "usage: %s <num_random_pairs> [<dataset_path> "
+	    "<first_word_num> <last_word_num>]\n", argv[0]);
+    return 1;
+  }
+  int numRandomPairs = atoi(argv[1]);
+  int numBad = 0;
+  long numChecks = 0;
+  long numAbandoned = 0;
+  int bandWidth = 15;
+
+  //random feature vectors (4 values per column like the word features)
+  srand(12345);
+  for(int pp=0; pp < numRandomPairs; ++pp){
+    DFeatureVector fv0, fv1;
+    int len0, len1;
+    double *rgData;
+    double cost;
+    len0 = 10 + rand() % 200;
+    len1 = 10 + rand() % 200;
+    rgData = new double[4*(len0 > len1 ? len0 : len1)];
+    D_CHECKPTR(rgData);
+    for(int i=0; i < 4*len0; ++i)
+      rgData[i] = rand() / (double)RAND_MAX;
+    fv0.setData_dbl(rgData, len0, 4, true, true, true);
+    for(int i=0; i < 4*len1; ++i)
+      rgData[i] = rand() / (double)RAND_MAX;
+    fv1.setData_dbl(rgData, len1, 4, true, true, true);
+    delete [] rgData;
+    cost = DDynamicProgramming::findDPCostOnly(fv0, fv1, bandWidth, 0.);
+    for(int bb=0; bb < numBoundScales; ++bb){
+      double upperBound, boundedCost;
+      upperBound = cost * rgBoundScales[bb];
+      boundedCost = DDynamicProgramming::findDPCostOnly(fv0, fv1, bandWidth,
+							0., upperBound);
+      ++numChecks;
+      if(!checkBounded("random findDPCostOnly", pp, cost, upperBound,
+		       boundedCost, &numAbandoned))
+	++numBad;
+    }
+    cost = DDynamicProgramming::findDPCostOnly(fv0, fv1, bandWidth, -0.3);
+    for(int bb=0; bb < numBoundScales; ++bb){
+      double upperBound, boundedCost;
+      bool fAbandoned;
+      upperBound = fabs(cost) * rgBoundScales[bb];
+      boundedCost = DDynamicProgramming::findDPCostOnly(fv0, fv1, bandWidth,
+							-0.3, upperBound, NULL,
+							NULL, NULL,
+							&fAbandoned);
+      ++numChecks;
+      if(fAbandoned || (0 != memcmp(&cost, &boundedCost, sizeof(double)))){
+	printf("random findDPCostOnly pair %d: negative nonDiagonalCost, "
+	       "bound %.17g: got %.17g, not the real cost %.17g\n", pp,
+	       upperBound, boundedCost, cost);
+	++numBad;
+      }
+    }
+  }
+
+  //every pair of the dataset words, through getWordDPCost()
+  if(5 == argc){
+    const char *stPathIn = argv[2];
+    int first = atoi(argv[3]);
+    int last = atoi(argv[4]);
+    int numWords = last - first + 1;
+    int pairNum = 0;
+    if(numWords < 2){
+      fprintf(stderr, "need at least 2 words\n");
+      return 1;
+    }
+    DImage *rgImgs = new DImage[numWords];
+    D_CHECKPTR(rgImgs);
+    DMorphInkPrepared *rgPrep = new DMorphInkPrepared[numWords];
+    D_CHECKPTR(rgPrep);
+    for(int w=0; w < numWords; ++w){
+      if(!loadPrepared(stPathIn, first+w, rgImgs[w]))
+	return 1;
+      rgPrep[w].prepare(rgImgs[w], false);
+    }
+    DMorphInk mobj;
+    for(int w0=0; w0 < numWords; ++w0){
+      for(int w1=w0+1; w1 < numWords; ++w1, ++pairNum){
+	double cost;
+	cost = mobj.getWordDPCost(rgPrep[w0], rgPrep[w1], bandWidth, 0., 0.);
+	for(int bb=0; bb < numBoundScales; ++bb){
+	  double upperBound, boundedCost;
+	  upperBound = cost * rgBoundScales[bb];
+	  boundedCost = mobj.getWordDPCost(rgPrep[w0], rgPrep[w1], bandWidth,
+					   0., 0., upperBound);
+	  ++numChecks;
+	  if(!checkBounded("words getWordDPCost", pairNum, cost, upperBound,
+			   boundedCost, &numAbandoned))
+	    ++numBad;
+	}
+      }
+    }
+    delete [] rgPrep;
+    delete [] rgImgs;
+  }
+
+  printf("%ld bounded costs checked, %ld abandoned\n", numChecks,
+	 numAbandoned);
+  if(numBad > 0){
+    printf("FAILED: %d wrong\n", numBad);
+    return 1;
+  }
+  printf("PASSED\n");
+  return 0;
+}
@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "dmorphink.h"
+#include "dthresholder.h"
+
+//compares the word morphing costs of a MORPHINK_FLOAT=1 build to the
+//default double build.  MORPHINK_FLOAT is a compile-time option, so this is
+//built twice (see the testfloat target in the Makefile): each build writes
+//the costs of every test word to every training word to a file, and then
+//--compare reads the two files.  Float doesn't give the same costs (the
+//greedy mesh search can take a different path), so the check is that the
+//mean relative difference is small and the best training word for each
+//test word is usually the same.
+
+bool loadPrepared(const char *stPathIn, int wordNum, DImage &img){
+  char stTmp[1025];
+  int tval;
+  snprintf(stTmp, 1025, "%s/w_%08d.pgm", stPathIn, wordNum);
+  if(!img.load(stTmp)){
+    fprintf(stderr, "couldn't load image '%s'\n", stTmp);
+    return false;
+  }
+  tval = atoi(img.getCommentByIndex(0).c_str());
+  DThresholder::threshImage_(img, img, tval);
+  return true;
+}
+
+//write "numTest numTrain" and then one line of numTrain costs per test word
+int writeCosts(const char *stPathIn, int trainFirst, int trainLast,
+	       int testFirst, int testLast, const char *stOut){
+  int numTrain = trainLast - trainFirst + 1;
+  int numTest = testLast - testFirst + 1;
+  FILE *fout;
+  if((numTrain < 1) || (numTest < 1)){
+    fprintf(stderr, "check the word ranges\n");
+    return 1;
+  }
+  DImage *rgImgs = new DImage[numTrain];
+  D_CHECKPTR(rgImgs);
+  DMorphInkPrepared *rgPrep = new DMorphInkPrepared[numTrain];
+  D_CHECKPTR(rgPrep);
+  for(int tr=0; tr < numTrain; ++tr){
+    if(!loadPrepared(stPathIn, trainFirst+tr, rgImgs[tr]))
+      return 1;
+    rgPrep[tr].prepare(rgImgs[tr], false);
+  }
+  double *rgCosts = new double[numTrain];
+  D_CHECKPTR(rgCosts);
+  fout = fopen(stOut, "w");
+  if(!fout){
+    fprintf(stderr, "couldn't open '%s' for writing\n", stOut);
+    return 1;
+  }
+  fprintf(fout, "%d %d\n", numTest, numTrain);
+  DMorphInk mobj;
+  DMorphInkBatchOptions opts;
+  opts.fFast = true;//getWordMorphCostFast(), like test_cascade
+  for(int tt=testFirst; tt <= testLast; ++tt){
+    DImage imgTest;
+    if(!loadPrepared(stPathIn, tt, imgTest))
+      return 1;
+    DMorphInkPrepared prepTest(imgTest, false);
+    mobj.computeCostsOneToMany(prepTest, rgPrep, numTrain, rgCosts, opts);
+    for(int tr=0; tr < numTrain; ++tr)
+      fprintf(fout, "%.17g ", rgCosts[tr]);
+    fprintf(fout, "\n");
+  }
+  fclose(fout);
+  printf("%s costs for %d test words x %d training words written to %s\n",
+	 MORPHINK_FLOAT ? "float" : "double", numTest, numTrain, stOut);
+  delete [] rgCosts;
+  delete [] rgPrep;
+  delete [] rgImgs;
+  return 0;
+}
+
+//read a file from writeCosts(). returns NULL on error
+double* readCosts(const char *stPath, int *numTest, int *numTrain){
+  FILE *fin;
+  double *rgCosts;
+  fin = fopen(stPath, "r");
+  if(!fin){
+    fprintf(stderr, "couldn't open '%s'\n", stPath);
+    return NULL;
+  }
+  if((2 != fscanf(fin, "%d %d", numTest, numTrain)) || ((*numTest) < 1) ||
+     ((*numTrain) < 1)){
+    fprintf(stderr, "bad header in '%s'\n", stPath);
+    fclose(fin);
+    return NULL;
+  }
+  rgCosts = new double[(*numTest) * (*numTrain)];
+  D_CHECKPTR(rgCosts);
+  for(int i=0; i < (*numTest) * (*numTrain); ++i){
+    if(1 != fscanf(fin, "%lf", &rgCosts[i])){
+      fprintf(stderr, "'%s' is missing costs\n", stPath);
+      fclose(fin);
+      delete [] rgCosts;
+      return NULL;
+    }
+  }
+  fclose(fin);
+  return rgCosts;
+}
+
+int compareCosts(const char *stDouble, const char *stFloat,
+		 double maxMeanRelDiff, double minTop1Frac){
+  int numTest, numTrain, numTestF, numTrainF;
+  double *rgDbl, *rgFlt;
+  double sumRelDiff = 0., maxRelDiff = 0.;
+  int numTop1Same = 0;
+  double meanRelDiff, top1Frac;
+
+  rgDbl = readCosts(stDouble, &numTest, &numTrain);
+  if(NULL == rgDbl)
+    return 1;
+  rgFlt = readCosts(stFloat, &numTestF, &numTrainF);
+  if(NULL == rgFlt)
+    return 1;
+  if((numTest != numTestF) || (numTrain != numTrainF)){
+    fprintf(stderr, "the cost files are for different word ranges\n");
+    return 1;
+  }
+  for(int tt=0; tt < numTest; ++tt){
+    int bestDbl = 0, bestFlt = 0;
+    for(int tr=0; tr < numTrain; ++tr){
+      double cd, cf, relDiff;
+      cd = rgDbl[tt*numTrain+tr];
+      cf = rgFlt[tt*numTrain+tr];
+      if(cf == cd)
+	relDiff = 0.;
+      else
+	relDiff = fabs(cf - cd) / ((fabs(cd) > 1e-9) ? fabs(cd) : 1e-9);
+      sumRelDiff += relDiff;
+      if(relDiff > maxRelDiff)
+	maxRelDiff = relDiff;
+      if(cd < rgDbl[tt*numTrain+bestDbl])
+	bestDbl = tr;
+      if(cf < rgFlt[tt*numTrain+bestFlt])
+	bestFlt = tr;
+    }
+    if(bestDbl == bestFlt)
+      ++numTop1Same;
+    else
+      printf("test word %d: best training word is %d with double, %d with "
+	     "float\n", tt, bestDbl, bestFlt);
+  }
+  meanRelDiff = sumRelDiff / (numTest * numTrain);
+  top1Frac = numTop1Same / (double)numTest;
+  printf("float vs double: mean relative cost difference %.4f (max %.4f), "
+	 "same best match for %d of %d test words\n", meanRelDiff, maxRelDiff,
+	 numTop1Same, numTest);
+  delete [] rgFlt;
+  delete [] rgDbl;
+  if((meanRelDiff > maxMeanRelDiff) || (top1Frac < minTop1Frac)){
+    printf("FAILED: allowed mean relative difference %.4f, required best "
+	   "match fraction %.2f\n", maxMeanRelDiff, minTop1Frac);
+    return 1;
+  }
+  printf("PASSED\n");
+  return 0;
+}
+
+int main(int argc, char **argv){
+  if((6 == argc) && (0 == strcmp(argv[1], "--compare")))
+    return compareCosts(argv[2], argv[3], atof(argv[4]), atof(argv[5]));
+  if(7 == argc)
+    return writeCosts(argv[1], atoi(argv[2]), atoi(argv[3]), atoi(argv[4]),
+		      atoi(argv[5]), argv[6]);
+  fprintf(stderr, "usage: %s <dataset_path> <first_training_num> "
+	  "<last_training_num> <first_test_num> <last_test_num> <out_costs>\n"
+	  "   or: %s --compare <double_costs> <float_costs> "
+	  "<max_mean_rel_diff> <min_best_match_fraction>\n", argv[0], argv[0]);
+  return 1;
+}
@@ -0,0 +1,149 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dmorphink.h"
+#include "ddynamicprogramming.h"
+
+//checks that the AVX2 kernels give bitwise the same results as the scalar
+//code on random inputs: DMorphInk::getVertexPositionCostIncr() (with
+//warped points on and off the distance map, so the clamping and
+//out-of-bounds compensation are covered) and the DP cell costs behind
+//DDynamicProgramming::findDPCostOnly().  This only holds if neither path
+//fuses a multiply and add into an FMA, so the library and this test are
+//built with -ffp-contract=off.  If the CPU doesn't have AVX2 there is
+//nothing to compare and the test passes.
+
+double randRange(double lo, double hi){
+  return lo + (hi - lo) * (rand() / (double)RAND_MAX);
+}
+
+bool sameBits(double a, double b){
+  return 0 == memcmp(&a, &b, sizeof(double));
+}
+
+int main(int argc, char **argv){
+  if(2 != argc){
+    fprintf(stderr, "usage: %s <num_random_trials>\n", argv[0]);
+    return 1;
+  }
+  int numTrials = atoi(argv[1]);
+  int numBad = 0;
+  long numChecks = 0;
+  DMorphInk mobj;
+
+  if(!mobj.fUseSIMD){
+    printf("no AVX2 vertex cost kernel (CPU or build), nothing to compare\n");
+    printf("PASSED\n");
+    return 0;
+  }
+  srand(12345);
+
+#if NEW_WARP
+  //random incremental vertex cost setups
+  for(int tt=0; tt < numTrials; ++tt){
+    DImage imgDist;
+    signed int *psDist;
+    int numVarying, capacity;
+    mobj.w1 = 20 + rand() % 200;
+    mobj.h1 = 20 + rand() % 100;
+    imgDist.create(mobj.w1, mobj.h1, DImage::DImage_u32);
+    psDist = (signed int*)imgDist.dataPointer_u32();
+    for(int i=0; i < mobj.w1 * mobj.h1; ++i)
+      psDist[i] = rand() % 1000;
+    mobj.pimgDist1 = &imgDist;
+    numVarying = rand() % 70;//includes counts that aren't a multiple of 8
+    capacity = numVarying + 1;
+    if(NULL != mobj.rgIncrTerms)
+      free(mobj.rgIncrTerms);
+    mobj.rgIncrTerms = (DMorphReal*)malloc(sizeof(DMorphReal)*6*capacity);
+    D_CHECKPTR(mobj.rgIncrTerms);
+    mobj.rgIncrVtxW = mobj.rgIncrTerms;
+    mobj.rgIncrRowX = mobj.rgIncrVtxW + capacity;
+    mobj.rgIncrRowY = mobj.rgIncrRowX + capacity;
+    mobj.rgIncrRowW = mobj.rgIncrRowY + capacity;
+    mobj.rgIncrOtherX = mobj.rgIncrRowW + capacity;
+    mobj.rgIncrOtherY = mobj.rgIncrOtherX + capacity;
+    for(int i=0; i < numVarying; ++i){
+      //bilinear weights and the other vertices' shares, spread so some of
+      //the warped points land off the distance map
+      mobj.rgIncrVtxW[i] = (DMorphReal)randRange(0., 1.);
+      mobj.rgIncrRowW[i] = (DMorphReal)randRange(0., 1.);
+      mobj.rgIncrRowX[i] = (DMorphReal)randRange(-0.2*mobj.w1, 0.8*mobj.w1);
+      mobj.rgIncrRowY[i] = (DMorphReal)randRange(-0.2*mobj.h1, 0.8*mobj.h1);
+      mobj.rgIncrOtherX[i] = (DMorphReal)randRange(-0.2*mobj.w1,
+						   0.8*mobj.w1);
+      mobj.rgIncrOtherY[i] = (DMorphReal)randRange(-0.2*mobj.h1,
+						   0.8*mobj.h1);
+    }
+    mobj.incrNumVarying = numVarying;
+    mobj.incrFixedCost = rand() % 5000;
+    mobj.tempMA0len = numVarying + 1 + rand() % 50;
+    for(int pp=0; pp < 20; ++pp){
+      double x1, y1, costScalar, costSIMD;
+      x1 = randRange(-0.3*mobj.w1, 1.3*mobj.w1);
+      y1 = randRange(-0.3*mobj.h1, 1.3*mobj.h1);
+      mobj.fUseSIMD = false;
+      costScalar = mobj.getVertexPositionCostIncr(x1, y1);
+      mobj.fUseSIMD = true;
+      costSIMD = mobj.getVertexPositionCostIncr(x1, y1);
+      ++numChecks;
+      if(!sameBits(costScalar, costSIMD)){
+	printf("vertex cost trial %d point %d (%d varying): AVX2 %.17g != "
+	       "scalar %.17g\n", tt, pp, numVarying, costSIMD, costScalar);
+	++numBad;
+      }
+    }
+    mobj.pimgDist1 = NULL;
+  }
+#endif
+
+  //random DP costs (double and float, grouped by dimension and interleaved)
+  for(int tt=0; tt < numTrials; ++tt){
+    DFeatureVector fv0, fv1;
+    int len0, len1, dims, maxLen;
+    double *rgData;
+    float *rgDataFlt;
+    double costScalar, costSIMD;
+    bool fFloat = (0 != (tt & 1));
+    bool fGrouped = (0 != (tt & 2));
+    len0 = 10 + rand() % 150;
+    len1 = 10 + rand() % 150;
+    dims = fGrouped ? (1 + rand() % 6) : 4;//AVX2 only does 4 interleaved
+    maxLen = (len0 > len1) ? len0 : len1;
+    rgData = new double[dims*maxLen];
+    D_CHECKPTR(rgData);
+    rgDataFlt = new float[dims*maxLen];
+    D_CHECKPTR(rgDataFlt);
+    for(int vv=0; vv < 2; ++vv){
+      DFeatureVector &fv = (0 == vv) ? fv0 : fv1;
+      int len = (0 == vv) ? len0 : len1;
+      for(int i=0; i < dims*len; ++i)
+	rgDataFlt[i] = (float)(rgData[i] = randRange(-10., 10.));
+      if(fFloat)
+	fv.setData_flt(rgDataFlt, len, dims, true, true, fGrouped);
+      else
+	fv.setData_dbl(rgData, len, dims, true, true, fGrouped);
+    }
+    delete [] rgDataFlt;
+    delete [] rgData;
+    DDynamicProgramming::fUseSIMD = false;
+    costScalar = DDynamicProgramming::findDPCostOnly(fv0, fv1, 15, 0.);
+    DDynamicProgramming::fUseSIMD = true;
+    costSIMD = DDynamicProgramming::findDPCostOnly(fv0, fv1, 15, 0.);
+    ++numChecks;
+    if(!sameBits(costScalar, costSIMD)){
+      printf("DP trial %d (%s, %s, %d dims): AVX2 %.17g != scalar %.17g\n",
+	     tt, fFloat ? "float" : "double",
+	     fGrouped ? "grouped" : "interleaved", dims, costSIMD, costScalar);
+      ++numBad;
+    }
+  }
+
+  printf("%ld AVX2/scalar comparisons\n", numChecks);
+  if(numBad > 0){
+    printf("FAILED: %d differ\n", numBad);
+    return 1;
+  }
+  printf("PASSED\n");
+  return 0;
+}
@@ -2,12 +2,16 @@
 #include <stdlib.h>
 #include <string.h>
 #include "dimage.h"
+#include "dimageio.h"
 #include "dtimer.h"
 #include "dmorphink.h"
+#include "dmorphinkstore.h"
 #include "dthresholder.h"
 #include "dfeaturevector.h"
 #include "dwordfeatures.h"
+#include "ddynamicprogramming.h"
 #include <math.h>
+#include <sys/stat.h>
 
 #ifndef D_NOTHREADS
 #include "dthreads.h"
@@ -16,6 +20,34 @@
 
 #define DO_FAST_PASS_FIRST 1
 
+//keep the prepared training words in <dataset_path>/train_w_FIRST_LAST.dmis
+//(written the first time, mapped on later runs. It is rebuilt if any of
+//the w_ files has changed since).  This writes into the dataset directory,
+//so it is off unless built with -DUSE_TRAINING_STORE=1
+#ifndef USE_TRAINING_STORE
+#define USE_TRAINING_STORE 0
+#endif
+//how the stored words were loaded (a store made any other way is rejected)
+#define TRAINING_STORE_SOURCE "w_%08d.pgm thresholded at each image's threshold"
+
+//number of test words that can be loaded ahead of the comparisons
+#define NUM_TEST_LOAD_SLOTS 2
+
+//do the fast pass through DMorphInk::getWordMorphCostCascade() with the
+//slowPassN-th best fast cost so far as the threshold (only if slowPassN>0).
+//Only the cascade's exact bounds are used, so the best slowPassN costs (and
+//so the slow pass) come out the same, but a training word that can't be
+//one of them gets the bound that rejected it (which is greater than the
+//slowPassN-th best cost, but is NOT its fast cost) in the output (its DP
+//cost is recomputed, so that column is still exact).  Off by
+//default since the output file is then no good for ranking every training
+//word (B__analyze_datafiles does that).
+#define CASCADE_FAST_PASS 0
+//training words compared per batch of the cascaded fast pass.  The
+//threshold is only lowered between batches, so the output doesn't depend
+//on the number of threads.
+#define FAST_PASS_CASCADE_CHUNK 64
+
 /*comparison function for qsort()ing doubles in nondecreasing order */
 int compareDoubles(const void *p1, const void *p2){
   if ( (*(double*)(p1)) < (*(double*)(p2)) )
@@ -46,106 +78,91 @@ int compareMORPHCOST_T(const void *p1, const void *p2){
 
 
 typedef struct{
-  int numThreads;//how many threads are doing comparisons
-  int threadNum;//which thread number this is (0..numThreads-1)
-  int testWordIdx; //0-based (even if first test word >0) index into arrays
-  int *rgNumLexReductionWordsSkipped;//each thread uses 1 slot of shared array
-  DImage *pimgTest;//pointer shared by all threads
-  DImage *rgTrainingImages;//pointer shared by all threads
-  int numTrain;
-  double *rgCostsMorph;//shared by all threads
-  double *rgCostsDP; //shared by all threads
-  double lengthPenalty;
-  int meshSpacingStatic;//-1 if auto-calculate like originally done
-  int numRefinesStatic;//-1 if auto-calculate like originally done
-  double meshDiv;//what to divide word image height by to get mesh size [4.0]
-  int bandWidthDP;//Sakoe-Chiba band DP constraint (rath/manmatha used 15)
-#if DO_FAST_PASS_FIRST
-  bool fFastPass; // true if this is a fast pass, false otherwise
-  int fastPassN; // what is N for the top-N from fast pass?
-  int *rgFastPassTopNidxs;//passed into thread func for slow pass
-  double *rgSlowPassTopNMorphCosts;//filled in by thread func during slow pass
-#endif
-} WORDWARP_THREAD_PARMS;
-
-
-void* word_morphing_thread_func(void *params){
- //Note:This looks like where the real comparison is done
-  WORDWARP_THREAD_PARMS *pparms;
-  int numTrain;
-  DMorphInk mobj;
-  int testWordIdx;
-
-  pparms = (WORDWARP_THREAD_PARMS*)params;
-  numTrain = pparms->numTrain;
-  testWordIdx = pparms->testWordIdx;
-
-  //now compare to all training values
-  int numLexReductionWordsSkipped;
-  numLexReductionWordsSkipped = 0;
-  for(int tr=(pparms->threadNum); tr < numTrain; tr+=(pparms->numThreads)){
-  	double morphCost=0.;
-  	double DPcost=0.;
-	
-#if DO_FAST_PASS_FIRST
-    	if(pparms->fFastPass)
-      	morphCost = mobj.getWordMorphCostFast(*(pparms->pimgTest),
-					  pparms->rgTrainingImages[tr],
-					  pparms->bandWidthDP,/*15 */
-					  0./*nonDiagonalCostDP*/,
-					  pparms->meshSpacingStatic,
-					  pparms->numRefinesStatic,
-					  pparms->meshDiv,
-					  pparms->lengthPenalty);
-    	else
-#else
-      	morphCost = mobj.getWordMorphCost(*(pparms->pimgTest),
-					pparms->rgTrainingImages[tr],
-					pparms->bandWidthDP,/*15 bandWidthDP*/
-					0./*nonDiagonalCostDP*/,
-					pparms->meshSpacingStatic,
-					pparms->numRefinesStatic,
-					pparms->meshDiv,
-					pparms->lengthPenalty);
+  char *stPathIn;
+  int testFirst;
+  int testLast;
+  std::string *rgLabelsTest;//filled in by the loader
+  int *rgPagesTest;//filled in by the loader
+  int *rgAuthorIdsTest;//filled in by the loader
+  DImage rgImgTest[NUM_TEST_LOAD_SLOTS];//test word i is in slot i%NUM_...
+  DMorphInkPrepared rgPrepTest[NUM_TEST_LOAD_SLOTS];
+#ifndef D_NOTHREADS
+  sem_t semSlotsFree;//posted by main thread when done with a slot
+  sem_t semSlotsReady;//posted by loader thread when a slot is loaded
 #endif
-	    DPcost = mobj.warpCostDP;
-	    pparms->rgCostsMorph[testWordIdx*(long)numTrain+tr] = morphCost;
-	    pparms->rgCostsDP[testWordIdx*(long)numTrain+tr] = DPcost;
-	    pparms->rgNumLexReductionWordsSkipped[pparms->threadNum] =
-		 numLexReductionWordsSkipped;
-  	}
-  	return NULL;
-}
+} TEST_LOADER_PARMS;
 
 
-#if DO_FAST_PASS_FIRST
-void* word_morphing_thread_func_slow_pass(void *params){
-  WORDWARP_THREAD_PARMS *pparms;
-  int numTrain;
-  DMorphInk mobj;
-  int testWordIdx;
-
-  pparms = (WORDWARP_THREAD_PARMS*)params;
-  numTrain = pparms->numTrain;
-  testWordIdx = pparms->testWordIdx;
-
-  //now do full morphing comparison to topN training values from fast pass
-  for(int tr=(pparms->threadNum); tr < (pparms->fastPassN);
-      tr+=(pparms->numThreads)){
-    double morphCost=0.;
-    int trIdx;
-    trIdx = pparms->rgFastPassTopNidxs[tr];
-    morphCost =
-      mobj.getWordMorphCost(*(pparms->pimgTest),
-			    pparms->rgTrainingImages[tr],
-			    pparms->bandWidthDP,/*15 bandWidthDP*/
-			    0./*nonDiagonalCostDP*/,
-			    pparms->meshSpacingStatic,
-			    pparms->numRefinesStatic,
-			    pparms->meshDiv,
-			    pparms->lengthPenalty);
-    //pparms->rgCostsMorph[testWordIdx*(long)numTrain+tr] = morphCost;
-    pparms->rgSlowPassTopNMorphCosts[tr] = morphCost;
+//load, threshold, and prepare test word i (0-based) into its slot
+void loadTestWord(TEST_LOADER_PARMS *pparms, int i){
+  char stTmp[1025];
+  DImage *pimgTest;
+  int tval;
+  int slot;
+
+  slot = i % NUM_TEST_LOAD_SLOTS;
+  pimgTest = &(pparms->rgImgTest[slot]);
+  sprintf(stTmp,"%s/w_%08d.pgm",pparms->stPathIn,pparms->testFirst+i);
+  if(!pimgTest->load(stTmp)){
+    fprintf(stderr,"couldn't load test image '%s'\n",stTmp);
+    exit(1);
+  }
+
+  if(pimgTest->getNumProperties() >= 4){
+    std::string strTmp;
+    strTmp = pimgTest->getPropertyVal(std::string("threshold"));
+    if(strTmp.size()<1){
+      fprintf(stderr,"couldn't find threshold property in training img %d\n",i);
+      exit(1);
+    }
+    tval = atoi(strTmp.c_str());
+    strTmp = pimgTest->getPropertyVal(std::string("label"));
+    if(strTmp.size()<1){
+      fprintf(stderr,"couldn't find label property in training img %d\n",i);
+      exit(1);
+    }
+    pparms->rgLabelsTest[i] = strTmp;
+
+    strTmp = pimgTest->getPropertyVal(std::string("page"));
+    if(strTmp.size()<1){
+      fprintf(stderr,"couldn't find page property in training img %d\n",i);
+      exit(1);
+    }
+    pparms->rgPagesTest[i] = atoi(strTmp.c_str());
+
+    strTmp = pimgTest->getPropertyVal(std::string("authorId"));
+    if(strTmp.size()<1){
+      fprintf(stderr,"couldn't find authorId property in training img %d\n",i);
+      exit(1);
+    }
+    pparms->rgAuthorIdsTest[i] = atoi(strTmp.c_str());
+  }
+  else{
+    if(3 != pimgTest->getNumComments()){
+      fprintf(stderr, "comment in image '%s' should be: #threshval\\n#label\\n#pageNum\\n",stTmp);
+      exit(1);
+    }
+    tval = atoi(pimgTest->getCommentByIndex(0).c_str());
+    pparms->rgLabelsTest[i] = pimgTest->getCommentByIndex(1);
+  }
+  //    printf(" tval=%d label=%s\n",tval, pparms->rgLabelsTest[i].c_str());
+  DThresholder::threshImage_(*pimgTest,*pimgTest, tval);
+  //DThresholder::otsuThreshImage_(*pimgTest,*pimgTest);
+  pparms->rgPrepTest[slot].prepare(*pimgTest, false);
+}
+
+#ifndef D_NOTHREADS
+//loads the test words ahead of the main thread (which does the comparisons)
+void* test_loader_thread_func(void *params){
+  TEST_LOADER_PARMS *pparms;
+  int numTest;
+
+  pparms = (TEST_LOADER_PARMS*)params;
+  numTest = pparms->testLast - pparms->testFirst + 1;
+  for(int i=0; i < numTest; ++i){
+    sem_wait(&(pparms->semSlotsFree));
+    loadTestWord(pparms, i);
+    sem_post(&(pparms->semSlotsReady));
   }
   return NULL;
 }
@@ -205,16 +222,85 @@ DImage clipWordImageToInk(DImage &img){
 }
 
 
+//fast pass of prepTest against all numTrain training words through the
+//cascade (see CASCADE_FAST_PASS).  rgBestK (numBest) is scratch space for
+//the best costs so far. rgThresholds and rgStages have room for
+//FAST_PASS_CASCADE_CHUNK. rgNumStage counts the stage each comparison
+//stopped at.  batchOpts must already be set up for the fast pass.
+void cascadedFastPass(DMorphInk &mobjBatch, DMorphInkBatchOptions &batchOpts,
+		      const DMorphInkPrepared &prepTest,
+		      const DMorphInkPrepared *rgPreparedTrain, int numTrain,
+		      int numBest, double *rgBestK, double *rgThresholds,
+		      int *rgStages, double *rgCostsMorph, double *rgCostsDP,
+		      long *rgNumStage){
+  int numBestSoFar;
+  numBestSoFar = 0;
+  for(int first=0; first < numTrain; first+=FAST_PASS_CASCADE_CHUNK){
+    int len;
+    double threshold;
+    len = numTrain - first;
+    if(len > FAST_PASS_CASCADE_CHUNK)
+      len = FAST_PASS_CASCADE_CHUNK;
+    threshold = (numBestSoFar < numBest) ? HUGE_VAL : rgBestK[numBest-1];
+    for(int k=0; k < len; ++k)
+      rgThresholds[k] = threshold;
+    batchOpts.rgIdxs = NULL;
+    batchOpts.rgWarpCostDP = &rgCostsDP[first];
+    batchOpts.rgThresholds = rgThresholds;
+    batchOpts.rgCascadeStage = rgStages;
+    mobjBatch.computeCostsOneToMany(prepTest, &rgPreparedTrain[first], len,
+				    &rgCostsMorph[first], batchOpts);
+    for(int k=0; k < len; ++k){
+      ++(rgNumStage[rgStages[k]]);
+      if(DMorphInk::CascadeNotRejected != rgStages[k]){
+	//the cascade may have stopped before the DP of the second direction
+	//(train to test), which is the warpCostDP the fast pass reports.
+	//resetMeshes() charges bandCost 1000 for leaving the band, so this
+	//does too (findDPCostOnly() only has a hard band)
+	rgCostsDP[first+k] =
+	  DDynamicProgramming::findDPAlignmentBanded(rgPreparedTrain[first+k].fvWord,
+						     prepTest.fvWord,
+						     batchOpts.bandWidthDP, 1000.,
+						     batchOpts.nonDiagonalCostDP);
+	continue;
+      }
+      //keep the best numBest costs sorted (insertion)
+      double cost;
+      int pos;
+      cost = rgCostsMorph[first+k];
+      if((numBestSoFar == numBest) && (cost >= rgBestK[numBest-1]))
+	continue;
+      pos = (numBestSoFar < numBest) ? numBestSoFar : (numBest-1);
+      while((pos > 0) && (rgBestK[pos-1] > cost)){
+	rgBestK[pos] = rgBestK[pos-1];
+	--pos;
+      }
+      rgBestK[pos] = cost;
+      if(numBestSoFar < numBest)
+	++numBestSoFar;
+    }
+  }
+  batchOpts.rgThresholds = NULL;
+  batchOpts.rgCascadeStage = NULL;
+}
+
 int main(int argc, char **argv);
 //Uhh, ya. This is not readable. Like, at all...
 int main(int argc, char **argv){
   char stPathIn[1025];
   char stOutfile[1025];
   char stTmp[1025];
+#if USE_TRAINING_STORE
+  char stStoreTrain[1025];//file the prepared training set is kept in
+  char stStoreSrcPattern[1025];//its source files (see DMorphInkStore::open)
+#endif
   int trainFirst, trainLast;
   int testFirst, testLast;
   int numTrain, numTest;
   DImage *rgTrainingImages;
+  DMorphInkPrepared *rgPreparedTrain;//skeletons, distance maps, etc.
+  DMorphInkStore storeTrain;//mapped training set (if USE_TRAINING_STORE)
+  bool fTrainFromStore = false;
   DImage testImage;
   double *rgCostsMorph;
   double *rgCostsDP;
@@ -227,8 +313,9 @@ int main(int argc, char **argv){
   int *rgAuthorIdsTrain;
   int *rgAuthorIdsTest;
   int *rgThresholdsTrain;
-  WORDWARP_THREAD_PARMS *rgThreadParms;
-  int *rgNumLexReductionWordsSkipped;
+  DMorphInk mobjBatch;//keeps its worker threads for the whole run
+  DMorphInkBatchOptions batchOpts;
+  TEST_LOADER_PARMS loaderParms;
   int numThreads = 1;
   double lengthPenalty = 0.;
   int meshSpacingStatic;
@@ -237,9 +324,7 @@ int main(int argc, char **argv){
   int bandWidthDP = 15;
   int slowPassN;//number of best matches from fast pass to do slow pass for
 #ifndef D_NOTHREADS
-  pthread_t *rgThreadID;
-#else
-  numThreads = 1;
+  pthread_t loaderThreadID;
 #endif
 
 
@@ -305,19 +390,14 @@ int main(int argc, char **argv){
 #endif
   }
 
-#ifndef D_NOTHREADS
-  rgThreadID = new pthread_t[numThreads];
-  D_CHECKPTR(rgThreadID);
-#else
-  numThreads = 1;
-#endif
+  batchOpts.numThreads = numThreads;
+  batchOpts.bandWidthDP = bandWidthDP;
+  batchOpts.nonDiagonalCostDP = 0.;
+  batchOpts.meshSpacingStatic = meshSpacingStatic;
+  batchOpts.numRefinementsStatic = numRefinesStatic;
+  batchOpts.meshDiv = meshDiv;
+  batchOpts.lengthMismatchPenalty = lengthPenalty;
 
-  rgThreadParms = (WORDWARP_THREAD_PARMS *)malloc(sizeof(WORDWARP_THREAD_PARMS)*
-						  numThreads);
-  D_CHECKPTR(rgThreadParms);
-  rgNumLexReductionWordsSkipped = new int[numThreads];
-  D_CHECKPTR(rgNumLexReductionWordsSkipped);
-  
   numTrain = trainLast - trainFirst + 1;
   numTest = testLast - testFirst + 1;
 
@@ -338,6 +418,8 @@ int main(int argc, char **argv){
 
   rgTrainingImages = new DImage[numTrain];
   D_CHECKPTR(rgTrainingImages);
+  rgPreparedTrain = new DMorphInkPrepared[numTrain];
+  D_CHECKPTR(rgPreparedTrain);
   rgLabelsTrain = new std::string[numTrain];
   D_CHECKPTR(rgLabelsTrain);
   rgLabelsTest = new std::string[numTest];
@@ -369,12 +451,43 @@ int main(int argc, char **argv){
   int heightHist[1000];
   for(int hh=0; hh < 1000; ++hh)
     	heightHist[hh] = 0;
-  for(int tt=trainFirst, i=0; tt <= trainLast; ++tt,++i){
-    	sprintf(stTmp,"%s/w_%08d.pgm",stPathIn,tt);
-    	if(!rgTrainingImages[i].load(stTmp)){
-      	fprintf(stderr,"couldn't load training image '%s'\n",stTmp);
+#if USE_TRAINING_STORE
+  if(snprintf(stStoreTrain, sizeof(stStoreTrain), "%s/train_w_%08d_%08d.dmis",
+	      stPathIn, trainFirst, trainLast) >= (int)sizeof(stStoreTrain)){
+    	fprintf(stderr,"dataset path '%s' is too long\n", stPathIn);
+    	exit(1);
+  }
+  if(snprintf(stStoreSrcPattern, sizeof(stStoreSrcPattern), "%s/w_%%08d.pgm",
+	      stPathIn) >= (int)sizeof(stStoreSrcPattern)){
+    	fprintf(stderr,"dataset path '%s' is too long\n", stPathIn);
+    	exit(1);
+  }
+  struct stat statStore;
+  if((0 == stat(stStoreTrain, &statStore)) &&
+     storeTrain.open(stStoreTrain, TRAINING_STORE_SOURCE, stStoreSrcPattern,
+		     trainFirst)){
+    	if(storeTrain.getNumWords() == numTrain)
+      	fTrainFromStore = true;
+    	else
+      	storeTrain.close();
+  }
+#endif
+  if(!fTrainFromStore){//decode (and threshold) all of the files in parallel
+    	if(snprintf(stTmp, sizeof(stTmp), "%s/w_%%08d.pgm", stPathIn) >=
+	   (int)sizeof(stTmp)){
+      	fprintf(stderr,"dataset path '%s' is too long\n", stPathIn);
       	exit(1);
     	}
+    	if(!DImageIO::loadMany(stTmp, trainFirst, trainLast, rgTrainingImages,
+			       numThreads, true)){
+      	fprintf(stderr,"couldn't load the training images\n");
+      	exit(1);
+    	}
+  }
+  for(int tt=trainFirst, i=0; tt <= trainLast; ++tt,++i){
+    	sprintf(stTmp,"%s/w_%08d.pgm",stPathIn,tt);
+    	if(fTrainFromStore)//only the properties. the pixels are in the store
+      	storeTrain.getProperties(i, rgTrainingImages[i]);
 
     	if(rgTrainingImages[i].getNumProperties() >= 4){
       	std::string strTmp;
@@ -417,25 +530,27 @@ int main(int argc, char **argv){
 			atoi(rgTrainingImages[i].getCommentByIndex(0).c_str());
       	rgLabelsTrain[i] = rgTrainingImages[i].getCommentByIndex(1);
     	}
-    	DThresholder::threshImage_(rgTrainingImages[i],rgTrainingImages[i],
-     			       rgThresholdsTrain[i]);
-    	if(rgTrainingImages[i].width() > maxTrainWidth)
-     	maxTrainWidth = rgTrainingImages[i].width();
-    	if(rgTrainingImages[i].height() > maxTrainHeight)
-      	maxTrainHeight = rgTrainingImages[i].height();
-
-    	DImage imgTmp;
+    	if(fTrainFromStore)
+      	storeTrain.getPrepared(i, rgPreparedTrain[i]);
+    	else//compute the per-image morphing data once instead of for every pair
+      	rgPreparedTrain[i].prepare(rgTrainingImages[i], false);
+    	if(rgPreparedTrain[i].w > maxTrainWidth)
+     	maxTrainWidth = rgPreparedTrain[i].w;
+    	if(rgPreparedTrain[i].h > maxTrainHeight)
+      	maxTrainHeight = rgPreparedTrain[i].h;
+
     	// char stTmp2[1025];
     	// sprintf(stTmp2,"/tmp/clip/noclip%04d.pgm",tt);
     	// rgTrainingImages[i].save(stTmp2);
-    	imgTmp = rgTrainingImages[i];
-    	imgTmp.copyProperties(rgTrainingImages[i]);
-    	imgTmp.copyComments(rgTrainingImages[i]);
+    	// DImage imgTmp;
+    	// imgTmp = rgTrainingImages[i];
+    	// imgTmp.copyProperties(rgTrainingImages[i]);
+    	// imgTmp.copyComments(rgTrainingImages[i]);
     	// rgTrainingImages[i] = clipWordImageToInk(imgTmp);
     	// rgTrainingImages[i].copyProperties(imgTmp);
     	// rgTrainingImages[i].copyComments(imgTmp);
     	int hh;
-    	hh = rgTrainingImages[i].height();
+    	hh = rgPreparedTrain[i].h;
     	if(hh >= 1000)
       	hh = 1000;
     	++(heightHist[hh]);
@@ -443,6 +558,15 @@ int main(int argc, char **argv){
     	// rgTrainingImages[i].save(stTmp2);
   }
   
+#if USE_TRAINING_STORE
+  if(fTrainFromStore)
+    printf("  (mapped from '%s')\n", stStoreTrain);
+  else if(DMorphInkStore::write(stStoreTrain, rgPreparedTrain, numTrain,
+				TRAINING_STORE_SOURCE, stStoreSrcPattern,
+				trainFirst))
+    printf("  (saved to '%s' for next time)\n", stStoreTrain);
+#endif
+  
   /////////////////////////////////////////////////
   t1.stop();
   printf("took %.02f seconds\n", t1.getAccumulated());
@@ -450,10 +574,35 @@ int main(int argc, char **argv){
 
 
 #if DO_FAST_PASS_FIRST
-  int *rgFastPassTopNidxs;
-  double *rgSlowPassTopNMorphCosts;
+  int *rgFastPassTopNidxs = NULL;
+  double *rgSlowPassTopNMorphCosts = NULL;
+  double *rgSlowPassThresholds = NULL;//fast pass cost (slow only used if <)
+  int *rgSlowPassStages = NULL;//cascade stage each slow comparison stopped at
+  long rgNumSlowPassStage[DMorphInk::CascadeNumStages];
   MORPHCOST_T *rgSlowPassMORPHCOST_T = NULL;
+  for(int st=0; st < DMorphInk::CascadeNumStages; ++st)
+    rgNumSlowPassStage[st] = 0;
+#if CASCADE_FAST_PASS
+  double *rgFastPassBestK = NULL;
+  double *rgFastPassThresholds = NULL;
+  int *rgFastPassStages = NULL;
+  long rgNumFastPassStage[DMorphInk::CascadeNumStages];
+  for(int st=0; st < DMorphInk::CascadeNumStages; ++st)
+    rgNumFastPassStage[st] = 0;
   if(slowPassN > 0){
+    rgFastPassBestK = new double[slowPassN];
+    D_CHECKPTR(rgFastPassBestK);
+    rgFastPassThresholds = new double[FAST_PASS_CASCADE_CHUNK];
+    D_CHECKPTR(rgFastPassThresholds);
+    rgFastPassStages = new int[FAST_PASS_CASCADE_CHUNK];
+    D_CHECKPTR(rgFastPassStages);
+  }
+#endif
+  if(slowPassN > 0){
+    rgSlowPassThresholds = new double[slowPassN];
+    D_CHECKPTR(rgSlowPassThresholds);
+    rgSlowPassStages = new int[slowPassN];
+    D_CHECKPTR(rgSlowPassStages);
     rgFastPassTopNidxs = new int[slowPassN];
     D_CHECKPTR(rgFastPassTopNidxs);
     rgSlowPassTopNMorphCosts = new double[slowPassN];
@@ -467,122 +616,69 @@ int main(int argc, char **argv){
   t1.start();
   printf("comparing test images to training images...\n");fflush(stdout);
   //////////////////////////////////////////////////////////////////////
+  //test word i+1 (and i+2...) is loaded and thresholded by another
+  //thread while test word i is being compared to the training words
+  loaderParms.stPathIn = stPathIn;
+  loaderParms.testFirst = testFirst;
+  loaderParms.testLast = testLast;
+  loaderParms.rgLabelsTest = rgLabelsTest;
+  loaderParms.rgPagesTest = rgPagesTest;
+  loaderParms.rgAuthorIdsTest = rgAuthorIdsTest;
+#ifndef D_NOTHREADS
+  if((0 != sem_init(&loaderParms.semSlotsFree, 0, NUM_TEST_LOAD_SLOTS)) ||
+     (0 != sem_init(&loaderParms.semSlotsReady, 0, 0))){
+    fprintf(stderr,"failed to init test loader semaphores. Exiting.\n");
+    exit(1);
+  }
+  if(0 != pthread_create(&loaderThreadID, NULL, test_loader_thread_func,
+			 &loaderParms)){
+    fprintf(stderr,"failed to spawn test loader thread. Exiting.\n");
+    exit(1);
+  }
+#endif
   for(int tt=testFirst, i=0; tt <= testLast; ++tt,++i){
-	    DImage imgTest;
-	    int tval;
 	    DTimer t2;
 	    
 	    t2.start();
 	    if(0==(i%1))
 			printf(" image %d of %d (%d%%)\n",i,numTest, 100*(i+1)/numTest);
-	    		sprintf(stTmp,"%s/w_%08d.pgm",stPathIn,tt);
-	    if(!imgTest.load(stTmp)){
-		 	fprintf(stderr,"couldn't load test image '%s'\n",stTmp);
-		 	exit(1);
-	    }
-
-	    if(imgTest.getNumProperties() >= 4){
-		 	std::string strTmp;
-		 	strTmp = imgTest.getPropertyVal(std::string("threshold"));
-		 	if(strTmp.size()<1){
-				fprintf(stderr,"couldn't find threshold property in training img %d\n",i);
-				exit(1);
-		 	}
-		 	tval = atoi(strTmp.c_str());
-		 	strTmp = imgTest.getPropertyVal(std::string("label"));
-		 	if(strTmp.size()<1){
-				fprintf(stderr,"couldn't find label property in training img %d\n",i);
-				exit(1);
-		 	}
-		 	rgLabelsTest[i] = strTmp;
-
-		 	strTmp = imgTest.getPropertyVal(std::string("page"));
-		 	if(strTmp.size()<1){
-				fprintf(stderr,"couldn't find page property in training img %d\n",i);
-				exit(1);
-		 	}
-		 	rgPagesTest[i] = atoi(strTmp.c_str());
-
-		 	strTmp = imgTest.getPropertyVal(std::string("authorId"));
-		 	if(strTmp.size()<1){
-				fprintf(stderr,"couldn't find authorId property in training img %d\n",i);
-				exit(1);
-		 	}
-		 	rgAuthorIdsTest[i] = atoi(strTmp.c_str());
-
-
-	    }
-	    else{
-		 	if(3 != imgTest.getNumComments()){
-				fprintf(stderr, "comment in image '%s' should be: #threshval\\n#label\\n#pageNum\\n",stTmp);
-				exit(1);
-		 	}
-		 	tval = atoi(imgTest.getCommentByIndex(0).c_str());
-		 	rgLabelsTest[i] = imgTest.getCommentByIndex(1);
-	    }
-	    //    printf(" tval=%d label=%s\n",tval, rgLabelsTest[i].c_str());
-	    DThresholder::threshImage_(imgTest,imgTest, tval);
-	    //DThresholder::otsuThreshImage_(imgTest,imgTest);
+#ifdef D_NOTHREADS
+	    loadTestWord(&loaderParms, i);
+#else
+	    sem_wait(&loaderParms.semSlotsReady);
+#endif
+	    DMorphInkPrepared &prepTest =
+		 loaderParms.rgPrepTest[i % NUM_TEST_LOAD_SLOTS];
 
 
 
 
 
 	    //now compare to all training values
-	    for(int tnum=numThreads-1; tnum >=0; --tnum){//launch threads reverse order
-		 rgThreadParms[tnum].numThreads = numThreads;
-		 rgThreadParms[tnum].threadNum = tnum;
-		 rgThreadParms[tnum].testWordIdx = i;
-		 rgThreadParms[tnum].rgNumLexReductionWordsSkipped =
-		rgNumLexReductionWordsSkipped;
-		 rgThreadParms[tnum].pimgTest = &imgTest;
-		 rgThreadParms[tnum].rgTrainingImages = rgTrainingImages;
-		 rgThreadParms[tnum].numTrain = numTrain;
-		 rgThreadParms[tnum].rgCostsMorph = rgCostsMorph;
-		 rgThreadParms[tnum].rgCostsDP = rgCostsDP;
-		 rgThreadParms[tnum].lengthPenalty = lengthPenalty;
-		 rgThreadParms[tnum].meshSpacingStatic = meshSpacingStatic;
-		 rgThreadParms[tnum].numRefinesStatic = numRefinesStatic;
-		 rgThreadParms[tnum].meshDiv = meshDiv;
-		 rgThreadParms[tnum].bandWidthDP = bandWidthDP;
-#if DO_FAST_PASS_FIRST
-		 rgThreadParms[tnum].fFastPass = true;
-		 if(slowPassN==-1)
-		rgThreadParms[tnum].fFastPass = false;
+	    batchOpts.fFast = true;
+	    if(slowPassN==-1)
+		 batchOpts.fFast = false;
+#if DO_FAST_PASS_FIRST && CASCADE_FAST_PASS
+	    if(slowPassN > 0)
+		 cascadedFastPass(mobjBatch, batchOpts, prepTest,
+				  rgPreparedTrain, numTrain, slowPassN,
+				  rgFastPassBestK, rgFastPassThresholds,
+				  rgFastPassStages,
+				  &rgCostsMorph[i*(long)numTrain],
+				  &rgCostsDP[i*(long)numTrain],
+				  rgNumFastPassStage);
+	    else
 #endif
-#ifdef D_NOTHREADS
-		 word_morphing_thread_func(rgThreadParms);
-#else
-		 if(0 == tnum){//don't spawn thread zero. use the current thread.
-		word_morphing_thread_func(rgThreadParms);
-		 }
-		 else{//spawn all other threads besides zero
-		if(0 !=pthread_create(&rgThreadID[tnum], NULL,
-					 word_morphing_thread_func, &rgThreadParms[tnum])){
-		  fprintf(stderr,"failed to spawn thread #%d. Exiting.\n",tnum);
-		  exit(1);
-		}
-		 }
-#endif
-	    }
-#ifndef D_NOTHREADS
-	    // wait for all threads to finish
-	    for(int tnum = 1; tnum < numThreads; ++tnum){
-		 if(pthread_join(rgThreadID[tnum],NULL)){
-		fprintf(stderr, "Thread #%d failed to join. Exiting.\n", tnum);
-		exit(1);
-		 }
-	    }
-#endif
-	    int numLexReductionWordsSkipped;
-	    numLexReductionWordsSkipped = 0;
-	    for(int tnum = 0; tnum < numThreads; ++tnum){
-		 numLexReductionWordsSkipped += rgNumLexReductionWordsSkipped[tnum];
+	    {
+	    batchOpts.rgIdxs = NULL;
+	    batchOpts.rgWarpCostDP = &rgCostsDP[i*(long)numTrain];
+	    mobjBatch.computeCostsOneToMany(prepTest, rgPreparedTrain, numTrain,
+					    &rgCostsMorph[i*(long)numTrain],
+					    batchOpts);
 	    }
 
 #if DO_FAST_PASS_FIRST
 	    //figure out which are the top N from the fast pass
-	    DMorphInk mobj;
 	    if(slowPassN > 0){
 			for(int fpi=0; fpi < numTrain; ++fpi){
 				rgSlowPassMORPHCOST_T[fpi].wordIdx=fpi;
@@ -590,42 +686,75 @@ int main(int argc, char **argv){
 		 	}
 		 	qsort((void*)rgSlowPassMORPHCOST_T, numTrain, sizeof(MORPHCOST_T),
 		    		compareMORPHCOST_T);
-		 	//right now we are just doing the slow pass sequentially
-		 	if(slowPassN > 100){//if it's more than a few, thread this
-				fprintf(stderr,"You should probably thread this part of the code\n");
-				exit(1);
-			 }
-			 else{
-				for(int fpi=0; fpi < slowPassN; ++fpi){
-		  			int trIdx;
-		  			double morphCostNew;
-		 			 trIdx = rgSlowPassMORPHCOST_T[fpi].wordIdx;
-		 			 morphCostNew =
-		 				mobj.getWordMorphCost(imgTest,
-						rgTrainingImages[trIdx],
-					  	bandWidthDP,
-					  	0./*nonDiagonalCostDP*/,
-					  	meshSpacingStatic,
-					  	numRefinesStatic,
-					  	meshDiv,
-					  	lengthPenalty);
-		 			 if(morphCostNew < rgCostsMorph[i*(long)numTrain+trIdx])
-		    				rgCostsMorph[i*(long)numTrain+trIdx] = morphCostNew;
-				}//end for(fpi...
-		 	}//end else
-	    
+			for(int fpi=0; fpi < slowPassN; ++fpi){
+				rgFastPassTopNidxs[fpi] = rgSlowPassMORPHCOST_T[fpi].wordIdx;
+				rgSlowPassThresholds[fpi] =
+					rgSlowPassMORPHCOST_T[fpi].morphCost;
+			}
+			//full morphing comparison to the top N from the fast pass.
+			//the slow cost only replaces the fast one if it is lower,
+			//so the cascade can stop as soon as it can't be.
+			batchOpts.fFast = false;
+			batchOpts.rgIdxs = rgFastPassTopNidxs;
+			batchOpts.rgWarpCostDP = NULL;
+			batchOpts.rgThresholds = rgSlowPassThresholds;
+			batchOpts.rgCascadeStage = rgSlowPassStages;
+			mobjBatch.computeCostsOneToMany(prepTest, rgPreparedTrain,
+							slowPassN,
+							rgSlowPassTopNMorphCosts,
+							batchOpts);
+			batchOpts.rgThresholds = NULL;
+			batchOpts.rgCascadeStage = NULL;
+			for(int fpi=0; fpi < slowPassN; ++fpi){
+				int trIdx;
+				++(rgNumSlowPassStage[rgSlowPassStages[fpi]]);
+				trIdx = rgFastPassTopNidxs[fpi];
+				if(rgSlowPassTopNMorphCosts[fpi] <
+				   rgCostsMorph[i*(long)numTrain+trIdx])
+					rgCostsMorph[i*(long)numTrain+trIdx] =
+						rgSlowPassTopNMorphCosts[fpi];
+			}
 	    }//end if (slowPassN > 0)
-
-	    
+#endif
+#ifndef D_NOTHREADS
+	    sem_post(&loaderParms.semSlotsFree);//loader can reuse this slot
 #endif
 	    t2.stop();
-	    printf("took %.02f seconds  numLexReductionWordsSkipped=%d\n", t2.getAccumulated(), numLexReductionWordsSkipped);fflush(stdout);
+	    printf("took %.02f seconds\n", t2.getAccumulated());fflush(stdout);
+  }
+#ifndef D_NOTHREADS
+  if(pthread_join(loaderThreadID,NULL)){
+    fprintf(stderr, "test loader thread failed to join. Exiting.\n");
+    exit(1);
   }
+  sem_destroy(&loaderParms.semSlotsFree);
+  sem_destroy(&loaderParms.semSlotsReady);
+#endif
   /////////////////////////////////////////////////////
   t1.stop();
   printf("took %.02f seconds\n", t1.getAccumulated());
-
-  delete [] rgNumLexReductionWordsSkipped;
+#if DO_FAST_PASS_FIRST
+#if CASCADE_FAST_PASS
+  if(slowPassN > 0){
+    printf("fast pass comparisons: %ld completed, rejected by stage: "
+	   "length=%ld DP=%ld coarse=%ld oneWay=%ld\n",
+	   rgNumFastPassStage[DMorphInk::CascadeNotRejected],
+	   rgNumFastPassStage[DMorphInk::CascadeLength],
+	   rgNumFastPassStage[DMorphInk::CascadeDP],
+	   rgNumFastPassStage[DMorphInk::CascadeCoarse],
+	   rgNumFastPassStage[DMorphInk::CascadeOneWay]);
+  }
+#endif
+  if(slowPassN > 0){
+    printf("slow pass comparisons: %ld completed, rejected by stage: "
+	   "length=%ld DP=%ld coarse=%ld oneWay=%ld\n",
+	   rgNumSlowPassStage[DMorphInk::CascadeNotRejected],
+	   rgNumSlowPassStage[DMorphInk::CascadeLength],
+	   rgNumSlowPassStage[DMorphInk::CascadeDP],
+	   rgNumSlowPassStage[DMorphInk::CascadeCoarse],
+	   rgNumSlowPassStage[DMorphInk::CascadeOneWay]);
+  }
+#endif
 
 
   //now output the costs for analysis
@@ -680,13 +809,10 @@ int main(int argc, char **argv){
   }
   fclose(fout);
 
-#ifndef D_NOTHREADS
-  delete [] rgThreadID;
-#endif
-  free(rgThreadParms);
   free(rgCostsMorph);
   free(rgCostsDP);
   free(rgThresholdsTrain);
+  delete [] rgPreparedTrain;
   delete [] rgTrainingImages;
   delete [] rgLabelsTrain;
   delete [] rgLabelsTest;
@@ -699,6 +825,13 @@ int main(int argc, char **argv){
   delete [] rgSlowPassMORPHCOST_T;
   delete [] rgFastPassTopNidxs;
   delete [] rgSlowPassTopNMorphCosts;
+  delete [] rgSlowPassThresholds;
+  delete [] rgSlowPassStages;
+  #if CASCADE_FAST_PASS
+  delete [] rgFastPassBestK;
+  delete [] rgFastPassThresholds;
+  delete [] rgFastPassStages;
+  #endif
   #endif
   
   return 0;
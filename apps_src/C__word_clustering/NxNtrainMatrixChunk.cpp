@@ -2,11 +2,13 @@
 #include <stdlib.h>
 #include <string.h>
 #include "dimage.h"
+#include "dimageio.h"
 #include "dtimer.h"
 #include "dmorphink.h"
 #include "dthresholder.h"
 #include "dfeaturevector.h"
 #include "dwordfeatures.h"
+#include "dcostmatrix.h"
 #include <math.h>
 
 //#define D_NOTHREADS
@@ -17,6 +19,10 @@
 
 #define USE_FAST_PASS_FOR_NxN_TRAINING 1
 
+//precision the cost matrix chunk is saved with (must be the same for
+//all of the chunks that combineNxNChunks puts together)
+#define COST_MATRIX_VALUE_TYPE DCostMatrix::CostValue_f32
+
 //n is numTrain, maxCost is th value mapped to 255 (anything > is clipped)
 void saveMatrixImage(char *stFileName, double *rgMatrix, int n,
 		     double maxCost){
@@ -42,91 +48,6 @@ void saveMatrixImage(char *stFileName, double *rgMatrix, int n,
   fclose(fout);
 }
 
-typedef struct{
-  int numThreads;
-  int threadNum;
-  DImage *rgTrainingImages;//pointer shared by all threads
-  int numTrain;
-  int chunkFirst;
-  int chunkLast;
-  double *rgTrainCostMatrix;
-  double weightMovement; // 0. to 1. (how much to weight the movement in cost)
-  double lengthPenalty;
-  int meshSpacingStatic;//-1 if auto-calculate like originally done
-  int numRefinesStatic;//-1 if auto-calculate like originally done
-  double meshDiv;//what to divide word image height by to get mesh size [4.0]
-  int bandWidthDP;//sakeo-chiba bandwidth for DP
-} TRAIN_NXN_THREAD_PARMS;
-
-
-
-void* word_morphing_NxN_training_thread_func(void *params){
-  TRAIN_NXN_THREAD_PARMS *pparms;
-  int numTrain;
-  DMorphInk mobj;
-  double *rgCosts;
-  DTimer t1;
-  t1.start();
-  int numRows;
-
-  pparms = (TRAIN_NXN_THREAD_PARMS*)params;
-  numRows = 1 + (pparms->chunkLast) - (pparms->chunkFirst);
-  numTrain = pparms->numTrain;
-  rgCosts = pparms->rgTrainCostMatrix;
-
-  for(long int idx = (pparms->threadNum)+(long)numTrain*(long)(pparms->chunkFirst),idx2=pparms->threadNum;
-      idx < (numTrain)*(long)(pparms->chunkLast+1);
-      idx+=(pparms->numThreads), idx2+=(pparms->numThreads)){
-    double morphCost;
-    int r, c;
-    r = idx / numTrain;
-    c = idx % numTrain;
-    if(r<c){
-      // morphCost = mobj.getWordMorphCost(pparms->rgTrainingImages[r],
-      // 					pparms->rgTrainingImages[c],
-      // 					15,/*bandWidthDP*/
-      // 					0./*nonDiagonalCostDP*/);
-#if USE_FAST_PASS_FOR_NxN_TRAINING
-      morphCost = 
-	mobj.getWordMorphCostFast(pparms->rgTrainingImages[r],
-				  pparms->rgTrainingImages[c],
-				  pparms->bandWidthDP,
-				  0./*nonDiagonalCostDP*/,
-				  pparms->meshSpacingStatic,
-				  pparms->numRefinesStatic,
-				  pparms->meshDiv,
-				  pparms->lengthPenalty);
-#else
-      morphCost = 
-	mobj.getWordMorphCost(pparms->rgTrainingImages[r],
-			      pparms->rgTrainingImages[c],
-			      pparms->bandWidthDP,/*bandWidthDP*/
-			      0./*nonDiagonalCostDP*/,
-			      pparms->meshSpacingStatic,
-			      pparms->numRefinesStatic,
-			      pparms->meshDiv,
-			      pparms->lengthPenalty);
-#endif
-      rgCosts[idx2] = morphCost;
-    }
-    else if(r==c){
-      rgCosts[idx2] = 0.;
-    }
-    else if(r>c){
-      rgCosts[idx2] = 999998.;
-    }
-    if(0==c){
-      if(0==(r%1)){
-	double pctRowsComplete;
-	pctRowsComplete = 100.*(r-(pparms->chunkFirst)) / (double)numRows;
-	printf(" NxN %.2lf%% complete (%.2lf seconds have elapsed total)\n",
-	       pctRowsComplete, t1.getAccumulated());fflush(stdout);
-      }
-    }
-  }
-  return NULL;
-}
-
 int main(int argc, char **argv);
 
 int main(int argc, char **argv){
@@ -135,30 +56,29 @@ int main(int argc, char **argv){
   char stTrainCostMatrix[1025];//file to load or write
   char stTmp[1025];
   int trainFirst, trainLast;
+  int tileNum, numTiles;
   int chunkFirst, chunkLast;
-  int numTrain, numChunk;
+  int numTrain;
+  int numRows;
   DImage *rgTrainingImages;
-  double *rgTrainCostMatrix;
+  DMorphInkPrepared *rgPreparedTrain;
+  double *rgRow;//one row of the upper triangle of the cost matrix
+  double *rgWorkWeights;//image areas, for splitting the work into tiles
   DTimer t1;
   std::string *rgLabelsTrain;
-  TRAIN_NXN_THREAD_PARMS *rgTrainThreadParms;
   int numThreads = 1;
   double weightMovement = 0.;
   double lengthPenalty = 0.;
   int meshSpacingStatic;
   int numRefinesStatic;
   double meshDiv;
-  DMorphInk mobj;
+  DMorphInk mobj;//also keeps the worker threads for the NxN comparisons
+  DMorphInkBatchOptions batchOpts;
   int bandWidth = 15;
-#ifndef D_NOTHREADS
-  pthread_t *rgThreadID;
-#else
-  numThreads = 1;
-#endif
 
 
   if(argc < 15){
-    fprintf(stderr, "usage: %s <dataset_path> <trainCostMatrix> <first_training_num> <last_training_num> <first_chunk_num> <last_chunk_num> <weightMovement=0.> <lengthPenalty=0.> <numThreads=-1> <meshSpacingStatic=-1> <numRefinesStatic=-1> <meshDiv=4> <SakoeChibaBandwidth=15> <output_file>\n",
+    fprintf(stderr, "usage: %s <dataset_path> <trainCostMatrix> <first_training_num> <last_training_num> <tile_num> <num_tiles> <weightMovement=0.> <lengthPenalty=0.> <numThreads=-1> <meshSpacingStatic=-1> <numRefinesStatic=-1> <meshDiv=4> <SakoeChibaBandwidth=15> <output_file>\n",
 	    argv[0]);
     exit(1);
   }
@@ -167,8 +87,8 @@ int main(int argc, char **argv){
   sprintf(stTrainCostMatrix, "%s", argv[2]);
   trainFirst = atoi(argv[3]);
   trainLast = atoi(argv[4]);
-  chunkFirst = atoi(argv[5]);
-  chunkLast = atoi(argv[6]);
+  tileNum = atoi(argv[5]);
+  numTiles = atoi(argv[6]);
   weightMovement = atof(argv[7]);
   lengthPenalty =  atof(argv[8]);
   numThreads = atoi(argv[9]);
@@ -220,33 +140,38 @@ int main(int argc, char **argv){
 #endif
   }
 
-#ifndef D_NOTHREADS
-  rgThreadID = new pthread_t[numThreads];
-  D_CHECKPTR(rgThreadID);
-#else
-  numThreads = 1;
+#if USE_FAST_PASS_FOR_NxN_TRAINING
+  batchOpts.fFast = true;
 #endif
+  batchOpts.numThreads = numThreads;
+  batchOpts.bandWidthDP = bandWidth;
+  batchOpts.nonDiagonalCostDP = 0.;
+  batchOpts.meshSpacingStatic = meshSpacingStatic;
+  batchOpts.numRefinementsStatic = numRefinesStatic;
+  batchOpts.meshDiv = meshDiv;
+  batchOpts.lengthMismatchPenalty = lengthPenalty;
 
-  rgTrainThreadParms =
-    (TRAIN_NXN_THREAD_PARMS*)malloc(sizeof(TRAIN_NXN_THREAD_PARMS)*numThreads);
-  D_CHECKPTR(rgTrainThreadParms);
-  
   numTrain = trainLast - trainFirst + 1;
-  numChunk = chunkLast - chunkFirst + 1;
 
   if(numTrain < 1){
     fprintf(stderr, "numTrain must be greater than 0\n");
     exit(1);
   }
-  if(numChunk < 1){
-    fprintf(stderr, "numChunk must be greater than 0\n");
+  if((numTiles < 1) || (numTiles > numTrain) ||
+     (tileNum < 0) || (tileNum >= numTiles)){
+    fprintf(stderr, "num_tiles must be 1-%d and tile_num 0-(num_tiles-1) "
+	    "(were %d and %d)\n", numTrain, numTiles, tileNum);
     exit(1);
   }
 
   rgTrainingImages = new DImage[numTrain];
   D_CHECKPTR(rgTrainingImages);
+  rgPreparedTrain = new DMorphInkPrepared[numTrain];
+  D_CHECKPTR(rgPreparedTrain);
   rgLabelsTrain = new std::string[numTrain];
   D_CHECKPTR(rgLabelsTrain);
+  rgWorkWeights = new double[numTrain];
+  D_CHECKPTR(rgWorkWeights);
 
   
   t1.start();
@@ -254,13 +179,16 @@ int main(int argc, char **argv){
   int maxTrainHeight = 0;
   printf("loading training data....\n");
 
+  //decode all of the files in parallel
+  sprintf(stTmp,"%s/thresh_w_%%08d.pgm",stPathIn);
+  if(!DImageIO::loadMany(stTmp, trainFirst, trainLast, rgTrainingImages,
+			 numThreads)){
+    fprintf(stderr,"couldn't load the training images\n");
+    exit(1);
+  }
   for(int tt=trainFirst, i=0; tt <= trainLast; ++tt,++i){
     // sprintf(stTmp,"%s/w_%08d.pgm",stPathIn,tt);
     sprintf(stTmp,"%s/thresh_w_%08d.pgm",stPathIn,tt);
-    if(!rgTrainingImages[i].load(stTmp)){
-      fprintf(stderr,"couldn't load training image '%s'\n",stTmp);
-      exit(1);
-    }
     std::string strTmp;
     strTmp = rgTrainingImages[i].getPropertyVal(std::string("label"));
     if(strTmp.size()<1){//couldn't find label property, try comments
@@ -285,6 +213,10 @@ int main(int argc, char **argv){
       maxTrainWidth = rgTrainingImages[i].width();
     if(rgTrainingImages[i].height() > maxTrainHeight)
       maxTrainHeight = rgTrainingImages[i].height();
+    rgWorkWeights[i] =
+      (double)rgTrainingImages[i].width() * rgTrainingImages[i].height();
+    //compute the per-image morphing data once instead of for every pair
+    rgPreparedTrain[i].prepare(rgTrainingImages[i], false);
   }
   
 
@@ -293,141 +225,72 @@ int main(int argc, char **argv){
 
   printf("numTrain=%d\n",numTrain);
 
-  rgTrainCostMatrix = new double[(long)numTrain*(long)numChunk];
-  D_CHECKPTR(rgTrainCostMatrix);
-  for(long int i=0; i < numTrain*(long)numChunk; ++i)
-    rgTrainCostMatrix[i] = -42.0;
-
-  // for(int r=0,idx=0; r < numChunk; ++r){
-  //   for(int c=0; c < numTrain; ++c, ++idx){
-  //     printf(" %9.2lf",rgTrainCostMatrix[idx]);
-  //   }
-  //   printf("\n");
-  // }
-
-
-  t1.start();
-  printf("doing NxN comparison of training words\n");
-  for(int tnum=numThreads-1; tnum >=0; --tnum){//launch threads reverse order
-    rgTrainThreadParms[tnum].numThreads = numThreads;
-    rgTrainThreadParms[tnum].threadNum = tnum;
-    rgTrainThreadParms[tnum].rgTrainingImages = rgTrainingImages;
-    rgTrainThreadParms[tnum].numTrain = numTrain;
-    rgTrainThreadParms[tnum].rgTrainCostMatrix = rgTrainCostMatrix;
-    rgTrainThreadParms[tnum].weightMovement = weightMovement;
-    rgTrainThreadParms[tnum].lengthPenalty = lengthPenalty;
-    rgTrainThreadParms[tnum].meshSpacingStatic = meshSpacingStatic;
-    rgTrainThreadParms[tnum].numRefinesStatic = numRefinesStatic;
-    rgTrainThreadParms[tnum].meshDiv = meshDiv;
-    rgTrainThreadParms[tnum].bandWidthDP = bandWidth;
-    rgTrainThreadParms[tnum].chunkFirst = chunkFirst;
-    rgTrainThreadParms[tnum].chunkLast = chunkLast;
-#ifdef D_NOTHREADS
-    word_morphing_NxN_training_thread_func(rgTrainThreadParms);
-#else
-    if(0 == tnum){//don't spawn thread zero. use the current thread.
-      word_morphing_NxN_training_thread_func(rgTrainThreadParms);
-    }
-    else{//spawn all other threads besides zero
-      if(0 !=pthread_create(&rgThreadID[tnum], NULL,
-			    word_morphing_NxN_training_thread_func,
-			    &rgTrainThreadParms[tnum])){
-	fprintf(stderr,"failed to spawn thread #%d. Exiting.\n",tnum);
-	exit(1);
-      }
-    }
-#endif
-  }
-#ifndef D_NOTHREADS
-  // wait for all threads to finish
-  for(int tnum = 1; tnum < numThreads; ++tnum){
-    if(pthread_join(rgThreadID[tnum],NULL)){
-      fprintf(stderr, "Thread #%d failed to join. Exiting.\n", tnum);
-      exit(1);
-    }
+  //Row r of the triangle has numTrain-1-r comparisons, so equal row
+  //ranges would give the first jobs most of the work.  Instead the
+  //triangle is split into numTiles ranges of rows that each take about
+  //the same time, counting each comparison as the sum of the two image
+  //areas.  Every job loads the same images, so they all agree on the
+  //tiles and the tiles fit together for combineNxNChunks.
+  if(!DCostMatrix::getTileRows(numTrain, rgWorkWeights, numTiles, tileNum,
+			       &chunkFirst, &chunkLast)){
+    fprintf(stderr,"couldn't split the NxN matrix into %d tiles\n",numTiles);
+    exit(1);
   }
-#endif
-  
-
-  double elapsedTime;
-  t1.stop();
-  elapsedTime = t1.getAccumulated();
-  printf("NxM comparison of training data took %.02f seconds\n", t1.getAccumulated());
-  //  int numCompares = (numTrain*numChunk-numChunk-1)/2;
-    // printf("(n*n-n)/2=%d comparisons = %.6lf sec per compare\n", numCompares,
-    // 	   t1.getAccumulated()/numCompares);
+  printf("tile %d of %d is rows %d-%d\n",tileNum,numTiles,
+	 chunkFirst,chunkLast);
 
-    // now save the cost matrix
   t1.start();
-  printf("SAVING matrix chunk file '%s'\n",stTrainCostMatrix);
-  FILE *ftrin;
-  ftrin = fopen(stTrainCostMatrix,"wb");
-  if(!ftrin){
+  printf("doing NxN comparison of training words\n");
+  numRows = 1 + chunkLast - chunkFirst;
+  char stText[4096];
+  sprintf(stText,"trainFirst=%d trainLast=%d\n"
+	  "weightMovement=%.2lf lengthPenalty=%.2lf meshSpacingStatic=%d numRefinesStatic=%d meshDiv=%.2lf bandWidth=%d\ndir=%s\nchunkFirst=%d chunkLast=%d tile=%d numTiles=%d\n",
+	  trainFirst, trainLast, weightMovement,
+	  lengthPenalty, meshSpacingStatic, numRefinesStatic,
+	  meshDiv, bandWidth, stPathIn, chunkFirst, chunkLast,
+	  tileNum, numTiles);
+  //rows are written (and journaled) as they finish, so only one row is
+  //ever in memory and a job that is killed continues where it left off
+  DCostMatrixWriter costWriter;
+  if(!costWriter.createOrResume(stTrainCostMatrix, trainFirst, trainLast,
+				chunkFirst, chunkLast, COST_MATRIX_VALUE_TYPE,
+				stText)){
     fprintf(stderr,"couldn't open '%s' to save training cost matrix\n",
 	    stTrainCostMatrix);
     exit(1);
   }
-  double rgHeader[128];//firstTrain,lastTrain, then whatever text
-  char *stHeaderText;
-  char stText[4096];
-  rgHeader[0] = trainFirst;
-  rgHeader[1] = trainLast;
-  rgHeader[2] = chunkFirst;
-  rgHeader[3] = chunkLast;
-  stHeaderText = (char*)&(rgHeader[4]);
-  sprintf(stText,"\n%d compares in %.2lf seconds\n"
-	  "trainFirst=%d trainLast=%d\n"
-	  "weightMovement=%.2lf lengthPenalty=%.2lf meshSpacingStatic=%d numRefinesStatic=%d meshDiv=%.2lf bandWidth=%d\ndir=%s\nchunkFirst=%d chunkLast=%d\n",
-	  -1, elapsedTime, trainFirst, trainLast, weightMovement,
-	  lengthPenalty, meshSpacingStatic, numRefinesStatic,
-	  meshDiv, bandWidth, stPathIn, chunkFirst, chunkLast);
-  for(int i=4; i < 128; ++i)
-    rgHeader[i] = 0.;
-  strncpy(stHeaderText,stText,124*sizeof(double));
-  stHeaderText[124*sizeof(double)-1]='\0';
-  if(128 != fwrite(rgHeader,sizeof(double),128,ftrin)){
-    fprintf(stderr,"couldn't fwrite header to '%s'\n",stTrainCostMatrix);
-    exit(1);
+  if(costWriter.getNextRow() > chunkFirst)
+    printf("resuming at row %d (rows %d-%d are already in '%s')\n",
+	   costWriter.getNextRow(), chunkFirst, costWriter.getNextRow()-1,
+	   stTrainCostMatrix);
+  rgRow = new double[numTrain];
+  D_CHECKPTR(rgRow);
+  for(int r=costWriter.getNextRow(); r <= chunkLast; ++r){
+    //costs from word r to words r+1..numTrain-1 (row r of the triangle)
+    if((r+1) < numTrain)
+      mobj.computeCostsOneToMany(rgPreparedTrain[r], &(rgPreparedTrain[r+1]),
+				 numTrain-r-1, rgRow, batchOpts);
+    if(!costWriter.writeRow(rgRow))
+      exit(1);
+    double pctRowsComplete;
+    pctRowsComplete = 100.*(r-chunkFirst) / (double)numRows;
+    printf(" NxN %.2lf%% complete (%.2lf seconds have elapsed total)\n",
+	   pctRowsComplete, t1.getAccumulated());fflush(stdout);
   }
-  if(numTrain*(long)numChunk != (long)
-     fwrite(rgTrainCostMatrix, sizeof(double),numTrain*(long)numChunk,
-		 ftrin)){
-    fprintf(stderr,"couldn't fwrite the cost matrix block to '%s'\n",
+  delete [] rgRow;
+  if(!costWriter.close()){
+    fprintf(stderr,"couldn't save the cost matrix chunk to '%s'\n",
 	    stTrainCostMatrix);
     exit(1);
   }
-  fclose(ftrin);
-  t1.stop();
-  printf("finished writing the cost matrix (took %.02f seconds)\n",
-	 t1.getAccumulated());
-
-  // for(int r=0,idx=0; r < numChunk; ++r){
-  //   for(int c=0; c < numTrain; ++c, ++idx){
-  //     printf(" %9.2lf",rgTrainCostMatrix[idx]);
-  //   }
-  //   printf("\n");
-  // }
-
-  // //debug: print the cost matrix
-#if 0
-  for(int r=0,idx=0;r < numTrain; ++r){
-    for(int c=0; c < numTrain; ++c,++idx){
-      printf(" %9.2lf",rgTrainCostMatrix[idx]);
-    }
-    printf("\n");
-  }
-#endif  
-
-  
-  // saveMatrixImage("/tmp/costs.pgm", rgTrainCostMatrix, numTrain, 25);
 
+  t1.stop();
+  printf("NxM comparison of training data took %.02f seconds\n", t1.getAccumulated());
+  printf("saved matrix chunk file '%s'\n",stTrainCostMatrix);
 
-#ifndef D_NOTHREADS
-  delete [] rgThreadID;
-#endif
-  free(rgTrainThreadParms);
+  delete [] rgPreparedTrain;
   delete [] rgTrainingImages;
   delete [] rgLabelsTrain;
-  delete [] rgTrainCostMatrix;
+  delete [] rgWorkWeights;
   return 0;
 }
@@ -2,16 +2,22 @@
 #include <stdlib.h>
 #include <string.h>
 #include "dimage.h"
+#include "dimageio.h"
 #include "dtimer.h"
 #include "dmorphink.h"
+#include "dmorphinkstore.h"
+#include "dcostmatrix.h"
+#include "dthreadpool.h"
+#include "dhactree.h"
 #include "dthresholder.h"
 #include "dfeaturevector.h"
 #include "dwordfeatures.h"
 #include <math.h>
+#include <float.h>
 #include <vector>
-#include <queue>
 #include <stack>
 #include <map>
+#include <algorithm>
 #include <sys/stat.h>
 
 #define USE_MEAN_VECTORS 1
@@ -24,6 +30,44 @@
 #define BEST_N_UNIQUE_LABELS 1
 
 #define DP_ONLY 0
+//compare words by their horizontal DP warp cost alone (no meshes at all,
+//see DMorphInk::fOnlyDoDPCost). Much cheaper than DP_ONLY.
+#ifndef DP_COST_ONLY
+#define DP_COST_ONLY 0
+#endif
+
+//give the tree search and slow pass comparisons the highest cost that could
+//still change the results, so they can stop early once a cost is over it
+//(see getCachedMorphCost()). The results are the same with it off (make
+//testbounds checks this)
+#ifndef BOUND_SEARCH_COSTS
+#define BOUND_SEARCH_COSTS 1
+#endif
+
+//keep the prepared training words in
+//<dataset_path>/train_thresh_w_FIRST_LAST.dmis (written the first time,
+//mapped on later runs. It is rebuilt if any of the thresh_w_ files has
+//changed since).  This writes into the dataset directory, so it is off
+//unless built with -DUSE_TRAINING_STORE=1
+#ifndef USE_TRAINING_STORE
+#define USE_TRAINING_STORE 0
+#endif
+//how the stored words were loaded (a store made any other way is rejected)
+#define TRAINING_STORE_SOURCE "thresh_w_%08d.pgm (already thresholded)"
+
+//default for how many of the best nodes in the tree search's queue are
+//expanded at once (the optional last argument changes it).  The costs to
+//all of their children are computed in parallel when a test word has
+//several threads, each with the bound as it was when the batch started, so
+//this, not the number of threads, decides which nodes get compared.  1 is
+//the original serial search.
+#ifndef TREE_SEARCH_BATCH_SIZE
+#define TREE_SEARCH_BATCH_SIZE 4
+#endif
+
+//precision the NxN training cost matrix is saved with when it is computed
+//(CostValue_f16 halves the file again, but see DCostMatrix about range)
+#define COST_MATRIX_VALUE_TYPE DCostMatrix::CostValue_f32
 
 
 //#define D_NOTHREADS
@@ -120,19 +164,6 @@ typedef struct{
 } WORDWARP_THREAD_PARMS;
 
 
-typedef struct{
-  int numThreads;
-  int threadNum;
-  DImage *rgTrainingImages;//pointer shared by all threads
-  int numTrain;
-  double *rgTrainCostMatrix;
-  double weightMovement; // 0. to 1. (how much to weight the movement in cost)
-  double lengthPenalty;
-  int meshSpacingStatic;//-1 if auto-calculate like originally done
-  int numRefinesStatic;//-1 if auto-calculate like originally done
-  double meshDiv;//what to divide word image height by to get mesh size [4.0]
-  int bandWidthDP;//sakeo-chiba bandwidth for DP
-} TRAIN_NXN_THREAD_PARMS;
 
 
 class HAC_TREE_NODE;//forward declaration so we can use pointer to own type
@@ -167,8 +198,6 @@ public:
   DFeatureVector fvMaxDistFromDescendantsMean;
   double maxDistFromDescendantsMeanFv;
 
-  int *rgTopNTrainingMatches;// these are indexes (0-based) into training array
-
   double centerAspectRatio_w_div_h;
   static int numInstances;//this is not thread safe!! only build one at a time
 };
@@ -189,7 +218,6 @@ HAC_TREE_NODE::HAC_TREE_NODE(){
   sumDistFromCenter = 0.;
   maxDistFromCenterFv = 0.;
   maxDistFromDescendantsMeanFv = 0.;
-  rgTopNTrainingMatches = NULL;
   centerAspectRatio_w_div_h = 0.;
   clustID=HAC_TREE_NODE::numInstances;
   ++HAC_TREE_NODE::numInstances;
@@ -213,8 +241,6 @@ HAC_TREE_NODE::~HAC_TREE_NODE(){
   numWordsIncludingDescendants = 0;
   if(NULL != rgWordsIncludingDescendants)
     delete [] rgWordsIncludingDescendants;
-  if(NULL != rgTopNTrainingMatches)
-    delete [] rgTopNTrainingMatches;
   rgWordsIncludingDescendants = NULL;
   centerIdx = -1;
   maxDistFromCenter = 0.;
@@ -223,13 +249,12 @@ HAC_TREE_NODE::~HAC_TREE_NODE(){
 }
 
 
-//node type for use by std::priority_queue
+//node type for the branch and bound priority queue (kept by value in a
+//std::vector heap, so nothing is allocated per node)
 typedef struct{
-  HAC_TREE_NODE *pHTnode;
+  int node;//index of the node in the DHACTree
   double priority;
   double morphCostFromTestToCenter;
-  double distFromTestToCenterFV;
-  double distFromTestToMeanFV;
 } PQ_NODE_T;
 
 typedef struct{
@@ -266,22 +291,19 @@ int compare_TOPN_matches(const void *pv1, const void *pv2){
 
 
 
-//comparison function for use by std::priority_queue
-bool compare_for_min_priority_queue(const PQ_NODE_T *a, const PQ_NODE_T *b){
-  return ((a->priority) > (b->priority));
+//comparison function for use by std::push_heap/pop_heap (min heap)
+bool compare_for_min_priority_queue(const PQ_NODE_T &a, const PQ_NODE_T &b){
+  return ((a.priority) > (b.priority));
 }
 class Compare_for_min_pri_queue{
 public:
- bool operator()(const PQ_NODE_T *p1, const PQ_NODE_T *p2){
-   return ((p1->priority) > (p2->priority));
+ bool operator()(const PQ_NODE_T &p1, const PQ_NODE_T &p2){
+   return ((p1.priority) > (p2.priority));
  }
-  // bool comp(const PQ_NODE_T *p1, const PQ_NODE_T *p2){
-  //   return ((p1->priority) > (p2->priority));
-  // }
 };
 void calculateTreeKeyVectors(HAC_TREE_NODE *pTreeRoot,
 			     int *rgKeyWordIdxs, int numKeyWords,
-			     double *rgTrainCostMatrix, int numTrain,
+			     const DCostMatrix &trainCostMatrix,
 			     HAC_TREE_NODE **rgOrigWordLeafNodes){
   std::stack<HAC_TREE_NODE*> searchStack;
   HAC_TREE_NODE *pCur;
@@ -299,7 +321,7 @@ void calculateTreeKeyVectors(HAC_TREE_NODE *pTreeRoot,
     if(0 == pCur->fvCenter.dimensions){//this is on the way down
       for(int kk=0; kk < numKeyWords; ++kk){
 	rgData[kk] =
-	  rgTrainCostMatrix[(pCur->centerIdx)*(long)numTrain+rgKeyWordIdxs[kk]];
+	  trainCostMatrix.at(pCur->centerIdx, rgKeyWordIdxs[kk]);
       }
       pCur->fvCenter.setData_dbl(rgData, numKeyWords,1,true,true,true);
       pCur->maxDistFromCenterFv = 0.;
@@ -429,7 +451,7 @@ void save3dWordPlot(char *stFileName, HAC_TREE_NODE *pTreeRoot,
 
 void saveTreeForGraphviz(char *stFileName,
 			 HAC_TREE_NODE *pTreeRoot, std::string *rgLabelsTrain,
-			 double *rgTrainCostMatrix, int numTrain,
+			 const DCostMatrix &trainCostMatrix,
 			 int *rgKeyWordIdxs, int numKeyWords){
   std::stack<HAC_TREE_NODE*> searchStack;
   HAC_TREE_NODE *root;
@@ -487,12 +509,12 @@ void saveTreeForGraphviz(char *stFileName,
 	fprintf(fout," I%d -> I%d [fontsize=10,label=\"%.2lf\",color=blue];\n",
 		root->clustID,
 		root->rgpChildren[i]->clustID,
-		rgTrainCostMatrix[(root->centerIdx)*(long)numTrain+root->rgpChildren[i]->centerIdx]);
+		trainCostMatrix.at(root->centerIdx, root->rgpChildren[i]->centerIdx));
       else
 	fprintf(fout," I%d -> I%d [fontsize=10,label=\"%.2lf\"];\n",
 		root->clustID,
 		root->rgpChildren[i]->clustID,
-		rgTrainCostMatrix[(root->centerIdx)*(long)numTrain+root->rgpChildren[i]->centerIdx]);
+		trainCostMatrix.at(root->centerIdx, root->rgpChildren[i]->centerIdx));
       searchStack.push(root->rgpChildren[i]);
     }
   }//end while
@@ -500,204 +522,570 @@ void saveTreeForGraphviz(char *stFileName,
   fclose(fout);
 }
 
-//if numCompares is not NULL, the number of morphCompares will be put in it
-HAC_TREE_NODE* findBestMatchNodeInTree(DImage &imgTest,
-				       HAC_TREE_NODE *pTreeRoot,
-				       DImage *rgTrainingImages,
-				       int numTrain,
-				       int bandWidth,
-				       int meshSpacingStatic,
-				       int numRefinesStatic,
-				       double meshDiv,
-				       double lengthPenalty,
-				       double alpha,
-				       int *numCompares,
-				       double *minC,
-				       std::string *rgLabelsTrain,
-				       std::string strLabelTest,
-				       int slowPassTopN,
-				       FASTPASS_SORT_NODE_T *rgFastpassSorted,
-				       int topNMatches
-				       ){
-  // now traverse the tree and find the best match using branch and bound
-  double minCostSoFar; // this is m in branch and bound
-  HAC_TREE_NODE *pMinNode;
-  std::priority_queue<PQ_NODE_T*, std::vector<PQ_NODE_T*>,Compare_for_min_pri_queue> priQueue;
-  DMorphInk mobj;
+//cache of the morph costs computed for the test word being searched
+//
+//The tree search, the slow pass over its top N, and the N-gram results
+//all get their costs through getCachedMorphCost(), keyed by (training
+//word, mode), so a cost is computed once no matter which phase asks for it
+//first.  In the tree search the first child of every merged node has the
+//same center as the node itself, so each expansion saves a comparison.
+//Each search thread has its own cache and reuses it for every test word:
+//reset() forgets the previous word's costs by bumping a generation
+//counter, so no memory is kept once a word's N-gram results are done and
+//nothing is locked.  (The workers expanding one batch of a search never
+//compute the same training word, since the children of a batch's nodes
+//are the roots of subtrees that don't overlap.)
+#define MORPH_COST_FAST 0 //DMorphInk::getWordMorphCostFast()
+#define MORPH_COST_FULL 1 //DMorphInk::getWordMorphCost()
+#if USE_FAST_PASS_FIRST
+#define TREE_SEARCH_COST_MODE MORPH_COST_FAST
+#else
+#define TREE_SEARCH_COST_MODE MORPH_COST_FULL
+#endif
+
+class MORPH_COST_CACHE{
+public:
+  MORPH_COST_CACHE(int numTrain);
+  ~MORPH_COST_CACHE();
+  void reset();
+  bool lookup(int trIdx, int mode, double *pCost) const;
+  void insert(int trIdx, int mode, double cost);
+  void getCosts(int mode, double *rgCosts, double missingCost) const;
+private:
+  MORPH_COST_CACHE(const MORPH_COST_CACHE &src);//not copyable
+  const MORPH_COST_CACHE& operator=(const MORPH_COST_CACHE &src);
+
+  double *rgCosts;//2*numTrain, indexed by trIdx*2+mode
+  unsigned int *rgGen;//2*numTrain: generation each cost was stored in
+  unsigned int curGen;
+  int _numTrain;
+};
+
+MORPH_COST_CACHE::MORPH_COST_CACHE(int numTrain){
+  _numTrain = numTrain;
+  rgCosts = new double[2*numTrain];
+  D_CHECKPTR(rgCosts);
+  rgGen = new unsigned int[2*numTrain];
+  D_CHECKPTR(rgGen);
+  memset(rgGen, 0, sizeof(unsigned int)*2*numTrain);
+  curGen = 1;
+}
+MORPH_COST_CACHE::~MORPH_COST_CACHE(){
+  delete [] rgCosts;
+  delete [] rgGen;
+}
+//forget all costs (call before each test word)
+void MORPH_COST_CACHE::reset(){
+  ++curGen;
+  if(0 == curGen){//wrapped around, so old generations could look current
+    memset(rgGen, 0, sizeof(unsigned int)*2*_numTrain);
+    curGen = 1;
+  }
+}
+inline bool MORPH_COST_CACHE::lookup(int trIdx, int mode,
+				     double *pCost) const{
+  if(rgGen[trIdx*2+mode] != curGen)
+    return false;
+  (*pCost) = rgCosts[trIdx*2+mode];
+  return true;
+}
+inline void MORPH_COST_CACHE::insert(int trIdx, int mode, double cost){
+  rgCosts[trIdx*2+mode] = cost;
+  rgGen[trIdx*2+mode] = curGen;
+}
+//fill rgCosts (numTrain) with the cached costs, missingCost where there are none
+void MORPH_COST_CACHE::getCosts(int mode, double *rgCostsOut,
+				double missingCost) const{
+  for(int tr=0; tr < _numTrain; ++tr){
+    if(rgGen[tr*2+mode] == curGen)
+      rgCostsOut[tr] = rgCosts[tr*2+mode];
+    else
+      rgCostsOut[tr] = missingCost;
+  }
+}
+
+//cost from the test word to training word trIdx, from the cache if it
+//has already been computed. numMorphCompares is incremented otherwise.
+//
+//If upperBound is finite, the caller doesn't need the cost if it is over
+//upperBound, so the comparison goes through
+//DMorphInk::getWordMorphCostCascade() (see setupBoundedMorph()) and may
+//stop early, returning a value that is over upperBound but is not the
+//cost. Those aren't cached.  If pfNew isn't NULL, it is set to true only
+//if this call computed the real cost (so it wasn't in the cache before).
+double getCachedMorphCost(MORPH_COST_CACHE *pCache, int trIdx,
+			  int mode, DMorphInk &mobj,
+			  const DMorphInkPrepared &prepTest,
+			  const DMorphInkPrepared &prepTrain,
+			  int bandWidth,
+			  int meshSpacingStatic,
+			  int numRefinesStatic,
+			  double meshDiv,
+			  double lengthPenalty,
+			  double upperBound,
+			  int *numMorphCompares,
+			  bool *pfNew){
+  double cost;
+#if !BOUND_SEARCH_COSTS
+  upperBound = HUGE_VAL;
+#endif
+  if(NULL != pfNew)
+    (*pfNew) = false;
+  if(pCache->lookup(trIdx, mode, &cost))
+    return cost;
+  ++(*numMorphCompares);
+  if(upperBound < HUGE_VAL){
+    DMorphInk::DMorphCascadeStage stage;
+    cost = mobj.getWordMorphCostCascade(prepTest, prepTrain, upperBound,
+					&stage, MORPH_COST_FAST == mode,
+					bandWidth,/*bandWidthDP*/
+					0./*nonDiagonalCostDP*/,
+					meshSpacingStatic,
+					numRefinesStatic,
+					meshDiv,
+					lengthPenalty);
+    if(DMorphInk::CascadeNotRejected != stage)
+      return cost;//only a bound over upperBound
+  }
+  else if(MORPH_COST_FAST == mode)
+    cost = mobj.getWordMorphCostFast(prepTest, prepTrain,
+				     bandWidth,/*bandWidthDP*/
+				     0./*nonDiagonalCostDP*/,
+				     meshSpacingStatic,
+				     numRefinesStatic,
+				     meshDiv,
+				     lengthPenalty);
+  else
+    cost = mobj.getWordMorphCost(prepTest, prepTrain,
+				 bandWidth,/*bandWidthDP*/
+				 0./*nonDiagonalCostDP*/,
+				 meshSpacingStatic,
+				 numRefinesStatic,
+				 meshDiv,
+				 lengthPenalty);
+  pCache->insert(trIdx, mode, cost);
+  if(NULL != pfNew)
+    (*pfNew) = true;
+  return cost;
+}
+
+//set up a DMorphInk used for getCachedMorphCost(). Only the cascade stages
+//that are real lower bounds are used (the length penalty, the one-way
+//cost, and the DP cost with early abandon if DP_COST_ONLY) so a bounded
+//comparison never drops a cost that is within its bound.
+void setupBoundedMorph(DMorphInk &mobj){
 #if DP_ONLY
   mobj.fOnlyDoCoarseAlignment = true;
 #endif
+#if DP_COST_ONLY
+  mobj.fOnlyDoDPCost = true;
+#endif
+  mobj.cascadeDPScale = 0.;
+  mobj.cascadeCoarseScale = 0.;
+}
+
+//the N lowest costs passed to insert(), sorted, or if a label array is
+//passed, the N lowest of each label's lowest cost (like the
+//BEST_N_UNIQUE_LABELS list).  A search can give up on any cost that is
+//over getNthBestCost() without changing its top N.
+class BEST_N_COSTS{
+public:
+  BEST_N_COSTS(int N);
+  ~BEST_N_COSTS();
+  void reset(){numSoFar = 0;}
+  void insert(double cost, int trIdx, const std::string *rgLabels);
+  double getNthBestCost() const;
+private:
+  BEST_N_COSTS(const BEST_N_COSTS &src);//not copyable
+  const BEST_N_COSTS& operator=(const BEST_N_COSTS &src);
+  int N;
+  int numSoFar;
+  double *rgCost;//N
+  int *rgTrIdx;//N
+};
+
+BEST_N_COSTS::BEST_N_COSTS(int N){
+  this->N = (N > 0) ? N : 0;
+  numSoFar = 0;
+  rgCost = new double[this->N + 1];
+  D_CHECKPTR(rgCost);
+  rgTrIdx = new int[this->N + 1];
+  D_CHECKPTR(rgTrIdx);
+}
+
+BEST_N_COSTS::~BEST_N_COSTS(){
+  delete [] rgCost;
+  delete [] rgTrIdx;
+}
+
+void BEST_N_COSTS::insert(double cost, int trIdx,
+			  const std::string *rgLabels){
+  int pos;
+  if(N < 1)
+    return;
+  if(NULL != rgLabels){//one per label: replace its cost if this is lower
+    for(pos=0; pos < numSoFar; ++pos){
+      if(rgLabels[rgTrIdx[pos]] == rgLabels[trIdx])
+	break;
+    }
+    if(pos < numSoFar){
+      if(cost >= rgCost[pos])
+	return;
+      for(; pos < (numSoFar-1); ++pos){
+	rgCost[pos] = rgCost[pos+1];
+	rgTrIdx[pos] = rgTrIdx[pos+1];
+      }
+      --numSoFar;
+    }
+  }
+  if((numSoFar == N) && (cost >= rgCost[N-1]))
+    return;
+  pos = (numSoFar < N) ? numSoFar : (N-1);
+  while((pos > 0) && (rgCost[pos-1] > cost)){
+    rgCost[pos] = rgCost[pos-1];
+    rgTrIdx[pos] = rgTrIdx[pos-1];
+    --pos;
+  }
+  rgCost[pos] = cost;
+  rgTrIdx[pos] = trIdx;
+  if(numSoFar < N)
+    ++numSoFar;
+}
+
+//0 if N is 0, HUGE_VAL until N costs (or labels) are known
+double BEST_N_COSTS::getNthBestCost() const{
+  if(N < 1)
+    return 0.;
+  if(numSoFar < N)
+    return HUGE_VAL;
+  return rgCost[N-1];
+}
+
+//scratch space for findBestMatchNodeInTree(), kept by each search thread
+//so that nothing is allocated for each test word
+//
+//Up to batchSize nodes that aren't pruned are taken off the priority queue
+//at a time.  Each child of one of them is an item (its index into
+//rgChildren, which gives both the node and the child), and if
+//numWorkers > 1 the items are computed in parallel by pPool, otherwise one
+//after another by the calling thread, with the same result.
+class TREE_SEARCH_SCRATCH{
+public:
+  TREE_SEARCH_SCRATCH(int numTrain, int numNodes, int numWorkers,
+		      int batchSize, int numBest, int numBestLabels);
+  ~TREE_SEARCH_SCRATCH();
+
+  std::vector<PQ_NODE_T> vectPQ;//the priority queue (a heap)
+  double *rgCostFromTestToTrain;//numTrain
+  int batchSize;//how many nodes are expanded at once
+  int *rgItemChild;//numNodes: rgFirstChild[n]+nn for each child nn of each
+                   //node n of the batch
+  double *rgChildCost;//numNodes: cost to each child's center
+  bool *rgfChildNew;//numNodes: true if that cost was computed (see
+                    //getCachedMorphCost())
+  BEST_N_COSTS bestCosts;//the numBest lowest costs must be exact
+  BEST_N_COSTS bestLabelCosts;//and those of the numBestLabels best labels
+  double getBestNBound() const;
+  DMorphInk *rgMorph;//one per worker
+  int *rgNumCompares;//one per worker
+  int numWorkers;
+  DThreadPool *pPool;//NULL unless numWorkers > 1
+private:
+  TREE_SEARCH_SCRATCH(const TREE_SEARCH_SCRATCH &src);//not copyable
+  const TREE_SEARCH_SCRATCH& operator=(const TREE_SEARCH_SCRATCH &src);
+};
+
+TREE_SEARCH_SCRATCH::TREE_SEARCH_SCRATCH(int numTrain, int numNodes,
+					 int numWorkers, int batchSize,
+					 int numBest, int numBestLabels) :
+  bestCosts(numBest), bestLabelCosts(numBestLabels){
+  if(numWorkers < 1)
+    numWorkers = 1;
+  if(batchSize < 1)
+    batchSize = 1;
+  vectPQ.reserve(numNodes);
+  rgCostFromTestToTrain = new double[numTrain];
+  D_CHECKPTR(rgCostFromTestToTrain);
+  this->batchSize = batchSize;
+  this->numWorkers = numWorkers;
+  rgItemChild = new int[numNodes];
+  D_CHECKPTR(rgItemChild);
+  rgChildCost = new double[numNodes];
+  D_CHECKPTR(rgChildCost);
+  rgfChildNew = new bool[numNodes];
+  D_CHECKPTR(rgfChildNew);
+  rgMorph = new DMorphInk[numWorkers];
+  D_CHECKPTR(rgMorph);
+  rgNumCompares = new int[numWorkers];
+  D_CHECKPTR(rgNumCompares);
+  for(int w=0; w < numWorkers; ++w){
+    setupBoundedMorph(rgMorph[w]);
+    rgNumCompares[w] = 0;
+  }
+  pPool = NULL;
+  if(numWorkers > 1){
+    pPool = new DThreadPool(numWorkers);
+    D_CHECKPTR(pPool);
+  }
+}
+TREE_SEARCH_SCRATCH::~TREE_SEARCH_SCRATCH(){
+  if(NULL != pPool)
+    delete pPool;
+  delete [] rgCostFromTestToTrain;
+  delete [] rgItemChild;
+  delete [] rgChildCost;
+  delete [] rgfChildNew;
+  delete [] rgMorph;
+  delete [] rgNumCompares;
+}
+
+//a cost over this can't be one that bestCosts or bestLabelCosts needs
+double TREE_SEARCH_SCRATCH::getBestNBound() const{
+  double bound;
+  bound = bestCosts.getNthBestCost();
+  if(bestLabelCosts.getNthBestCost() > bound)
+    bound = bestLabelCosts.getNthBestCost();
+  return bound;
+}
+
+//parameters for tree_expand_func() (the same for every item of a batch)
+typedef struct{
+  const DHACTree *pTree;
+  const DMorphInkPrepared *pPrepTest;
+  const DMorphInkPrepared *rgPreparedTrain;
+  MORPH_COST_CACHE *pCostCache;
+  int bandWidth;
+  int meshSpacingStatic;
+  int numRefinesStatic;
+  double meshDiv;
+  double lengthPenalty;
+  double alpha;
+  double minCostSoFar;//bound when the batch started (only changed between batches)
+  double nthBestCost;//higher of the scratch best N bounds when the batch
+                     //started
+  TREE_SEARCH_SCRATCH *pScratch;
+} TREE_EXPAND_PARMS_T;
+
+//compute the cost to the center of child rgItemChild[itemIdx] of the batch.
+//It only uses the bounds as they were when the batch started, so the result
+//doesn't depend on how the items are spread over the threads.
+//findBestMatchNodeInTree() prunes the children and lowers minCostSoFar
+//itself once the batch is done.
+//
+//A child's cost only matters if it would keep the child from being pruned,
+//lower minCostSoFar, or be among the best N costs the caller needs, so it is
+//computed with the largest of those as its upper bound.  The bounds only
+//go down while the batch is pruned, so a cost over it is still pruned.
+void tree_expand_func(void *params, int itemIdx, int threadNum){
+  TREE_EXPAND_PARMS_T *pparms;
+  TREE_SEARCH_SCRATCH *pScratch;
+  const DHACTree *pTree;
+  int child, nodeNew, jj;
+  double upperBound;//a cost over this wouldn't change the search
+
+  pparms = (TREE_EXPAND_PARMS_T*)params;
+  pScratch = pparms->pScratch;
+  pTree = pparms->pTree;
+  child = pScratch->rgItemChild[itemIdx];
+  nodeNew = pTree->rgChildren[child];
+  jj = pTree->rgCenterIdx[nodeNew];
+  upperBound = pparms->alpha * pparms->minCostSoFar +
+    pTree->rgMaxDistFromCenter[nodeNew];
+  if(pparms->minCostSoFar > upperBound)
+    upperBound = pparms->minCostSoFar;
+  if(pparms->nthBestCost > upperBound)
+    upperBound = pparms->nthBestCost;
+  pScratch->rgChildCost[child] =
+    getCachedMorphCost(pparms->pCostCache, jj,
+		       TREE_SEARCH_COST_MODE, pScratch->rgMorph[threadNum],
+		       *(pparms->pPrepTest), pparms->rgPreparedTrain[jj],
+		       pparms->bandWidth, pparms->meshSpacingStatic,
+		       pparms->numRefinesStatic, pparms->meshDiv,
+		       pparms->lengthPenalty, upperBound,
+		       &(pScratch->rgNumCompares[threadNum]),
+		       &(pScratch->rgfChildNew[child]));
+}
+
+//if numCompares is not NULL, the number of morphCompares will be put in it
+//
+//The tree is searched through the flat arrays of a DHACTree (node 0 is the
+//root).  Costs to the node centers go through pCostCache, which must have
+//been reset for this test word.  scratch is owned by the caller so that
+//nothing is allocated for each test word, and its pool (if any) computes
+//the costs to the children of several of the best nodes in the queue at
+//once.  The costs in
+//scratch.bestCosts and scratch.bestLabelCosts are always exact (costs over
+//them may only be bounds).  Returns the index of the best node found.
+int findBestMatchNodeInTree(const DMorphInkPrepared &prepTest,
+			    const DHACTree &tree,
+			    const DMorphInkPrepared *rgPreparedTrain,
+			    int numTrain,
+			    int bandWidth,
+			    int meshSpacingStatic,
+			    int numRefinesStatic,
+			    double meshDiv,
+			    double lengthPenalty,
+			    double alpha,
+			    int *numCompares,
+			    double *minC,
+			    std::string *rgLabelsTrain,
+			    std::string strLabelTest,
+			    int slowPassTopN,
+			    FASTPASS_SORT_NODE_T *rgFastpassSorted,
+			    int topNMatches,
+			    MORPH_COST_CACHE *pCostCache,
+			    TREE_SEARCH_SCRATCH &scratch
+			    ){
+  // now traverse the tree and find the best match using branch and bound
+  double minCostSoFar; // this is m in branch and bound
+  int minNode;
+  const D_sint32 *rgCenterIdx = tree.rgCenterIdx;
+  const D_sint32 *rgFirstChild = tree.rgFirstChild;
+  const D_sint32 *rgNumChildren = tree.rgNumChildren;
+  Compare_for_min_pri_queue compPQ;
+  DMorphInk &mobj = scratch.rgMorph[0];
 
   // here we could prime the search by choosing a few frequent words or using
   // a dynamic cache of frequent words
 
   // initialize to search for this word's best training match
   int numMorphCompares;
-  double *rgCostFromTestToTrain;
-  rgCostFromTestToTrain = new double[numTrain];
-  D_CHECKPTR(rgCostFromTestToTrain);
+  double mcostToRoot;
 
-  for(int jjj=0; jjj < numTrain; ++jjj)
-    rgCostFromTestToTrain[jjj] = 999999.;
   numMorphCompares = 0;
 
   int j;
-  j = pTreeRoot->centerIdx;
-  if(true/*999999. == rgCostFromTestToTrain[j]*/){
-#if USE_FAST_PASS_FIRST
-    rgCostFromTestToTrain[j] =
-      mobj.getWordMorphCostFast(imgTest, rgTrainingImages[j],
-				bandWidth,/*bandWidthDP*/
-				0./*nonDiagonalCostDP*/,
-				meshSpacingStatic,
-				numRefinesStatic,
-				meshDiv,
-				lengthPenalty);
-#else
-    rgCostFromTestToTrain[j] =
-      mobj.getWordMorphCost(imgTest, rgTrainingImages[j],
-			    bandWidth,/*bandWidthDP*/
-			    0./*nonDiagonalCostDP*/,
-			    meshSpacingStatic,
-			    numRefinesStatic,
-			    meshDiv,
-			    lengthPenalty);
-#endif //USE_FAST_PASS_FIRST
-    ++numMorphCompares;
-  }
-  pMinNode = pTreeRoot;
-  minCostSoFar = rgCostFromTestToTrain[j];
+  j = rgCenterIdx[0];
+  mcostToRoot =
+    getCachedMorphCost(pCostCache, j, TREE_SEARCH_COST_MODE, mobj,
+		       prepTest, rgPreparedTrain[j], bandWidth,
+		       meshSpacingStatic, numRefinesStatic, meshDiv,
+		       lengthPenalty, HUGE_VAL, &numMorphCompares, NULL);
+  minNode = 0;
+  minCostSoFar = mcostToRoot;
 
   {//this block is experimental and should be removed------------------------
     //it finds the best match for each word (as an ORACLE) and starts with it
     //as the "best so far" to see how well the search prunes.
 #if 0    
-    std::stack<HAC_TREE_NODE*> searchStack;
-    HAC_TREE_NODE *root;
-
-    searchStack.push(pTreeRoot);
-    while(!searchStack.empty()){
-      root = searchStack.top();
-      searchStack.pop();
-      for(int ii=0; ii < root->numWordsInClustAtThisLevel; ++ii){
-	if(0==strcmp(rgLabelsTrain[root->rgWordsInClustAtThisLevel[ii]].c_str(),
-		     strLabelTest.c_str())){
+    for(int n=0; n < tree.getNumNodes(); ++n){
+      for(int ii=0; ii < tree.rgNumWordsHere[n]; ++ii){
+	int trIdx;
+	trIdx = tree.rgWords[tree.rgFirstWord[n]+ii];
+	if(0==strcmp(rgLabelsTrain[trIdx].c_str(), strLabelTest.c_str())){
 	  double tmpMorphCost;
-#if USE_FAST_PASS_FIRST
 	  tmpMorphCost =
-	    mobj.getWordMorphCostFast(imgTest,
-				      rgTrainingImages[root->rgWordsInClustAtThisLevel[ii]],
-				      bandWidth,/*bandWidthDP*/
-				      0./*nonDiagonalCostDP*/,
-				      meshSpacingStatic,
-				      numRefinesStatic,
-				      meshDiv,
-				      lengthPenalty);
-#else
-	  tmpMorphCost =
-	    mobj.getWordMorphCost(imgTest,
-				  rgTrainingImages[root->rgWordsInClustAtThisLevel[ii]],
-				  bandWidth,/*bandWidthDP*/
-				  0./*nonDiagonalCostDP*/,
-				  meshSpacingStatic,
-				  numRefinesStatic,
-				  meshDiv,
-				  lengthPenalty);
-#endif //USE_FAST_PASS_FIRST
+	    getCachedMorphCost(pCostCache, trIdx,
+			       TREE_SEARCH_COST_MODE, mobj, prepTest,
+			       rgPreparedTrain[trIdx], bandWidth,
+			       meshSpacingStatic, numRefinesStatic, meshDiv,
+			       lengthPenalty, HUGE_VAL, &numMorphCompares,
+			       NULL);
 	  if(tmpMorphCost < minCostSoFar){
 	    minCostSoFar = tmpMorphCost;
-	    pMinNode = root;
+	    minNode = n;
 	  }
 	}
       }
-      for(int i=0; i < root->numChildren; ++i){
-	searchStack.push(root->rgpChildren[i]);
-      }
-    }//end while
+    }
     printf("initializing search to cost %.2lf minNode=#%d(%s)\n",
-	   minCostSoFar,pMinNode->centerIdx,rgLabelsTrain[pMinNode->centerIdx].c_str());
+	   minCostSoFar,rgCenterIdx[minNode],
+	   rgLabelsTrain[rgCenterIdx[minNode]].c_str());
 #endif
   }//end of experimental block-------------------------------------------------
 
 
-  PQ_NODE_T *pQN;
-  pQN = new PQ_NODE_T;
-  pQN->pHTnode = pTreeRoot;
-  pQN->priority = rgCostFromTestToTrain[j];
-  pQN->morphCostFromTestToCenter = rgCostFromTestToTrain[j];
-  priQueue.push(pQN);
-  while(!priQueue.empty()){
-    double mcostToCenter;
-    HAC_TREE_NODE *pHTN;
-    pQN = priQueue.top();
-    priQueue.pop();
-    mcostToCenter = pQN->morphCostFromTestToCenter;
-    pHTN = pQN->pHTnode;
-    delete pQN; pQN = NULL;
-    // here we check the bounding function to see if we need to prune
-    if( ((mcostToCenter) - (pHTN->maxDistFromCenter)) >
-	(alpha * minCostSoFar)){//prune
-      //printf("p(%d)",pHTN->numWordsIncludingDescendants);fflush(stdout);
+  PQ_NODE_T qn;
+  TREE_EXPAND_PARMS_T expandParms;
+  std::vector<PQ_NODE_T> &vectPQ = scratch.vectPQ;
+
+  expandParms.pTree = &tree;
+  expandParms.pPrepTest = &prepTest;
+  expandParms.rgPreparedTrain = rgPreparedTrain;
+  expandParms.pCostCache = pCostCache;
+  expandParms.bandWidth = bandWidth;
+  expandParms.meshSpacingStatic = meshSpacingStatic;
+  expandParms.numRefinesStatic = numRefinesStatic;
+  expandParms.meshDiv = meshDiv;
+  expandParms.lengthPenalty = lengthPenalty;
+  expandParms.alpha = alpha;
+  expandParms.minCostSoFar = minCostSoFar;
+  scratch.bestCosts.reset();
+  scratch.bestLabelCosts.reset();
+  scratch.bestCosts.insert(mcostToRoot, j, NULL);
+  scratch.bestLabelCosts.insert(mcostToRoot, j, rgLabelsTrain);
+  expandParms.nthBestCost = scratch.getBestNBound();
+  expandParms.pScratch = &scratch;
+  for(int w=0; w < scratch.numWorkers; ++w)
+    scratch.rgNumCompares[w] = 0;
+
+  vectPQ.clear();
+  qn.node = 0;
+  qn.priority = mcostToRoot;
+  qn.morphCostFromTestToCenter = mcostToRoot;
+  vectPQ.push_back(qn);
+  while(!vectPQ.empty()){
+    int batchLen;
+    int numItems;
+    // take the best few nodes that can't be pruned off the queue (against
+    // the bound as it is now) and compute the costs to all of their
+    // children (in parallel)
+    batchLen = 0;
+    numItems = 0;
+    while((!vectPQ.empty()) && (batchLen < scratch.batchSize)){
+      int node;
+      std::pop_heap(vectPQ.begin(), vectPQ.end(), compPQ);
+      qn = vectPQ.back();
+      vectPQ.pop_back();
+      node = qn.node;
+      // here we check the bounding function to see if we need to prune
+      if( ((qn.morphCostFromTestToCenter) -
+	   (tree.rgMaxDistFromCenter[node])) > (alpha * minCostSoFar))
+	continue;//prune
+      ++batchLen;
+      for(int nn=0; nn < rgNumChildren[node]; ++nn){
+	scratch.rgItemChild[numItems] = rgFirstChild[node] + nn;
+	++numItems;
+      }
     }
-    else{// don't prune, expand the node by adding children to queue
-      for(int nn=0; nn < (pHTN->numChildren); ++nn){
-	int jj;
-	HAC_TREE_NODE *pHTNnew;
-	double mcostToCenterNew;
-	
-	pHTNnew = pHTN->rgpChildren[nn];
-	jj=pHTNnew->centerIdx;
-	if(999999. == rgCostFromTestToTrain[jj]){
-	  //printf("*");fflush(stdout);
-#if USE_FAST_PASS_FIRST
-	  rgCostFromTestToTrain[jj] =
-	    mobj.getWordMorphCostFast(imgTest,
-				      rgTrainingImages[jj],
-				      bandWidth,/*bandWidthDP*/
-				      0./*nonDiagonalCostDP*/,
-				      meshSpacingStatic,
-				      numRefinesStatic,
-				      meshDiv,
-				      lengthPenalty);
-#else
-	  rgCostFromTestToTrain[jj] =
-	    mobj.getWordMorphCost(imgTest,
-				  rgTrainingImages[jj],
-				  bandWidth,/*bandWidthDP*/
-				  0./*nonDiagonalCostDP*/,
-				  meshSpacingStatic,
-				  numRefinesStatic,
-				  meshDiv,
-				  lengthPenalty);
-#endif //USE_FAST_PASS_FIRST
-
-	  ++numMorphCompares;
-	}
-	else{
-	  //printf(".");fflush(stdout);
-	}
-	mcostToCenterNew = rgCostFromTestToTrain[jj];
-	if( ((mcostToCenterNew) - (pHTNnew->maxDistFromCenter)) >
-	    (alpha * minCostSoFar)){//prune (don't add to priorityQueue)
-	  //printf("P(%d)",pHTNnew->numWordsIncludingDescendants);fflush(stdout);
-	}
-	else{
-	  PQ_NODE_T *pQNnew;
-	  pQNnew = new PQ_NODE_T;
-	  pQNnew->pHTnode = pHTNnew;
-	  pQNnew->priority = mcostToCenterNew;
-	  pQNnew->morphCostFromTestToCenter = mcostToCenterNew;
-	  priQueue.push(pQNnew);
-	  if(mcostToCenterNew < minCostSoFar){
-	    minCostSoFar = mcostToCenterNew;
-	    pMinNode = pHTNnew;
-	  }
-	}
+    if((NULL != scratch.pPool) && (numItems > 1))
+      scratch.pPool->run(numItems, tree_expand_func, (void*)&expandParms);
+    else{
+      for(int it=0; it < numItems; ++it)
+	tree_expand_func((void*)&expandParms, it, 0);
+    }
+    // prune the children, add the rest to the queue, and lower the bound
+    // as each one is reached (in batch order, so it is deterministic)
+    for(int it=0; it < numItems; ++it){
+      int child, nodeNew;
+      double cost;
+      child = scratch.rgItemChild[it];
+      nodeNew = tree.rgChildren[child];
+      cost = scratch.rgChildCost[child];
+      if(scratch.rgfChildNew[child]){
+	scratch.bestCosts.insert(cost, rgCenterIdx[nodeNew], NULL);
+	scratch.bestLabelCosts.insert(cost, rgCenterIdx[nodeNew],
+				      rgLabelsTrain);
+      }
+      if( ((cost) - (tree.rgMaxDistFromCenter[nodeNew])) >
+	  (alpha * minCostSoFar))
+	continue;//prune
+      qn.node = nodeNew;
+      qn.priority = cost;
+      qn.morphCostFromTestToCenter = cost;
+      vectPQ.push_back(qn);
+      std::push_heap(vectPQ.begin(), vectPQ.end(), compPQ);
+      if(cost < minCostSoFar){
+	minCostSoFar = cost;
+	minNode = nodeNew;
       }
     }
-  }//end while(!priQueue.empty())
+    expandParms.minCostSoFar = minCostSoFar;
+    expandParms.nthBestCost = scratch.getBestNBound();
+  }//end while(!vectPQ.empty())
+  for(int w=0; w < scratch.numWorkers; ++w)
+    numMorphCompares += scratch.rgNumCompares[w];
   
-  // printf("bestMatch='%s'\n", rgLabelsTrain[pMinNode->centerIdx].c_str());
   if(NULL != numCompares){
     (*numCompares) = numMorphCompares;
   }
@@ -706,9 +1094,12 @@ HAC_TREE_NODE* findBestMatchNodeInTree(DImage &imgTest,
   }
 #if TRACK_THE_BEST_N
   if((slowPassTopN > 0)||(topNMatches > 0)){
+    //words the search didn't reach sort last
+    pCostCache->getCosts(TREE_SEARCH_COST_MODE,
+			 scratch.rgCostFromTestToTrain, 999999.);
     for(int i=0; i < numTrain; ++i){
       rgFastpassSorted[i].trIdx = i;
-      rgFastpassSorted[i].cost = rgCostFromTestToTrain[i];
+      rgFastpassSorted[i].cost = scratch.rgCostFromTestToTrain[i];
     }
     qsort((void*)rgFastpassSorted, numTrain, sizeof(FASTPASS_SORT_NODE_T),
 	  compare_fastpass_sort);
@@ -718,79 +1109,23 @@ HAC_TREE_NODE* findBestMatchNodeInTree(DImage &imgTest,
     // }
   }
 #endif
-  delete [] rgCostFromTestToTrain;
-  return pMinNode;
+  return minNode;
 } 
 
 
 
-void* word_morphing_NxN_training_thread_func(void *params){
-  TRAIN_NXN_THREAD_PARMS *pparms;
-  int numTrain;
-  DMorphInk mobj;
-#if DP_ONLY
-  mobj.fOnlyDoCoarseAlignment = true;
-#endif
-  double *rgCosts;
-
-  pparms = (TRAIN_NXN_THREAD_PARMS*)params;
-  numTrain = pparms->numTrain;
-  rgCosts = pparms->rgTrainCostMatrix;
-
-  for(long int idx = (pparms->threadNum); idx < numTrain*(long)numTrain;
-      idx+=(pparms->numThreads)){
-    double morphCost;
-    long int r, c;
-    r = idx / numTrain;
-    c = idx % numTrain;
-    if(r<c){
-#if USE_FAST_PASS_FOR_NxN_TRAINING
-      morphCost = 
-	mobj.getWordMorphCostFast(pparms->rgTrainingImages[r],
-				  pparms->rgTrainingImages[c],
-				  pparms->bandWidthDP,
-				  0./*nonDiagonalCostDP*/,
-				  pparms->meshSpacingStatic,
-				  pparms->numRefinesStatic,
-				  pparms->meshDiv,
-				  pparms->lengthPenalty);
-#else
-      morphCost = 
-	mobj.getWordMorphCost(pparms->rgTrainingImages[r],
-			      pparms->rgTrainingImages[c],
-			      pparms->bandWidthDP,/*bandWidthDP*/
-			      0./*nonDiagonalCostDP*/,
-			      pparms->meshSpacingStatic,
-			      pparms->numRefinesStatic,
-			      pparms->meshDiv,
-			      pparms->lengthPenalty);
-#endif
-      rgCosts[idx] = morphCost;
-    }
-    else if(r==c){
-      rgCosts[idx] = 0.;
-    }
-    else if(r>c){
-      rgCosts[idx] = 999999.;
-    }
-    if(0==c){
-      if(0==(r%1))
-	printf(" NxN %.2lf%% complete row%ld\n",(r*100/(double)numTrain),r);
-    }
-  }
-  return NULL;
-}
-
-
 typedef struct{
   int numThreads;//how many threads are doing comparisons
   int threadNum;//which thread number this is (0..numThreads-1)
+  int numThreadsPerWord;//threads that expand the tree for each test word
+  int treeSearchBatchSize;//nodes expanded at once (see TREE_SEARCH_SCRATCH)
   DImage *rgTrainingImages;//pointer shared by all threads
+  DMorphInkPrepared *rgPreparedTrain;//pointer shared by all threads
   int numTrain;
   int testFirst;
   int testLast;
   double *rgCostsMorph;//shared by all threads
-  HAC_TREE_NODE **rgMatchNodes;//shared by all threads
+  int *rgMatchIdxs;//training word matched by each test word (shared)
   int *rgNumMorphCompares;//shared by all threads
   double weightMovement; // 0. to 1. (how much to weight the movement in cost)
   double lengthPenalty;
@@ -798,7 +1133,7 @@ typedef struct{
   int numRefinesStatic;//-1 if auto-calculate like originally done
   double meshDiv;//what to divide word image height by to get mesh size [4.0]
   int bandWidthDP;//sakeo-chiba bandwidth for DP
-  HAC_TREE_NODE *treeRoot;//shared by all threads
+  const DHACTree *pTree;//shared by all threads
   double alpha;//constant multiplier for pruning the tree
   char *stPathIn;//shared by all threads
   std::string *rgLabelsTest;//shared by all threads
@@ -809,7 +1144,7 @@ typedef struct{
   int *rgKeyWordIdxs;//shared by all threads
   int numKeyWords;
   int slowPassTopN;//top N to check after fast pass
-  HAC_TREE_NODE **rgOrigWordLeafNodes;//shared by all threads
+  int *rgTopNTrainingMatches;//slowPassTopN per training word (shared)
   int topN;//N for word N-grams (currently must be <= slowPassTopN)
   TOPN_MATCHES_T *rgTopNMatches;//shared by all threads
   FASTPASS_SORT_NODE_T *rgFastpassSorted;
@@ -822,9 +1157,30 @@ void* tree_search_thread_func(void *params){
   DMorphInk mobj;
   FASTPASS_SORT_NODE_T *rgFastpassSorted = NULL;
 
+  mobj.cascadeDPScale = 0.;//only exact bounds in the slow pass
+  mobj.cascadeCoarseScale = 0.;
+
   pparms = (TREE_SEARCH_THREAD_PARMS*)params;
   numTrain = pparms->numTrain;
   numTest = (pparms->testLast) - (pparms->testFirst) + 1;
+  //the tree search costs that must be exact: the slow pass uses the
+  //slowPassTopN best and the N-gram list the topN best (labels)
+  int numBest = 0;
+  int numBestLabels = 0;
+#if TRACK_THE_BEST_N
+  numBest = pparms->slowPassTopN;
+#if BEST_N_UNIQUE_LABELS
+  numBestLabels = pparms->topN;
+#else
+  if((pparms->topN) > numBest)
+    numBest = pparms->topN;
+#endif
+#endif
+  TREE_SEARCH_SCRATCH scratch(numTrain, pparms->pTree->getNumNodes(),
+			      pparms->numThreadsPerWord,
+			      pparms->treeSearchBatchSize, numBest,
+			      numBestLabels);
+  MORPH_COST_CACHE costCache(numTrain);//reset for each test word
 
 #if TRACK_THE_BEST_N
   if((pparms->slowPassTopN) > numTrain){
@@ -867,19 +1223,22 @@ void* tree_search_thread_func(void *params){
     }
     else
       pparms->rgLabelsTest[i] = strTmp;
+    DMorphInkPrepared prepTest(imgTest, false);
     //    if(pparms->threadNum==(pparms->numThreads - 1))
 
 
 
     double morphCost;
-    HAC_TREE_NODE *pMinNode;
+    int minNode;
+    int matchIdx;//training word matched
     int numMorphCompares;
     int numPrunedFV, numPrunedChildFV;
     numPrunedFV = numPrunedChildFV = 0;
-    pMinNode = 
-      findBestMatchNodeInTree(imgTest,
-      			      pparms->treeRoot, 
-      			      pparms->rgTrainingImages,
+    costCache.reset();
+    minNode = 
+      findBestMatchNodeInTree(prepTest,
+      			      *(pparms->pTree), 
+      			      pparms->rgPreparedTrain,
       			      numTrain,
       			      pparms->bandWidthDP,
       			      pparms->meshSpacingStatic,
@@ -893,44 +1252,40 @@ void* tree_search_thread_func(void *params){
 			      // ,rgTopNFoundInTree,rgTopNFoundInTreeCosts,
 			      pparms->slowPassTopN,
 			      rgFastpassSorted,
-			      pparms->topN
+			      pparms->topN,
+			      &costCache,
+			      scratch
 			      );
+    matchIdx = pparms->pTree->rgCenterIdx[minNode];
 #if USE_FAST_PASS_FIRST
-    //use the proper leaf node instead of an internal tree node as min
-    int leafIdx;
-    leafIdx = pMinNode->centerIdx;
-    pMinNode = pparms->rgOrigWordLeafNodes[pMinNode->centerIdx];
-    if((pMinNode->centerIdx) != leafIdx){//debug can be removed
-      fprintf(stderr,"Found another error!\n");exit(1);//debug
-    }//debug
     // do full morph on the top N to see if any are better
     for(int topn=0; topn < (pparms->slowPassTopN); ++topn){
       double newMorphCost;
+      double upperBound;//a cost over this wouldn't change anything below
       int trIdx;
 #if TRACK_THE_BEST_N
       //trIdx = rgTopNFoundInTree[topn];
       trIdx = rgFastpassSorted[topn].trIdx;
 #else
-      trIdx = pMinNode->rgTopNTrainingMatches[topn];
+      trIdx = pparms->rgTopNTrainingMatches[(long)matchIdx *
+					   (pparms->slowPassTopN) + topn];
 #endif
       if(trIdx >= 0){
+	upperBound = morphCost;
+#if TRACK_THE_BEST_N
+	if(rgFastpassSorted[topn].cost > upperBound)
+	  upperBound = rgFastpassSorted[topn].cost;
+#endif
 	newMorphCost = 
-	  mobj.getWordMorphCost(imgTest,
-				pparms->rgTrainingImages[trIdx],
-				pparms->bandWidthDP,/*bandWidthDP*/
-				0./*nonDiagonalCostDP*/,
-				pparms->meshSpacingStatic,
-				pparms->numRefinesStatic,
-				pparms->meshDiv,
-				pparms->lengthPenalty);
-	++numMorphCompares;
+	  getCachedMorphCost(&costCache, trIdx, MORPH_COST_FULL,
+			     mobj, prepTest, pparms->rgPreparedTrain[trIdx],
+			     pparms->bandWidthDP, pparms->meshSpacingStatic,
+			     pparms->numRefinesStatic, pparms->meshDiv,
+			     pparms->lengthPenalty, upperBound,
+			     &numMorphCompares, NULL);
 	if(newMorphCost < morphCost){
 	  morphCost = newMorphCost;
-	  pMinNode = pparms->rgOrigWordLeafNodes[trIdx];
-	  if(pMinNode->centerIdx != trIdx){//this debug block can be removed
-	    fprintf(stderr,"Found an error!\n");exit(1);//debug
-	  }//debug
-	  
+	  matchIdx = trIdx;
 	}//end if(newMorphCost < morphCost)
 #if TRACK_THE_BEST_N
 	if(newMorphCost < rgFastpassSorted[topn].cost){
@@ -994,9 +1349,9 @@ void* tree_search_thread_func(void *params){
 #endif //TRACK_THE_BEST_N
 
     pparms->rgCostsMorph[i] = morphCost;
-    pparms->rgMatchNodes[i] = pMinNode;
+    pparms->rgMatchIdxs[i] = matchIdx;
     pparms->rgNumMorphCompares[i] = numMorphCompares;
-    if(0 == strcmp(pparms->rgLabelsTrain[pMinNode->centerIdx].c_str(),
+    if(0 == strcmp(pparms->rgLabelsTrain[matchIdx].c_str(),
 		   pparms->rgLabelsTest[i].c_str())){
       pparms->rgfCorrect[i] = true;
     }
@@ -1010,8 +1365,8 @@ void* tree_search_thread_func(void *params){
 	   pparms->threadNum,tt,i,pparms->rgLabelsTest[i].c_str(),
 	   numTest, 100*(i+1)/numTest, t2.getAccumulated(), morphCost,
 	   numMorphCompares,
-	   pMinNode->centerIdx,
-	   pparms->rgLabelsTrain[pMinNode->centerIdx].c_str(),
+	   matchIdx,
+	   pparms->rgLabelsTrain[matchIdx].c_str(),
 	   (pparms->rgfCorrect[i]) ? "correct" : "WRONG!");
     fflush(stdout);
 
@@ -1029,8 +1384,8 @@ void* tree_search_thread_func(void *params){
 // this version computes distance only from the "center" word of each node
 inline double getClusterNodeDist(HAC_TREE_NODE *node1,
 			  HAC_TREE_NODE *node2,
-			  double *rgCostMatrix, int N){
-  return rgCostMatrix[(node1->centerIdx) * (long)N + (node2->centerIdx)];
+			  const DCostMatrix &costMatrix){
+  return costMatrix.at(node1->centerIdx, node2->centerIdx);
 }
 
 
@@ -1043,7 +1398,7 @@ inline double getClusterNodeDist(HAC_TREE_NODE *node1,
 void mergeClusterNodes(HAC_TREE_NODE **rgHACNodes, int *numHACNodes,
 		       int iMinDist, int jMinDist, double minDist,
 		       std::string *rgLabels,
-		       double *rgTrainCostMatrix, int numTrain, bool fPrint){
+		       const DCostMatrix &trainCostMatrix, bool fPrint){
   HAC_TREE_NODE *pnodei;
   HAC_TREE_NODE *pnodej;
   HAC_TREE_NODE *proot;
@@ -1084,8 +1439,7 @@ void mergeClusterNodes(HAC_TREE_NODE **rgHACNodes, int *numHACNodes,
   for(int jj=0; jj < pnodej->numWordsIncludingDescendants; ++jj){
     double costToCenter;
     costToCenter =
-      rgTrainCostMatrix[pnodej->rgWordsIncludingDescendants[jj]*(long)numTrain+
-			proot->centerIdx];
+      trainCostMatrix.at(pnodej->rgWordsIncludingDescendants[jj], proot->centerIdx);
     if(costToCenter > proot->maxDistFromCenter)
       proot->maxDistFromCenter = costToCenter;
     proot->sumDistFromCenter += costToCenter;
@@ -1109,6 +1463,83 @@ void mergeClusterNodes(HAC_TREE_NODE **rgHACNodes, int *numHACNodes,
 }
 
 
+//Cached nearest neighbor of each HAC node, for the clustering loop.
+//
+//A node's distance to the others is the cost from its center word, and
+//a merge keeps the center of node i, so merging just removes node j and
+//no distances ever change.  rgNN[i] is the index of the closest node
+//after i in rgHACNodes (the first one on ties) and rgNNDist[i] its
+//distance, so the closest pair is found with one pass over the nodes
+//(the same pair the full i,j scan used to find), and after a merge only
+//the nodes whose nearest neighbor was j have to be rescanned.
+typedef struct{
+  HAC_TREE_NODE **rgHACNodes;
+  int numHACNodes;
+  const DCostMatrix *pCostMatrix;
+  int *rgNN;//-1 for the last node
+  double *rgNNDist;//DBL_MAX for the last node
+  int *rgRowsToUpdate;//nodes whose rgNN needs to be found (pool items)
+} HAC_NN_PARMS_T;
+
+void hac_nn_row_func(void *params, int itemIdx, int threadNum){
+  HAC_NN_PARMS_T *pparms;
+  int i, nn;
+  double nnDist;
+  pparms = (HAC_NN_PARMS_T*)params;
+  i = pparms->rgRowsToUpdate[itemIdx];
+  nn = -1;
+  nnDist = DBL_MAX;
+  for(int j=i+1; j < pparms->numHACNodes; ++j){
+    double dist;
+    dist = getClusterNodeDist(pparms->rgHACNodes[i], pparms->rgHACNodes[j],
+			      *(pparms->pCostMatrix));
+    if((-1 == nn) || (dist < nnDist)){
+      nnDist = dist;
+      nn = j;
+    }
+  }
+  pparms->rgNN[i] = nn;
+  pparms->rgNNDist[i] = nnDist;
+}
+
+//find the nearest neighbor of the numRows nodes in parms.rgRowsToUpdate
+void updateHACNearestNeighbors(HAC_NN_PARMS_T &parms, int numRows,
+			       DThreadPool &pool){
+  //the pool only pays off when there is a reasonable amount of work
+  if(((long)numRows * parms.numHACNodes < 20000) ||
+     (pool.getNumThreads() < 2)){
+    for(int rr=0; rr < numRows; ++rr)
+      hac_nn_row_func((void*)&parms, rr, 0);
+  }
+  else
+    pool.run(numRows, hac_nn_row_func, (void*)&parms);
+}
+
+//update the nearest neighbor cache after mergeClusterNodes() has merged
+//iMinDist and jMinDist (and removed jMinDist from rgHACNodes).  Center
+//linkage keeps iMinDist's center, so no distance changes and only the rows
+//whose nearest neighbor was jMinDist need an O(n) rescan.  How many rows
+//that is depends on the data; it can be nearly all of them.
+void updateHACNearestNeighborsAfterMerge(HAC_NN_PARMS_T &parms,
+					 int numHACNodes, int jMinDist,
+					 DThreadPool &pool){
+  int numRows;
+  parms.numHACNodes = numHACNodes;
+  for(int k=jMinDist; k < numHACNodes; ++k){
+    parms.rgNN[k] = parms.rgNN[k+1];
+    parms.rgNNDist[k] = parms.rgNNDist[k+1];
+  }
+  numRows = 0;
+  for(int k=0; k < numHACNodes; ++k){
+    if(parms.rgNN[k] == jMinDist)
+      parms.rgRowsToUpdate[numRows++] = k;
+    else if(parms.rgNN[k] > jMinDist)
+      --(parms.rgNN[k]);
+  }
+  updateHACNearestNeighbors(parms, numRows, pool);
+}
+
+
 void printHACTree(HAC_TREE_NODE *node, int depth, std::string *rgLabels,
 		    int num){
   // print this node
@@ -1209,909 +1640,1061 @@ int traverseTreeForTrainingWord(int trainIdxToFind, HAC_TREE_NODE *node,
 				     minDistChild, cost);
 }
 
-int main(int argc, char **argv);
+//cluster the training words (replaying and recording the merges in
+//stHACMergeFile if it isn't empty), choose the key words, and compute the
+//key-word feature vectors of every node.  rgHACNodes[0] is the root.
+//*pMergeChecksum is set to the DHACMergeJournal::getChecksum() of the merge
+//file (0 if there isn't one)
+void buildHACTree(int numTrain, const DMorphInkPrepared *rgPreparedTrain,
+		  std::string *rgLabelsTrain,
+		  const DCostMatrix &trainCostMatrix, D_uint64 costChecksum,
+		  int *rgLevelSizes, int numLevels,
+		  const char *stHACMergeFile, int numThreads, DTimer &t1,
+		  HAC_TREE_NODE ***prgHACNodes,
+		  HAC_TREE_NODE ***prgOrigWordLeafNodes,
+		  int **prgKeyWordIdxs, int *pNumKeyWords,
+		  D_uint64 *pMergeChecksum){
+  HAC_TREE_NODE ***rgLevelHACNodes;
+  rgLevelHACNodes = new HAC_TREE_NODE**[numLevels];
+  D_CHECKPTR(rgLevelHACNodes);
+  for(int lvl=0; lvl < numLevels; ++lvl){
+    rgLevelHACNodes[lvl] = new HAC_TREE_NODE*[rgLevelSizes[lvl]];
+    D_CHECKPTR(rgLevelHACNodes[lvl]);
+  }
 
-int main(int argc, char **argv){
-  char stPathIn[1025];
-  char stOutfile[1025];
-  char stTrainCostMatrix[1025];//file to load or write
-  char stTmp[1025];
-  int trainFirst, trainLast;
-  int testFirst, testLast;
-  int numTrain, numTest;
-  DImage *rgTrainingImages;
-  DImage testImage;
-  double *rgTrainCostMatrix;
-  double *rgCostsMorph;
-  DTimer t1;
-  std::string *rgLabelsTrain;
-  std::string *rgLabelsTest;
-  WORDWARP_THREAD_PARMS *rgThreadParms;
-  TRAIN_NXN_THREAD_PARMS *rgTrainThreadParms;
-  TREE_SEARCH_THREAD_PARMS *rgTreeThreadParms;
-  int numThreads = 1;
-  double weightMovement = 0.;
-  double lengthPenalty = 0.;
-  int meshSpacingStatic;
-  int numRefinesStatic;
-  double meshDiv;
-  DMorphInk mobj;
-#if DP_ONLY
-  mobj.fOnlyDoCoarseAlignment = true;
-#endif
-  int bandWidth = 15;
-  double alpha = 1.0;
-  char stHACMergeFile[2048];//list of nodes to merge (to avoid recalculating)
-  FILE *fmerge = NULL;
-  int slowPassTopN = 10;
-  int topNMatches = 10;// top N matches to save for N-gram post-processing
-  TOPN_MATCHES_T *rgTopNMatches;//top N matches for all test words
-#ifndef D_NOTHREADS
-  pthread_t *rgThreadID;
-#else
-  numThreads = 1;
-#endif
 
+  //start with each word as its own node
+  HAC_TREE_NODE **rgHACNodes;
+  rgHACNodes = new HAC_TREE_NODE*[numTrain];
+  int numHACNodes;
+  numHACNodes = numTrain;
+  for(int i=0; i < numHACNodes; ++i){
+    rgHACNodes[i] = new HAC_TREE_NODE;
+  }
+  for(int i=0; i < numTrain; ++i){
+    //    rgHACNodes[i]->clustID = i;
+    rgHACNodes[i]->numWordsInClustAtThisLevel = 1;
+    rgHACNodes[i]->numWordsIncludingDescendants = 1;
+    rgHACNodes[i]->rgWordsInClustAtThisLevel = new int[1];
+    rgHACNodes[i]->rgWordsInClustAtThisLevel[0] = i;
+    rgHACNodes[i]->rgWordsIncludingDescendants = new int[1];
+    rgHACNodes[i]->rgWordsIncludingDescendants[0] = i;
 
-  if((argc < 18)||(argc > 19)){
-    fprintf(stderr, "usage: %s <dataset_path> <trainCostMatrix> <first_training_num> <last_training_num> <first_test_num> <last_test_num> <weightMovement=0.> <lengthPenalty=0.> <numThreads=-1> <meshSpacingStatic=-1> <numRefinesStatic=-1> <meshDiv=4> <SakoeChibaBandwidth=15> <alpha=1.0> <slowPassTopN=10> <topNmatches=10> <output_file> [mergeFileHAC]\n",
-	    argv[0]);
-    exit(1);
+    rgHACNodes[i]->centerIdx = i;
+    if(rgPreparedTrain[i].h != 0.)
+      rgHACNodes[i]->centerAspectRatio_w_div_h = 
+	rgPreparedTrain[i].w / rgPreparedTrain[i].h;
+    else
+      rgHACNodes[i]->centerAspectRatio_w_div_h = 0.;
   }
 
-  sprintf(stPathIn, "%s", argv[1]);
-  sprintf(stTrainCostMatrix, "%s", argv[2]);
-  trainFirst = atoi(argv[3]);
-  trainLast = atoi(argv[4]);
-  testFirst = atoi(argv[5]);
-  testLast = atoi(argv[6]);
-  weightMovement = atof(argv[7]);
-  lengthPenalty =  atof(argv[8]);
-  numThreads = atoi(argv[9]);
-  meshSpacingStatic = atoi(argv[10]);
-  numRefinesStatic = atoi(argv[11]);
-  meshDiv = atof(argv[12]);
-  bandWidth = atoi(argv[13]);
-  alpha = atof(argv[14]);
-  slowPassTopN = atoi(argv[15]);
-  topNMatches = atoi(argv[16]);
-  sprintf(stOutfile, "%s", argv[17]);
-  stHACMergeFile[0] = '\0';
-  if(argc > 18)
-    sprintf(stHACMergeFile, "%s", argv[18]);
 
-  if((meshDiv < 1) || (meshDiv > 50)){
-    fprintf(stderr,"meshDiv should be 1.0 - 50.0 (default=4). was %lf\n",
-	    meshDiv);
-    exit(1);
-  }
-
-  if((bandWidth < 2) || (bandWidth > 50)){
-    fprintf(stderr,"bandWidth should be 2-50 (default=15). was %d\n",
-	    bandWidth);
-    exit(1);
-  }
-
-  if((alpha < 0.1) || (alpha > 5.0)){
-    fprintf(stderr,"alpha should be 0.1-5.0. was %lf\n",alpha);
-    exit(1);
-  }
-  if((meshSpacingStatic==0) ||
-     ((meshSpacingStatic!=-1)&&(meshSpacingStatic>200))){
-    fprintf(stderr,"meshSpacingStatic expected to be 1-200 or -1! (was %d)\n",
-	    meshSpacingStatic);
-    exit(1);
-  }
-  if((numRefinesStatic < -1) || (numRefinesStatic > 4)){
-    fprintf(stderr,"numRefinesStatic expected to be 0-4 or -1! (was %d)\n",
-	    numRefinesStatic);
-    exit(1);
-  }
-
-  if((numThreads!=-1) && ((numThreads<1)||(numThreads>64))){
-    fprintf(stderr,"numThreads(%d) should be 1-64, or -1 to use all processors\n",numThreads);
-    exit(1);
-  }
-  if((weightMovement < 0.) || (weightMovement > 1.)){
-    fprintf(stderr,"weightMovement should be 0. to 1. (was %lf)\n",
-	    weightMovement);
-    exit(1);
-  }
-
-  if(numThreads < 1){
-#ifndef D_NOTHREADS
-    numThreads = getNumCPUs();
-#else
-    numThreads = 1;
-#endif
-  }
-
-#ifndef D_NOTHREADS
-  rgThreadID = new pthread_t[numThreads];
-  D_CHECKPTR(rgThreadID);
-#else
-  numThreads = 1;
-#endif
-
-  rgThreadParms = (WORDWARP_THREAD_PARMS *)malloc(sizeof(WORDWARP_THREAD_PARMS)*
-						  numThreads);
-  D_CHECKPTR(rgThreadParms);
-  rgTrainThreadParms =
-    (TRAIN_NXN_THREAD_PARMS*)malloc(sizeof(TRAIN_NXN_THREAD_PARMS)*numThreads);
-  D_CHECKPTR(rgTrainThreadParms);
-  rgTreeThreadParms =
-    (TREE_SEARCH_THREAD_PARMS*)malloc(sizeof(TREE_SEARCH_THREAD_PARMS)*
-				      numThreads);
-  D_CHECKPTR(rgTreeThreadParms);
-  
-  numTrain = trainLast - trainFirst + 1;
-  numTest = testLast - testFirst + 1;
-
-  if(numTrain < 1){
-    fprintf(stderr, "numTrain must be greater than 0\n");
-    exit(1);
-  }
-  if(numTest < 1){
-    fprintf(stderr, "numTest must be greater than 0\n");
-    exit(1);
+  HAC_TREE_NODE **rgOrigWordLeafNodes;
+  rgOrigWordLeafNodes = new HAC_TREE_NODE*[numTrain];
+  D_CHECKPTR(rgOrigWordLeafNodes);
+  for(int tr=0; tr < numTrain; ++tr){
+    rgOrigWordLeafNodes[tr] = rgHACNodes[tr];
   }
 
-  rgTrainingImages = new DImage[numTrain];
-  D_CHECKPTR(rgTrainingImages);
-  rgLabelsTrain = new std::string[numTrain];
-  D_CHECKPTR(rgLabelsTrain);
-  rgLabelsTest = new std::string[numTest];
-  D_CHECKPTR(rgLabelsTest);
-  rgCostsMorph = (double*)malloc(sizeof(double)*numTest);
-  D_CHECKPTR(rgCostsMorph);
-
-
-  rgTopNMatches = new TOPN_MATCHES_T[(long)numTest*topNMatches];
-  D_CHECKPTR(rgTopNMatches);
-  
-  t1.start();
-  int maxTrainWidth = 0;
-  int maxTrainHeight = 0;
-  printf("loading training data....\n");
+  int curLevel;
+  curLevel = numLevels-1;
 
-  for(int tt=trainFirst, i=0; tt <= trainLast; ++tt,++i){
-    // sprintf(stTmp,"%s/w_%08d.pgm",stPathIn,tt);
-    sprintf(stTmp,"%s/thresh_w_%08d.pgm",stPathIn,tt);
-    if(!rgTrainingImages[i].load(stTmp)){
-      fprintf(stderr,"couldn't load training image '%s'\n",stTmp);
-      exit(1);
-    }
-    std::string strTmp;
-    strTmp = rgTrainingImages[i].getPropertyVal(std::string("label"));
-    if(strTmp.size()<1){//couldn't find label property, try comments
-      if(3 != rgTrainingImages[i].getNumComments()){
-	fprintf(stderr, "image '%s' needs 'label' property or else comments should be: #threshval\\n#label\\n#pageNum\\n",stTmp);
-	exit(1);
-      }
-      rgLabelsTrain[i] = rgTrainingImages[i].getCommentByIndex(1);
+  //Replay the merges already in the merge file (if one was given), then
+  //record each new merge in it so an interrupted run can pick up where it
+  //left off.  The merge file is a binary DHACMergeJournal.  Old text merge
+  //files ("numTrain N" then a "lineNo iMerge jMerge *" line per merge) are
+  //still read, and are converted to a journal as their merges are replayed.
+  DHACMergeJournal mergeJournal;
+  if(0 != strlen(stHACMergeFile)){
+    std::vector<long int> vectMergeIJs;
+    long int numHACMergeIdxsInFile = 0;
+    char stTmpString[1024];
+    char stConvertedFile[2060];//journal written while replaying a text file
+    long int numTrainInFile = 0;
+    long int lineNo = 0;
+    bool fTextFile = false;
+    FILE *fmerge;
+    fmerge = fopen(stHACMergeFile, "rb");
+    if((NULL != fmerge) && DHACMergeJournal::isMergeJournal(stHACMergeFile)){
+      fclose(fmerge);
+      fmerge = NULL;
     }
-    else
-      rgLabelsTrain[i] = strTmp;
-    strTmp =
-      rgTrainingImages[i].getPropertyVal(std::string("textlineExtractionOK"));
-    if(strTmp.size()>0){
-      if(0 == strcmp("0",strTmp.c_str())){
-	fprintf(stderr,"textlineExtractionOK=0 for training image '%s'\n",
-		stTmp);
+    if(fmerge){//an old text merge file, so read the merges
+      printf("reading merge file '%s'...\n",stHACMergeFile);
+      if(2 != fscanf(fmerge,"%s%ld",stTmpString, &numTrainInFile)){
+	fprintf(stderr,"ERROR! expect 'numTrain %%ld\\n' in merge file '%s'\n",
+		stHACMergeFile);
 	exit(1);
       }
-    }
-    if(rgTrainingImages[i].width() > maxTrainWidth)
-      maxTrainWidth = rgTrainingImages[i].width();
-    if(rgTrainingImages[i].height() > maxTrainHeight)
-      maxTrainHeight = rgTrainingImages[i].height();
-  }
-  
-
-  t1.stop();
-  printf("took %.02f seconds\n", t1.getAccumulated());
-
-  printf("numTrain=%d\n",numTrain);
-
-  printf("allocating %ld bytes for rgTrainCostMatrix\n",
-	 sizeof(double)*numTrain*(long)numTrain);
-  rgTrainCostMatrix = new double[numTrain*(long)numTrain];
-  D_CHECKPTR(rgTrainCostMatrix);
-
-  // load the training NxN cost matrix
-  FILE *ftrin;
-  ftrin = fopen(stTrainCostMatrix,"rb");
-  if(ftrin){
-    char *stHeaderText;
-    double rgHeader[128];//firstTrain,lastTrain, then whatever text
-    int numTrainTmp;
-    int firstTrainTmp, lastTrainTmp;
-
-    printf("loading '%s' into rgTrainCostMatrix\n",stTrainCostMatrix);
-    fflush(stdout);
-    if(128!=fread(rgHeader,sizeof(double),128,ftrin)){
-      fprintf(stderr,"fread did not return 128 header doubles\n");
-      exit(1);
-    }
-    t1.start();
-    firstTrainTmp = (int)(rgHeader[0]);
-    lastTrainTmp = (int)(rgHeader[1]);
-    numTrainTmp = lastTrainTmp-firstTrainTmp+1;
-    stHeaderText = (char*)(&rgHeader[2]);
-    stHeaderText[128*sizeof(double)-1]='\0';
-    if((trainFirst < firstTrainTmp)||(trainLast > lastTrainTmp)){
-      fprintf(stderr,"requested #%d-#%d as training, but matrix file '%s' only has costs for #%d-%d\n",trainFirst, trainLast, stTrainCostMatrix,
-	      firstTrainTmp, lastTrainTmp);
-      exit(1);
-    }
-
-    //skip forward in file if necessary
-    long int skipForward = 0;
-    skipForward = trainFirst - firstTrainTmp;
-    if(skipForward > 0){
-      printf("skipForward=%ld skipping %ld doubles\n",skipForward,
-	     skipForward*(long)numTrainTmp);
-      if(-1==fseek(ftrin,sizeof(double)*(skipForward*(long)numTrainTmp+
-					 skipForward),
-		   SEEK_CUR)){
-	fprintf(stderr,"error fseeking in matrix file\n");
+      if(0 != strcmp(stTmpString,"numTrain")){
+	fprintf(stderr,"ERROR!!! expect 'numTrain %%ld\\n' in file '%s'\n",
+		stHACMergeFile);
 	exit(1);
       }
-    }
-    if(numTrainTmp == numTrain){//row sizes are the same, load entire block
-      if(numTrain*(long)numTrain != (long)fread(rgTrainCostMatrix,sizeof(double),
-					       numTrain*(long)numTrain,ftrin)){
-	fprintf(stderr,"error reading the matrix as a block\n");
+      if(numTrainInFile != (long)numTrain){
+	fprintf(stderr,"ERROR!!! numTrain=%d but it is %ld in merge file '%s'\n",numTrain, numTrainInFile, stHACMergeFile);
 	exit(1);
       }
-    }
-    else{//row sizes don't match, read a row at a time
-      for(int tr=0; tr < numTrain; ++tr){
-	if((long)numTrain!=(long)fread(&(rgTrainCostMatrix[tr*(long)numTrain]),
-				sizeof(double), numTrain,ftrin)){
-	  fprintf(stderr,"error reading a line from the matrix\n");
+      while(!feof(fmerge)){
+	long int mergeI, mergeJ;
+	int numRet;
+	numRet=fscanf(fmerge,"%ld%ld%ld%s",&lineNo,&mergeI,&mergeJ,stTmpString);
+	if(4!=numRet){
+	  if(feof(fmerge))//end of file
+	    break;
+	  fprintf(stderr,
+		  "ERROR!! on line %ld of mergefile '%s'\n",
+		  numHACMergeIdxsInFile+2, stHACMergeFile);
 	  exit(1);
 	}
-	if(-1==fseek(ftrin,sizeof(double)*(long)(numTrainTmp-numTrain),
-		     SEEK_CUR)){
-	  fprintf(stderr,"error fseeking to next line in matrix file\n");
+	if(lineNo != numHACMergeIdxsInFile){
+	  fprintf(stderr,"expect lineNo=%ld but was %ld on line %ld of '%s'\n",
+		  numHACMergeIdxsInFile, lineNo, numHACMergeIdxsInFile+2,
+		  stHACMergeFile);
+	  exit(1);
+	}
+	if(0 != strcmp(stTmpString,"*")){
+	  fprintf(stderr,"expect '*' at end of line %ld in merge file '%s'\n",
+		  numHACMergeIdxsInFile+2, stHACMergeFile);
 	  exit(1);
 	}
+	vectMergeIJs.push_back(mergeI);
+	vectMergeIJs.push_back(mergeJ);
+	++numHACMergeIdxsInFile;
       }
+      fclose(fmerge);
+      fmerge = NULL;
+      fTextFile = true;
+      sprintf(stConvertedFile, "%s.partial", stHACMergeFile);
+      remove(stConvertedFile);
+      if(!mergeJournal.open(stConvertedFile, numTrain, costChecksum))
+	exit(1);
     }
-    t1.stop();
-    printf("successfully loaded the matrix (took %.2f seconds)\n",
-	   t1.getAccumulated());
-    
-  }
-  else{
-    printf("couldn't find matrix file '%s'\n",stTrainCostMatrix);
-
-    t1.start();
-    printf("doing NxN comparison of training words\n");
-    for(int tnum=numThreads-1; tnum >=0; --tnum){//launch threads reverse order
-      rgTrainThreadParms[tnum].numThreads = numThreads;
-      rgTrainThreadParms[tnum].threadNum = tnum;
-      rgTrainThreadParms[tnum].rgTrainingImages = rgTrainingImages;
-      rgTrainThreadParms[tnum].numTrain = numTrain;
-      rgTrainThreadParms[tnum].rgTrainCostMatrix = rgTrainCostMatrix;
-      rgTrainThreadParms[tnum].weightMovement = weightMovement;
-      rgTrainThreadParms[tnum].lengthPenalty = lengthPenalty;
-      rgTrainThreadParms[tnum].meshSpacingStatic = meshSpacingStatic;
-      rgTrainThreadParms[tnum].numRefinesStatic = numRefinesStatic;
-      rgTrainThreadParms[tnum].meshDiv = meshDiv;
-      rgTrainThreadParms[tnum].bandWidthDP = bandWidth;
-#ifdef D_NOTHREADS
-      word_morphing_NxN_training_thread_func(rgTrainThreadParms);
-#else
-      if(0 == tnum){//don't spawn thread zero. use the current thread.
-	word_morphing_NxN_training_thread_func(rgTrainThreadParms);
+    else{
+      if(!mergeJournal.open(stHACMergeFile, numTrain, costChecksum)){
+	fprintf(stderr,"ERROR! couldn't use merge file '%s'\n",
+		stHACMergeFile);
+	exit(1);
       }
-      else{//spawn all other threads besides zero
-	if(0 !=pthread_create(&rgThreadID[tnum], NULL,
-			      word_morphing_NxN_training_thread_func,
-			      &rgTrainThreadParms[tnum])){
-	  fprintf(stderr,"failed to spawn thread #%d. Exiting.\n",tnum);
-	  exit(1);
-	}
+      if(mergeJournal.getNumMerges() > 0)
+	printf("reading merge file '%s'...\n",stHACMergeFile);
+      else
+	printf("merge file '%s' not found, so creating it...\n",
+	       stHACMergeFile);
+      for(int ll=0; ll < mergeJournal.getNumMerges(); ++ll){
+	vectMergeIJs.push_back(mergeJournal.getMerges()[ll].i);
+	vectMergeIJs.push_back(mergeJournal.getMerges()[ll].j);
       }
-#endif
+      numHACMergeIdxsInFile = mergeJournal.getNumMerges();
     }
-#ifndef D_NOTHREADS
-    // wait for all threads to finish
-    for(int tnum = 1; tnum < numThreads; ++tnum){
-      if(pthread_join(rgThreadID[tnum],NULL)){
-	fprintf(stderr, "Thread #%d failed to join. Exiting.\n", tnum);
+    // now merge them (the journal was checked by open(), but not text)
+    for(long int ll=0; ll < numHACMergeIdxsInFile; ++ll){
+      long int mergeI, mergeJ;
+      mergeI = vectMergeIJs[ll*2];
+      mergeJ = vectMergeIJs[ll*2+1];
+      if((mergeI < 0) || (mergeJ <= mergeI) || (mergeJ >= numHACNodes)){
+	fprintf(stderr,"ERROR!!! merge %ld (%ld,%ld) in file '%s' is invalid "
+		"with %d nodes left\n", ll, mergeI, mergeJ, stHACMergeFile,
+		numHACNodes);
+	exit(1);
+      }
+      if(fTextFile &&
+	 (!mergeJournal.append(mergeI, mergeJ,
+			       getClusterNodeDist(rgHACNodes[mergeI],
+						  rgHACNodes[mergeJ],
+						  trainCostMatrix))))
 	exit(1);
+      mergeClusterNodes(rgHACNodes, &numHACNodes, mergeI, mergeJ,
+			999999./*parm ignored*/,
+			rgLabelsTrain, trainCostMatrix, false);
+      if((curLevel>=0) && (numHACNodes == rgLevelSizes[curLevel])){
+	printf("copying %d nodes for level %d\n",numHACNodes,curLevel);
+	for(int nd=0; nd < numHACNodes; ++nd){
+	  printf(" %d=%d(%s)",nd,rgHACNodes[nd]->centerIdx,
+		 rgLabelsTrain[rgHACNodes[nd]->centerIdx].c_str());
+	  rgLevelHACNodes[curLevel][nd] = rgHACNodes[nd];
+	}
+	printf("\n");
+	--curLevel;
       }
     }
-#endif
-    // now mirror the upper half of the matrix
-    printf("mirroring the upper half of the matrix...");fflush(stdout);
-    for(int r=0;r < numTrain; ++r){
-      for(int c=0; c < r; ++c){
-    	rgTrainCostMatrix[r*(long)numTrain+c] =
-	  rgTrainCostMatrix[c*(long)numTrain+r];
+    vectMergeIJs.clear();
+    if(fTextFile){
+      mergeJournal.close();
+      if((0 != rename(stConvertedFile, stHACMergeFile)) ||
+	 (!mergeJournal.open(stHACMergeFile, numTrain, costChecksum))){
+	fprintf(stderr,"ERROR! couldn't replace text merge file '%s' with "
+		"'%s'\n", stHACMergeFile, stConvertedFile);
+	exit(1);
       }
+      printf("converted text merge file '%s' to a binary merge journal\n",
+	     stHACMergeFile);
     }
+    if((numHACNodes > 1) && (numHACMergeIdxsInFile > 0))
+      printf("there are still %d HAC nodes... appending to file '%s'\n",
+	     numHACNodes, stHACMergeFile);
+  }
 
-  //   for(int r=0,idx=0;r < numTrain; ++r){
-  //     for(int c=0; c < numTrain; ++c,++idx){
-  // 	printf(" %9.2lf",rgTrainCostMatrix[idx]);
-  //     }
-  //     printf("\n");
-  //   }
-  // }
-
-
-
-
-    double elapsedTime;
-    t1.stop();
-    elapsedTime = t1.getAccumulated();
-    printf("NxN comparison of training data took %.02f seconds\n", t1.getAccumulated());
-    long int numCompares = (numTrain*(long)numTrain-numTrain)/2;
-    printf("(n*n-n)/2=%ld comparisons = %.6lf sec per compare\n", numCompares,
-	   t1.getAccumulated()/numCompares);
-
-    // now save the cost matrix
-    printf("SAVING matrix file '%s'\n",stTrainCostMatrix);
-    t1.start();
-    ftrin = fopen(stTrainCostMatrix,"wb");
-    if(!ftrin){
-      fprintf(stderr,"couldn't open '%s' to save training cost matrix\n",
-	      stTrainCostMatrix);
-      exit(1);
+  //cluster until all nodes are combined.  Each node's nearest neighbor is
+  //found once and kept up to date, so a merge only rescans the rows whose
+  //nearest neighbor was the removed node.  That is close to O(n^2) overall
+  //when few nodes share a nearest neighbor, but it is still O(n^3) in the
+  //worst case (a "hub" word that is the nearest neighbor of most others
+  //forces most rows to be rescanned every time it is removed)
+  DThreadPool hacPool(numThreads);
+  HAC_NN_PARMS_T hacNNParms;
+  hacNNParms.rgHACNodes = rgHACNodes;
+  hacNNParms.numHACNodes = numHACNodes;
+  hacNNParms.pCostMatrix = &trainCostMatrix;
+  hacNNParms.rgNN = new int[numTrain];
+  D_CHECKPTR(hacNNParms.rgNN);
+  hacNNParms.rgNNDist = new double[numTrain];
+  D_CHECKPTR(hacNNParms.rgNNDist);
+  hacNNParms.rgRowsToUpdate = new int[numTrain];
+  D_CHECKPTR(hacNNParms.rgRowsToUpdate);
+  for(int i=0; i < numHACNodes; ++i)
+    hacNNParms.rgRowsToUpdate[i] = i;
+  updateHACNearestNeighbors(hacNNParms, numHACNodes, hacPool);
+  while(numHACNodes > 1){
+    int iMinDist, jMinDist;
+    double minDist;
+    iMinDist = 0;
+    for(int i=1; i < numHACNodes-1; ++i){
+      if(hacNNParms.rgNNDist[i] < hacNNParms.rgNNDist[iMinDist])
+	iMinDist = i;
     }
-    double rgHeader[128];//firstTrain,lastTrain, then whatever text
-    char *stHeaderText;
-    char stText[4096];
-    rgHeader[0] = trainFirst;
-    rgHeader[1] = trainLast;
-    stHeaderText = (char*)&(rgHeader[2]);
-    sprintf(stText,"\n%ld compares in %.2lf seconds\n"
-	    "trainFirst=%d trainLast=%d\n"
-	    "weightMovement=%.2lf lengthPenalty=%.2lf meshSpacingStatic=%d numRefinesStatic=%d meshDiv=%.2lf bandWidth=%d\ndir=%s\n",
-	    numCompares, elapsedTime, trainFirst, trainLast, weightMovement,
-	    lengthPenalty, meshSpacingStatic, numRefinesStatic,
-	    meshDiv, bandWidth, stPathIn);
-    for(int i=2; i < 128; ++i)
-      rgHeader[i] = 0.;
-    strncpy(stHeaderText,stText,126*sizeof(double));
-    stHeaderText[126*sizeof(double)-1]='\0';
-    if(128 != fwrite(rgHeader,sizeof(double),128,ftrin)){
-      fprintf(stderr,"couldn't fwrite header to '%s'\n",stTrainCostMatrix);
-      exit(1);
+    jMinDist = hacNNParms.rgNN[iMinDist];
+    minDist = hacNNParms.rgNNDist[iMinDist];
+    //now merge the two clusters that are nearest each other (iMinDist,jMinDist)
+    //the function will remove jMinDist and shorten the array length by 1
+    mergeClusterNodes(rgHACNodes, &numHACNodes, iMinDist, jMinDist, minDist,
+		      rgLabelsTrain, trainCostMatrix, true);
+    updateHACNearestNeighborsAfterMerge(hacNNParms, numHACNodes, jMinDist,
+					hacPool);
+    if(mergeJournal.isOpen()){//save to merge file
+      if(!mergeJournal.append(iMinDist, jMinDist, minDist))
+	fprintf(stderr,"WARNING!!! couldn't add merge to '%s'\n",
+		stHACMergeFile);
     }
-    if(numTrain*(long)numTrain !=
-       (int)fwrite(rgTrainCostMatrix, sizeof(double),numTrain*(long)numTrain,
-		   ftrin)){
-      fprintf(stderr,"couldn't fwrite the cost matrix block to '%s'\n",
-	      stTrainCostMatrix);
-      exit(1);
+    if((curLevel>=0) && (numHACNodes == rgLevelSizes[curLevel])){
+      printf("copying %d nodes for level %d\n",numHACNodes,curLevel);
+      for(int nd=0; nd < numHACNodes; ++nd){
+	printf(" %d=%d(%s)",nd,rgHACNodes[nd]->centerIdx,
+	       rgLabelsTrain[rgHACNodes[nd]->centerIdx].c_str());
+	rgLevelHACNodes[curLevel][nd] = rgHACNodes[nd];
+      }
+      printf("\n");
+      --curLevel;
     }
-    fclose(ftrin);
-    t1.stop();
-    printf("finished writing the cost matrix (took %.2f seconds)\n",
-	   t1.getAccumulated());
-	   
+    if(0 == numHACNodes%10)
+      printf("   (total elapsed time so far for clustering is %.2lf seconds\n",
+	     t1.getAccumulated());
   }
-  // printf("TRAINING WORDS:");
-  // for(int i=0; i < numTrain; ++i){
-  //   if(0==(i%10))
-  //     printf("\n");
-  //   printf(" %d(%s)",i,rgLabelsTrain[i].c_str());
-  // }
-  // printf("\n");
-  // //debug: print the cost matrix
-#if 0
-  for(long int r=0,idx=0;r < numTrain; ++r){
-    for(int c=0; c < numTrain; ++c,++idx){
-      printf(" %9.2lf",rgTrainCostMatrix[idx]);
-    }
-    printf("\n");
+  t1.stop();
+  printf("clustering took %.2lf seconds\n", t1.getAccumulated());
+  delete [] hacNNParms.rgNN;
+  delete [] hacNNParms.rgNNDist;
+  delete [] hacNNParms.rgRowsToUpdate;
+  (*pMergeChecksum) = mergeJournal.isOpen() ? mergeJournal.getChecksum() : 0;
+  mergeJournal.close();
+
+  //count up the number of descendant tree nodes for each node in the tree
+  printf("counting number of descendant tree nodes for each node in tree...");
+  t1.start();
+  for(int i=0; i < numTrain; ++i){
+    HAC_TREE_NODE *np;
+    np = rgOrigWordLeafNodes[i];
+    while(np != NULL){
+      np = np->pParent;
+      if(np != NULL){
+	np->numDescendantTreeNodes += 1;
+      }
+    }
   }
-#endif  
+  t1.stop();
+  printf("(%.2lf seconds)\n", t1.getAccumulated());
 
-  
+  //use the first level of HAC nodes as key word images for pseudo-features
+  int numKeyWords;
+  int *rgKeyWordIdxs;
+  numKeyWords = rgLevelSizes[0];
+  rgKeyWordIdxs = new int[numKeyWords];
+  D_CHECKPTR(rgKeyWordIdxs);
+#if DONT_USE_SMART_KEY_IMAGE_SELECTION
+  for(int kk=0; kk < numKeyWords; ++kk){
+    rgKeyWordIdxs[kk] = rgLevelHACNodes[0][kk]->centerIdx;
+    printf("rgKeyWordIdxs[%d]=%d(%s)\n",kk,rgKeyWordIdxs[kk],
+	   rgLabelsTrain[rgLevelHACNodes[0][kk]->centerIdx].c_str());
+  }
+  for(int kk=0; kk < numKeyWords; ++kk){
+    printf("I%d [color=red];\n",rgLevelHACNodes[0][kk]->clustID);
+  }
+#else /*smart selection of key images*/
+  {
+    int maxNumSamples = 200;
+    int numSamples = 0;
+    int *rgSampleIdxs;
+    rgSampleIdxs = new int[maxNumSamples];
+    D_CHECKPTR(rgSampleIdxs);
+    memset(rgSampleIdxs,0, numSamples*sizeof(int));
 
+ #if USE_MOST_FREQUENT_LABELS_AS_SAMPLES
+    std::map<std::string,int> mapLabelCounts;
+    for(int i=0; i < numTrain; ++i){
+      mapLabelCounts[rgLabelsTrain[i]] += 1;
+    }
+    die();
+    abort();
+ #else
+    std::map<std::string, int> mapLabelsSampled;
+    std::map<std::string, int>::iterator mapiter;
+    std::string strTmp;
+    mapLabelsSampled.clear();
+    for(int i=0; (i < numTrain) && (numSamples < maxNumSamples); ++i){
+      mapiter = mapLabelsSampled.find(rgLabelsTrain[i]);
+      if(mapLabelsSampled.end() == mapiter){
+	strTmp = rgLabelsTrain[i];
+	mapLabelsSampled[strTmp] = 1;
+	rgSampleIdxs[numSamples] = i;
+	printf(" sample%d=rgLabelsTrain[%d](%s)\n",numSamples,i,
+	       rgLabelsTrain[i].c_str());
+	++numSamples;
+      }
+    }
+ #endif   
+    //rgKeyWordIdxs[0]: select sample with greatest variance in dist to other
+    //sample images (for each row k, find mean_k then var_k. rgKeyWordIdxs[0]
+    //is the k for which var_k is highest
+    double bestVar;
+    int bestVarSampleIdx;
+    bestVar = -1.;
+    bestVarSampleIdx = 0;
+    
+    double *rgDists;
+    rgDists = new double[numSamples];
+    D_CHECKPTR(rgDists);
+    for(int samp=0; samp<numSamples; ++samp){
+      double sampDistVar;//variance of distances from samp to other samples (ss)
+      for(int ss=0,distnum=0; ss<numSamples; ++ss){
+	if(ss==samp)
+	  continue;
+	rgDists[distnum] =
+	  trainCostMatrix.at(rgSampleIdxs[ss], rgSampleIdxs[samp]);
+	++distnum;
+      }
+      sampDistVar = DMath::variance(rgDists,numSamples-1);
+      printf(" variance%d=%.2lf\n",samp,sampDistVar);
+      if(sampDistVar > bestVar){
+	bestVar = sampDistVar;
+	bestVarSampleIdx = samp;
+      }
+    }
+    rgKeyWordIdxs[0] = rgSampleIdxs[bestVarSampleIdx];
+    printf("***rgKeyWordIdxs[0]=samp%d trainIdx=%d(%s)  variance=%.2lf\n",
+	   bestVarSampleIdx, rgKeyWordIdxs[0],
+	   rgLabelsTrain[rgKeyWordIdxs[0]].c_str(), bestVar);
 
+    //rgKeyWordIdxs[1..K]: select sample image, samp, that increases variance
+    //for all other sample image vectors when samp is used as key image k
+    bool *rgfSampUsed;
+    rgfSampUsed = new bool[numSamples];
+    D_CHECKPTR(rgfSampUsed);
+    double **rgFV_data;
+    rgFV_data = new double*[numSamples];
+    D_CHECKPTR(rgFV_data);
+    for(int ss=0; ss < numSamples; ++ss){
+      rgFV_data[ss] = new double[numSamples];
+      D_CHECKPTR(rgFV_data[ss]);
+      rgFV_data[ss][0] = trainCostMatrix.at(rgKeyWordIdxs[0], rgSampleIdxs[ss]);
+      rgfSampUsed[ss] = false;
+    }
+    rgfSampUsed[bestVarSampleIdx] = true;
+    for(int k=1; k < numKeyWords; ++k){//choose the rest of the keywords
+      int bestSampIdx;
+      double bestSampFVvar;//variance in distance in feature space
+      DFeatureVector fvMeanTmp;
+      DFeatureVector fvTmp;
+      bestSampIdx = -1;
+      bestSampFVvar = 0.;
 
+      fvTmp.setData_dbl(rgFV_data[0],k+1,1,true,false/*no copy*/,true);
+      fvMeanTmp.setData_dbl(rgFV_data[0],k+1,1,true,true/*copy*/,true);
+      for(int samp=0; samp < numSamples; ++samp){
+	if(rgfSampUsed[samp])
+	  continue;//only consider samp if it isn't already used as key image
+	fvMeanTmp.setValuesToZero();
+	for(int ss=0; ss < numSamples; ++ss){
+	  rgFV_data[ss][k]=trainCostMatrix.at(rgSampleIdxs[samp], rgSampleIdxs[ss]);
+	  fvTmp.pDbl = rgFV_data[ss];
+	  fvMeanTmp.add(fvTmp);
+	}
+	fvMeanTmp.divideByScalar((double)numSamples);
+	double varianceTmp;
+	varianceTmp = 0.;
+	for(int ss=0; ss < numSamples; ++ss){
+	  double dblDistFVTmp;
+	  fvTmp.pDbl = rgFV_data[ss];
+	  dblDistFVTmp = DFeatureVector::getEuclideanDist(fvTmp,fvMeanTmp);
+	  varianceTmp += (dblDistFVTmp * dblDistFVTmp);
+	}
+	varianceTmp /= numSamples;
+	if(varianceTmp > bestSampFVvar){
+	  bestSampFVvar = varianceTmp;
+	  bestSampIdx = samp;
+	}
+      }//end for samp
+      if(-1==bestSampIdx){
+	fprintf(stderr,"this shouldn't happen! bestSampIdx ==-1. are there less samples than key word images?\n");
+	exit(1);
+      }
+      rgKeyWordIdxs[k] = rgSampleIdxs[bestSampIdx];
+      rgfSampUsed[bestSampIdx] = true;
+      for(int ss=0; ss < numSamples; ++ss){
+	rgFV_data[ss][k] = trainCostMatrix.at(rgKeyWordIdxs[k], rgSampleIdxs[ss]);
+      }
+      printf("***rgKeyWordIdxs[%d]=samp%d trainIdx=%d(%s)  variance=%.2lf\n",
+	     k,bestSampIdx, rgKeyWordIdxs[k],
+	     rgLabelsTrain[rgKeyWordIdxs[k]].c_str(), bestSampFVvar);
+    }//end for(k=1; k < numKeyWords...
+    delete [] rgDists;
+    delete [] rgfSampUsed;
+    for(int i=0; i < numSamples; ++i)
+      delete [] rgFV_data[i];
+    delete [] rgFV_data;
 
-  //--------------------------------------------------------------------------
-  //--------------------------------------------------------------------------
-  //--------------------------------------------------------------------------
-  //     do hierarchical clustering
-  //--------------------------------------------------------------------------
-  //--------------------------------------------------------------------------
-  //--------------------------------------------------------------------------
-  t1.start();
+    delete [] rgSampleIdxs;
+  }
+#endif // end #else (do use SMART_KEY_IMAGE_SELECTION)
+  // exit(1);
 
-  // int *rgClustAssignments;
-  // rgClustAssignments = new int[numTrain];
-  // D_CHECKPTR(rgClustAssignments);
+  for(int lvl=0; lvl < numLevels; ++lvl){
+    delete [] rgLevelHACNodes[lvl];
+    rgLevelHACNodes[lvl] = NULL;
+  }
+  delete [] rgLevelHACNodes;
 
 
-  // int rgLevelSizes[3] = {50,1000,10000};
-  // int numLevels=3;
-  // int rgLevelSizes[3] = {200,10000,100000};
-  // int numLevels=3;
-  int rgLevelSizes[1] = {16};//use the words at level 1 as key images
-  int numLevels=1;
-  while((rgLevelSizes[numLevels-1] >= numTrain)&&(numLevels>1))
-    --numLevels;
+  //calculate pseudo distances and max pseudo distances for each tree node
+  DTimer t4;
+  t4.start();
+  printf("calling calculateTreeKeyVectors()...");fflush(stdout);
+  calculateTreeKeyVectors(rgHACNodes[0],rgKeyWordIdxs, numKeyWords,
+			  trainCostMatrix, rgOrigWordLeafNodes);
+  t4.stop();
+  printf("took %.2f seconds\n",t4.getAccumulated());
 
-  printf(">> numLevels=%d\n", numLevels);
+  (*prgHACNodes) = rgHACNodes;
+  (*prgOrigWordLeafNodes) = rgOrigWordLeafNodes;
+  (*prgKeyWordIdxs) = rgKeyWordIdxs;
+  (*pNumKeyWords) = numKeyWords;
+}
 
-  HAC_TREE_NODE ***rgLevelHACNodes;
-  rgLevelHACNodes = new HAC_TREE_NODE**[numLevels];
-  D_CHECKPTR(rgLevelHACNodes);
-  for(int lvl=0; lvl < numLevels; ++lvl){
-    rgLevelHACNodes[lvl] = new HAC_TREE_NODE*[rgLevelSizes[lvl]];
-    D_CHECKPTR(rgLevelHACNodes[lvl]);
+
+//copy a finished tree (after calculateTreeKeyVectors()) into a DHACTree,
+//which is what gets saved and what findBestMatchNodeInTree() searches
+//
+//The nodes are numbered in depth-first order (children in order), so
+//the words of every node and its descendants end up as one range of
+//rgWords, in the same order as its rgWordsIncludingDescendants.
+bool flattenHACTree(DHACTree *pTree, HAC_TREE_NODE *pRoot, int numTrain,
+		    const int *rgKeyWordIdxs, int numKeyWords){
+  DHACTree &tree = *pTree;
+  std::vector<HAC_TREE_NODE*> vectNodes;
+  std::map<HAC_TREE_NODE*, int> mapNodeNums;
+  std::stack<HAC_TREE_NODE*> searchStack;
+  int numNodes, childCursor, wordCursor;
+
+  searchStack.push(pRoot);
+  while(!searchStack.empty()){
+    HAC_TREE_NODE *pCur;
+    pCur = searchStack.top();
+    searchStack.pop();
+    mapNodeNums[pCur] = (int)vectNodes.size();
+    vectNodes.push_back(pCur);
+    for(int i=pCur->numChildren-1; i >= 0; --i)
+      searchStack.push(pCur->rgpChildren[i]);
+  }
+  numNodes = (int)vectNodes.size();
+  if(!tree.create(numTrain, numNodes, numKeyWords))
+    return false;
+  childCursor = 0;
+  wordCursor = 0;
+  for(int n=0; n < numNodes; ++n){
+    HAC_TREE_NODE *pCur;
+    pCur = vectNodes[n];
+    if((pCur->fvCenter.vectLen != numKeyWords) ||
+       (pCur->fvMean.vectLen != numKeyWords) ||
+       (wordCursor + pCur->numWordsInClustAtThisLevel > numTrain)){
+      fprintf(stderr,"flattenHACTree() tree isn't finished\n");
+      return false;
+    }
+    tree.rgParent[n] = (NULL == pCur->pParent) ? -1 : mapNodeNums[pCur->pParent];
+    tree.rgFirstChild[n] = childCursor;
+    tree.rgNumChildren[n] = pCur->numChildren;
+    for(int i=0; i < pCur->numChildren; ++i)
+      tree.rgChildren[childCursor++] = mapNodeNums[pCur->rgpChildren[i]];
+    tree.rgCenterIdx[n] = pCur->centerIdx;
+    tree.rgFirstWord[n] = wordCursor;
+    tree.rgNumWordsHere[n] = pCur->numWordsInClustAtThisLevel;
+    tree.rgNumWords[n] = pCur->numWordsIncludingDescendants;
+    for(int i=0; i < pCur->numWordsInClustAtThisLevel; ++i)
+      tree.rgWords[wordCursor++] = pCur->rgWordsInClustAtThisLevel[i];
+    tree.rgNumDescendantNodes[n] = pCur->numDescendantTreeNodes;
+    tree.rgClustID[n] = pCur->clustID;
+    tree.rgMaxDistFromCenter[n] = pCur->maxDistFromCenter;
+    tree.rgSumDistFromCenter[n] = pCur->sumDistFromCenter;
+    tree.rgMaxDistFromCenterFv[n] = pCur->maxDistFromCenterFv;
+    tree.rgMaxDistFromDescendantsMeanFv[n] =
+      pCur->maxDistFromDescendantsMeanFv;
+    tree.rgCenterAspectRatio[n] = pCur->centerAspectRatio_w_div_h;
+    memcpy(&(tree.rgFvCenter[(long)n*numKeyWords]), pCur->fvCenter.pDbl,
+	   sizeof(double)*numKeyWords);
+    memcpy(&(tree.rgFvMean[(long)n*numKeyWords]), pCur->fvMean.pDbl,
+	   sizeof(double)*numKeyWords);
   }
+  if(wordCursor != numTrain){
+    fprintf(stderr,"flattenHACTree() tree has %d words, not %d\n",
+	    wordCursor, numTrain);
+    return false;
+  }
+  for(int k=0; k < numKeyWords; ++k)
+    tree.rgKeyIdxs[k] = rgKeyWordIdxs[k];
+  return true;
+}
 
+int main(int argc, char **argv);
 
-  //start with each word as its own node
-  HAC_TREE_NODE **rgHACNodes;
-  rgHACNodes = new HAC_TREE_NODE*[numTrain];
-  int numHACNodes;
-  numHACNodes = numTrain;
-  for(int i=0; i < numHACNodes; ++i){
-    rgHACNodes[i] = new HAC_TREE_NODE;
+int main(int argc, char **argv){
+  char stPathIn[1025];
+  char stOutfile[1025];
+  char stTrainCostMatrix[1025];//file to load or write
+  char stTmp[1025];
+  int trainFirst, trainLast;
+  int testFirst, testLast;
+  int numTrain, numTest;
+  DImage *rgTrainingImages;
+  DMorphInkPrepared *rgPreparedTrain;//skeletons, distance maps, etc.
+  DMorphInkStore storeTrain;//mapped training set (if USE_TRAINING_STORE)
+  bool fTrainFromStore = false;
+#if USE_TRAINING_STORE
+  char stStoreTrain[1025];//file the prepared training set is kept in
+  char stStoreSrcPattern[1025];//its source files (see DMorphInkStore::open)
+#endif
+  DImage testImage;
+  DCostMatrix trainCostMatrix;
+  double *rgCostsMorph;
+  DTimer t1;
+  std::string *rgLabelsTrain;
+  std::string *rgLabelsTest;
+  WORDWARP_THREAD_PARMS *rgThreadParms;
+  TREE_SEARCH_THREAD_PARMS *rgTreeThreadParms;
+  int numThreads = 1;
+  double weightMovement = 0.;
+  double lengthPenalty = 0.;
+  int meshSpacingStatic;
+  int numRefinesStatic;
+  double meshDiv;
+  DMorphInk mobj;
+#if DP_ONLY
+  mobj.fOnlyDoCoarseAlignment = true;
+#endif
+#if DP_COST_ONLY
+  mobj.fOnlyDoDPCost = true;
+#endif
+  int bandWidth = 15;
+  double alpha = 1.0;
+  char stHACMergeFile[2048];//list of nodes to merge (to avoid recalculating)
+  int slowPassTopN = 10;
+  int topNMatches = 10;// top N matches to save for N-gram post-processing
+  int treeSearchBatchSize = TREE_SEARCH_BATCH_SIZE;
+  TOPN_MATCHES_T *rgTopNMatches;//top N matches for all test words
+#ifndef D_NOTHREADS
+  pthread_t *rgThreadID;
+#else
+  numThreads = 1;
+#endif
+
+
+  if((argc < 18)||(argc > 20)){
+    fprintf(stderr, "usage: %s <dataset_path> <trainCostMatrix> <first_training_num> <last_training_num> <first_test_num> <last_test_num> <weightMovement=0.> <lengthPenalty=0.> <numThreads=-1> <meshSpacingStatic=-1> <numRefinesStatic=-1> <meshDiv=4> <SakoeChibaBandwidth=15> <alpha=1.0> <slowPassTopN=10> <topNmatches=10> <output_file> [mergeFileHAC] [treeSearchBatchSize=%d]\n  (mergeFileHAC may be \"\" to give treeSearchBatchSize without one)\n",
+	    argv[0], TREE_SEARCH_BATCH_SIZE);
+    exit(1);
   }
-  for(int i=0; i < numTrain; ++i){
-    //    rgHACNodes[i]->clustID = i;
-    rgHACNodes[i]->numWordsInClustAtThisLevel = 1;
-    rgHACNodes[i]->numWordsIncludingDescendants = 1;
-    rgHACNodes[i]->rgWordsInClustAtThisLevel = new int[1];
-    rgHACNodes[i]->rgWordsInClustAtThisLevel[0] = i;
-    rgHACNodes[i]->rgWordsIncludingDescendants = new int[1];
-    rgHACNodes[i]->rgWordsIncludingDescendants[0] = i;
 
-    rgHACNodes[i]->centerIdx = i;
-    if(rgTrainingImages[i].height() != 0.)
-      rgHACNodes[i]->centerAspectRatio_w_div_h = 
-	rgTrainingImages[i].width() / rgTrainingImages[i].height();
-    else
-      rgHACNodes[i]->centerAspectRatio_w_div_h = 0.;
+  sprintf(stPathIn, "%s", argv[1]);
+  sprintf(stTrainCostMatrix, "%s", argv[2]);
+  trainFirst = atoi(argv[3]);
+  trainLast = atoi(argv[4]);
+  testFirst = atoi(argv[5]);
+  testLast = atoi(argv[6]);
+  weightMovement = atof(argv[7]);
+  lengthPenalty =  atof(argv[8]);
+  numThreads = atoi(argv[9]);
+  meshSpacingStatic = atoi(argv[10]);
+  numRefinesStatic = atoi(argv[11]);
+  meshDiv = atof(argv[12]);
+  bandWidth = atoi(argv[13]);
+  alpha = atof(argv[14]);
+  slowPassTopN = atoi(argv[15]);
+  topNMatches = atoi(argv[16]);
+  sprintf(stOutfile, "%s", argv[17]);
+  stHACMergeFile[0] = '\0';
+  if(argc > 18)
+    sprintf(stHACMergeFile, "%s", argv[18]);
+  if(argc > 19)
+    treeSearchBatchSize = atoi(argv[19]);
+
+  if((meshDiv < 1) || (meshDiv > 50)){
+    fprintf(stderr,"meshDiv should be 1.0 - 50.0 (default=4). was %lf\n",
+	    meshDiv);
+    exit(1);
+  }
+
+  if((bandWidth < 2) || (bandWidth > 50)){
+    fprintf(stderr,"bandWidth should be 2-50 (default=15). was %d\n",
+	    bandWidth);
+    exit(1);
+  }
+
+  if((alpha < 0.1) || (alpha > 5.0)){
+    fprintf(stderr,"alpha should be 0.1-5.0. was %lf\n",alpha);
+    exit(1);
+  }
+  if(treeSearchBatchSize < 1){
+    fprintf(stderr,"treeSearchBatchSize should be at least 1. was %d\n",
+	    treeSearchBatchSize);
+    exit(1);
+  }
+  if((meshSpacingStatic==0) ||
+     ((meshSpacingStatic!=-1)&&(meshSpacingStatic>200))){
+    fprintf(stderr,"meshSpacingStatic expected to be 1-200 or -1! (was %d)\n",
+	    meshSpacingStatic);
+    exit(1);
+  }
+  if((numRefinesStatic < -1) || (numRefinesStatic > 4)){
+    fprintf(stderr,"numRefinesStatic expected to be 0-4 or -1! (was %d)\n",
+	    numRefinesStatic);
+    exit(1);
+  }
+
+  if((numThreads!=-1) && ((numThreads<1)||(numThreads>64))){
+    fprintf(stderr,"numThreads(%d) should be 1-64, or -1 to use all processors\n",numThreads);
+    exit(1);
+  }
+  if((weightMovement < 0.) || (weightMovement > 1.)){
+    fprintf(stderr,"weightMovement should be 0. to 1. (was %lf)\n",
+	    weightMovement);
+    exit(1);
+  }
+
+  if(numThreads < 1){
+#ifndef D_NOTHREADS
+    numThreads = getNumCPUs();
+#else
+    numThreads = 1;
+#endif
+  }
+
+#ifndef D_NOTHREADS
+  rgThreadID = new pthread_t[numThreads];
+  D_CHECKPTR(rgThreadID);
+#else
+  numThreads = 1;
+#endif
+
+  rgThreadParms = (WORDWARP_THREAD_PARMS *)malloc(sizeof(WORDWARP_THREAD_PARMS)*
+						  numThreads);
+  D_CHECKPTR(rgThreadParms);
+  rgTreeThreadParms =
+    (TREE_SEARCH_THREAD_PARMS*)malloc(sizeof(TREE_SEARCH_THREAD_PARMS)*
+				      numThreads);
+  D_CHECKPTR(rgTreeThreadParms);
+  
+  numTrain = trainLast - trainFirst + 1;
+  numTest = testLast - testFirst + 1;
+
+  if(numTrain < 1){
+    fprintf(stderr, "numTrain must be greater than 0\n");
+    exit(1);
+  }
+  if(numTest < 1){
+    fprintf(stderr, "numTest must be greater than 0\n");
+    exit(1);
   }
 
+  rgTrainingImages = new DImage[numTrain];
+  D_CHECKPTR(rgTrainingImages);
+  rgPreparedTrain = new DMorphInkPrepared[numTrain];
+  D_CHECKPTR(rgPreparedTrain);
+  rgLabelsTrain = new std::string[numTrain];
+  D_CHECKPTR(rgLabelsTrain);
+  rgLabelsTest = new std::string[numTest];
+  D_CHECKPTR(rgLabelsTest);
+  rgCostsMorph = (double*)malloc(sizeof(double)*numTest);
+  D_CHECKPTR(rgCostsMorph);
 
-  HAC_TREE_NODE **rgOrigWordLeafNodes;
-  rgOrigWordLeafNodes = new HAC_TREE_NODE*[numTrain];
-  D_CHECKPTR(rgOrigWordLeafNodes);
-  for(int tr=0; tr < numTrain; ++tr){
-    rgOrigWordLeafNodes[tr] = rgHACNodes[tr];
-  }
 
-  int curLevel;
-  curLevel = numLevels-1;
+  rgTopNMatches = new TOPN_MATCHES_T[(long)numTest*topNMatches];
+  D_CHECKPTR(rgTopNMatches);
+  
+  t1.start();
+  int maxTrainWidth = 0;
+  int maxTrainHeight = 0;
+  printf("loading training data....\n");
 
-#if USE_FAST_PASS_FIRST
-#if !TRACK_THE_BEST_N
-  FASTPASS_SORT_NODE_T *rgFastPassSortNodes;
-  rgFastPassSortNodes = new FASTPASS_SORT_NODE_T[numTrain];
-  D_CHECKPTR(rgFastPassSortNodes);
-  printf("setting up top-N matches for every leaf in tree...(not threaded yet)\n");fflush(stdout);
-  DTimer t8;
-  t8.start();
-  for(int tr=0; tr < numTrain; ++tr){
-    int numSoFar;
-    numSoFar = 0;
-    rgHACNodes[tr]->rgTopNTrainingMatches = new int[slowPassTopN];
-    D_CHECKPTR(rgHACNodes[tr]->rgTopNTrainingMatches);
-    for(int jj=0; jj < slowPassTopN; ++jj)
-      rgHACNodes[tr]->rgTopNTrainingMatches[jj] = -1;
-    for(int trIdx=0; trIdx < numTrain; ++trIdx){
-      rgFastPassSortNodes[trIdx].trIdx = trIdx;
-      rgFastPassSortNodes[trIdx].cost =
-	rgTrainCostMatrix[tr*(long)numTrain+trIdx];
-    }
-    qsort((void*)rgFastPassSortNodes, numTrain, sizeof(FASTPASS_SORT_NODE_T),
-	  compare_fastpass_sort);
-    if(0 != rgFastPassSortNodes[0].cost){
-      fprintf(stderr,"oops!\n");
+#if USE_TRAINING_STORE
+  if(snprintf(stStoreTrain, sizeof(stStoreTrain),
+	      "%s/train_thresh_w_%08d_%08d.dmis", stPathIn, trainFirst,
+	      trainLast) >= (int)sizeof(stStoreTrain)){
+    fprintf(stderr,"dataset path '%s' is too long\n", stPathIn);
+    exit(1);
+  }
+  if(snprintf(stStoreSrcPattern, sizeof(stStoreSrcPattern),
+	      "%s/thresh_w_%%08d.pgm", stPathIn) >=
+     (int)sizeof(stStoreSrcPattern)){
+    fprintf(stderr,"dataset path '%s' is too long\n", stPathIn);
+    exit(1);
+  }
+  struct stat statStore;
+  if((0 == stat(stStoreTrain, &statStore)) &&
+     storeTrain.open(stStoreTrain, TRAINING_STORE_SOURCE, stStoreSrcPattern,
+		     trainFirst)){
+    if(storeTrain.getNumWords() == numTrain)
+      fTrainFromStore = true;
+    else
+      storeTrain.close();
+  }
+#endif
+  if(!fTrainFromStore){//decode all of the files in parallel
+    if(snprintf(stTmp, sizeof(stTmp), "%s/thresh_w_%%08d.pgm", stPathIn) >=
+       (int)sizeof(stTmp)){
+      fprintf(stderr,"dataset path '%s' is too long\n", stPathIn);
       exit(1);
     }
-    int trIdxTmp;
-    trIdxTmp = 0;
-    // if(tr < 20)
-    //   printf("tr%d:'%s' topN:\n",tr,rgLabelsTrain[tr].c_str());
-    while((numSoFar<slowPassTopN) && (trIdxTmp<numTrain)){
-      bool fFound;
-      fFound = false;
-      for(int jj=0; jj < numSoFar; ++jj){
-	if(0==strcmp(rgLabelsTrain[rgHACNodes[tr]->rgTopNTrainingMatches[jj]].c_str(),
-		     rgLabelsTrain[rgFastPassSortNodes[trIdxTmp].trIdx].c_str()))
-	  fFound = true;
-      }
-#if BEST_N_UNIQUE_LABELS
-#else
-      fFound=false;
-#endif
-      if(!fFound){
-	// if(tr < 20)
-	//   printf("  [%d] %d %d:'%s'\n",numSoFar,trIdxTmp,rgFastPassSortNodes[trIdxTmp].trIdx,
-	// 	 rgLabelsTrain[rgFastPassSortNodes[trIdxTmp].trIdx].c_str());
-	rgHACNodes[tr]->rgTopNTrainingMatches[numSoFar] =
-	  rgFastPassSortNodes[trIdxTmp].trIdx;
-	++numSoFar;
-      }
-      else{
-	// if(tr < 20)
-	// printf("      skip %d %d:'%s'\n",trIdxTmp,
-	//        rgFastPassSortNodes[trIdxTmp].trIdx,
-	//        rgLabelsTrain[rgFastPassSortNodes[trIdxTmp].trIdx].c_str());
-      }
-      ++trIdxTmp;
+    if(!DImageIO::loadMany(stTmp, trainFirst, trainLast, rgTrainingImages,
+			   numThreads)){
+      fprintf(stderr,"couldn't load the training images\n");
+      exit(1);
     }
   }
-  t8.stop();
-  printf("time to set up top-N matches for tree: %.2lf seconds\n",
-	 t8.getAccumulated());
-  delete [] rgFastPassSortNodes;
-#endif
-#endif
-
-  //lineNo0 iMerge jMerge *\n
-  //lineNo1 iMerge jMerge *\n
-  // ...
-
-  //see if the merge file exists. if so, read all the merges 
-  //file format: each line is exactly 32 bytes long and has two numbers
-  //(15 digits each) separated by a space and a newline as the 32nd char
-  //the 2 numbers on the first line are numMergesInFile and numTrain
-  //numMergesInFile gets updated after each additional merge line is added
-  //any partial line after the 
-  std::vector<long int> vectMergeIJs;
-  long int numHACMergeIdxsInFile = 0;
-  if(0 != strlen(stHACMergeFile)){
-    char stTmpString[1024];
-    long int numTrainInFile = 0;
-    long int lineNo = 0;
-    fmerge = fopen(stHACMergeFile, "rb");
-    if(fmerge){//opened it, so read the merges
-      printf("reading merge file '%s'...\n",stHACMergeFile);
-      if(2 != fscanf(fmerge,"%s%ld",stTmpString, &numTrainInFile)){
-	fprintf(stderr,"ERROR! expect 'numTrain %%ld\\n' in merge file '%s'\n",
-		stHACMergeFile);
-	exit(1);
-      }
-      if(0 != strcmp(stTmpString,"numTrain")){
-	fprintf(stderr,"ERROR!!! expect 'numTrain %%ld\\n' in file '%s'\n",
-		stHACMergeFile);
-	exit(1);
-      }
-      if(numTrainInFile != (long)numTrain){
-	fprintf(stderr,"ERROR!!! numTrain=%d but it is %ld in merge file '%s'\n",numTrain, numTrainInFile, stHACMergeFile);
+  for(int tt=trainFirst, i=0; tt <= trainLast; ++tt,++i){
+    // sprintf(stTmp,"%s/w_%08d.pgm",stPathIn,tt);
+    sprintf(stTmp,"%s/thresh_w_%08d.pgm",stPathIn,tt);
+    if(fTrainFromStore)//only the properties. the pixels are in the store
+      storeTrain.getProperties(i, rgTrainingImages[i]);
+    std::string strTmp;
+    strTmp = rgTrainingImages[i].getPropertyVal(std::string("label"));
+    if(strTmp.size()<1){//couldn't find label property, try comments
+      if(3 != rgTrainingImages[i].getNumComments()){
+	fprintf(stderr, "image '%s' needs 'label' property or else comments should be: #threshval\\n#label\\n#pageNum\\n",stTmp);
 	exit(1);
       }
-      while(!feof(fmerge)){
-	long int mergeI, mergeJ;
-	int numRet;
-	numRet=fscanf(fmerge,"%ld%ld%ld%s",&lineNo,&mergeI,&mergeJ,stTmpString);
-	if(4!=numRet){
-	  if(feof(fmerge))//end of file
-	    break;
-	  fprintf(stderr,
-		  "ERROR!! on line %ld of mergefile '%s'\n",
-		  numHACMergeIdxsInFile+2, stHACMergeFile);
-	  exit(1);
-	}
-	if(lineNo != numHACMergeIdxsInFile){
-	  fprintf(stderr,"expect lineNo=%ld but was %ld on line %ld of '%s'\n",
-		  numHACMergeIdxsInFile, lineNo, numHACMergeIdxsInFile+2,
-		  stHACMergeFile);
-	  exit(1);
-	}
-	if(0 != strcmp(stTmpString,"*")){
-	  fprintf(stderr,"expect '*' at end of line %ld in merge file '%s'\n",
-		  numHACMergeIdxsInFile+2, stHACMergeFile);
-	  exit(1);
-	}
-	vectMergeIJs.push_back(mergeI);
-	vectMergeIJs.push_back(mergeJ);
-	++numHACMergeIdxsInFile;
-      }
-      fclose(fmerge);
-      fmerge = NULL;
-      // now merge them, then if not completely merged, open file for append
-      for(long int ll=0; ll < numHACMergeIdxsInFile; ++ll){
-	mergeClusterNodes(rgHACNodes, &numHACNodes, vectMergeIJs[ll*2],
-			  vectMergeIJs[ll*2+1], 999999./*parm ignored*/,
-			  rgLabelsTrain, rgTrainCostMatrix, numTrain,false);
-	if((curLevel>=0) && (numHACNodes == rgLevelSizes[curLevel])){
-	  printf("copying %d nodes for level %d\n",numHACNodes,curLevel);
-	  for(int nd=0; nd < numHACNodes; ++nd){
-	    printf(" %d=%d(%s)",nd,rgHACNodes[nd]->centerIdx,
-		   rgLabelsTrain[rgHACNodes[nd]->centerIdx].c_str());
-	    rgLevelHACNodes[curLevel][nd] = rgHACNodes[nd];
-	  }
-	  printf("\n");
-	  --curLevel;
-	}
-	if(numHACNodes < 1){
-	  fprintf(stderr,
-		  "ERROR!!! did merges from file '%s' and ran out of nodes!\n",
-		  stHACMergeFile);
-	  exit(1);
-	}
-      }
-      vectMergeIJs.clear();
-      if(numHACNodes > 1){
-	printf("there are still %d HAC nodes... appending to file '%s'\n",
-	       numHACNodes, stHACMergeFile);
-	fmerge = fopen(stHACMergeFile,"ab");
-	if(!fmerge){
-	  fprintf(stderr,"WARNING!!! couldn't open '%s' for append\n",
-		  stHACMergeFile);
-	}
-      }
+      rgLabelsTrain[i] = rgTrainingImages[i].getCommentByIndex(1);
     }
-    else{//couldn't open, so create it
-      printf("merge file '%s' not found, so creating it...\n",stHACMergeFile);
-      fmerge = fopen(stHACMergeFile,"wb");
-      if(!fmerge){
-	fprintf(stderr,"ERROR! couldn't open OR create merge file '%s'\n",
-		stHACMergeFile);
+    else
+      rgLabelsTrain[i] = strTmp;
+    strTmp =
+      rgTrainingImages[i].getPropertyVal(std::string("textlineExtractionOK"));
+    if(strTmp.size()>0){
+      if(0 == strcmp("0",strTmp.c_str())){
+	fprintf(stderr,"textlineExtractionOK=0 for training image '%s'\n",
+		stTmp);
 	exit(1);
       }
-      fprintf(fmerge,"numTrain %ld\n",(long)numTrain);
-      fflush(fmerge);
     }
+    if(fTrainFromStore)
+      storeTrain.getPrepared(i, rgPreparedTrain[i]);
+    else//compute the per-image morphing data once instead of for every pair
+      rgPreparedTrain[i].prepare(rgTrainingImages[i], false);
+    if(rgPreparedTrain[i].w > maxTrainWidth)
+      maxTrainWidth = rgPreparedTrain[i].w;
+    if(rgPreparedTrain[i].h > maxTrainHeight)
+      maxTrainHeight = rgPreparedTrain[i].h;
   }
+#if USE_TRAINING_STORE
+  if(fTrainFromStore)
+    printf("  (mapped from '%s')\n", stStoreTrain);
+  else if(DMorphInkStore::write(stStoreTrain, rgPreparedTrain, numTrain,
+				TRAINING_STORE_SOURCE, stStoreSrcPattern,
+				trainFirst))
+    printf("  (saved to '%s' for next time)\n", stStoreTrain);
+#endif
   
 
-  //cluster until all nodes are combined
-  while(numHACNodes > 1){
-    int iMinDist, jMinDist;
-    double minDist;
-    iMinDist = 0; jMinDist = 1; minDist = 999999.;
-    for(int i=0; i < numHACNodes; ++i){
-      for(int j=0; j < numHACNodes; ++j){
-	if(i==j)
-	  continue;
-	double dist;
-	dist = getClusterNodeDist(rgHACNodes[i], rgHACNodes[j],
-				  rgTrainCostMatrix, numTrain);
-	if(((i==0) && (j==1)) || (dist < minDist)){
-	  minDist = dist;
-	  iMinDist = i;
-	  jMinDist = j;
-	}
-      }
+  t1.stop();
+  printf("took %.02f seconds\n", t1.getAccumulated());
+
+  printf("numTrain=%d\n",numTrain);
+
+  // map the training NxN cost matrix, computing and saving it first if needed
+  struct stat statMatrix;
+  if(0 != stat(stTrainCostMatrix, &statMatrix)){
+    DCostMatrixWriter costWriter;
+    char stMatrixTmp[1025+16];//written here and renamed when complete
+    char stText[4096];
+    double *rgRow;//costs from word r to words r+1..numTrain-1
+
+    printf("couldn't find matrix file '%s'\n",stTrainCostMatrix);
+
+    t1.start();
+    printf("doing NxN comparison of training words\n");
+    DMorphInkBatchOptions batchOpts;
+#if USE_FAST_PASS_FOR_NxN_TRAINING
+    batchOpts.fFast = true;
+#endif
+    batchOpts.numThreads = numThreads;
+    batchOpts.bandWidthDP = bandWidth;
+    batchOpts.nonDiagonalCostDP = 0.;
+    batchOpts.meshSpacingStatic = meshSpacingStatic;
+    batchOpts.numRefinementsStatic = numRefinesStatic;
+    batchOpts.meshDiv = meshDiv;
+    batchOpts.lengthMismatchPenalty = lengthPenalty;
+    sprintf(stText,"trainFirst=%d trainLast=%d\n"
+	    "weightMovement=%.2lf lengthPenalty=%.2lf meshSpacingStatic=%d numRefinesStatic=%d meshDiv=%.2lf bandWidth=%d\ndir=%s\n",
+	    trainFirst, trainLast, weightMovement,
+	    lengthPenalty, meshSpacingStatic, numRefinesStatic,
+	    meshDiv, bandWidth, stPathIn);
+    sprintf(stMatrixTmp, "%s.partial", stTrainCostMatrix);
+    if(!costWriter.create(stMatrixTmp, trainFirst, trainLast, 0, numTrain-1,
+			  COST_MATRIX_VALUE_TYPE, stText)){
+      fprintf(stderr,"couldn't create '%s' to save training cost matrix\n",
+	      stMatrixTmp);
+      exit(1);
     }
-    //now merge the two clusters that are nearest each other (iMinDist,jMinDist)
-    //the function will remove jMinDist and shorten the array length by 1
-    mergeClusterNodes(rgHACNodes, &numHACNodes, iMinDist, jMinDist, minDist,
-		      rgLabelsTrain, rgTrainCostMatrix, numTrain,true);
-    if(fmerge){//save to merge file
-      fprintf(fmerge,"%ld %ld %ld *\n",numHACMergeIdxsInFile,(long)iMinDist,
-	      (long)jMinDist);
-      fflush(fmerge);
-      ++numHACMergeIdxsInFile;
+    rgRow = new double[numTrain];
+    D_CHECKPTR(rgRow);
+    //no upper bound here (batchOpts.rgThresholds stays NULL): every cost is
+    //saved, and the clustering and rgMaxDistFromCenter need the real ones.
+    //The DP early abandon is used by the tree search instead.
+    for(int r=0; r < numTrain; ++r){
+      if((r+1) < numTrain)//mobj workers use its fOnlyDoCoarseAlignment/fOnlyDoDPCost
+	mobj.computeCostsOneToMany(rgPreparedTrain[r],&(rgPreparedTrain[r+1]),
+				   numTrain-r-1, rgRow, batchOpts);
+      if(!costWriter.writeRow(rgRow))
+	exit(1);
+      printf(" NxN %.2lf%% complete row%d\n",(r*100/(double)numTrain),r);
     }
-    if((curLevel>=0) && (numHACNodes == rgLevelSizes[curLevel])){
-      printf("copying %d nodes for level %d\n",numHACNodes,curLevel);
-      for(int nd=0; nd < numHACNodes; ++nd){
-	printf(" %d=%d(%s)",nd,rgHACNodes[nd]->centerIdx,
-	       rgLabelsTrain[rgHACNodes[nd]->centerIdx].c_str());
-	rgLevelHACNodes[curLevel][nd] = rgHACNodes[nd];
-      }
-      printf("\n");
-      --curLevel;
+    delete [] rgRow;
+    if((!costWriter.close()) || (0 != rename(stMatrixTmp,stTrainCostMatrix))){
+      fprintf(stderr,"couldn't save the cost matrix to '%s'\n",
+	      stTrainCostMatrix);
+      exit(1);
     }
-    if(0 == numHACNodes%10)
-      printf("   (total elapsed time so far for clustering is %.2lf seconds\n",
-	     t1.getAccumulated());
+
+    t1.stop();
+    printf("NxN comparison of training data took %.02f seconds\n", t1.getAccumulated());
+    long int numCompares = (numTrain*(long)numTrain-numTrain)/2;
+    printf("(n*n-n)/2=%ld comparisons = %.6lf sec per compare\n", numCompares,
+	   t1.getAccumulated()/numCompares);
+    printf("saved matrix file '%s'\n",stTrainCostMatrix);
   }
-  t1.stop();
-  printf("clustering took %.2lf seconds\n", t1.getAccumulated());
-  if(fmerge){
-    fclose(fmerge);
+  printf("mapping matrix file '%s'\n",stTrainCostMatrix);
+  if((!trainCostMatrix.open(stTrainCostMatrix)) ||
+     (!trainCostMatrix.selectRange(trainFirst, trainLast))){
+    fprintf(stderr,"couldn't use '%s' as the training cost matrix\n",
+	    stTrainCostMatrix);
+    exit(1);
   }
-
-  //count up the number of descendant tree nodes for each node in the tree
-  printf("counting number of descendant tree nodes for each node in tree...");
-  t1.start();
-  for(int i=0; i < numTrain; ++i){
-    HAC_TREE_NODE *np;
-    np = rgOrigWordLeafNodes[i];
-    while(np != NULL){
-      np = np->pParent;
-      if(np != NULL){
-	np->numDescendantTreeNodes += 1;
-      }
+  printf("  %s matrix of %d-byte costs for #%d-#%d\n",
+	 trainCostMatrix.isLegacy() ? "old square" : "triangular",
+	 (int)trainCostMatrix.getValueType(), trainCostMatrix.getFirstIdx(),
+	 trainCostMatrix.getLastIdx());
+  // printf("TRAINING WORDS:");
+  // for(int i=0; i < numTrain; ++i){
+  //   if(0==(i%10))
+  //     printf("\n");
+  //   printf(" %d(%s)",i,rgLabelsTrain[i].c_str());
+  // }
+  // printf("\n");
+  // //debug: print the cost matrix
+#if 0
+  for(int r=0; r < numTrain; ++r){
+    for(int c=0; c < numTrain; ++c){
+      printf(" %9.2lf",trainCostMatrix.at(r,c));
     }
+    printf("\n");
   }
-  t1.stop();
-  printf("(%.2lf seconds)\n", t1.getAccumulated());
+#endif  
 
-  //use the first level of HAC nodes as key word images for pseudo-features
+  
+
+
+
+
+  //--------------------------------------------------------------------------
+  //--------------------------------------------------------------------------
+  //--------------------------------------------------------------------------
+  //     do hierarchical clustering
+  //--------------------------------------------------------------------------
+  //--------------------------------------------------------------------------
+  //--------------------------------------------------------------------------
+  t1.start();
+
+  // int *rgClustAssignments;
+  // rgClustAssignments = new int[numTrain];
+  // D_CHECKPTR(rgClustAssignments);
+
+
+  // int rgLevelSizes[3] = {50,1000,10000};
+  // int numLevels=3;
+  // int rgLevelSizes[3] = {200,10000,100000};
+  // int numLevels=3;
+  int rgLevelSizes[1] = {16};//use the words at level 1 as key images
+  int numLevels=1;
+  while((rgLevelSizes[numLevels-1] >= numTrain)&&(numLevels>1))
+    --numLevels;
+
+  printf(">> numLevels=%d\n", numLevels);
+
+  HAC_TREE_NODE **rgHACNodes;
+  HAC_TREE_NODE **rgOrigWordLeafNodes;
   int numKeyWords;
   int *rgKeyWordIdxs;
-  numKeyWords = rgLevelSizes[0];
-  rgKeyWordIdxs = new int[numKeyWords];
-  D_CHECKPTR(rgKeyWordIdxs);
-#if DONT_USE_SMART_KEY_IMAGE_SELECTION
-  for(int kk=0; kk < numKeyWords; ++kk){
-    rgKeyWordIdxs[kk] = rgLevelHACNodes[0][kk]->centerIdx;
-    printf("rgKeyWordIdxs[%d]=%d(%s)\n",kk,rgKeyWordIdxs[kk],
-	   rgLabelsTrain[rgLevelHACNodes[0][kk]->centerIdx].c_str());
-  }
-  for(int kk=0; kk < numKeyWords; ++kk){
-    printf("I%d [color=red];\n",rgLevelHACNodes[0][kk]->clustID);
-  }
-#else /*smart selection of key images*/
-  {
-    int maxNumSamples = 200;
-    int numSamples = 0;
-    int *rgSampleIdxs;
-    rgSampleIdxs = new int[maxNumSamples];
-    D_CHECKPTR(rgSampleIdxs);
-    memset(rgSampleIdxs,0, numSamples*sizeof(int));
-
- #if USE_MOST_FREQUENT_LABELS_AS_SAMPLES
-    std::map<std::string,int> mapLabelCounts;
-    for(int i=0; i < numTrain; ++i){
-      mapLabelCounts[rgLabelsTrain[i]] += 1;
-    }
-    die();
-    abort();
- #else
-    std::map<std::string, int> mapLabelsSampled;
-    std::map<std::string, int>::iterator mapiter;
-    std::string strTmp;
-    mapLabelsSampled.clear();
-    for(int i=0; (i < numTrain) && (numSamples < maxNumSamples); ++i){
-      mapiter = mapLabelsSampled.find(rgLabelsTrain[i]);
-      if(mapLabelsSampled.end() == mapiter){
-	strTmp = rgLabelsTrain[i];
-	mapLabelsSampled[strTmp] = 1;
-	rgSampleIdxs[numSamples] = i;
-	printf(" sample%d=rgLabelsTrain[%d](%s)\n",numSamples,i,
-	       rgLabelsTrain[i].c_str());
-	++numSamples;
+  D_uint64 costChecksum;
+  D_uint64 mergeChecksum = 0;
+  char stHACTreeFile[2060];//finished tree, saved next to the merge file
+  bool fTreeLoaded = false;
+  DHACTree hacTree;//the tree that is searched (mapped or flattened)
+  int *rgTopNTrainingMatches = NULL;//slowPassTopN for each training word
+
+  //a tree saved by an earlier run from the same costs and the same
+  //(finished) merge file is mapped and used instead of clustering again
+  costChecksum = trainCostMatrix.getChecksum();
+  stHACTreeFile[0] = '\0';
+  if(0 != strlen(stHACMergeFile)){
+    struct stat statTree;
+    sprintf(stHACTreeFile, "%s.tree", stHACMergeFile);
+    if(0 == stat(stHACTreeFile, &statTree)){
+      bool fMergesDone = false;
+      if(DHACMergeJournal::isMergeJournal(stHACMergeFile)){
+	DHACMergeJournal journal;
+	if(journal.open(stHACMergeFile, numTrain, costChecksum) &&
+	   (journal.getNumMerges() == (numTrain-1))){
+	  mergeChecksum = journal.getChecksum();
+	  fMergesDone = true;
+	}
       }
-    }
- #endif   
-    //rgKeyWordIdxs[0]: select sample with greatest variance in dist to other
-    //sample images (for each row k, find mean_k then var_k. rgKeyWordIdxs[0]
-    //is the k for which var_k is highest
-    double bestVar;
-    int bestVarSampleIdx;
-    bestVar = -1.;
-    bestVarSampleIdx = 0;
-    
-    double *rgDists;
-    rgDists = new double[numSamples];
-    D_CHECKPTR(rgDists);
-    for(int samp=0; samp<numSamples; ++samp){
-      double sampDistVar;//variance of distances from samp to other samples (ss)
-      for(int ss=0,distnum=0; ss<numSamples; ++ss){
-	if(ss==samp)
-	  continue;
-	rgDists[distnum] =
-	  rgTrainCostMatrix[(long int)rgSampleIdxs[ss]*(long)numTrain+
-			    (long int)rgSampleIdxs[samp]];
-	++distnum;
+      if(fMergesDone && hacTree.open(stHACTreeFile) &&
+	 (hacTree.getNumItems() == numTrain) &&
+	 (hacTree.getNumKeys() == rgLevelSizes[0]) &&
+	 (hacTree.getCostChecksum() == costChecksum) &&
+	 (hacTree.getMergeChecksum() == mergeChecksum)){
+	printf("using the tree saved in '%s'\n",stHACTreeFile);
+	numKeyWords = hacTree.getNumKeys();
+	rgKeyWordIdxs = new int[numKeyWords];
+	D_CHECKPTR(rgKeyWordIdxs);
+	for(int k=0; k < numKeyWords; ++k)
+	  rgKeyWordIdxs[k] = hacTree.rgKeyIdxs[k];
+	fTreeLoaded = true;
       }
-      sampDistVar = DMath::variance(rgDists,numSamples-1);
-      printf(" variance%d=%.2lf\n",samp,sampDistVar);
-      if(sampDistVar > bestVar){
-	bestVar = sampDistVar;
-	bestVarSampleIdx = samp;
+      else{
+	hacTree.close();
+	printf("tree in '%s' is for different words, costs, or merges. "
+	       "rebuilding it\n", stHACTreeFile);
       }
     }
-    rgKeyWordIdxs[0] = rgSampleIdxs[bestVarSampleIdx];
-    printf("***rgKeyWordIdxs[0]=samp%d trainIdx=%d(%s)  variance=%.2lf\n",
-	   bestVarSampleIdx, rgKeyWordIdxs[0],
-	   rgLabelsTrain[rgKeyWordIdxs[0]].c_str(), bestVar);
-
-    //rgKeyWordIdxs[1..K]: select sample image, samp, that increases variance
-    //for all other sample image vectors when samp is used as key image k
-    bool *rgfSampUsed;
-    rgfSampUsed = new bool[numSamples];
-    D_CHECKPTR(rgfSampUsed);
-    double **rgFV_data;
-    rgFV_data = new double*[numSamples];
-    D_CHECKPTR(rgFV_data);
-    for(int ss=0; ss < numSamples; ++ss){
-      rgFV_data[ss] = new double[numSamples];
-      D_CHECKPTR(rgFV_data[ss]);
-      rgFV_data[ss][0] = rgTrainCostMatrix[rgKeyWordIdxs[0]*(long)numTrain+
-					  rgSampleIdxs[ss]];
-      rgfSampUsed[ss] = false;
+  }
+  if(!fTreeLoaded){
+    buildHACTree(numTrain, rgPreparedTrain, rgLabelsTrain, trainCostMatrix,
+		 costChecksum, rgLevelSizes, numLevels, stHACMergeFile,
+		 numThreads, t1, &rgHACNodes, &rgOrigWordLeafNodes,
+		 &rgKeyWordIdxs, &numKeyWords, &mergeChecksum);
+    if(!flattenHACTree(&hacTree, rgHACNodes[0], numTrain,
+		       rgKeyWordIdxs, numKeyWords)){
+      fprintf(stderr,"ERROR! couldn't flatten the tree for searching\n");
+      exit(1);
     }
-    rgfSampUsed[bestVarSampleIdx] = true;
-    for(int k=1; k < numKeyWords; ++k){//choose the rest of the keywords
-      int bestSampIdx;
-      double bestSampFVvar;//variance in distance in feature space
-      DFeatureVector fvMeanTmp;
-      DFeatureVector fvTmp;
-      bestSampIdx = -1;
-      bestSampFVvar = 0.;
+    if((0 != strlen(stHACTreeFile)) &&
+       (!hacTree.save(stHACTreeFile, costChecksum, mergeChecksum)))
+      fprintf(stderr,"WARNING!!! couldn't save the tree to '%s'\n",
+	      stHACTreeFile);
+    //the search only uses the flat tree
+    delete [] rgOrigWordLeafNodes;
+    delete rgHACNodes[0];
+    delete [] rgHACNodes;
+  }
+  else
+    t1.stop();
 
-      fvTmp.setData_dbl(rgFV_data[0],k+1,1,true,false/*no copy*/,true);
-      fvMeanTmp.setData_dbl(rgFV_data[0],k+1,1,true,true/*copy*/,true);
-      for(int samp=0; samp < numSamples; ++samp){
-	if(rgfSampUsed[samp])
-	  continue;//only consider samp if it isn't already used as key image
-	fvMeanTmp.setValuesToZero();
-	for(int ss=0; ss < numSamples; ++ss){
-	  rgFV_data[ss][k]=rgTrainCostMatrix[rgSampleIdxs[samp]*(long)numTrain+
-					     rgSampleIdxs[ss]];
-	  fvTmp.pDbl = rgFV_data[ss];
-	  fvMeanTmp.add(fvTmp);
-	}
-	fvMeanTmp.divideByScalar((double)numSamples);
-	double varianceTmp;
-	varianceTmp = 0.;
-	for(int ss=0; ss < numSamples; ++ss){
-	  double dblDistFVTmp;
-	  fvTmp.pDbl = rgFV_data[ss];
-	  dblDistFVTmp = DFeatureVector::getEuclideanDist(fvTmp,fvMeanTmp);
-	  varianceTmp += (dblDistFVTmp * dblDistFVTmp);
-	}
-	varianceTmp /= numSamples;
-	if(varianceTmp > bestSampFVvar){
-	  bestSampFVvar = varianceTmp;
-	  bestSampIdx = samp;
-	}
-      }//end for samp
-      if(-1==bestSampIdx){
-	fprintf(stderr,"this shouldn't happen! bestSampIdx ==-1. are there less samples than key word images?\n");
-	exit(1);
+#if USE_FAST_PASS_FIRST
+#if !TRACK_THE_BEST_N
+  FASTPASS_SORT_NODE_T *rgFastPassSortNodes;
+  rgFastPassSortNodes = new FASTPASS_SORT_NODE_T[numTrain];
+  D_CHECKPTR(rgFastPassSortNodes);
+  rgTopNTrainingMatches = new int[(long)numTrain*slowPassTopN];
+  D_CHECKPTR(rgTopNTrainingMatches);
+  printf("setting up top-N matches for every leaf in tree...(not threaded yet)\n");fflush(stdout);
+  DTimer t8;
+  t8.start();
+  for(int tr=0; tr < numTrain; ++tr){
+    int numSoFar;
+    numSoFar = 0;
+    int *rgTopN;
+    rgTopN = &(rgTopNTrainingMatches[(long)tr*slowPassTopN]);
+    for(int jj=0; jj < slowPassTopN; ++jj)
+      rgTopN[jj] = -1;
+    for(int trIdx=0; trIdx < numTrain; ++trIdx){
+      rgFastPassSortNodes[trIdx].trIdx = trIdx;
+      rgFastPassSortNodes[trIdx].cost =
+	trainCostMatrix.at(tr, trIdx);
+    }
+    qsort((void*)rgFastPassSortNodes, numTrain, sizeof(FASTPASS_SORT_NODE_T),
+	  compare_fastpass_sort);
+    if(0 != rgFastPassSortNodes[0].cost){
+      fprintf(stderr,"oops!\n");
+      exit(1);
+    }
+    int trIdxTmp;
+    trIdxTmp = 0;
+    // if(tr < 20)
+    //   printf("tr%d:'%s' topN:\n",tr,rgLabelsTrain[tr].c_str());
+    while((numSoFar<slowPassTopN) && (trIdxTmp<numTrain)){
+      bool fFound;
+      fFound = false;
+      for(int jj=0; jj < numSoFar; ++jj){
+	if(0==strcmp(rgLabelsTrain[rgTopN[jj]].c_str(),
+		     rgLabelsTrain[rgFastPassSortNodes[trIdxTmp].trIdx].c_str()))
+	  fFound = true;
       }
-      rgKeyWordIdxs[k] = rgSampleIdxs[bestSampIdx];
-      rgfSampUsed[bestSampIdx] = true;
-      for(int ss=0; ss < numSamples; ++ss){
-	rgFV_data[ss][k] = rgTrainCostMatrix[rgKeyWordIdxs[k]*(long)numTrain+
-					    rgSampleIdxs[ss]];
+#if BEST_N_UNIQUE_LABELS
+#else
+      fFound=false;
+#endif
+      if(!fFound){
+	// if(tr < 20)
+	//   printf("  [%d] %d %d:'%s'\n",numSoFar,trIdxTmp,rgFastPassSortNodes[trIdxTmp].trIdx,
+	// 	 rgLabelsTrain[rgFastPassSortNodes[trIdxTmp].trIdx].c_str());
+	rgTopN[numSoFar] =
+	  rgFastPassSortNodes[trIdxTmp].trIdx;
+	++numSoFar;
       }
-      printf("***rgKeyWordIdxs[%d]=samp%d trainIdx=%d(%s)  variance=%.2lf\n",
-	     k,bestSampIdx, rgKeyWordIdxs[k],
-	     rgLabelsTrain[rgKeyWordIdxs[k]].c_str(), bestSampFVvar);
-    }//end for(k=1; k < numKeyWords...
-    delete [] rgDists;
-    delete [] rgfSampUsed;
-    for(int i=0; i < numSamples; ++i)
-      delete [] rgFV_data[i];
-    delete [] rgFV_data;
-
-    delete [] rgSampleIdxs;
-  }
-#endif // end #else (do use SMART_KEY_IMAGE_SELECTION)
-  // exit(1);
-
-  for(int lvl=0; lvl < numLevels; ++lvl){
-    delete [] rgLevelHACNodes[lvl];
-    rgLevelHACNodes[lvl] = NULL;
+      else{
+	// if(tr < 20)
+	// printf("      skip %d %d:'%s'\n",trIdxTmp,
+	//        rgFastPassSortNodes[trIdxTmp].trIdx,
+	//        rgLabelsTrain[rgFastPassSortNodes[trIdxTmp].trIdx].c_str());
+      }
+      ++trIdxTmp;
+    }
   }
-  delete [] rgLevelHACNodes;
-
-
-  //calculate pseudo distances and max pseudo distances for each tree node
-  DTimer t4;
-  t4.start();
-  printf("calling calculateTreeKeyVectors()...");fflush(stdout);
-  calculateTreeKeyVectors(rgHACNodes[0],rgKeyWordIdxs, numKeyWords,
-			  rgTrainCostMatrix, numTrain, rgOrigWordLeafNodes);
-  t4.stop();
-  printf("took %.2f seconds\n",t4.getAccumulated());
+  t8.stop();
+  printf("time to set up top-N matches for tree: %.2lf seconds\n",
+	 t8.getAccumulated());
+  delete [] rgFastPassSortNodes;
+#endif
+#endif
 
   //printf("NOT saving tree graphviz diagram or 3d matlab word plot\n");
  // saveTreeForGraphviz("/tmp/tree_graphviz_file.dot",rgHACNodes[0],rgLabelsTrain,
- // 		      		      rgTrainCostMatrix, numTrain, rgKeyWordIdxs, numKeyWords);
+ // 		      		      trainCostMatrix, rgKeyWordIdxs, numKeyWords);
  //   printf("to create the tree image do 'dot -Tps /tmp/tree_graphviz_file.dot -o /tmp/tree_graphviz_file.ps'\n");
 
 
 
 
-  HAC_TREE_NODE **rgMatchNodes;
-  rgMatchNodes = new HAC_TREE_NODE*[numTest];
-  D_CHECKPTR(rgMatchNodes);
+  int *rgMatchIdxs;
+  rgMatchIdxs = new int[numTest];
+  D_CHECKPTR(rgMatchIdxs);
   int *rgNumMorphCompares;
   rgNumMorphCompares = new int[numTest];
   D_CHECKPTR(rgNumMorphCompares);
@@ -2125,17 +2708,30 @@ int main(int argc, char **argv){
   rgNumPrunedChildFV = new int[numTest];
   D_CHECKPTR(rgNumPrunedChildFV);
 
+  //one thread per test word until there are more threads than test words
+  //(a single query, for example), then each word gets several threads to
+  //expand its tree search in parallel
+  int numWordThreads;//test words searched at the same time
+  int numThreadsPerWord;
+  numWordThreads = (numTest < numThreads) ? numTest : numThreads;
+  numThreadsPerWord = numThreads / numWordThreads;
+
   t1.start();
-  printf("Doing threaded tree search to classify each test word\n");
-  for(int tnum=numThreads-1; tnum >=0; --tnum){//launch threads reverse order
-    rgTreeThreadParms[tnum].numThreads = numThreads;
+  printf("Doing threaded tree search to classify each test word "
+	 "(%d words at a time, %d threads each)\n",
+	 numWordThreads, numThreadsPerWord);
+  for(int tnum=numWordThreads-1; tnum >=0; --tnum){//launch in reverse order
+    rgTreeThreadParms[tnum].numThreads = numWordThreads;
     rgTreeThreadParms[tnum].threadNum = tnum;
+    rgTreeThreadParms[tnum].numThreadsPerWord = numThreadsPerWord;
+    rgTreeThreadParms[tnum].treeSearchBatchSize = treeSearchBatchSize;
     rgTreeThreadParms[tnum].rgTrainingImages = rgTrainingImages;
+    rgTreeThreadParms[tnum].rgPreparedTrain = rgPreparedTrain;
     rgTreeThreadParms[tnum].numTrain = numTrain;
     rgTreeThreadParms[tnum].testFirst = testFirst;
     rgTreeThreadParms[tnum].testLast = testLast;
     rgTreeThreadParms[tnum].rgCostsMorph = rgCostsMorph;
-    rgTreeThreadParms[tnum].rgMatchNodes = rgMatchNodes;
+    rgTreeThreadParms[tnum].rgMatchIdxs = rgMatchIdxs;
     rgTreeThreadParms[tnum].rgNumMorphCompares = rgNumMorphCompares;
     rgTreeThreadParms[tnum].weightMovement = weightMovement;
     rgTreeThreadParms[tnum].lengthPenalty = lengthPenalty;
@@ -2143,7 +2739,7 @@ int main(int argc, char **argv){
     rgTreeThreadParms[tnum].numRefinesStatic = numRefinesStatic;
     rgTreeThreadParms[tnum].meshDiv = meshDiv;
     rgTreeThreadParms[tnum].bandWidthDP = bandWidth;
-    rgTreeThreadParms[tnum].treeRoot = rgHACNodes[0];
+    rgTreeThreadParms[tnum].pTree = &hacTree;
     rgTreeThreadParms[tnum].alpha = alpha;
     rgTreeThreadParms[tnum].stPathIn = stPathIn;//don't alloc/copy, just point
     rgTreeThreadParms[tnum].rgLabelsTest = rgLabelsTest;
@@ -2153,7 +2749,7 @@ int main(int argc, char **argv){
     rgTreeThreadParms[tnum].rgNumPrunedChildFV = rgNumPrunedChildFV;
     rgTreeThreadParms[tnum].rgKeyWordIdxs = rgKeyWordIdxs;
     rgTreeThreadParms[tnum].numKeyWords = numKeyWords;
-    rgTreeThreadParms[tnum].rgOrigWordLeafNodes = rgOrigWordLeafNodes;
+    rgTreeThreadParms[tnum].rgTopNTrainingMatches = rgTopNTrainingMatches;
     rgTreeThreadParms[tnum].slowPassTopN = slowPassTopN;
     rgTreeThreadParms[tnum].rgTopNMatches = rgTopNMatches;
     rgTreeThreadParms[tnum].topN = topNMatches;
@@ -2175,7 +2771,7 @@ int main(int argc, char **argv){
   }
 #ifndef D_NOTHREADS
   // wait for all threads to finish
-  for(int tnum = 1; tnum < numThreads; ++tnum){
+  for(int tnum = 1; tnum < numWordThreads; ++tnum){
     if(pthread_join(rgThreadID[tnum],NULL)){
       fprintf(stderr, "Thread #%d failed to join. Exiting.\n", tnum);
       exit(1);
@@ -2251,24 +2847,22 @@ int main(int argc, char **argv){
 #ifndef D_NOTHREADS
   delete [] rgThreadID;
 #endif
-  delete [] rgMatchNodes;
+  delete [] rgMatchIdxs;
   delete [] rgNumMorphCompares;
   delete [] rgfCorrect;
   delete [] rgNumPrunedFV;
   delete [] rgNumPrunedChildFV;
 
   free(rgTreeThreadParms);
-  free(rgTrainThreadParms);
   free(rgThreadParms);
   free(rgCostsMorph);
+  delete [] rgPreparedTrain;
   delete [] rgTrainingImages;
   delete [] rgLabelsTrain;
   delete [] rgLabelsTest;
-  delete [] rgTrainCostMatrix;
   delete [] rgKeyWordIdxs;
   delete [] rgTopNMatches;
-  delete [] rgOrigWordLeafNodes;
-  delete rgHACNodes[0];
-  delete [] rgHACNodes;
+  if(NULL != rgTopNTrainingMatches)
+    delete [] rgTopNTrainingMatches;
   return 0;
 }
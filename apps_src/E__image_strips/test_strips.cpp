@@ -0,0 +1,339 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dimage.h"
+#include "dimagestrips.h"
+#include "dmedianfilter.h"
+#ifndef D_NOTIFF
+#include "tiffio.h"
+#endif
+
+//checks the strip-at-a-time image code against the whole-image code:
+//reading a file in strips with DImageStripReader must give the same pixels
+//as DImage::load() (for PNM, PNG, and the TIFF variants it accepts), the
+//TIFF variants it can't read that way must be rejected, and median
+//filtering a strip at a time (DImageStrips::processImage() and
+//DMedianFilter::medianFilterFile()) must give the same result as filtering
+//the whole image.
+
+const int rgStripRows[] = {1, 7, 64, 1000};
+const int numStripRows = sizeof(rgStripRows) / sizeof(int);
+
+size_t rowBytes(const DImage &img){
+  return (DImage::DImage_RGB == img.getImageType()) ? 3*(size_t)img.width() :
+    (size_t)img.width();
+}
+
+//a random image with some smooth areas so the median filter has work to do
+void makeImage(DImage &img, int w, int h, DImage::DImageType imgType){
+  D_uint8 *p8;
+  size_t len;
+  img.create(w, h, imgType);
+  p8 = img.dataPointer_u8();
+  len = rowBytes(img) * h;
+  for(size_t i=0; i < len; ++i)
+    p8[i] = (D_uint8)(((i / 5) % 200) + rand() % 56);
+}
+
+bool sameImages(const DImage &img0, const DImage &img1){
+  if((img0.width() != img1.width()) || (img0.height() != img1.height()) ||
+     (img0.getImageType() != img1.getImageType()))
+    return false;
+  return 0 == memcmp(img0.dataPointer_u8(), img1.dataPointer_u8(),
+		     rowBytes(img0) * img0.height());
+}
+
+//read stPath in strips of each size and compare to DImage::load()
+bool checkRead(const char *stPath){
+  DImage imgWhole;
+  bool fOK = true;
+  if(!imgWhole.load(stPath)){
+    printf("%s: DImage::load() failed\n", stPath);
+    return false;
+  }
+  for(int ss=0; ss < numStripRows; ++ss){
+    DImageStripReader reader;
+    DImage imgStrip;
+    if(!reader.open(stPath)){
+      printf("%s: DImageStripReader::open() failed\n", stPath);
+      return false;
+    }
+    if((reader.width() != imgWhole.width()) ||
+       (reader.height() != imgWhole.height()) ||
+       (reader.getImageType() != imgWhole.getImageType())){
+      printf("%s: reader is %dx%d type %d, DImage::load() gave %dx%d type "
+	     "%d\n", stPath, reader.width(), reader.height(),
+	     (int)reader.getImageType(), imgWhole.width(), imgWhole.height(),
+	     (int)imgWhole.getImageType());
+      return false;
+    }
+    while(reader.getNextRow() < reader.height()){
+      int y0 = reader.getNextRow();
+      if(!reader.readRows(imgStrip, rgStripRows[ss])){
+	printf("%s: readRows() failed at row %d\n", stPath, y0);
+	return false;
+      }
+      if(0 != memcmp(imgStrip.dataPointer_u8(),
+		     imgWhole.dataPointer_u8() + y0 * rowBytes(imgWhole),
+		     rowBytes(imgWhole) * imgStrip.height())){
+	printf("%s: strip of %d rows at row %d differs from DImage::load()\n",
+	       stPath, rgStripRows[ss], y0);
+	fOK = false;
+      }
+    }
+  }
+  return fOK;
+}
+
+bool checkRejected(const char *stPath){
+  DImageStripReader reader;
+  if(reader.open(stPath)){
+    printf("%s: DImageStripReader::open() should have rejected it\n", stPath);
+    return false;
+  }
+  return true;
+}
+
+//DImageStripFunc for processImage()
+void medianStrip(DImage &imgDst, const DImage &imgSrc, void *params){
+  int *rgRadii = (int*)params;
+  DMedianFilter::medianFilterImage(imgDst, imgSrc, false, rgRadii[0],
+				   rgRadii[1]);
+}
+
+//median filter in strips (in memory and file to file) and compare to the
+//whole-image filter
+bool checkMedian(const char *stSrcPath, const char *stDstPath){
+  DImage imgSrc, imgWhole, imgStrips;
+  int rgRadii[2] = {2, 3};
+  bool fOK = true;
+  if(!imgSrc.load(stSrcPath)){
+    printf("%s: DImage::load() failed\n", stSrcPath);
+    return false;
+  }
+  DMedianFilter::medianFilterImage(imgWhole, imgSrc, false, rgRadii[0],
+				   rgRadii[1]);
+  for(int ss=0; ss < numStripRows; ++ss){
+    DImageStrips::processImage(imgStrips, imgSrc, rgStripRows[ss], rgRadii[1],
+			       medianStrip, (void*)rgRadii);
+    if(!sameImages(imgStrips, imgWhole)){
+      printf("%s: processImage() median with %d-row strips differs from "
+	     "the whole image\n", stSrcPath, rgStripRows[ss]);
+      fOK = false;
+    }
+    if(!DMedianFilter::medianFilterFile(stSrcPath, stDstPath, rgRadii[0],
+					rgRadii[1],
+					DMedianFilter::DMedFilt_default,
+					rgStripRows[ss])){
+      printf("%s: medianFilterFile() failed\n", stSrcPath);
+      return false;
+    }
+    if((!imgStrips.load(stDstPath)) || (!sameImages(imgStrips, imgWhole))){
+      printf("%s: medianFilterFile() with %d-row strips differs from the "
+	     "whole image\n", stSrcPath, rgStripRows[ss]);
+      fOK = false;
+    }
+  }
+  return fOK;
+}
+
+#ifndef D_NOTIFF
+//write img (u8 or RGB) as a strip TIFF with the given photometric and
+//compression, or with an alpha channel if fAlpha
+bool writeTIFF(const char *stPath, const DImage &img, uint16 photometric,
+	       uint16 compression, uint16 orientation, bool fAlpha){
+  TIFF *tif;
+  int w = img.width();
+  int h = img.height();
+  int numSamps = (DImage::DImage_RGB == img.getImageType()) ? 3 : 1;
+  D_uint8 *rgRow;
+  tif = TIFFOpen(stPath, "w");
+  if(NULL == tif){
+    printf("couldn't write '%s'\n", stPath);
+    return false;
+  }
+  if(fAlpha)
+    ++numSamps;
+  TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, (uint32)w);
+  TIFFSetField(tif, TIFFTAG_IMAGELENGTH, (uint32)h);
+  TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, 8);
+  TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, numSamps);
+  TIFFSetField(tif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+  TIFFSetField(tif, TIFFTAG_ORIENTATION, orientation);
+  TIFFSetField(tif, TIFFTAG_COMPRESSION, compression);
+  TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, photometric);
+  if(fAlpha){
+    uint16 extra = EXTRASAMPLE_UNASSALPHA;
+    TIFFSetField(tif, TIFFTAG_EXTRASAMPLES, 1, &extra);
+  }
+  if(COMPRESSION_JPEG == compression){
+    TIFFSetField(tif, TIFFTAG_JPEGQUALITY, 75);
+    TIFFSetField(tif, TIFFTAG_JPEGCOLORMODE, JPEGCOLORMODE_RGB);
+  }
+  TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, 16);
+  rgRow = new D_uint8[numSamps * w];
+  D_CHECKPTR(rgRow);
+  for(int y=0; y < h; ++y){
+    const D_uint8 *pSrc = img.dataPointer_u8() + y * rowBytes(img);
+    for(int x=0; x < w; ++x){
+      for(int s=0; s < numSamps; ++s)
+	rgRow[numSamps*x+s] = (fAlpha && (s == numSamps-1)) ? 255 :
+	  pSrc[(numSamps - (fAlpha ? 1 : 0))*x + s];
+    }
+    if(TIFFWriteScanline(tif, rgRow, y, 0) < 0){
+      printf("error writing '%s'\n", stPath);
+      TIFFClose(tif);
+      delete [] rgRow;
+      return false;
+    }
+  }
+  TIFFClose(tif);
+  delete [] rgRow;
+  return true;
+}
+
+//write a 1-bit TIFF (pixels >= 128 set) with the given photometric
+bool writeTIFF_1bit(const char *stPath, const DImage &img,
+		    uint16 photometric){
+  TIFF *tif;
+  int w = img.width();
+  int h = img.height();
+  int rowLen = (w + 7) / 8;
+  D_uint8 *rgRow;
+  tif = TIFFOpen(stPath, "w");
+  if(NULL == tif){
+    printf("couldn't write '%s'\n", stPath);
+    return false;
+  }
+  TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, (uint32)w);
+  TIFFSetField(tif, TIFFTAG_IMAGELENGTH, (uint32)h);
+  TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, 1);
+  TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, 1);
+  TIFFSetField(tif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+  TIFFSetField(tif, TIFFTAG_COMPRESSION, COMPRESSION_NONE);
+  TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, photometric);
+  TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, 16);
+  rgRow = new D_uint8[rowLen];
+  D_CHECKPTR(rgRow);
+  for(int y=0; y < h; ++y){
+    const D_uint8 *pSrc = img.dataPointer_u8() + y * w;
+    memset(rgRow, 0, rowLen);
+    for(int x=0; x < w; ++x)
+      if(pSrc[x] >= 128)
+	rgRow[x>>3] |= (0x80 >> (x&7));
+    if(TIFFWriteScanline(tif, rgRow, y, 0) < 0){
+      printf("error writing '%s'\n", stPath);
+      TIFFClose(tif);
+      delete [] rgRow;
+      return false;
+    }
+  }
+  TIFFClose(tif);
+  delete [] rgRow;
+  return true;
+}
+#endif
+
+int main(int argc, char **argv){
+  if(2 != argc){
+    fprintf(stderr, "usage: %s <tmp_dir>\n", argv[0]);
+    return 1;
+  }
+  const char *stDir = argv[1];
+  char stPath[1025], stDst[1025];
+  DImage imgGray, imgRGB;
+  int numBad = 0;
+  int numChecks = 0;
+
+  srand(12345);
+  makeImage(imgGray, 97, 131, DImage::DImage_u8);
+  makeImage(imgRGB, 83, 71, DImage::DImage_RGB);
+  snprintf(stDst, 1025, "%s/strips_dst.pnm", stDir);
+
+  for(int ii=0; ii < 2; ++ii){
+    DImage &img = (0 == ii) ? imgGray : imgRGB;
+    const char *stName = (0 == ii) ? "gray" : "rgb";
+    //PNM and PNG through DImage::save(), TIFF through DImageStripWriter
+    snprintf(stPath, 1025, "%s/strips_%s.pnm", stDir, stName);
+    img.save(stPath);
+    ++numChecks;
+    if(!checkRead(stPath))
+      ++numBad;
+    ++numChecks;
+    if(!checkMedian(stPath, stDst))
+      ++numBad;
+    snprintf(stPath, 1025, "%s/strips_%s.png", stDir, stName);
+    img.save(stPath, DImage::DFileFormat_png);
+    ++numChecks;
+    if(!checkRead(stPath))
+      ++numBad;
+    ++numChecks;
+    if(!checkMedian(stPath, stDst))
+      ++numBad;
+#ifndef D_NOTIFF
+    {
+      DImageStripWriter writer;
+      DImage imgLoaded;
+      snprintf(stPath, 1025, "%s/strips_%s.tif", stDir, stName);
+      ++numChecks;
+      if((!writer.open(stPath, img.width(), img.height(),
+		       img.getImageType(), DImage::DFileFormat_tiff)) ||
+	 (!writer.writeRows(img)) || (!writer.close()) ||
+	 (!imgLoaded.load(stPath)) || (!sameImages(imgLoaded, img))){
+	printf("%s: DImageStripWriter TIFF doesn't load as what was "
+	       "written\n", stPath);
+	++numBad;
+      }
+      ++numChecks;
+      if(!checkRead(stPath))
+	++numBad;
+      ++numChecks;
+      if(!checkMedian(stPath, stDst))
+	++numBad;
+    }
+#endif
+  }
+
+#ifndef D_NOTIFF
+  //the other TIFF variants DImageStripReader has to convert
+  snprintf(stPath, 1025, "%s/strips_miniswhite.tif", stDir);
+  ++numChecks;
+  if((!writeTIFF(stPath, imgGray, PHOTOMETRIC_MINISWHITE, COMPRESSION_NONE,
+		 ORIENTATION_TOPLEFT, false)) || (!checkRead(stPath)))
+    ++numBad;
+  snprintf(stPath, 1025, "%s/strips_1bit_black.tif", stDir);
+  ++numChecks;
+  if((!writeTIFF_1bit(stPath, imgGray, PHOTOMETRIC_MINISBLACK)) ||
+     (!checkRead(stPath)))
+    ++numBad;
+  snprintf(stPath, 1025, "%s/strips_1bit_white.tif", stDir);
+  ++numChecks;
+  if((!writeTIFF_1bit(stPath, imgGray, PHOTOMETRIC_MINISWHITE)) ||
+     (!checkRead(stPath)))
+    ++numBad;
+  snprintf(stPath, 1025, "%s/strips_ycbcr.tif", stDir);
+  ++numChecks;
+  if((!writeTIFF(stPath, imgRGB, PHOTOMETRIC_YCBCR, COMPRESSION_JPEG,
+		 ORIENTATION_TOPLEFT, false)) || (!checkRead(stPath)))
+    ++numBad;
+  //and the ones it has to reject because it would not match DImage::load()
+  snprintf(stPath, 1025, "%s/strips_rgba.tif", stDir);
+  ++numChecks;
+  if((!writeTIFF(stPath, imgRGB, PHOTOMETRIC_RGB, COMPRESSION_NONE,
+		 ORIENTATION_TOPLEFT, true)) || (!checkRejected(stPath)))
+    ++numBad;
+  snprintf(stPath, 1025, "%s/strips_botleft.tif", stDir);
+  ++numChecks;
+  if((!writeTIFF(stPath, imgGray, PHOTOMETRIC_MINISBLACK, COMPRESSION_NONE,
+		 ORIENTATION_BOTLEFT, false)) || (!checkRejected(stPath)))
+    ++numBad;
+#endif
+
+  printf("%d strip checks\n", numChecks);
+  if(numBad > 0){
+    printf("FAILED: %d wrong\n", numBad);
+    return 1;
+  }
+  printf("PASSED\n");
+  return 0;
+}
@@ -0,0 +1,77 @@
+#include "darena.h"
+#include "ddefs.h"
+#include <stdio.h>
+
+DArena::DArena(size_t initialBytes){
+  pBuf = NULL;
+  bufSize = 0;
+  bufUsed = 0;
+  rgOverflow = NULL;
+  numOverflow = 0;
+  overflowCapacity = 0;
+  overflowBytes = 0;
+  if(initialBytes > 0){
+    pBuf = (unsigned char*)malloc(initialBytes);
+    D_CHECKPTR(pBuf);
+    bufSize = initialBytes;
+  }
+}
+
+DArena::~DArena(){
+  for(int i=0; i < numOverflow; ++i)
+    free(rgOverflow[i]);
+  if(NULL != rgOverflow)
+    free(rgOverflow);
+  if(NULL != pBuf)
+    free(pBuf);
+}
+
+///get numBytes of memory that stays valid until the next reset()
+void* DArena::alloc(size_t numBytes){
+  void *pRet;
+  //round up so the next piece is aligned too
+  numBytes = (numBytes + DARENA_ALIGNMENT - 1) & ~((size_t)DARENA_ALIGNMENT-1);
+  if(0 == numBytes)
+    numBytes = DARENA_ALIGNMENT;
+  if((bufUsed + numBytes) <= bufSize){
+    pRet = (void*)(pBuf + bufUsed);
+    bufUsed += numBytes;
+    return pRet;
+  }
+  //doesn't fit. malloc it and make the buffer bigger at the next reset()
+  if(numOverflow >= overflowCapacity){
+    void **rgTmp;
+    overflowCapacity = (overflowCapacity < 8) ? 8 : (2*overflowCapacity);
+    rgTmp = (void**)realloc(rgOverflow, sizeof(void*)*overflowCapacity);
+    D_CHECKPTR(rgTmp);
+    rgOverflow = rgTmp;
+  }
+  pRet = malloc(numBytes);
+  D_CHECKPTR(pRet);
+  rgOverflow[numOverflow] = pRet;
+  ++numOverflow;
+  overflowBytes += numBytes;
+  return pRet;
+}
+
+///make all of the memory available again
+/**Anything returned by alloc() before this call must not be used
+   afterward.*/
+void DArena::reset(){
+  if(numOverflow > 0){
+    size_t newSize;
+    for(int i=0; i < numOverflow; ++i)
+      free(rgOverflow[i]);
+    newSize = bufUsed + overflowBytes;
+    numOverflow = 0;
+    overflowBytes = 0;
+    if(newSize < 2*bufSize)
+      newSize = 2*bufSize;
+    if(NULL != pBuf)
+      free(pBuf);
+    pBuf = (unsigned char*)malloc(newSize);
+    D_CHECKPTR(pBuf);
+    bufSize = newSize;
+  }
+  bufUsed = 0;
+}
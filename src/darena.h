@@ -0,0 +1,51 @@
+#ifndef DARENA_H
+#define DARENA_H
+
+#include <stdlib.h>
+
+///A growable block of scratch memory that is handed out and then reset
+/** alloc() returns pieces of one big buffer, and reset() makes all of
+    it available again, so code that needs the same temporary arrays
+    over and over (for every comparison, for example) doesn't call
+    malloc() and free() each time.  Everything returned by alloc() is
+    valid until the next reset() (or until the arena is destroyed) and
+    must NOT be passed to free().
+
+    If a request doesn't fit in what is left of the buffer, it is
+    malloc'ed separately.  The next reset() frees those extra blocks
+    and grows the main buffer so that the same sequence of requests
+    will fit next time.  After the first few uses, alloc() is just a
+    pointer increment.
+
+    Pieces are aligned to DARENA_ALIGNMENT bytes.  A DArena is not
+    thread-safe, so each thread should have its own (e.g. one per
+    DMorphInk object).
+*/
+#define DARENA_ALIGNMENT 16
+
+class DArena{
+public:
+  DArena(size_t initialBytes = 0);
+  ~DArena();
+  void* alloc(size_t numBytes);
+  void reset();
+  size_t getCapacity() const;
+
+private:
+  DArena(const DArena &src);//not copyable
+  const DArena& operator=(const DArena &src);
+
+  unsigned char *pBuf;//the main buffer
+  size_t bufSize;//allocated size of pBuf
+  size_t bufUsed;//bytes of pBuf handed out since the last reset()
+  void **rgOverflow;//blocks malloc'ed because pBuf was full
+  int numOverflow;
+  int overflowCapacity;//allocated length of rgOverflow
+  size_t overflowBytes;//total size of the blocks in rgOverflow
+};
+
+inline size_t DArena::getCapacity() const{
+  return bufSize;
+}
+
+#endif
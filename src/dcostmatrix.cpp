@@ -0,0 +1,781 @@
+#include "dcostmatrix.h"
+#include "ddefs.h"
+#include <string.h>
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#else
+#include <io.h>
+#define fseeko(f,offs,whence) _fseeki64((f),(__int64)(offs),(whence))
+#define ftello _ftelli64
+#endif
+
+static const char stCostMatrixMagic[8] = {'D','C','O','S','T','M','A','T'};
+static const char stJournalMagic[8] = {'D','C','M','J','O','U','R','N'};
+
+/*the old square format: 128 doubles (firstTrain, lastTrain, then text)*/
+#define DCOSTMATRIX_LEGACY_HEADER_LEN (128*sizeof(double))
+
+DCostMatrix::DCostMatrix(){
+  pFile = NULL;
+  fileLen = 0;
+  pData = NULL;
+  dataLen = 0;
+  _valType = CostValue_f64;
+  fLegacy = false;
+  _n = 0;
+  _firstIdx = _lastIdx = -1;
+  _rowFirst = _rowLast = -1;
+  _rowFirstOffs = 0;
+  _offs = 0;
+  _size = 0;
+  stText[0] = '\0';
+}
+
+DCostMatrix::~DCostMatrix(){
+  close();
+}
+
+///map a cost matrix file (new or old square format) for reading
+bool DCostMatrix::open(const char *stPath){
+  const DCOSTMATRIX_HEADER_T *phdr;
+
+  close();
+#ifndef _WIN32
+  int fd;
+  struct stat st;
+  void *pMap;
+  fd = ::open(stPath, O_RDONLY);
+  if(fd < 0){
+    fprintf(stderr, "DCostMatrix::open() couldn't open '%s'\n", stPath);
+    return false;
+  }
+  if((0 != fstat(fd, &st)) || (st.st_size < (off_t)sizeof(*phdr))){
+    fprintf(stderr, "DCostMatrix::open() '%s' is too short\n", stPath);
+    ::close(fd);
+    return false;
+  }
+  pMap = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if(MAP_FAILED == pMap){
+    fprintf(stderr, "DCostMatrix::open() couldn't map '%s'\n", stPath);
+    return false;
+  }
+  pFile = (D_uint8*)pMap;
+  fileLen = (size_t)st.st_size;
+#else
+  FILE *fin;
+  long len;
+  fin = fopen(stPath, "rb");
+  if(!fin){
+    fprintf(stderr, "DCostMatrix::open() couldn't open '%s'\n", stPath);
+    return false;
+  }
+  fseek(fin, 0, SEEK_END);
+  len = ftell(fin);
+  fseek(fin, 0, SEEK_SET);
+  if(len < (long)sizeof(*phdr)){
+    fprintf(stderr, "DCostMatrix::open() '%s' is too short\n", stPath);
+    fclose(fin);
+    return false;
+  }
+  pFile = (D_uint8*)malloc(len);
+  D_CHECKPTR(pFile);
+  fileLen = (size_t)len;
+  if(1 != fread(pFile, fileLen, 1, fin)){
+    fprintf(stderr, "DCostMatrix::open() couldn't read '%s'\n", stPath);
+    fclose(fin);
+    close();
+    return false;
+  }
+  fclose(fin);
+#endif
+
+  phdr = (const DCOSTMATRIX_HEADER_T*)pFile;
+  if(0 != memcmp(phdr->stMagic, stCostMatrixMagic,sizeof(stCostMatrixMagic))){
+    //old format: square matrix of doubles after a 128-double header
+    const double *rgHeader;
+    rgHeader = (const double*)pFile;
+    _firstIdx = (int)(rgHeader[0]);
+    _lastIdx = (int)(rgHeader[1]);
+    _n = _lastIdx - _firstIdx + 1;
+    if((_n < 1) || (fileLen != DCOSTMATRIX_LEGACY_HEADER_LEN +
+		    (D_uint64)_n * _n * sizeof(double))){
+      fprintf(stderr, "DCostMatrix::open() '%s' is neither a cost matrix "
+	      "nor an old-style square matrix file\n", stPath);
+      close();
+      return false;
+    }
+    fLegacy = true;
+    _valType = CostValue_f64;
+    _rowFirst = 0;
+    _rowLast = _n - 1;
+    pData = pFile + DCOSTMATRIX_LEGACY_HEADER_LEN;
+    dataLen = (D_uint64)_n * _n * sizeof(double);
+    strncpy(stText, (const char*)(&rgHeader[2]), DCOSTMATRIX_TEXT_LEN-1);
+    stText[DCOSTMATRIX_TEXT_LEN-1] = '\0';
+  }
+  else{
+    _firstIdx = phdr->firstIdx;
+    _lastIdx = phdr->lastIdx;
+    _n = _lastIdx - _firstIdx + 1;
+    _rowFirst = phdr->rowFirst;
+    _rowLast = phdr->rowLast;
+    if((0x01020304 != phdr->byteOrderMark) ||
+       (DCOSTMATRIX_VERSION != phdr->version) ||
+       ((CostValue_f16 != phdr->valueType) &&
+	(CostValue_f32 != phdr->valueType) &&
+	(CostValue_f64 != phdr->valueType)) ||
+       (_n < 1) || (_rowFirst < 0) || (_rowLast < _rowFirst) ||
+       (_rowLast >= _n) ||
+       (phdr->dataLen != getNumValues(_n, _rowFirst, _rowLast) *
+	phdr->valueType) ||
+       (fileLen != sizeof(*phdr) + phdr->dataLen)){
+      fprintf(stderr, "DCostMatrix::open() '%s' is corrupt, incomplete, or "
+	      "not a version %d cost matrix written on this machine\n",
+	      stPath, DCOSTMATRIX_VERSION);
+      close();
+      return false;
+    }
+    _valType = (DCostValueType)(phdr->valueType);
+    pData = pFile + sizeof(*phdr);
+    dataLen = phdr->dataLen;
+    memcpy(stText, phdr->stText, DCOSTMATRIX_TEXT_LEN);
+    stText[DCOSTMATRIX_TEXT_LEN-1] = '\0';
+  }
+  _rowFirstOffs = getTriangleOffset(_n, _rowFirst);
+  _offs = 0;
+  _size = _n;
+  return true;
+}
+
+///unmap the file
+void DCostMatrix::close(){
+  if(NULL != pFile){
+#ifndef _WIN32
+    munmap(pFile, fileLen);
+#else
+    free(pFile);
+#endif
+  }
+  pFile = NULL;
+  fileLen = 0;
+  pData = NULL;
+  dataLen = 0;
+  fLegacy = false;
+  _n = 0;
+  _firstIdx = _lastIdx = -1;
+  _rowFirst = _rowLast = -1;
+  _rowFirstOffs = 0;
+  _offs = 0;
+  _size = 0;
+  stText[0] = '\0';
+}
+
+///make at() use word numbers first..last (as 0..last-first)
+/**The file may hold a bigger range than is being used (for example
+   trainFirst..trainLast of a matrix computed for more words).
+   Returns false if first..last isn't within
+   getFirstIdx()..getLastIdx().*/
+bool DCostMatrix::selectRange(int first, int last){
+  if((first < _firstIdx) || (last > _lastIdx) || (last < first)){
+    fprintf(stderr, "DCostMatrix::selectRange() requested #%d-#%d but the "
+	    "matrix only has costs for #%d-#%d\n", first, last,
+	    _firstIdx, _lastIdx);
+    return false;
+  }
+  _offs = first - _firstIdx;
+  _size = last - first + 1;
+  return true;
+}
+
+///checksum identifying the costs visible through at()
+/**Files that depend on a cost matrix (like the HAC merge journal and
+   tree) store this so they can tell when the matrix has changed.  It
+   hashes the range and value type along with every cost of a small
+   matrix, or 4096 costs at fixed pseudo-random pairs of a bigger one,
+   so it is cheap even for a huge matrix.  A change to a big matrix
+   that misses all of the sampled pairs won't be noticed.*/
+D_uint64 DCostMatrix::getChecksum() const{
+  D_uint64 hash;
+  D_uint64 rgVals[3];
+  D_uint64 numPairs;
+  hash = 0xcbf29ce484222325ULL;//64-bit FNV-1a
+  rgVals[0] = (D_uint64)(_firstIdx + _offs);
+  rgVals[1] = (D_uint64)_size;
+  rgVals[2] = (D_uint64)_valType;
+  for(size_t b=0; b < sizeof(rgVals); ++b){
+    hash ^= ((const D_uint8*)rgVals)[b];
+    hash *= 0x100000001b3ULL;
+  }
+  if(_size < 2)
+    return hash;
+  numPairs = (D_uint64)_size * (_size - 1) / 2;
+  for(D_uint64 k=0; (k < 4096) && (k < numPairs); ++k){
+    union{ double d; D_uint8 rgb[8]; } v;
+    int i, j;
+    if(numPairs <= 4096){//small enough to just use every pair
+      i = (int)k;//becomes the row, and j the column, of pair k
+      for(j = 0; i >= (_size - 1 - j); ++j)
+	i -= (_size - 1 - j);
+      v.d = at(j, j + 1 + i);
+    }
+    else{//pseudo-random pairs (splitmix64 of k)
+      D_uint64 x;
+      x = (k + 1) * 0x9e3779b97f4a7c15ULL;
+      x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+      x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+      x ^= x >> 31;
+      i = (int)((x >> 32) % (D_uint64)_size);
+      j = (int)((x & 0xffffffffULL) % (D_uint64)_size);
+      v.d = at(i, j);
+    }
+    for(int b=0; b < 8; ++b){
+      hash ^= v.rgb[b];
+      hash *= 0x100000001b3ULL;
+    }
+  }
+  return hash;
+}
+
+///convert a float to an IEEE half float (round to nearest even)
+/**Values too big for a half become infinity.*/
+D_uint16 DCostMatrix::floatToHalf(float val){
+  union{ D_uint32 u; float f; } v;
+  D_uint32 sign, mant;
+  int expo;
+  v.f = val;
+  sign = (v.u >> 16) & 0x8000;
+  expo = (int)((v.u >> 23) & 0xff);
+  mant = v.u & 0x7fffff;
+  if(0xff == expo)//inf or nan (keep nan a nan)
+    return (D_uint16)(sign | 0x7c00 | ((0 != mant) ? 0x200 : 0));
+  expo = expo - 127 + 15;
+  if(expo >= 0x1f)//overflow
+    return (D_uint16)(sign | 0x7c00);
+  if(expo <= 0){//subnormal half (or zero)
+    D_uint32 shift, halfMant, rem, halfway;
+    if(expo < -10)
+      return (D_uint16)sign;
+    mant |= 0x800000;
+    shift = (D_uint32)(14 - expo);
+    halfMant = mant >> shift;
+    rem = mant & ((1u << shift) - 1);
+    halfway = 1u << (shift - 1);
+    if((rem > halfway) || ((rem == halfway) && (halfMant & 1)))
+      ++halfMant;//may carry into the smallest normal, which is correct
+    return (D_uint16)(sign | halfMant);
+  }
+  else{
+    D_uint32 h;
+    h = ((D_uint32)expo << 10) | (mant >> 13);
+    if(((mant & 0x1fff) > 0x1000) ||
+       (((mant & 0x1fff) == 0x1000) && (h & 1)))
+      ++h;//may carry into the exponent (up to infinity), which is correct
+    return (D_uint16)(sign | h);
+  }
+}
+
+
+///rows of tile tileNum when the triangle is split into numTiles tiles
+/**Each tile is a range of whole rows, chosen so that the tiles have
+   about the same amount of work instead of the same number of rows
+   (row r has n-1-r comparisons, so the top rows of the triangle are
+   much more work than the bottom ones).  Comparing words r and c is
+   counted as rgWeights[r]+rgWeights[c] (for example the areas of the
+   two images), or as 1 if rgWeights is NULL.  The same n, weights,
+   and numTiles always give the same tiles, and tiles 0..numTiles-1
+   cover rows 0..n-1 end to end with at least one row each.  Returns
+   false if numTiles isn't 1..n or tileNum isn't 0..numTiles-1.*/
+bool DCostMatrix::getTileRows(int n, const double *rgWeights, int numTiles,
+			      int tileNum, int *pRowFirst, int *pRowLast){
+  double *rgWork;//rgWork[r] is the work of rows 0..r-1
+  double sumAfter;//weights of the words after row r
+  int rowStart, rowEnd;
+
+  if((numTiles < 1) || (numTiles > n) || (tileNum < 0) ||
+     (tileNum >= numTiles))
+    return false;
+  rgWork = (double*)malloc(sizeof(double) * (n+1));
+  D_CHECKPTR(rgWork);
+  sumAfter = 0.;
+  for(int r = n-1; r >= 0; --r){
+    if(NULL == rgWeights)
+      rgWork[r+1] = (double)(n-1-r);
+    else{
+      rgWork[r+1] = rgWeights[r] * (n-1-r) + sumAfter;
+      sumAfter += rgWeights[r];
+    }
+  }
+  rgWork[0] = 0.;
+  for(int r = 1; r <= n; ++r)
+    rgWork[r] += rgWork[r-1];
+
+  //tile k starts at the first row where k/numTiles of the work is done
+  rowStart = 0;
+  rowEnd = 0;
+  for(int k = 1, r = 0; k <= (tileNum+1); ++k){
+    double target;
+    rowStart = rowEnd;
+    if(k == numTiles){
+      rowEnd = n;
+      break;
+    }
+    target = rgWork[n] * k / numTiles;
+    while((r < n) && (rgWork[r] < target))
+      ++r;
+    rowEnd = r;
+    if(rowEnd <= rowStart)//a heavy row can't be split, so keep tiles nonempty
+      rowEnd = rowStart + 1;
+    if(rowEnd > (n - (numTiles - k)))//leave a row for each remaining tile
+      rowEnd = n - (numTiles - k);
+  }
+  free(rgWork);
+  (*pRowFirst) = rowStart;
+  (*pRowLast) = rowEnd - 1;
+  return true;
+}
+
+/*stPath with ".journal" appended (free() it when done)*/
+static char* getJournalPath(const char *stPath){
+  char *stJournal;
+  stJournal = (char*)malloc(strlen(stPath) + 9);
+  D_CHECKPTR(stJournal);
+  sprintf(stJournal, "%s.journal", stPath);
+  return stJournal;
+}
+
+/*FNV-1a hash of the bytes of a row*/
+static D_uint32 getRowChecksum(const D_uint8 *pRow, size_t len){
+  D_uint32 hash = 2166136261u;
+  for(size_t i=0; i < len; ++i){
+    hash ^= pRow[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+/*checksum of the nul-terminated stText of a matrix header*/
+static D_uint32 getTextChecksum(const DCOSTMATRIX_HEADER_T &hdr){
+  size_t len = 0;
+  while((len < DCOSTMATRIX_TEXT_LEN) && ('\0' != hdr.stText[len]))
+    ++len;
+  return getRowChecksum((const D_uint8*)hdr.stText, len);
+}
+
+/*flush f and wait until it is actually on disk*/
+static bool syncFile(FILE *f){
+  if(0 != fflush(f))
+    return false;
+#ifndef _WIN32
+  if(0 != fsync(fileno(f)))
+    return false;
+#else
+  if(0 != _commit(_fileno(f)))
+    return false;
+#endif
+  return true;
+}
+
+/*cut f off at len bytes and leave it positioned at the end*/
+static bool truncateFile(FILE *f, D_uint64 len){
+  fflush(f);
+#ifndef _WIN32
+  if(0 != ftruncate(fileno(f), (off_t)len))
+    return false;
+#else
+  if(0 != _chsize_s(_fileno(f), (__int64)len))
+    return false;
+#endif
+  return (0 == fseeko(f, (off_t)len, SEEK_SET));
+}
+
+/*read the journal of stPath (*pLastChecksum is for the last good row)*/
+static bool readJournalFile(const char *stPath,
+			    DCOSTMATRIX_JOURNAL_HEADER_T *phdr,
+			    int *numRowsDone, D_uint32 *pLastChecksum){
+  FILE *fin;
+  char *stJournal;
+  DCOSTMATRIX_JOURNAL_RECORD_T rec;
+
+  stJournal = getJournalPath(stPath);
+  fin = fopen(stJournal, "rb");
+  free(stJournal);
+  if(!fin)
+    return false;
+  if((1 != fread(phdr, sizeof(*phdr), 1, fin)) ||
+     (0 != memcmp(phdr->stMagic, stJournalMagic, sizeof(stJournalMagic))) ||
+     (0x01020304 != phdr->byteOrderMark) ||
+     (DCOSTMATRIX_JOURNAL_VERSION != phdr->version)){
+    fprintf(stderr, "the journal of '%s' is not a version %d journal written "
+	    "on this machine\n", stPath, DCOSTMATRIX_JOURNAL_VERSION);
+    fclose(fin);
+    return false;
+  }
+  //the same checks DCostMatrix::open() does on a matrix header, so callers
+  //can size and index arrays by these
+  if(((DCostMatrix::CostValue_f16 != phdr->valueType) &&
+      (DCostMatrix::CostValue_f32 != phdr->valueType) &&
+      (DCostMatrix::CostValue_f64 != phdr->valueType)) ||
+     (phdr->lastIdx < phdr->firstIdx) ||
+     (((long long)phdr->lastIdx - phdr->firstIdx) >= 0x7fffffffLL) ||
+     (phdr->rowFirst < 0) || (phdr->rowLast < phdr->rowFirst) ||
+     (phdr->rowLast > (phdr->lastIdx - phdr->firstIdx))){
+    fprintf(stderr, "the journal of '%s' has a bad header: words #%d-#%d rows "
+	    "%d-%d with %d-byte costs\n", stPath, phdr->firstIdx,
+	    phdr->lastIdx, phdr->rowFirst, phdr->rowLast,
+	    (int)phdr->valueType);
+    fclose(fin);
+    return false;
+  }
+  //rows are journaled in order.  a torn record at the end doesn't count
+  (*numRowsDone) = 0;
+  (*pLastChecksum) = 0;
+  while((1 == fread(&rec, sizeof(rec), 1, fin)) &&
+	(rec.row == phdr->rowFirst + (*numRowsDone)) &&
+	(rec.row <= phdr->rowLast)){
+    ++(*numRowsDone);
+    (*pLastChecksum) = rec.checksum;
+  }
+  fclose(fin);
+  return true;
+}
+
+DCostMatrixWriter::DCostMatrixWriter(){
+  fout = NULL;
+  fjournal = NULL;
+  _valType = DCostMatrix::CostValue_f64;
+  _n = 0;
+  _rowLast = -1;
+  _nextRow = 0;
+  rgRowBuf = NULL;
+  fErr = false;
+}
+
+DCostMatrixWriter::~DCostMatrixWriter(){
+  if((NULL != fout) || (NULL != rgRowBuf))
+    close();
+}
+
+/*the header create() writes for these parameters*/
+static void fillMatrixHeader(DCOSTMATRIX_HEADER_T *phdr, int firstIdx,
+			     int lastIdx, int rowFirst, int rowLast,
+			     DCostMatrix::DCostValueType valType,
+			     const char *stText){
+  memset(phdr, 0, sizeof(*phdr));
+  memcpy(phdr->stMagic, stCostMatrixMagic, sizeof(stCostMatrixMagic));
+  phdr->byteOrderMark = 0x01020304;
+  phdr->version = DCOSTMATRIX_VERSION;
+  phdr->valueType = (D_uint32)valType;
+  phdr->firstIdx = firstIdx;
+  phdr->lastIdx = lastIdx;
+  phdr->rowFirst = rowFirst;
+  phdr->rowLast = rowLast;
+  phdr->dataLen =
+    DCostMatrix::getNumValues(lastIdx - firstIdx + 1, rowFirst, rowLast) *
+    (D_uint64)valType;
+  if(NULL != stText)
+    strncpy(phdr->stText, stText, DCOSTMATRIX_TEXT_LEN-1);
+}
+
+///create stPath for rows rowFirst..rowLast of words firstIdx..lastIdx
+/**rowFirst and rowLast are 0..(lastIdx-firstIdx).  To write the
+   whole matrix, use 0 and lastIdx-firstIdx.*/
+bool DCostMatrixWriter::create(const char *stPath, int firstIdx, int lastIdx,
+			       int rowFirst, int rowLast,
+			       DCostMatrix::DCostValueType valType,
+			       const char *stText){
+  DCOSTMATRIX_HEADER_T hdr;
+  char *stJournal;
+
+  if(NULL != fout)
+    close();
+  _n = lastIdx - firstIdx + 1;
+  if((_n < 1) || (rowFirst < 0) || (rowLast < rowFirst) || (rowLast >= _n)){
+    fprintf(stderr, "DCostMatrixWriter::create() bad range: words #%d-#%d "
+	    "rows %d-%d\n", firstIdx, lastIdx, rowFirst, rowLast);
+    return false;
+  }
+  fout = fopen(stPath, "wb");
+  if(!fout){
+    fprintf(stderr, "DCostMatrixWriter::create() couldn't open '%s' for "
+	    "writing\n", stPath);
+    return false;
+  }
+  //a journal left from an earlier file would no longer describe this one
+  stJournal = getJournalPath(stPath);
+  remove(stJournal);
+  free(stJournal);
+  fillMatrixHeader(&hdr, firstIdx, lastIdx, rowFirst, rowLast, valType,
+		   stText);
+  if(1 != fwrite(&hdr, sizeof(hdr), 1, fout)){
+    fprintf(stderr, "DCostMatrixWriter::create() couldn't write header to "
+	    "'%s'\n", stPath);
+    fclose(fout);
+    fout = NULL;
+    return false;
+  }
+  _valType = valType;
+  _rowLast = rowLast;
+  _nextRow = rowFirst;
+  fErr = false;
+  rgRowBuf = (D_uint8*)malloc((size_t)_n * valType);
+  D_CHECKPTR(rgRowBuf);
+  return true;
+}
+
+///like create(), but journal each row and continue an interrupted file
+/**If stPath has a journal from an earlier run with the same
+   parameters (word and row ranges, value type, and stText, which
+   should describe everything the costs depend on), the rows it lists
+   are kept and writing continues with
+   the next one (see getNextRow()).  Otherwise the file is created
+   from scratch along with a new journal.  Returns false if the
+   existing journal or file doesn't match the parameters, rather than
+   throwing away work that was done for something else.*/
+bool DCostMatrixWriter::createOrResume(const char *stPath, int firstIdx,
+				       int lastIdx, int rowFirst, int rowLast,
+				       DCostMatrix::DCostValueType valType,
+				       const char *stText){
+  DCOSTMATRIX_HEADER_T hdr;
+  char *stJournal;
+  FILE *ftmp;
+
+  stJournal = getJournalPath(stPath);
+  ftmp = fopen(stJournal, "rb");
+  free(stJournal);
+  if(NULL != ftmp){//there is a journal, so this is a restart
+    fclose(ftmp);
+    if(NULL != fout)
+      close();
+    if((lastIdx < firstIdx) || (rowFirst < 0) || (rowLast < rowFirst) ||
+       (rowLast > (lastIdx - firstIdx))){
+      fprintf(stderr, "DCostMatrixWriter::createOrResume() bad range: words "
+	      "#%d-#%d rows %d-%d\n", firstIdx, lastIdx, rowFirst, rowLast);
+      return false;
+    }
+    fillMatrixHeader(&hdr, firstIdx, lastIdx, rowFirst, rowLast, valType,
+		     stText);
+    return resume(stPath, hdr);
+  }
+  if(!create(stPath, firstIdx, lastIdx, rowFirst, rowLast, valType, stText))
+    return false;
+  fillMatrixHeader(&hdr, firstIdx, lastIdx, rowFirst, rowLast, valType,
+		   stText);
+  if(!createJournal(stPath, hdr)){
+    fErr = true;
+    close();
+    return false;
+  }
+  return true;
+}
+
+/*write a journal with no rows yet (after the matrix header is on disk)*/
+bool DCostMatrixWriter::createJournal(const char *stPath,
+				      const DCOSTMATRIX_HEADER_T &hdr){
+  DCOSTMATRIX_JOURNAL_HEADER_T jhdr;
+  char *stJournal;
+
+  memset(&jhdr, 0, sizeof(jhdr));
+  memcpy(jhdr.stMagic, stJournalMagic, sizeof(stJournalMagic));
+  jhdr.byteOrderMark = 0x01020304;
+  jhdr.version = DCOSTMATRIX_JOURNAL_VERSION;
+  jhdr.valueType = hdr.valueType;
+  jhdr.firstIdx = hdr.firstIdx;
+  jhdr.lastIdx = hdr.lastIdx;
+  jhdr.rowFirst = hdr.rowFirst;
+  jhdr.rowLast = hdr.rowLast;
+  jhdr.textChecksum = getTextChecksum(hdr);
+  stJournal = getJournalPath(stPath);
+  fjournal = fopen(stJournal, "wb");
+  if((NULL == fjournal) || (!syncFile(fout)) ||
+     (1 != fwrite(&jhdr, sizeof(jhdr), 1, fjournal)) ||
+     (!syncFile(fjournal))){
+    fprintf(stderr, "DCostMatrixWriter::createOrResume() couldn't create "
+	    "'%s'\n", stJournal);
+    if(NULL != fjournal)
+      fclose(fjournal);
+    fjournal = NULL;
+    free(stJournal);
+    return false;
+  }
+  free(stJournal);
+  return true;
+}
+
+/*reopen stPath and its journal, keeping only the journaled rows*/
+bool DCostMatrixWriter::resume(const char *stPath,
+			       const DCOSTMATRIX_HEADER_T &hdr){
+  DCOSTMATRIX_JOURNAL_HEADER_T jhdr;
+  DCOSTMATRIX_HEADER_T hdrFile;
+  int numRowsDone;
+  D_uint32 lastChecksum;
+  D_uint64 lenDone;
+  char *stJournal;
+
+  if(!readJournalFile(stPath, &jhdr, &numRowsDone, &lastChecksum))
+    return false;
+  if((jhdr.valueType != hdr.valueType) || (jhdr.firstIdx != hdr.firstIdx) ||
+     (jhdr.lastIdx != hdr.lastIdx) || (jhdr.rowFirst != hdr.rowFirst) ||
+     (jhdr.rowLast != hdr.rowLast)){
+    fprintf(stderr, "DCostMatrixWriter::createOrResume() the journal of '%s' "
+	    "is for words #%d-#%d rows %d-%d with %d-byte costs, not #%d-#%d "
+	    "rows %d-%d with %d-byte costs (delete both files to start "
+	    "over)\n", stPath, jhdr.firstIdx, jhdr.lastIdx, jhdr.rowFirst,
+	    jhdr.rowLast, (int)jhdr.valueType, hdr.firstIdx, hdr.lastIdx,
+	    hdr.rowFirst, hdr.rowLast, (int)hdr.valueType);
+    return false;
+  }
+  if(jhdr.textChecksum != getTextChecksum(hdr)){
+    fprintf(stderr, "DCostMatrixWriter::createOrResume() the journal of '%s' "
+	    "was written with different parameters (description text):\n%s\n"
+	    "(delete both files to start over)\n", stPath, hdr.stText);
+    return false;
+  }
+  _valType = (DCostMatrix::DCostValueType)hdr.valueType;
+  _n = hdr.lastIdx - hdr.firstIdx + 1;
+  _rowLast = hdr.rowLast;
+  _nextRow = hdr.rowFirst + numRowsDone;
+  fErr = false;
+  rgRowBuf = (D_uint8*)malloc((size_t)_n * _valType);
+  D_CHECKPTR(rgRowBuf);
+  lenDone = sizeof(hdr) +
+    DCostMatrix::getNumValues(_n, hdr.rowFirst, _nextRow-1) * _valType;
+
+  fout = fopen(stPath, "r+b");
+  if((NULL == fout) || (1 != fread(&hdrFile, sizeof(hdrFile), 1, fout)) ||
+     (0 != memcmp(hdrFile.stMagic, hdr.stMagic, sizeof(hdr.stMagic))) ||
+     (hdrFile.valueType != hdr.valueType) ||
+     (hdrFile.firstIdx != hdr.firstIdx) || (hdrFile.lastIdx != hdr.lastIdx) ||
+     (hdrFile.rowFirst != hdr.rowFirst) || (hdrFile.rowLast != hdr.rowLast) ||
+     (0 != strncmp(hdrFile.stText, hdr.stText, DCOSTMATRIX_TEXT_LEN)) ||
+     (0 != fseeko(fout, 0, SEEK_END)) || ((D_uint64)ftello(fout) < lenDone)){
+    fprintf(stderr, "DCostMatrixWriter::createOrResume() '%s' doesn't match "
+	    "its journal (delete both files to start over)\n", stPath);
+    fErr = true;
+    close();
+    return false;
+  }
+  if(numRowsDone > 0){//make sure the last journaled row really is there
+    size_t rowLen;
+    rowLen = (size_t)(_n - _nextRow) * _valType;//row _nextRow-1
+    if((0 != fseeko(fout, (off_t)(lenDone - rowLen), SEEK_SET)) ||
+       ((rowLen > 0) && (1 != fread(rgRowBuf, rowLen, 1, fout))) ||
+       (getRowChecksum(rgRowBuf, rowLen) != lastChecksum)){
+      fprintf(stderr, "DCostMatrixWriter::createOrResume() row %d of '%s' "
+	      "doesn't match its journal (delete both files to start over)\n",
+	      _nextRow-1, stPath);
+      fErr = true;
+      close();
+      return false;
+    }
+  }
+  //throw away anything written after the last journaled row
+  stJournal = getJournalPath(stPath);
+  fjournal = fopen(stJournal, "r+b");
+  free(stJournal);
+  if((!truncateFile(fout, lenDone)) || (NULL == fjournal) ||
+     (!truncateFile(fjournal, sizeof(jhdr) + (D_uint64)numRowsDone *
+		    sizeof(DCOSTMATRIX_JOURNAL_RECORD_T)))){
+    fprintf(stderr, "DCostMatrixWriter::createOrResume() couldn't reopen "
+	    "'%s' and its journal for writing\n", stPath);
+    fErr = true;
+    close();
+    return false;
+  }
+  return true;
+}
+
+///append the next row: costs from word getNextRow() to each word after it
+/**rgCosts holds n-1-getNextRow() values (none for the last row).  If
+   the file is journaled, the row is on disk when this returns.*/
+bool DCostMatrixWriter::writeRow(const double *rgCosts){
+  const void *pRow;
+  int len;
+  if((NULL == fout) || fErr || (_nextRow > _rowLast)){
+    fprintf(stderr, "DCostMatrixWriter::writeRow() can't write row %d\n",
+	    _nextRow);
+    fErr = true;
+    return false;
+  }
+  len = _n - 1 - _nextRow;
+  switch(_valType){
+    case DCostMatrix::CostValue_f16:
+      for(int c=0; c < len; ++c)
+	((D_uint16*)rgRowBuf)[c] = DCostMatrix::floatToHalf((float)rgCosts[c]);
+      pRow = (const void*)rgRowBuf;
+      break;
+    case DCostMatrix::CostValue_f32:
+      for(int c=0; c < len; ++c)
+	((float*)rgRowBuf)[c] = (float)rgCosts[c];
+      pRow = (const void*)rgRowBuf;
+      break;
+    default:
+      pRow = (const void*)rgCosts;
+      break;
+  }
+  if((len > 0) && ((size_t)len != fwrite(pRow, _valType, len, fout))){
+    fprintf(stderr, "DCostMatrixWriter::writeRow() write error at row %d\n",
+	    _nextRow);
+    fErr = true;
+    return false;
+  }
+  if(NULL != fjournal){//the row has to be on disk before it is journaled
+    DCOSTMATRIX_JOURNAL_RECORD_T rec;
+    rec.row = _nextRow;
+    rec.checksum = getRowChecksum((const D_uint8*)pRow,
+				  (size_t)(len > 0 ? len : 0) * _valType);
+    if((!syncFile(fout)) || (1 != fwrite(&rec, sizeof(rec), 1, fjournal)) ||
+       (!syncFile(fjournal))){
+      fprintf(stderr, "DCostMatrixWriter::writeRow() couldn't journal row "
+	      "%d\n", _nextRow);
+      fErr = true;
+      return false;
+    }
+  }
+  ++_nextRow;
+  return true;
+}
+
+///finish the file
+/**Returns false if there was an error or not all of the rows were
+   written (DCostMatrix::open() will reject the file in that case).
+   The journal, if there is one, is left for combineNxNChunks and for
+   resuming.*/
+bool DCostMatrixWriter::close(){
+  bool fOK;
+  if(NULL != fout){
+    fOK = (!fErr) && (_nextRow == (_rowLast + 1));
+    if((!fErr) && (!fOK))
+      fprintf(stderr, "DCostMatrixWriter::close() closed before row %d was "
+	      "written\n", _nextRow);
+    if(0 != fclose(fout))
+      fOK = false;
+    fout = NULL;
+  }
+  else
+    fOK = false;
+  if(NULL != fjournal){
+    if(0 != fclose(fjournal))
+      fOK = false;
+    fjournal = NULL;
+  }
+  if(NULL != rgRowBuf)
+    free(rgRowBuf);
+  rgRowBuf = NULL;
+  return fOK;
+}
+
+///read the journal that createOrResume() keeps for stPath
+/**numRowsDone is how many rows, starting at phdr->rowFirst, are
+   complete in the matrix file.  Returns false if there is no journal
+   or it can't be read.*/
+bool DCostMatrixWriter::readJournal(const char *stPath,
+				    DCOSTMATRIX_JOURNAL_HEADER_T *phdr,
+				    int *numRowsDone){
+  D_uint32 lastChecksum;
+  return readJournalFile(stPath, phdr, numRowsDone, &lastChecksum);
+}
@@ -0,0 +1,285 @@
+#ifndef DCOSTMATRIX_H
+#define DCOSTMATRIX_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "dinttypes.h"
+
+///A symmetric matrix of word-to-word costs, stored as its upper triangle
+/** The NxN training matrix used to be saved as a header of 128
+    doubles followed by all numTrain*numTrain doubles, even though it
+    is symmetric with zeros on the diagonal.  At 60k words that is
+    28GB that has to be read into memory before clustering can start.
+
+    A DCostMatrix file holds only the costs above the diagonal, one
+    row after another (row r has the costs to words r+1..n-1), as
+    16-bit half floats, floats, or doubles.  open() maps the file
+    read-only, so the OS pages in the parts that are actually used and
+    the matrix doesn't have to fit in memory at all.  at(i,j) returns
+    the cost for any pair, swapping i and j when i > j and returning
+    0 when i==j.
+
+    A file can also hold just a range of rows (rowFirst..rowLast) of
+    the triangle, which is what NxNtrainMatrixChunk writes.  The row
+    ranges of chunk files fit end to end, so combining chunks is just
+    concatenating their data.  at() must only be called for pairs
+    whose smaller index is one of the rows in the file.  getTileRows()
+    picks row ranges that are about equal amounts of work.
+
+    open() also accepts the old square files (128 double header with
+    firstTrain and lastTrain, then the full matrix) so that existing
+    matrices can still be used.
+
+    Half floats keep about 3 significant digits and saturate to
+    infinity above 65504, which is fine for ranking word costs but
+    should be chosen knowingly.  Bump DCOSTMATRIX_VERSION if the
+    layout ever changes so old files are rejected.
+*/
+#define DCOSTMATRIX_VERSION 1
+#define DCOSTMATRIX_TEXT_LEN 976
+
+typedef struct{
+  char stMagic[8];//"DCOSTMAT"
+  D_uint32 byteOrderMark;//0x01020304 as written by this machine
+  D_uint32 version;//DCOSTMATRIX_VERSION
+  D_uint32 valueType;//bytes per value (DCostMatrix::DCostValueType)
+  D_sint32 firstIdx, lastIdx;//word numbers of the first and last words
+  D_sint32 rowFirst, rowLast;//rows (0..n-1) of the triangle in this file
+  D_uint32 reserved;
+  D_uint64 dataLen;//bytes of cost data following this header
+  char stText[DCOSTMATRIX_TEXT_LEN];//free-form description (nul-terminated)
+} DCOSTMATRIX_HEADER_T;
+
+///Journal kept next to a matrix file (<file>.journal) by createOrResume()
+/** The header describes the matrix file being written and is
+    followed by one DCOSTMATRIX_JOURNAL_RECORD_T per row, appended
+    (and fsync'd) only after the row itself has been fsync'd to the
+    matrix file.  So every row listed in the journal is on disk, and
+    a job that is killed can pick up after the last one.  textChecksum
+    is of the matrix header's stText (the parameters the costs were
+    computed with), so a restart with different ones is refused.*/
+#define DCOSTMATRIX_JOURNAL_VERSION 2
+
+typedef struct{
+  char stMagic[8];//"DCMJOURN"
+  D_uint32 byteOrderMark;//0x01020304 as written by this machine
+  D_uint32 version;//DCOSTMATRIX_JOURNAL_VERSION
+  D_uint32 valueType;
+  D_sint32 firstIdx, lastIdx;
+  D_sint32 rowFirst, rowLast;
+  D_uint32 textChecksum;//of stText in the matrix header
+} DCOSTMATRIX_JOURNAL_HEADER_T;
+
+typedef struct{
+  D_sint32 row;
+  D_uint32 checksum;//of the bytes of the row in the matrix file
+} DCOSTMATRIX_JOURNAL_RECORD_T;
+
+class DCostMatrix{
+public:
+  enum DCostValueType{
+    CostValue_f16 = 2,
+    CostValue_f32 = 4,
+    CostValue_f64 = 8
+  };
+
+  DCostMatrix();
+  ~DCostMatrix();
+  bool open(const char *stPath);
+  void close();
+  bool isOpen() const;
+  bool selectRange(int first, int last);
+  int size() const;
+  int getFirstIdx() const;
+  int getLastIdx() const;
+  int getRowFirst() const;
+  int getRowLast() const;
+  DCostValueType getValueType() const;
+  bool isLegacy() const;
+  const char* getText() const;
+  const void* getData() const;
+  D_uint64 getDataLen() const;
+  double at(int i, int j) const;
+  D_uint64 getChecksum() const;
+
+  static D_uint64 getTriangleOffset(int n, int row);
+  static D_uint64 getNumValues(int n, int rowFirst, int rowLast);
+  static bool getTileRows(int n, const double *rgWeights, int numTiles,
+			  int tileNum, int *pRowFirst, int *pRowLast);
+  static D_uint16 floatToHalf(float val);
+  static float halfToFloat(D_uint16 h);
+
+private:
+  DCostMatrix(const DCostMatrix &src);//not copyable
+  const DCostMatrix& operator=(const DCostMatrix &src);
+
+  D_uint8 *pFile;//the mapped (or read, on Windows) file
+  size_t fileLen;
+  const D_uint8 *pData;//first cost value
+  D_uint64 dataLen;
+  DCostValueType _valType;
+  bool fLegacy;//old square layout (all n*n doubles)
+  int _n;//number of words in the file
+  int _firstIdx, _lastIdx;
+  int _rowFirst, _rowLast;
+  D_uint64 _rowFirstOffs;//getTriangleOffset(_n, _rowFirst)
+  int _offs;//added to indices passed to at() (from selectRange())
+  int _size;//number of words visible through at()
+  char stText[DCOSTMATRIX_TEXT_LEN];
+};
+
+///Writes a DCostMatrix file one row of the triangle at a time
+/** Call create(), then writeRow() for rows rowFirst..rowLast in order
+    (row r is the costs from word r to words r+1..n-1), then close(),
+    which returns false unless every row was written.  The costs are
+    converted to the value type given to create() as they are
+    written, so the whole matrix never has to be in memory.
+
+    createOrResume() is the same as create() but also keeps a journal
+    of the finished rows.  If it is called again after the program
+    was killed, it keeps the rows that the journal says are complete,
+    discards anything after them, and getNextRow() tells the caller
+    which row to compute next.
+*/
+class DCostMatrixWriter{
+public:
+  DCostMatrixWriter();
+  ~DCostMatrixWriter();
+  bool create(const char *stPath, int firstIdx, int lastIdx,
+	      int rowFirst, int rowLast,
+	      DCostMatrix::DCostValueType valType, const char *stText = NULL);
+  bool createOrResume(const char *stPath, int firstIdx, int lastIdx,
+		      int rowFirst, int rowLast,
+		      DCostMatrix::DCostValueType valType,
+		      const char *stText = NULL);
+  bool writeRow(const double *rgCosts);
+  bool close();
+  int getNextRow() const;
+
+  static bool readJournal(const char *stPath,
+			  DCOSTMATRIX_JOURNAL_HEADER_T *phdr,
+			  int *numRowsDone);
+
+private:
+  DCostMatrixWriter(const DCostMatrixWriter &src);//not copyable
+  const DCostMatrixWriter& operator=(const DCostMatrixWriter &src);
+
+  bool createJournal(const char *stPath, const DCOSTMATRIX_HEADER_T &hdr);
+  bool resume(const char *stPath, const DCOSTMATRIX_HEADER_T &hdr);
+
+  FILE *fout;
+  FILE *fjournal;//NULL unless createOrResume() was used
+  DCostMatrix::DCostValueType _valType;
+  int _n;
+  int _rowLast;
+  int _nextRow;
+  D_uint8 *rgRowBuf;//one row converted to _valType
+  bool fErr;
+};
+
+
+inline bool DCostMatrix::isOpen() const{
+  return (NULL != pFile);
+}
+///number of words (rows and columns) that at() can be asked about
+inline int DCostMatrix::size() const{
+  return _size;
+}
+inline int DCostMatrix::getFirstIdx() const{
+  return _firstIdx;
+}
+inline int DCostMatrix::getLastIdx() const{
+  return _lastIdx;
+}
+inline int DCostMatrix::getRowFirst() const{
+  return _rowFirst;
+}
+inline int DCostMatrix::getRowLast() const{
+  return _rowLast;
+}
+inline DCostMatrix::DCostValueType DCostMatrix::getValueType() const{
+  return _valType;
+}
+inline bool DCostMatrix::isLegacy() const{
+  return fLegacy;
+}
+inline const char* DCostMatrix::getText() const{
+  return stText;
+}
+inline const void* DCostMatrix::getData() const{
+  return (const void*)pData;
+}
+inline D_uint64 DCostMatrix::getDataLen() const{
+  return dataLen;
+}
+
+///index of the first value of row in an n-word upper triangle
+inline D_uint64 DCostMatrix::getTriangleOffset(int n, int row){
+  return ((D_uint64)row * (D_uint64)(2*(D_uint64)n - row - 1)) / 2;
+}
+
+///number of values in rows rowFirst..rowLast of an n-word upper triangle
+inline D_uint64 DCostMatrix::getNumValues(int n, int rowFirst, int rowLast){
+  return getTriangleOffset(n, rowLast+1) - getTriangleOffset(n, rowFirst);
+}
+
+///convert an IEEE half float to a float (handles subnormals, inf, nan)
+inline float DCostMatrix::halfToFloat(D_uint16 h){
+  union{ D_uint32 u; float f; } v;
+  D_uint32 sign, expo, mant;
+  sign = ((D_uint32)(h & 0x8000)) << 16;
+  expo = (h >> 10) & 0x1f;
+  mant = h & 0x3ff;
+  if(0x1f == expo)//inf or nan
+    v.u = sign | 0x7f800000 | (mant << 13);
+  else if(0 != expo)//normal
+    v.u = sign | ((expo + 112) << 23) | (mant << 13);
+  else if(0 == mant)
+    v.u = sign;
+  else{//subnormal half is a normal float
+    expo = 113;
+    while(0 == (mant & 0x400)){
+      mant <<= 1;
+      --expo;
+    }
+    v.u = sign | (expo << 23) | ((mant & 0x3ff) << 13);
+  }
+  return v.f;
+}
+
+///cost between words i and j (0 if i==j)
+/**i and j are 0..size()-1, relative to the range given to
+   selectRange() (or to getFirstIdx() if it wasn't called).  No
+   bounds checking is done.*/
+inline double DCostMatrix::at(int i, int j) const{
+  D_uint64 idx;
+  if(i == j)
+    return 0.;
+  i += _offs;
+  j += _offs;
+  if(fLegacy)
+    idx = (D_uint64)i * (D_uint64)_n + (D_uint64)j;
+  else{
+    if(i > j){
+      int tmp = i;
+      i = j;
+      j = tmp;
+    }
+    idx = getTriangleOffset(_n, i) - _rowFirstOffs + (D_uint64)(j - i - 1);
+  }
+  switch(_valType){
+    case CostValue_f16:
+      return (double)halfToFloat(((const D_uint16*)pData)[idx]);
+    case CostValue_f32:
+      return (double)(((const float*)pData)[idx]);
+    default:
+      break;
+  }
+  return ((const double*)pData)[idx];
+}
+
+inline int DCostMatrixWriter::getNextRow() const{
+  return _nextRow;
+}
+
+#endif
@@ -11,7 +11,8 @@ enum  D_AllocationMethod{
   AllocationMethod_daligned,///<allocated w/ daligned_malloc(use daligned_free)
   AllocationMethod_malloc, ///<allocated with malloc (so use free)
   AllocationMethod_new,///<allocated with new (so use delete)
-  AllocationMethod_src ///< whatever method the source image used (copy,etc.)
+  AllocationMethod_src, ///< whatever method the source image used (copy,etc.)
+  AllocationMethod_mapped///<points into an mmap()ed file (so use munmap)
 };
 
 //if the machine is big-endian, change this to 0
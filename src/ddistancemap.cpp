@@ -6,9 +6,6 @@ void DDistanceMap::getDistFromInkBitonal_(DImage &dst, DImage &src,
 					  int maxDist, int maxNegDist){
   //  DImage imgResult;
   int w, h;
-  D_uint8 *pu8;
-  D_sint32 *ps32;
-  const int MAXDIST = 9999;
   if(src.getImageType() != DImage::DImage_u8){
     fprintf(stderr, "DDistanceMap::getDistFromInkBitonal() only works on "
 	    "grayscale images\n");
@@ -16,10 +13,21 @@ void DDistanceMap::getDistFromInkBitonal_(DImage &dst, DImage &src,
   }
   w = src.width();
   h = src.height();
-  pu8 = src.dataPointer_u8();
   dst.create(w,h,DImage::DImage_u32,1);
   //dst.fill(0.); //don't fill - we are going to overwrite it all anyway
-  ps32 = (D_sint32*)dst.dataPointer_u32();
+  getDistFromInkBitonalBuf((D_sint32*)dst.dataPointer_u32(),
+			   src.dataPointer_u8(), w, h, maxDist, maxNegDist);
+}
+
+///same as getDistFromInkBitonal_(), but on raw buffers supplied by the caller
+/**pu8 is a w by h grayscale image and ps32 must have room for w*h
+   values.  This lets callers that compute many distance maps (like
+   DMorphInk::getCost()) reuse their own buffers instead of having dst
+   reallocated every time.*/
+void DDistanceMap::getDistFromInkBitonalBuf(D_sint32 *ps32, const D_uint8 *pu8,
+					    int w, int h,
+					    int maxDist, int maxNegDist){
+  const int MAXDIST = 9999;
 
   //first pass - forward -----------------------------------
   //first pixel (x=0, y=0)
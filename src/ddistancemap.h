@@ -10,6 +10,9 @@ public:
 				      int maxNegDist=-12);
   static void getDistFromInkBitonal_(DImage &dst, DImage &src, int maxDist=240,
 				     int maxNegDist=-12);
+  static void getDistFromInkBitonalBuf(D_sint32 *ps32, const D_uint8 *pu8,
+				       int w, int h, int maxDist=240,
+				       int maxNegDist=-12);
 
 };
 inline DImage DDistanceMap::getDistFromInkBitonal(DImage &src, int maxDist,
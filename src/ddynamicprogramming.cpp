@@ -2,6 +2,13 @@
 #include "dmath.h"
 #include "dcolorspace.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(D_NOSIMD)
+#define DYNPROG_SIMD 1
+#include <immintrin.h>
+#else
+#define DYNPROG_SIMD 0
+#endif
+
 //whichOne says which is the min.  Ties go to c so diagonal is preferred.
 static inline double min3double(double a, double b, double c, int *whichOne){
   if(a < b){
@@ -25,6 +32,216 @@ static inline double min3double(double a, double b, double c, int *whichOne){
 
 
 
+#if DYNPROG_SIMD
+static bool cpuHasAVX2(){
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+}
+bool DDynamicProgramming::fUseSIMD = cpuHasAVX2();
+#else
+bool DDynamicProgramming::fUseSIMD = false;
+#endif
+
+//rgD[j] = squared distance between column i-1 of fv1 and column j-1 of fv2
+//for j = lo..hi.  Each cell adds up its dimensions in order starting from 0.
+//so every layout (and the AVX2 version below) gives the same d as the
+//original grouped-by-dimension loop.  Float data is subtracted and squared
+//as float and then added up as double.  The AVX2 version only matches
+//bitwise because the library is built with -ffp-contract=off (otherwise
+//t*t added to rgD[j] can become an FMA here and not there).
+static void getLocalCostRow_scalar(const DFeatureVector &fv1,
+				   const DFeatureVector &fv2,
+				   int i, int lo, int hi, double *rgD){
+  int Wa, Wb, dims;
+  Wa = fv1.vectLen;
+  Wb = fv2.vectLen;
+  dims = fv1.dimensions;
+  if(fv1.fDataGroupedByDim){
+    for(int j = lo; j <= hi; ++j)
+      rgD[j] = 0.;
+    for(int k = 0; k < dims; ++k){
+      if(fv1.fDataIsDouble){
+	double a;
+	const double *pb;
+	a = fv1.pDbl[Wa*k+i-1];
+	pb = fv2.pDbl + Wb*k - 1;
+	for(int j = lo; j <= hi; ++j){
+	  double t;
+	  t = a - pb[j];
+	  rgD[j] += t*t;
+	}
+      }
+      else{
+	float a;
+	const float *pb;
+	a = fv1.pFlt[Wa*k+i-1];
+	pb = fv2.pFlt + Wb*k - 1;
+	for(int j = lo; j <= hi; ++j){
+	  float t;
+	  t = a - pb[j];
+	  rgD[j] += (double)(t*t);
+	}
+      }
+    }
+  }
+  else{//interleaved: dims values for column 0, then column 1, ...
+    for(int j = lo; j <= hi; ++j){
+      double d = 0.;
+      if(fv1.fDataIsDouble){
+	const double *pa, *pb;
+	pa = fv1.pDbl + (i-1)*dims;
+	pb = fv2.pDbl + (j-1)*dims;
+	for(int k = 0; k < dims; ++k){
+	  double t;
+	  t = pa[k] - pb[k];
+	  d += t*t;
+	}
+      }
+      else{
+	const float *pa, *pb;
+	pa = fv1.pFlt + (i-1)*dims;
+	pb = fv2.pFlt + (j-1)*dims;
+	for(int k = 0; k < dims; ++k){
+	  float t;
+	  t = pa[k] - pb[k];
+	  d += (double)(t*t);
+	}
+      }
+      rgD[j] = d;
+    }
+  }
+}
+
+#if DYNPROG_SIMD
+//AVX2 version of getLocalCostRow_scalar() that does 4 cells (j values) at a
+//time.  Interleaved data is only done here if there are exactly 4
+//dimensions (each group of 4 cells is transposed so each dimension can be
+//added in the same order as the scalar code).  Returns the first j that was
+//not done (the caller does the rest with getLocalCostRow_scalar()).
+__attribute__((target("avx2")))
+static int getLocalCostRow_avx2(const DFeatureVector &fv1,
+				const DFeatureVector &fv2,
+				int i, int lo, int hi, double *rgD){
+  int Wa, Wb, dims;
+  int j;
+  Wa = fv1.vectLen;
+  Wb = fv2.vectLen;
+  dims = fv1.dimensions;
+  j = lo;
+  if(fv1.fDataGroupedByDim){
+    if(fv1.fDataIsDouble){
+      for( ; (j+3) <= hi; j += 4){
+	__m256d acc = _mm256_setzero_pd();
+	for(int k = 0; k < dims; ++k){
+	  __m256d t;
+	  t = _mm256_sub_pd(_mm256_set1_pd(fv1.pDbl[Wa*k+i-1]),
+			    _mm256_loadu_pd(fv2.pDbl + Wb*k + j - 1));
+	  acc = _mm256_add_pd(acc, _mm256_mul_pd(t, t));
+	}
+	_mm256_storeu_pd(rgD + j, acc);
+      }
+    }
+    else{
+      for( ; (j+3) <= hi; j += 4){
+	__m256d acc = _mm256_setzero_pd();
+	for(int k = 0; k < dims; ++k){
+	  __m128 t;
+	  t = _mm_sub_ps(_mm_set1_ps(fv1.pFlt[Wa*k+i-1]),
+			 _mm_loadu_ps(fv2.pFlt + Wb*k + j - 1));
+	  acc = _mm256_add_pd(acc, _mm256_cvtps_pd(_mm_mul_ps(t, t)));
+	}
+	_mm256_storeu_pd(rgD + j, acc);
+      }
+    }
+  }
+  else if(4 == dims){
+    if(fv1.fDataIsDouble){
+      const double *pa;
+      __m256d a0, a1, a2, a3;
+      pa = fv1.pDbl + (i-1)*4;
+      a0 = _mm256_set1_pd(pa[0]);
+      a1 = _mm256_set1_pd(pa[1]);
+      a2 = _mm256_set1_pd(pa[2]);
+      a3 = _mm256_set1_pd(pa[3]);
+      for( ; (j+3) <= hi; j += 4){
+	const double *pb;
+	__m256d r0, r1, r2, r3, t0, t1, t2, t3, acc;
+	pb = fv2.pDbl + (j-1)*4;
+	r0 = _mm256_loadu_pd(pb);//the 4 dims of cell j
+	r1 = _mm256_loadu_pd(pb + 4);
+	r2 = _mm256_loadu_pd(pb + 8);
+	r3 = _mm256_loadu_pd(pb + 12);
+	//transpose so r0 has dim 0 of the 4 cells, etc.
+	t0 = _mm256_unpacklo_pd(r0, r1);
+	t1 = _mm256_unpackhi_pd(r0, r1);
+	t2 = _mm256_unpacklo_pd(r2, r3);
+	t3 = _mm256_unpackhi_pd(r2, r3);
+	r0 = _mm256_permute2f128_pd(t0, t2, 0x20);
+	r1 = _mm256_permute2f128_pd(t1, t3, 0x20);
+	r2 = _mm256_permute2f128_pd(t0, t2, 0x31);
+	r3 = _mm256_permute2f128_pd(t1, t3, 0x31);
+	t0 = _mm256_sub_pd(a0, r0);
+	acc = _mm256_add_pd(_mm256_setzero_pd(), _mm256_mul_pd(t0, t0));
+	t1 = _mm256_sub_pd(a1, r1);
+	acc = _mm256_add_pd(acc, _mm256_mul_pd(t1, t1));
+	t2 = _mm256_sub_pd(a2, r2);
+	acc = _mm256_add_pd(acc, _mm256_mul_pd(t2, t2));
+	t3 = _mm256_sub_pd(a3, r3);
+	acc = _mm256_add_pd(acc, _mm256_mul_pd(t3, t3));
+	_mm256_storeu_pd(rgD + j, acc);
+      }
+    }
+    else{
+      const float *pa;
+      __m128 a0, a1, a2, a3;
+      pa = fv1.pFlt + (i-1)*4;
+      a0 = _mm_set1_ps(pa[0]);
+      a1 = _mm_set1_ps(pa[1]);
+      a2 = _mm_set1_ps(pa[2]);
+      a3 = _mm_set1_ps(pa[3]);
+      for( ; (j+3) <= hi; j += 4){
+	const float *pb;
+	__m128 r0, r1, r2, r3;
+	__m256d acc;
+	pb = fv2.pFlt + (j-1)*4;
+	r0 = _mm_loadu_ps(pb);
+	r1 = _mm_loadu_ps(pb + 4);
+	r2 = _mm_loadu_ps(pb + 8);
+	r3 = _mm_loadu_ps(pb + 12);
+	_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+	r0 = _mm_sub_ps(a0, r0);
+	acc = _mm256_add_pd(_mm256_setzero_pd(),
+			    _mm256_cvtps_pd(_mm_mul_ps(r0, r0)));
+	r1 = _mm_sub_ps(a1, r1);
+	acc = _mm256_add_pd(acc, _mm256_cvtps_pd(_mm_mul_ps(r1, r1)));
+	r2 = _mm_sub_ps(a2, r2);
+	acc = _mm256_add_pd(acc, _mm256_cvtps_pd(_mm_mul_ps(r2, r2)));
+	r3 = _mm_sub_ps(a3, r3);
+	acc = _mm256_add_pd(acc, _mm256_cvtps_pd(_mm_mul_ps(r3, r3)));
+	_mm256_storeu_pd(rgD + j, acc);
+      }
+    }
+  }
+  return j;
+}
+#endif
+
+//fill in rgD[lo..hi] for row i of the DP table (see getLocalCostRow_scalar())
+static inline void getLocalCostRow(const DFeatureVector &fv1,
+				   const DFeatureVector &fv2,
+				   int i, int lo, int hi, double *rgD){
+#if DYNPROG_SIMD
+  if(DDynamicProgramming::fUseSIMD){
+    lo = getLocalCostRow_avx2(fv1, fv2, i, lo, hi, rgD);
+    if(lo > hi)
+      return;
+  }
+#endif
+  getLocalCostRow_scalar(fv1, fv2, i, lo, hi, rgD);
+}
+
+
+
 ///Find the DP alignment cost (and alignment if desired) between 2 feature vects
 /** This finds optimal alignment of fv1 to fv2 according to the
     Dynamic Time Warping algorithm used by Rath and Manmatha.  Rath
@@ -43,6 +260,10 @@ static inline double min3double(double a, double b, double c, int *whichOne){
     memory), they must already be allocated to at least
     (1+fv1.vectLen)*(1+fv2.vectLen).
 
+    fv1 and fv2 may hold double or float data, grouped by dimension or
+    interleaved, as long as both are the same.  The cost is the same
+    for double data in either layout.
+
     TODO: nonDiagonalCost is empirically chosen right now.  The higher
     this cost, the more linear the DP warped will be because it makes
     it more costly to stretch or compress (go east or south) than to
@@ -59,13 +280,13 @@ double DDynamicProgramming::findDPAlignment(const DFeatureVector &fv1,
   // parameter variables:
   //   int *rgPrev; /* table of which direction was best (previous) */
   //   double *rgTable; /* Dynamic Time Warping table */
-  int i, j, k; /* i=table row, j=table col, k=feature number */
+  int i, j; /* i=table row, j=table col */
   int Wa, Wb; /* Wa=width of word a (same as feature len), likewise for b */
   int WaPlus1, WbPlus1, WbPlus2;
   double d; /* current cost of aligning features i of word a with features j of
 	      word b.  This is added to minimum previoud cost (min of W,NW,N)*/
+  double *rgD; /* d for each j of the current row (see getLocalCostRow()) */
   int idx;
-  int dims;
   int whichOne;
   bool fAllocTable = false;
   bool fAllocPrev = false;
@@ -75,7 +296,6 @@ double DDynamicProgramming::findDPAlignment(const DFeatureVector &fv1,
   WaPlus1 = Wa+1;
   WbPlus1 = Wb+1;
   WbPlus2 = Wb+2;
-  dims = fv1.dimensions;
 
   if(bandRadius < 2){
     fprintf(stderr, "Warning: DDynamicProgramming::findDPAlignment() changing "
@@ -110,6 +330,8 @@ double DDynamicProgramming::findDPAlignment(const DFeatureVector &fv1,
     D_CHECKPTR(rgPrev);
     fAllocPrev = true;
   }
+  rgD = (double*)malloc(sizeof(double) * WbPlus1);
+  D_CHECKPTR(rgD);
     /* initialize the first row and column of table */
 
   for(j = 0; j < WbPlus1; ++j){
@@ -123,119 +345,24 @@ double DDynamicProgramming::findDPAlignment(const DFeatureVector &fv1,
   rgTable[0] = 0;
 
   /* we are doing this one-based, even though the features are 0-based,
-     that is why we have i-1 and j-1 in the feature index, because we
+     that is why rgD[j] is the cost of features i-1 and j-1, because we
      have the initial row and col 0 initialized above so we don't have to
      check for row/col 0 every time through the loop */
-  if(fv1.fDataGroupedByDim){
-    if(fv1.fDataIsDouble){
-      for(i = 1; i < WaPlus1; ++i){
-	for(j = 1; j < WbPlus1; ++j){
-	  d= 0.;
-	  idx = i*WbPlus1+j;
-	  for(k = 0; k < dims; ++k){
-	    d += ((fv1.pDbl[Wa*k+i-1] - fv2.pDbl[Wb*k+j-1]) *
-		  (fv1.pDbl[Wa*k+i-1] - fv2.pDbl[Wb*k+j-1]));
-	  }
-	  // rgTable[idx] = d + min3double(nonDiagonalCost + rgTable[idx-1]+
-	  // 				checkBandCost(i-1,j,Wa,Wb,bandRadius,
-	  // 					      bandCost),
-	  // 				nonDiagonalCost + 
-	  // 				rgTable[idx-WbPlus1] +
-	  // 				checkBandCost(i,j-1,Wa,Wb, bandRadius,
-	  // 					      bandCost),
-	  // 				rgTable[idx-WbPlus2]+
-	  // 				checkBandCost(i-1,j-1,Wa,Wb,bandRadius,
-	  // 					      bandCost),
-	  // 				&whichOne);
-	  double bc;//bandcost
-	  bc = checkBandCost(i,j,Wa,Wb,bandRadius, bandCost);
-	  rgTable[idx] = d + min3double(nonDiagonalCost + rgTable[idx-1]+bc,
-	  				nonDiagonalCost + rgTable[idx-WbPlus1] + bc,
-	  				rgTable[idx-WbPlus2]+ bc,
-	  				&whichOne);
-	  rgPrev[idx] = whichOne;
-	}//for j
-      }//for i
-    }//if(fv1.fDataIsDouble)
-    else{// data is float, so use float arrays (pFlt) in DFeatureVectors
-      fprintf(stderr,"NYI!!! (%s:%d)\n",__FILE__,__LINE__);
-      exit(1);
-      for(i = 1; i < WaPlus1; ++i){
-	for(j = 1; j < WbPlus1; ++j){
-	  d= 0.;
-	  idx = i*WbPlus1+j;
-	  for(k = 0; k < dims; ++k){
-	    d += ((double)((fv1.pFlt[Wa*k+i-1] - fv2.pFlt[Wb*k+j-1]) *
-			      (fv1.pFlt[Wa*k+i-1] - fv2.pFlt[Wb*k+j-1])));
-	  }
-	  rgTable[idx] = d + min3double(nonDiagonalCost +rgTable[idx-1]+
-					checkBandCost(i-1,j,Wa,Wb,bandRadius,
-						      bandCost),
-					nonDiagonalCost +
-					rgTable[idx-WbPlus1] +
-					checkBandCost(i,j-1,Wa,Wb, bandRadius,
-						      bandCost),
-					rgTable[idx-WbPlus2]+
-					checkBandCost(i-1,j-1,Wa,Wb,bandRadius,
-						      bandCost),
-					&whichOne);
-	  rgPrev[idx] = whichOne;
-	}//for j
-      }//for i
-    }//else
-  }//if(fv1.fGroupedByDim)
-  else{// data is not grouped by dimension.  interleaved instead
-      fprintf(stderr,"NYI!!! (%s:%d)\n",__FILE__,__LINE__);
-      exit(1);
-    if(fv1.fDataIsDouble){
-      for(i = 1; i < WaPlus1; ++i){
-	for(j = 1; j < WbPlus1; ++j){
-	  d= 0.;
-	  idx = i*WbPlus1+j;
-	  for(k = 0; k < dims; ++k){
-	    d += ((fv1.pDbl[(i-1)*dims+k] - fv2.pDbl[(j-1)*dims+k]) *
-		  (fv1.pDbl[(i-1)*dims+k] - fv2.pDbl[(j-1)*dims+k]));
-	  }
-	  rgTable[idx] = d + min3double(nonDiagonalCost +rgTable[idx-1]+
-					checkBandCost(i-1,j,Wa,Wb,bandRadius,
-						      bandCost),
-					nonDiagonalCost +
-					rgTable[idx-WbPlus1] +
-					checkBandCost(i,j-1,Wa,Wb, bandRadius,
-						      bandCost),
-					rgTable[idx-WbPlus2]+
-					checkBandCost(i-1,j-1,Wa,Wb,bandRadius,
-						      bandCost),
-					&whichOne);
-	  rgPrev[idx] = whichOne;
-	}//for j
-      }//for i
-    }//if(fv1.fDataIsDouble)
-    else{// data is float, so use float arrays (pFlt) in DFeatureVectors
-      for(i = 1; i < WaPlus1; ++i){
-	for(j = 1; j < WbPlus1; ++j){
-	  d= 0.;
-	  idx = i*WbPlus1+j;
-	  for(k = 0; k < dims; ++k){
-	    d += ((double)((fv1.pFlt[(i-1)*dims+k] - fv2.pFlt[(j-1)*dims+k]) *
-			       (fv1.pFlt[(i-1)*dims+k] - fv2.pFlt[(j-1)*dims+k])));
-	  }
-	  rgTable[idx] = d + min3double(nonDiagonalCost +rgTable[idx-1]+
-					checkBandCost(i-1,j,Wa,Wb,bandRadius,
-						      bandCost),
-					nonDiagonalCost +
-					rgTable[idx-WbPlus1] +
-					checkBandCost(i,j-1,Wa,Wb, bandRadius,
-						      bandCost),
-					rgTable[idx-WbPlus2]+
-					checkBandCost(i-1,j-1,Wa,Wb,bandRadius,
-						      bandCost),
-					&whichOne);
-	  rgPrev[idx] = whichOne;
-	}//for j
-      }//for i
-    }//else
-  }
+  for(i = 1; i < WaPlus1; ++i){
+    getLocalCostRow(fv1, fv2, i, 1, Wb, rgD);
+    for(j = 1; j < WbPlus1; ++j){
+      double bc;//bandcost
+      d = rgD[j];
+      idx = i*WbPlus1+j;
+      bc = checkBandCost(i,j,Wa,Wb,bandRadius, bandCost);
+      rgTable[idx] = d + min3double(nonDiagonalCost + rgTable[idx-1]+bc,
+				    nonDiagonalCost + rgTable[idx-WbPlus1] + bc,
+				    rgTable[idx-WbPlus2]+ bc,
+				    &whichOne);
+      rgPrev[idx] = whichOne;
+    }//for j
+  }//for i
+  free(rgD);
   if(NULL != pathLen)
     (*pathLen) = 0;
   pLen = 0;
@@ -321,6 +448,620 @@ double DDynamicProgramming::findDPAlignment(const DFeatureVector &fv1,
   return d;
 }
 
+//these are the two halves of checkBandCost() (and must stay the same as it).
+//cell i,j is in the band if both are true
+static inline bool bandLowerOK(int i, int j, int Wa, int Wb, int bandRadius){
+  return !(i > ((Wa * j / (double)Wb) + bandRadius));
+}
+static inline bool bandUpperOK(int i, int j, int Wa, int Wb, int bandRadius){
+  return !(j > ((((Wa-1)+Wb * i) /  (double)Wa) + bandRadius));
+}
+
+//find the first and last in-band column of each row 1..Wa (row 0 is just
+//cell 0,0) and where each row starts in the banded table.  The arrays may
+//be NULL if only the returned number of cells is needed.
+static int computeBandRows(int Wa, int Wb, int bandRadius,
+			   int *rgLo, int *rgHi, int *rgStart){
+  int lo, hi, numCells;
+  if(NULL != rgLo){
+    rgLo[0] = rgHi[0] = 0;
+    rgStart[0] = 0;
+  }
+  numCells = 1;
+  lo = hi = 1;
+  //both ends only move right as i increases, so this is O(Wa+Wb)
+  for(int i=1; i <= Wa; ++i){
+    while((lo < Wb) && !bandLowerOK(i, lo, Wa, Wb, bandRadius))
+      ++lo;
+    if(hi < lo)
+      hi = lo;
+    while((hi < Wb) && bandUpperOK(i, hi+1, Wa, Wb, bandRadius))
+      ++hi;
+    if(NULL != rgLo){
+      rgLo[i] = lo;
+      rgHi[i] = hi;
+      rgStart[i] = numCells;
+    }
+    numCells += hi - lo + 1;
+  }
+  return numCells;
+}
+
+///number of cells rgPrev and rgTable need for findDPAlignmentBanded()
+int DDynamicProgramming::getBandedTableSize(int Wa, int Wb, int bandRadius){
+  if(bandRadius < 2)
+    bandRadius = 2;
+  return computeBandRows(Wa, Wb, bandRadius, NULL, NULL, NULL);
+}
+
+///Same as findDPAlignment(), but only the Sakoe-Chiba band is stored and computed
+/** findDPAlignment() fills in the whole (1+Wa)*(1+Wb) table and adds
+    bandCost to the cells outside of the band (the same band
+    checkBandCost() uses).  This version first fills in only the cells
+    within the band, which is about (2*bandRadius+1)*max(Wa,Wb) cells,
+    treating the cells outside of it as unreachable.  A path that
+    leaves the band costs at least bandCost (row 0 and column 0 start
+    at bandCost, every other cell outside the band adds it, and the
+    table never decreases along a path), so if the in-band cost at
+    Wa,Wb is less than bandCost, no such path can beat or tie it and
+    the cost and path are exactly what findDPAlignment() gives.
+    Otherwise (or if nonDiagonalCost is negative) findDPAlignment() is
+    called on a locally allocated full table instead, so the result is
+    always the same as findDPAlignment() with the same bandCost.  Pass
+    HUGE_VAL as the bandCost for a hard band (paths can't leave it).
+
+    rgPath is the same as for findDPAlignment() (it needs at most
+    Wa+Wb slots).  rgPrev and rgTable, if not NULL, must have
+    getBandedTableSize(Wa,Wb,bandRadius) slots, and rgBandRows, if not
+    NULL, must have 3*(Wa+1) slots.  Any that are NULL are allocated
+    and freed locally.
+**/
+double DDynamicProgramming::findDPAlignmentBanded(const DFeatureVector &fv1,
+						  const DFeatureVector &fv2,
+						  int bandRadius,
+						  double bandCost,
+						  double nonDiagonalCost,
+						  int *pathLen, int *rgPath,
+						  int *rgPrev, double *rgTable,
+						  int *rgBandRows){
+  int i, j;
+  int Wa, Wb;
+  int whichOne;
+  int numCells;
+  int pLen;
+  int *rgLo, *rgHi, *rgStart;//first/last column and table offset of each row
+  bool fAllocTable = false;
+  bool fAllocPrev = false;
+  bool fAllocRows = false;
+  double d;
+  double *rgD;//d for each j of the current row (see getLocalCostRow())
+  const double dblUnreachable = HUGE_VAL;
+
+  Wa = fv1.vectLen;
+  Wb = fv2.vectLen;
+  if(bandRadius < 2){
+    fprintf(stderr, "Warning: DDynamicProgramming::findDPAlignmentBanded() "
+	    "changing bandRadius to 2 (was set to %d)\n",bandRadius);
+    bandRadius = 2;
+  }
+  if((fv1.dimensions) != (fv2.dimensions)){
+    fprintf(stderr, "DDynamicProgramming::findDPAlignmentBanded() dimensions "
+	    "of fv1 (%d) and fv2 (%d) must be equal!\n", fv1.dimensions,
+	    fv2.dimensions);
+    exit(1);
+  }
+  if(((fv1.fDataIsDouble)!=(fv2.fDataIsDouble)) ||
+     ((fv1.fDataGroupedByDim)!=(fv2.fDataGroupedByDim))){
+    fprintf(stderr, "DDynamicProgramming::findDPAlignmentBanded() fv1 and fv2 must "
+	    "have the same data type and layout!\n");
+    exit(1);
+  }
+  if((Wa < 1) || (Wb < 1)){
+    fprintf(stderr, "DDynamicProgramming::findDPAlignmentBanded() empty "
+	    "feature vector (Wa=%d Wb=%d)\n", Wa, Wb);
+    exit(1);
+  }
+
+  if(NULL == rgBandRows){
+    rgBandRows = (int*)malloc(sizeof(int) * 3 * (Wa+1));
+    D_CHECKPTR(rgBandRows);
+    fAllocRows = true;
+  }
+  rgLo = rgBandRows;
+  rgHi = rgLo + (Wa+1);
+  rgStart = rgHi + (Wa+1);
+  numCells = computeBandRows(Wa, Wb, bandRadius, rgLo, rgHi, rgStart);
+  if(NULL == rgTable){
+    rgTable = (double*)malloc(sizeof(double) * numCells);
+    D_CHECKPTR(rgTable);
+    fAllocTable = true;
+  }
+  if(NULL == rgPrev){
+    rgPrev = (int*)malloc(sizeof(int) * numCells);
+    D_CHECKPTR(rgPrev);
+    fAllocPrev = true;
+  }
+  rgD = (double*)malloc(sizeof(double) * (Wb+1));
+  D_CHECKPTR(rgD);
+
+  rgTable[0] = 0.;//cell 0,0. The rest of row 0 and column 0 are unreachable
+  rgPrev[0] = 3;
+  for(i = 1; i <= Wa; ++i){
+    int lo, hi, loPrev, hiPrev;
+    double *pRow, *pRowPrev;
+    int *pPrevDir;
+    lo = rgLo[i];
+    hi = rgHi[i];
+    loPrev = rgLo[i-1];
+    hiPrev = rgHi[i-1];
+    //pRow[j] and pRowPrev[j] are table cells i,j and i-1,j (when in the band)
+    pRow = rgTable + rgStart[i] - lo;
+    pRowPrev = rgTable + rgStart[i-1] - loPrev;
+    pPrevDir = rgPrev + rgStart[i] - lo;
+    getLocalCostRow(fv1, fv2, i, lo, hi, rgD);
+    for(j = lo; j <= hi; ++j){
+      double west, north, diag;
+      d = rgD[j];
+      west = (j > lo) ? (nonDiagonalCost + pRow[j-1]) : dblUnreachable;
+      north = ((j >= loPrev) && (j <= hiPrev)) ?
+	(nonDiagonalCost + pRowPrev[j]) : dblUnreachable;
+      diag = (((j-1) >= loPrev) && ((j-1) <= hiPrev)) ?
+	pRowPrev[j-1] : dblUnreachable;
+      pRow[j] = d + min3double(west, north, diag, &whichOne);
+      pPrevDir[j] = whichOne;
+    }
+  }
+  free(rgD);
+
+  //see the comment above: a path that leaves the band could win
+  if((bandCost < HUGE_VAL) &&
+     !((nonDiagonalCost >= 0.) && (rgTable[numCells-1] < bandCost))){
+    if(fAllocTable)
+      free(rgTable);
+    if(fAllocPrev)
+      free(rgPrev);
+    if(fAllocRows)
+      free(rgBandRows);
+    return findDPAlignment(fv1, fv2, bandRadius, bandCost, nonDiagonalCost,
+			   pathLen, rgPath, NULL, NULL);
+  }
+
+  //follow the path back from Wa,Wb (it is counted first so it can be
+  //copied into rgPath forward)
+  pLen = 0;
+  i = Wa;
+  j = Wb;
+  while((i != 0) || (j != 0)){
+    if((i < 0) || (j < rgLo[i]) || (j > rgHi[i])){
+      fprintf(stderr,"ERROR! i=%d j=%d (%s:%d)\n",i,j,__FILE__,__LINE__);
+      abort();
+    }
+    ++pLen;
+    whichOne = rgPrev[rgStart[i] + j - rgLo[i]];
+    if(1 == whichOne)
+      --j;
+    else if(2 == whichOne)
+      --i;
+    else{
+      --i;
+      --j;
+    }
+  }
+  if(NULL != rgPath){
+    int pathidx;
+    pathidx = pLen-1;
+    i = Wa;
+    j = Wb;
+    while((i != 0) || (j != 0)){
+      whichOne = rgPrev[rgStart[i] + j - rgLo[i]];
+      if(1 == whichOne){ /* east (right) */
+	rgPath[pathidx] = 1;
+	--j;
+      }
+      else if(2 == whichOne){ /* south (down) */
+	rgPath[pathidx] = 2;
+	--i;
+      }
+      else{ /* diagonal (SouthEast) */
+	rgPath[pathidx] = 0;
+	--j;
+	--i;
+      }
+      --pathidx;
+    }
+  }
+  if (0 == pLen){
+    fprintf(stderr, "ERROR! (%s:%d)\n", __FILE__, __LINE__);
+    pLen = 1;
+  }
+
+  d = rgTable[numCells-1] / pLen;//cell Wa,Wb is the last one in the band
+
+  if(NULL != pathLen)
+    (*pathLen) = pLen;
+  if(fAllocTable)
+    free(rgTable);
+  if(fAllocPrev)
+    free(rgPrev);
+  if(fAllocRows)
+    free(rgBandRows);
+  return d;
+}
+
+///Hard-band findDPAlignmentBanded() cost, keeping only two rows and no path
+/** For callers that only need the cost.  Two rows of the table (and
+    of the path lengths, which the cost is normalized by) are kept
+    instead of the whole band, and nothing is kept for backtracking.
+    If they are not NULL, rgRows must have 2*(Wb+1) slots, rgLens
+    must have 2*(Wb+1) slots, and rgD (the local costs of one row)
+    must have Wb+1 slots.  Otherwise they are allocated locally.
+
+    Every path from 0,0 to Wa,Wb goes through each row, the table never
+    decreases along a path (as long as nonDiagonalCost isn't negative),
+    and no path is longer than Wa+Wb.  So once every cell of a row is
+    more than upperBound*(Wa+Wb), the final cost has to be more than
+    upperBound and the rest of the table is skipped.  If
+    nonDiagonalCost is negative, the table can decrease along a path,
+    so upperBound is ignored (the same way findDPAlignmentBanded()
+    falls back to the full table) and the whole table is always done.  In that case the
+    returned value is that lower bound (which is greater than
+    upperBound but is NOT the real cost), *pathLen is not set, and
+    *pfAbandoned (if not NULL) is set to true.  Otherwise the returned
+    cost and *pathLen are the same as findDPAlignmentBanded() gives
+    with a bandCost of HUGE_VAL (paths can't leave the band).
+**/
+double DDynamicProgramming::findDPCostOnly(const DFeatureVector &fv1,
+					   const DFeatureVector &fv2,
+					   int bandRadius,
+					   double nonDiagonalCost,
+					   double upperBound,
+					   int *pathLen,
+					   double *rgRows, int *rgLens,
+					   bool *pfAbandoned, double *rgD){
+  int i, j;
+  int Wa, Wb;
+  int whichOne;
+  int lo, hi, loPrev, hiPrev;
+  bool fAllocRows = false;
+  bool fAllocLens = false;
+  bool fAllocD = false;
+  double *pRow, *pRowPrev;//table cells i,j and i-1,j
+  int *pLen, *pLenPrev;//path lengths for the same cells
+  double d;
+  double rowMin;
+  double abandonCost;
+  const double dblUnreachable = HUGE_VAL;
+
+  Wa = fv1.vectLen;
+  Wb = fv2.vectLen;
+  if(NULL != pfAbandoned)
+    (*pfAbandoned) = false;
+  if(bandRadius < 2){
+    fprintf(stderr, "Warning: DDynamicProgramming::findDPCostOnly() "
+	    "changing bandRadius to 2 (was set to %d)\n",bandRadius);
+    bandRadius = 2;
+  }
+  if((fv1.dimensions) != (fv2.dimensions)){
+    fprintf(stderr, "DDynamicProgramming::findDPCostOnly() dimensions "
+	    "of fv1 (%d) and fv2 (%d) must be equal!\n", fv1.dimensions,
+	    fv2.dimensions);
+    exit(1);
+  }
+  if(((fv1.fDataIsDouble)!=(fv2.fDataIsDouble)) ||
+     ((fv1.fDataGroupedByDim)!=(fv2.fDataGroupedByDim))){
+    fprintf(stderr, "DDynamicProgramming::findDPCostOnly() fv1 and fv2 must "
+	    "have the same data type and layout!\n");
+    exit(1);
+  }
+  if((Wa < 1) || (Wb < 1)){
+    fprintf(stderr, "DDynamicProgramming::findDPCostOnly() empty "
+	    "feature vector (Wa=%d Wb=%d)\n", Wa, Wb);
+    exit(1);
+  }
+
+  if(NULL == rgRows){
+    rgRows = (double*)malloc(sizeof(double) * 2 * (Wb+1));
+    D_CHECKPTR(rgRows);
+    fAllocRows = true;
+  }
+  if(NULL == rgLens){
+    rgLens = (int*)malloc(sizeof(int) * 2 * (Wb+1));
+    D_CHECKPTR(rgLens);
+    fAllocLens = true;
+  }
+  if(NULL == rgD){//d for each j of the current row (see getLocalCostRow())
+    rgD = (double*)malloc(sizeof(double) * (Wb+1));
+    D_CHECKPTR(rgD);
+    fAllocD = true;
+  }
+  if(nonDiagonalCost < 0.)
+    abandonCost = HUGE_VAL;//rowMin isn't a lower bound of the final cost
+  else
+    abandonCost = upperBound * (Wa + Wb);
+
+  //rows are indexed by column j, but only loPrev..hiPrev (or lo..hi) are used
+  pRowPrev = rgRows;
+  pRow = rgRows + (Wb+1);
+  pLenPrev = rgLens;
+  pLen = rgLens + (Wb+1);
+  pRowPrev[0] = 0.;//cell 0,0. The rest of row 0 is unreachable
+  pLenPrev[0] = 0;
+  loPrev = hiPrev = 0;
+  lo = hi = 1;
+  for(i = 1; i <= Wa; ++i){
+    //same band as computeBandRows()
+    while((lo < Wb) && !bandLowerOK(i, lo, Wa, Wb, bandRadius))
+      ++lo;
+    if(hi < lo)
+      hi = lo;
+    while((hi < Wb) && bandUpperOK(i, hi+1, Wa, Wb, bandRadius))
+      ++hi;
+    getLocalCostRow(fv1, fv2, i, lo, hi, rgD);
+    rowMin = dblUnreachable;
+    for(j = lo; j <= hi; ++j){
+      double west, north, diag;
+      d = rgD[j];
+      west = (j > lo) ? (nonDiagonalCost + pRow[j-1]) : dblUnreachable;
+      north = ((j >= loPrev) && (j <= hiPrev)) ?
+	(nonDiagonalCost + pRowPrev[j]) : dblUnreachable;
+      diag = (((j-1) >= loPrev) && ((j-1) <= hiPrev)) ?
+	pRowPrev[j-1] : dblUnreachable;
+      pRow[j] = d + min3double(west, north, diag, &whichOne);
+      if(1 == whichOne)
+	pLen[j] = pLen[j-1] + 1;
+      else if(2 == whichOne)
+	pLen[j] = pLenPrev[j] + 1;
+      else
+	pLen[j] = pLenPrev[j-1] + 1;
+      if(pRow[j] < rowMin)
+	rowMin = pRow[j];
+    }
+    if(rowMin > abandonCost){
+      if(NULL != pfAbandoned)
+	(*pfAbandoned) = true;
+      if(fAllocD)
+	free(rgD);
+      if(fAllocRows)
+	free(rgRows);
+      if(fAllocLens)
+	free(rgLens);
+      return rowMin / (Wa + Wb);
+    }
+    //this row becomes the previous row
+    double *pTmp;
+    int *pTmpLen;
+    pTmp = pRowPrev;
+    pRowPrev = pRow;
+    pRow = pTmp;
+    pTmpLen = pLenPrev;
+    pLenPrev = pLen;
+    pLen = pTmpLen;
+    loPrev = lo;
+    hiPrev = hi;
+  }
+
+  //row Wa is now in pRowPrev
+  if(pLenPrev[Wb] < 1){
+    fprintf(stderr, "ERROR! (%s:%d)\n", __FILE__, __LINE__);
+    pLenPrev[Wb] = 1;
+  }
+  d = pRowPrev[Wb] / pLenPrev[Wb];
+  if(NULL != pathLen)
+    (*pathLen) = pLenPrev[Wb];
+  if(fAllocD)
+    free(rgD);
+  if(fAllocRows)
+    free(rgRows);
+  if(fAllocLens)
+    free(rgLens);
+  return d;
+}
+
+//value of dimension k of column col (0-based) for any storage layout
+static inline double featureValue(const DFeatureVector &fv, int col, int k){
+  if(fv.fDataGroupedByDim){
+    if(fv.fDataIsDouble)
+      return fv.pDbl[fv.vectLen*k+col];
+    return fv.pFlt[fv.vectLen*k+col];
+  }
+  if(fv.fDataIsDouble)
+    return fv.pDbl[col*fv.dimensions+k];
+  return fv.pFlt[col*fv.dimensions+k];
+}
+
+//squared distance from v to the interval [lower,upper]
+static inline double distToEnvelope(double v, double lower, double upper){
+  if(v > upper)
+    return (v-upper)*(v-upper);
+  if(v < lower)
+    return (lower-v)*(lower-v);
+  return 0.;
+}
+
+//Streaming min/max of rgVals over windows [rgLo[i],rgHi[i]] (indexes
+//into rgVals) for i=1..numWindows, where both ends never move left as i
+//increases (Lemire's algorithm, so O(numWindows+numVals)).  rgQueue must
+//have 2*numVals slots.  rgLower[i] and rgUpper[i] get the min and max of
+//window i.  An empty window (rgLo[i] > rgHi[i]) gets HUGE_VAL,-HUGE_VAL.
+static void slidingMinMax(const double *rgVals, int numWindows,
+			  const int *rgLo, const int *rgHi, int *rgQueue,
+			  double *rgLower, double *rgUpper){
+  int *rgMinQ, *rgMaxQ;
+  int minHead, minTail, maxHead, maxTail;
+  int next;
+  rgMinQ = rgQueue;
+  rgMaxQ = rgQueue + (rgHi[numWindows] + 1);
+  minHead = minTail = maxHead = maxTail = 0;
+  next = rgLo[1];
+  for(int i = 1; i <= numWindows; ++i){
+    if(next < rgLo[i]){//(only if a window was empty)
+      next = rgLo[i];
+      minHead = minTail = maxHead = maxTail = 0;
+    }
+    for( ; next <= rgHi[i]; ++next){
+      while((minTail > minHead) && (rgVals[rgMinQ[minTail-1]] >= rgVals[next]))
+	--minTail;
+      rgMinQ[minTail++] = next;
+      while((maxTail > maxHead) && (rgVals[rgMaxQ[maxTail-1]] <= rgVals[next]))
+	--maxTail;
+      rgMaxQ[maxTail++] = next;
+    }
+    while((minTail > minHead) && (rgMinQ[minHead] < rgLo[i]))
+      ++minHead;
+    while((maxTail > maxHead) && (rgMaxQ[maxHead] < rgLo[i]))
+      ++maxHead;
+    if(minTail > minHead){
+      rgLower[i] = rgVals[rgMinQ[minHead]];
+      rgUpper[i] = rgVals[rgMaxQ[maxHead]];
+    }
+    else{
+      rgLower[i] = HUGE_VAL;
+      rgUpper[i] = -HUGE_VAL;
+    }
+  }
+}
+
+///LB_Keogh lower bound of the findDPAlignmentBanded() cost of fv1 to fv2
+/** Every path through the banded table has at least one cell in each
+    row i, and that cell's column is somewhere in the band for row i.
+    So the cost of the path is at least the sum over i of the distance
+    from column i of fv1 to the envelope (the min and max of each
+    dimension) of fv2 over the band of row i.  The DP cost is divided
+    by the path length, which is at most Wa+Wb, so the bound is divided
+    by Wa+Wb.  The result is never more than what findDPCostOnly() or a
+    hard-band findDPAlignmentBanded() (bandCost of HUGE_VAL) return for
+    the same arguments (with nonDiagonalCost >= 0), so if it is already more than the best cost
+    found so far, the DP doesn't need to be done.  It takes
+    O((Wa+Wb)*dims) instead of O(Wa*bandRadius*dims).
+
+    The band is slanted to fit the lengths of both vectors, so the
+    envelopes depend on both and are made here (with a streaming
+    min/max) rather than stored with each DFeatureVector.
+
+    Note that findDPAlignment() and findDPAlignmentBanded() with a
+    finite bandCost let the path leave the band (for bandCost per
+    cell), so this does not bound their cost.  For float
+    data the DP rounds each squared difference to float, so the bound
+    is only good to within float rounding.
+**/
+double DDynamicProgramming::getLowerBoundKeogh(const DFeatureVector &fv1,
+					       const DFeatureVector &fv2,
+					       int bandRadius){
+  return getLowerBoundImproved(fv1, fv2, bandRadius, -1.);
+}
+
+///LB_Improved lower bound of the findDPAlignmentBanded() cost of fv1 to fv2
+/** This is getLowerBoundKeogh() plus a second pass (Lemire, 2009).
+    Each column of fv1 is projected onto the envelope of fv2 for its
+    row (call the projection H).  Every path cell i,j then costs at
+    least the distance from column i of fv1 to H[i] plus the distance
+    from H[i] to column j of fv2, so the second pass adds the distance
+    from each column j of fv2 to the envelope of H over the rows whose
+    band includes column j.  The bound is tighter than LB_Keogh and
+    still O((Wa+Wb)*dims), but costs about twice as much.
+
+    If the LB_Keogh part is already more than upperBound, the second
+    pass is skipped and that is returned.
+**/
+double DDynamicProgramming::getLowerBoundImproved(const DFeatureVector &fv1,
+						  const DFeatureVector &fv2,
+						  int bandRadius,
+						  double upperBound){
+  int Wa, Wb, dims;
+  int *rgBandRows;
+  int *rgRowLo, *rgRowHi, *rgRowStart;//band columns of each row (1-based)
+  int *rgColLo, *rgColHi;//band rows of each column (1-based)
+  int *rgQueue;
+  double *rgVals;//one dimension of fv2 (or of H)
+  double *rgLower, *rgUpper;
+  double *rgH;//the projection of fv1 onto the envelope of fv2 (grouped)
+  double lbKeogh, lbSecond;
+  int maxLen;
+
+  Wa = fv1.vectLen;
+  Wb = fv2.vectLen;
+  dims = fv1.dimensions;
+  if(bandRadius < 2)
+    bandRadius = 2;
+  if((fv1.dimensions) != (fv2.dimensions)){
+    fprintf(stderr, "DDynamicProgramming::getLowerBoundImproved() dimensions "
+	    "of fv1 (%d) and fv2 (%d) must be equal!\n", fv1.dimensions,
+	    fv2.dimensions);
+    exit(1);
+  }
+  if((Wa < 1) || (Wb < 1)){
+    fprintf(stderr, "DDynamicProgramming::getLowerBoundImproved() empty "
+	    "feature vector (Wa=%d Wb=%d)\n", Wa, Wb);
+    exit(1);
+  }
+  maxLen = (Wa > Wb) ? Wa : Wb;
+  rgBandRows = (int*)malloc(sizeof(int) * (3*(Wa+1) + 2*(Wb+1)));
+  D_CHECKPTR(rgBandRows);
+  rgRowLo = rgBandRows;
+  rgRowHi = rgRowLo + (Wa+1);
+  rgRowStart = rgRowHi + (Wa+1);
+  rgColLo = rgRowStart + (Wa+1);
+  rgColHi = rgColLo + (Wb+1);
+  rgQueue = (int*)malloc(sizeof(int) * 2 * (maxLen+1));
+  D_CHECKPTR(rgQueue);
+  rgVals = (double*)malloc(sizeof(double) * 3 * (maxLen+1));
+  D_CHECKPTR(rgVals);
+  rgLower = rgVals + (maxLen+1);
+  rgUpper = rgLower + (maxLen+1);
+  rgH = (double*)malloc(sizeof(double) * dims * (Wa+1));
+  D_CHECKPTR(rgH);
+  computeBandRows(Wa, Wb, bandRadius, rgRowLo, rgRowHi, rgRowStart);
+
+  //first pass (LB_Keogh): fv1 against the envelope of fv2 for each row
+  lbKeogh = 0.;
+  for(int k = 0; k < dims; ++k){
+    for(int j = 1; j <= Wb; ++j)
+      rgVals[j] = featureValue(fv2, j-1, k);
+    slidingMinMax(rgVals, Wa, rgRowLo, rgRowHi, rgQueue, rgLower, rgUpper);
+    for(int i = 1; i <= Wa; ++i){
+      double v;
+      v = featureValue(fv1, i-1, k);
+      lbKeogh += distToEnvelope(v, rgLower[i], rgUpper[i]);
+      if(v > rgUpper[i])
+	v = rgUpper[i];
+      else if(v < rgLower[i])
+	v = rgLower[i];
+      rgH[(Wa+1)*k+i] = v;
+    }
+  }
+
+  lbSecond = 0.;
+  if((lbKeogh / (Wa+Wb)) <= upperBound){
+    //second pass: fv2 against the envelope of H for each column.  The band
+    //rows of column j are the rows i with rgRowLo[i] <= j <= rgRowHi[i]
+    for(int j = 1, i = 1; j <= Wb; ++j){
+      while((i <= Wa) && (rgRowHi[i] < j))
+	++i;
+      rgColLo[j] = i;
+    }
+    for(int j = Wb, i = Wa; j >= 1; --j){
+      while((i >= 1) && (rgRowLo[i] > j))
+	--i;
+      rgColHi[j] = i;
+    }
+    for(int k = 0; k < dims; ++k){
+      slidingMinMax(rgH + (Wa+1)*k, Wb, rgColLo, rgColHi, rgQueue,
+		    rgLower, rgUpper);
+      for(int j = 1; j <= Wb; ++j){
+	if(rgColLo[j] <= rgColHi[j])
+	  lbSecond += distToEnvelope(featureValue(fv2, j-1, k),
+				     rgLower[j], rgUpper[j]);
+      }
+    }
+  }
+
+  free(rgBandRows);
+  free(rgQueue);
+  free(rgVals);
+  free(rgH);
+  return (lbKeogh + lbSecond) / (Wa + Wb);
+}
+
 //Do a piecewise linear warp of img1 to img2 using previously calculated rgPath
 /**This function assumes that rgPath has been calculated on DFeatureVectors extracted from img1 and img2, respectively, and having the same length as the width (or height if fVertical is true) as img1 and img2. If a column is squished, then the min value of any column mapping to it is used.  This function is mainly for debug.**/
 DImage DDynamicProgramming::piecewiseLinearWarpDImage(DImage &img1,
@@ -14,6 +14,33 @@ public:
 				int *rgPath = NULL,
 				int *rgPrev = NULL,
 				double *rgTable = NULL);
+  static double findDPAlignmentBanded(const DFeatureVector &fv1,
+				      const DFeatureVector &fv2,
+				      int bandRadius, double bandCost=1000.,
+				      double nonDiagonalCost = 0.,
+				      int *pathLen = NULL,
+				      int *rgPath = NULL,
+				      int *rgPrev = NULL,
+				      double *rgTable = NULL,
+				      int *rgBandRows = NULL);
+  static int getBandedTableSize(int Wa, int Wb, int bandRadius);
+  static double findDPCostOnly(const DFeatureVector &fv1,
+			       const DFeatureVector &fv2,
+			       int bandRadius,
+			       double nonDiagonalCost = 0.,
+			       double upperBound = HUGE_VAL,
+			       int *pathLen = NULL,
+			       double *rgRows = NULL,
+			       int *rgLens = NULL,
+			       bool *pfAbandoned = NULL,
+			       double *rgD = NULL);
+  static double getLowerBoundKeogh(const DFeatureVector &fv1,
+				   const DFeatureVector &fv2,
+				   int bandRadius);
+  static double getLowerBoundImproved(const DFeatureVector &fv1,
+				      const DFeatureVector &fv2,
+				      int bandRadius,
+				      double upperBound = HUGE_VAL);
   static DImage piecewiseLinearWarpDImage(DImage &img1, int warpToLength,
 					  int pathLen, int *rgPath,
 					  bool fVertical);
@@ -26,6 +53,9 @@ public:
 					int pathLen, int *rgPath);
   static double checkBandCost(int i,int j,int numRows,int numCols,
 			      int bandRadius, double bandCost = 1000.);
+  //compute the DP cell costs 4 at a time with AVX2 (set at startup if the
+  //CPU has it).  The results are the same either way.
+  static bool fUseSIMD;
 };
 
 ///adds high cost to anything outside of Sakoe-Chiba band
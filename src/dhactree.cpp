@@ -0,0 +1,502 @@
+#include "dhactree.h"
+#include "ddefs.h"
+#include <string.h>
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#else
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+static const char stMergeMagic[8] = {'D','H','A','C','M','E','R','G'};
+static const char stTreeMagic[8] = {'D','H','A','C','T','R','E','E'};
+
+
+DHACMergeJournal::DHACMergeJournal(){
+  fjournal = NULL;
+  _numItems = 0;
+  numMerges = 0;
+  rgMerges = NULL;
+}
+
+DHACMergeJournal::~DHACMergeJournal(){
+  close();
+}
+
+///true if stPath starts with a DHACMERGE_HEADER_T (any version)
+bool DHACMergeJournal::isMergeJournal(const char *stPath){
+  FILE *fin;
+  char stMagic[8];
+  bool fIs;
+  fin = fopen(stPath, "rb");
+  if(NULL == fin)
+    return false;
+  fIs = (1 == fread(stMagic, sizeof(stMagic), 1, fin)) &&
+    (0 == memcmp(stMagic, stMergeMagic, sizeof(stMagic)));
+  fclose(fin);
+  return fIs;
+}
+
+///open (or create) the journal at stPath for numItems items
+/**If stPath already exists its merges are read (see getMerges()) and
+   new merges will be appended after them.  Returns false if the file
+   can't be read or written, is not a merge journal, or was written for
+   a different number of items or different costs (costChecksum).*/
+bool DHACMergeJournal::open(const char *stPath, int numItems,
+			    D_uint64 costChecksum){
+  DHACMERGE_HEADER_T hdr;
+  FILE *fin;
+
+  close();
+  if(numItems < 1){
+    fprintf(stderr, "DHACMergeJournal::open() numItems=%d\n", numItems);
+    return false;
+  }
+  _numItems = numItems;
+  rgMerges = (DHACMERGE_RECORD_T*)
+    malloc(sizeof(DHACMERGE_RECORD_T) * (numItems > 1 ? numItems-1 : 1));
+  D_CHECKPTR(rgMerges);
+
+  fin = fopen(stPath, "rb");
+  if(NULL == fin){//start a new journal
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.stMagic, stMergeMagic, sizeof(hdr.stMagic));
+    hdr.byteOrderMark = 0x01020304;
+    hdr.version = DHACMERGE_VERSION;
+    hdr.numItems = numItems;
+    hdr.costChecksum = costChecksum;
+    fjournal = fopen(stPath, "wb");
+    if((NULL == fjournal) || (1 != fwrite(&hdr, sizeof(hdr), 1, fjournal)) ||
+       (0 != fflush(fjournal))){
+      fprintf(stderr, "DHACMergeJournal::open() couldn't create '%s'\n",
+	      stPath);
+      close();
+      return false;
+    }
+    return true;
+  }
+
+  //read the merges that are already there
+  long len;
+  long numRecs;
+  if((1 != fread(&hdr, sizeof(hdr), 1, fin)) ||
+     (0 != memcmp(hdr.stMagic, stMergeMagic, sizeof(stMergeMagic))) ||
+     (0x01020304 != hdr.byteOrderMark) ||
+     (DHACMERGE_VERSION != hdr.version)){
+    fprintf(stderr, "DHACMergeJournal::open() '%s' is not a version %d "
+	    "merge journal written on this machine\n", stPath,
+	    DHACMERGE_VERSION);
+    fclose(fin);
+    close();
+    return false;
+  }
+  if(hdr.numItems != numItems){
+    fprintf(stderr, "DHACMergeJournal::open() '%s' is for %d items, not %d\n",
+	    stPath, (int)hdr.numItems, numItems);
+    fclose(fin);
+    close();
+    return false;
+  }
+  if(hdr.costChecksum != costChecksum){
+    fprintf(stderr, "DHACMergeJournal::open() '%s' was made from different "
+	    "costs (delete it to start over)\n", stPath);
+    fclose(fin);
+    close();
+    return false;
+  }
+  fseek(fin, 0, SEEK_END);
+  len = ftell(fin);
+  numRecs = (len - (long)sizeof(hdr)) / (long)sizeof(DHACMERGE_RECORD_T);
+  if(numRecs > (numItems-1)){
+    fprintf(stderr, "DHACMergeJournal::open() '%s' has %ld merges but there "
+	    "can only be %d\n", stPath, numRecs, numItems-1);
+    fclose(fin);
+    close();
+    return false;
+  }
+  fseek(fin, (long)sizeof(hdr), SEEK_SET);
+  if((numRecs > 0) &&
+     ((size_t)numRecs != fread(rgMerges, sizeof(DHACMERGE_RECORD_T),
+			       (size_t)numRecs, fin))){
+    fprintf(stderr, "DHACMergeJournal::open() couldn't read '%s'\n", stPath);
+    fclose(fin);
+    close();
+    return false;
+  }
+  fclose(fin);
+  for(long m=0; m < numRecs; ++m){
+    int numLeft;
+    numLeft = numItems - (int)m;
+    if((rgMerges[m].i < 0) || (rgMerges[m].j <= rgMerges[m].i) ||
+       (rgMerges[m].j >= numLeft)){
+      fprintf(stderr, "DHACMergeJournal::open() merge %ld in '%s' (%d,%d) "
+	      "is invalid with %d nodes left\n", m, stPath,
+	      (int)rgMerges[m].i, (int)rgMerges[m].j, numLeft);
+      close();
+      return false;
+    }
+  }
+  numMerges = (int)numRecs;
+
+  //drop any partial record before appending
+  if(len != (long)(sizeof(hdr) + numRecs * sizeof(DHACMERGE_RECORD_T))){
+    int ret;
+#ifndef _WIN32
+    ret = truncate(stPath, (off_t)(sizeof(hdr) +
+				   numRecs * sizeof(DHACMERGE_RECORD_T)));
+#else
+    int fd;
+    ret = -1;
+    fd = _open(stPath, _O_RDWR | _O_BINARY);
+    if(fd >= 0){
+      ret = _chsize_s(fd, (__int64)(sizeof(hdr) +
+				    numRecs * sizeof(DHACMERGE_RECORD_T)));
+      _close(fd);
+    }
+#endif
+    if(0 != ret){
+      fprintf(stderr, "DHACMergeJournal::open() couldn't remove the partial "
+	      "merge at the end of '%s'\n", stPath);
+      close();
+      return false;
+    }
+  }
+  fjournal = fopen(stPath, "ab");
+  if(NULL == fjournal){
+    fprintf(stderr, "DHACMergeJournal::open() couldn't open '%s' to append\n",
+	    stPath);
+    close();
+    return false;
+  }
+  return true;
+}
+
+///record that nodes i and j (i < j) of the nodes left were merged
+bool DHACMergeJournal::append(int i, int j, double dist){
+  DHACMERGE_RECORD_T rec;
+  if((NULL == fjournal) || (numMerges >= (_numItems-1))){
+    fprintf(stderr, "DHACMergeJournal::append() journal is not open or "
+	    "already has every merge\n");
+    return false;
+  }
+  rec.i = i;
+  rec.j = j;
+  rec.dist = dist;
+  if((1 != fwrite(&rec, sizeof(rec), 1, fjournal)) ||
+     (0 != fflush(fjournal))){
+    fprintf(stderr, "DHACMergeJournal::append() write failed\n");
+    return false;
+  }
+  rgMerges[numMerges] = rec;
+  ++numMerges;
+  return true;
+}
+
+/*add len bytes at pData to a 64-bit FNV-1a hash*/
+static void addToHash(D_uint64 *pHash, const void *pData, size_t len){
+  for(size_t b=0; b < len; ++b){
+    (*pHash) ^= ((const D_uint8*)pData)[b];
+    (*pHash) *= 0x100000001b3ULL;
+  }
+}
+
+///checksum of the merges so far (what a tree built from them depends on)
+/**This is a 64-bit FNV-1a hash of the number of items and the i, j,
+   and dist of each merge, in order.*/
+D_uint64 DHACMergeJournal::getChecksum() const{
+  D_uint64 hash;
+  D_sint32 numItems;
+  hash = 0xcbf29ce484222325ULL;
+  numItems = _numItems;
+  addToHash(&hash, &numItems, sizeof(numItems));
+  for(int m=0; m < numMerges; ++m){
+    addToHash(&hash, &(rgMerges[m].i), sizeof(rgMerges[m].i));
+    addToHash(&hash, &(rgMerges[m].j), sizeof(rgMerges[m].j));
+    addToHash(&hash, &(rgMerges[m].dist), sizeof(rgMerges[m].dist));
+  }
+  return hash;
+}
+
+void DHACMergeJournal::close(){
+  if(NULL != fjournal)
+    fclose(fjournal);
+  fjournal = NULL;
+  if(NULL != rgMerges)
+    free(rgMerges);
+  rgMerges = NULL;
+  numMerges = 0;
+  _numItems = 0;
+}
+
+
+DHACTree::DHACTree(){
+  pFile = NULL;
+  fileLen = 0;
+  fMapped = false;
+  rgParent = rgFirstChild = rgNumChildren = rgCenterIdx = NULL;
+  rgFirstWord = rgNumWordsHere = rgNumWords = NULL;
+  rgNumDescendantNodes = rgClustID = NULL;
+  rgMaxDistFromCenter = rgSumDistFromCenter = NULL;
+  rgMaxDistFromCenterFv = rgMaxDistFromDescendantsMeanFv = NULL;
+  rgCenterAspectRatio = rgFvCenter = rgFvMean = NULL;
+  rgChildren = rgWords = rgKeyIdxs = NULL;
+}
+
+DHACTree::~DHACTree(){
+  close();
+}
+
+/*offset of each array (in the order of the members) and the file length*/
+D_uint64 DHACTree::getLayout(int numNodes, int numItems, int numKeys,
+			     D_uint64 *rgOffsets){
+  D_uint64 rgLens[DHACTREE_NUM_ARRAYS];
+  D_uint64 offs;
+  D_uint64 n, nk;
+  n = (D_uint64)numNodes;
+  nk = (D_uint64)numNodes * numKeys;
+  for(int a=0; a < 9; ++a)
+    rgLens[a] = n * sizeof(D_sint32);//rgParent..rgClustID
+  for(int a=9; a < 14; ++a)
+    rgLens[a] = n * sizeof(double);//rgMaxDistFromCenter..rgCenterAspectRatio
+  rgLens[14] = nk * sizeof(double);//rgFvCenter
+  rgLens[15] = nk * sizeof(double);//rgFvMean
+  rgLens[16] = (n > 0 ? n-1 : 0) * sizeof(D_sint32);//rgChildren
+  rgLens[17] = (D_uint64)numItems * sizeof(D_sint32);//rgWords
+  rgLens[18] = (D_uint64)numKeys * sizeof(D_sint32);//rgKeyIdxs
+  offs = sizeof(DHACTREE_HEADER_T);
+  for(int a=0; a < DHACTREE_NUM_ARRAYS; ++a){
+    offs = (offs + DHACTREE_ALIGNMENT-1) & ~(D_uint64)(DHACTREE_ALIGNMENT-1);
+    rgOffsets[a] = offs;
+    offs += rgLens[a];
+  }
+  return offs;
+}
+
+/*point the arrays at the offsets in the header of pFile*/
+void DHACTree::setPointers(){
+  const D_uint64 *rgOffs;
+  rgOffs = ((const DHACTREE_HEADER_T*)pFile)->rgOffsets;
+  rgParent = (D_sint32*)(pFile + rgOffs[0]);
+  rgFirstChild = (D_sint32*)(pFile + rgOffs[1]);
+  rgNumChildren = (D_sint32*)(pFile + rgOffs[2]);
+  rgCenterIdx = (D_sint32*)(pFile + rgOffs[3]);
+  rgFirstWord = (D_sint32*)(pFile + rgOffs[4]);
+  rgNumWordsHere = (D_sint32*)(pFile + rgOffs[5]);
+  rgNumWords = (D_sint32*)(pFile + rgOffs[6]);
+  rgNumDescendantNodes = (D_sint32*)(pFile + rgOffs[7]);
+  rgClustID = (D_sint32*)(pFile + rgOffs[8]);
+  rgMaxDistFromCenter = (double*)(pFile + rgOffs[9]);
+  rgSumDistFromCenter = (double*)(pFile + rgOffs[10]);
+  rgMaxDistFromCenterFv = (double*)(pFile + rgOffs[11]);
+  rgMaxDistFromDescendantsMeanFv = (double*)(pFile + rgOffs[12]);
+  rgCenterAspectRatio = (double*)(pFile + rgOffs[13]);
+  rgFvCenter = (double*)(pFile + rgOffs[14]);
+  rgFvMean = (double*)(pFile + rgOffs[15]);
+  rgChildren = (D_sint32*)(pFile + rgOffs[16]);
+  rgWords = (D_sint32*)(pFile + rgOffs[17]);
+  rgKeyIdxs = (D_sint32*)(pFile + rgOffs[18]);
+}
+
+///allocate (zeroed) arrays for a tree of numNodes nodes over numItems items
+bool DHACTree::create(int numItems, int numNodes, int numKeys){
+  DHACTREE_HEADER_T *phdr;
+  D_uint64 rgOffsets[DHACTREE_NUM_ARRAYS];
+  D_uint64 len;
+
+  close();
+  if((numItems < 1) || (numNodes < 1) || (numKeys < 0)){
+    fprintf(stderr, "DHACTree::create() numItems=%d numNodes=%d numKeys=%d\n",
+	    numItems, numNodes, numKeys);
+    return false;
+  }
+  len = getLayout(numNodes, numItems, numKeys, rgOffsets);
+  pFile = (D_uint8*)calloc(1, (size_t)len);
+  D_CHECKPTR(pFile);
+  fileLen = (size_t)len;
+  fMapped = false;
+  phdr = (DHACTREE_HEADER_T*)pFile;
+  memcpy(phdr->stMagic, stTreeMagic, sizeof(phdr->stMagic));
+  phdr->byteOrderMark = 0x01020304;
+  phdr->version = DHACTREE_VERSION;
+  phdr->numNodes = numNodes;
+  phdr->numItems = numItems;
+  phdr->numKeys = numKeys;
+  phdr->fileLen = len;
+  memcpy(phdr->rgOffsets, rgOffsets, sizeof(rgOffsets));
+  setPointers();
+  return true;
+}
+
+///write the tree to stPath
+/**costChecksum and mergeChecksum identify the costs and the merges the
+   tree was made from (see getCostChecksum() and getMergeChecksum()).*/
+bool DHACTree::save(const char *stPath, D_uint64 costChecksum,
+		    D_uint64 mergeChecksum) const{
+  DHACTREE_HEADER_T hdr;
+  FILE *fout;
+  bool fOk;
+  if(NULL == pFile){
+    fprintf(stderr, "DHACTree::save() there is no tree to save\n");
+    return false;
+  }
+  memcpy(&hdr, pFile, sizeof(hdr));
+  hdr.costChecksum = costChecksum;
+  hdr.mergeChecksum = mergeChecksum;
+  fout = fopen(stPath, "wb");
+  if(NULL == fout){
+    fprintf(stderr, "DHACTree::save() couldn't open '%s'\n", stPath);
+    return false;
+  }
+  fOk = (1 == fwrite(&hdr, sizeof(hdr), 1, fout)) &&
+    (1 == fwrite(pFile + sizeof(hdr), fileLen - sizeof(hdr), 1, fout));
+  if(0 != fclose(fout))
+    fOk = false;
+  if(!fOk){
+    fprintf(stderr, "DHACTree::save() couldn't write '%s'\n", stPath);
+    remove(stPath);
+  }
+  return fOk;
+}
+
+/*check that the indexes in the arrays are all in range*/
+bool DHACTree::isConsistent() const{
+  int numNodes, numItems, numKeys;
+  numNodes = getNumNodes();
+  numItems = getNumItems();
+  numKeys = getNumKeys();
+  if(-1 != rgParent[0])
+    return false;
+  for(int n=0; n < numNodes; ++n){
+    if((n > 0) && ((rgParent[n] < 0) || (rgParent[n] >= numNodes)))
+      return false;
+    if((rgNumChildren[n] < 0) || (rgFirstChild[n] < 0) ||
+       ((D_uint64)rgFirstChild[n] + rgNumChildren[n] > (D_uint64)numNodes-1))
+      return false;
+    if((rgCenterIdx[n] < 0) || (rgCenterIdx[n] >= numItems))
+      return false;
+    if((rgNumWords[n] < rgNumWordsHere[n]) || (rgNumWordsHere[n] < 0) ||
+       (rgFirstWord[n] < 0) ||
+       ((D_uint64)rgFirstWord[n] + rgNumWords[n] > (D_uint64)numItems))
+      return false;
+  }
+  for(int c=0; c < numNodes-1; ++c){
+    if((rgChildren[c] < 1) || (rgChildren[c] >= numNodes))
+      return false;
+  }
+  for(int w=0; w < numItems; ++w){
+    if((rgWords[w] < 0) || (rgWords[w] >= numItems))
+      return false;
+  }
+  for(int k=0; k < numKeys; ++k){
+    if((rgKeyIdxs[k] < 0) || (rgKeyIdxs[k] >= numItems))
+      return false;
+  }
+  return true;
+}
+
+///map a tree file written by save() (read-only)
+bool DHACTree::open(const char *stPath){
+  const DHACTREE_HEADER_T *phdr;
+  D_uint64 rgOffsets[DHACTREE_NUM_ARRAYS];
+
+  close();
+#ifndef _WIN32
+  int fd;
+  struct stat st;
+  void *pMap;
+  fd = ::open(stPath, O_RDONLY);
+  if(fd < 0){
+    fprintf(stderr, "DHACTree::open() couldn't open '%s'\n", stPath);
+    return false;
+  }
+  if((0 != fstat(fd, &st)) || (st.st_size < (off_t)sizeof(*phdr))){
+    fprintf(stderr, "DHACTree::open() '%s' is too short\n", stPath);
+    ::close(fd);
+    return false;
+  }
+  pMap = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if(MAP_FAILED == pMap){
+    fprintf(stderr, "DHACTree::open() couldn't map '%s'\n", stPath);
+    return false;
+  }
+  pFile = (D_uint8*)pMap;
+  fileLen = (size_t)st.st_size;
+  fMapped = true;
+#else
+  FILE *fin;
+  long len;
+  fin = fopen(stPath, "rb");
+  if(!fin){
+    fprintf(stderr, "DHACTree::open() couldn't open '%s'\n", stPath);
+    return false;
+  }
+  fseek(fin, 0, SEEK_END);
+  len = ftell(fin);
+  fseek(fin, 0, SEEK_SET);
+  if(len < (long)sizeof(*phdr)){
+    fprintf(stderr, "DHACTree::open() '%s' is too short\n", stPath);
+    fclose(fin);
+    return false;
+  }
+  pFile = (D_uint8*)malloc(len);
+  D_CHECKPTR(pFile);
+  fileLen = (size_t)len;
+  fMapped = false;
+  if(1 != fread(pFile, fileLen, 1, fin)){
+    fprintf(stderr, "DHACTree::open() couldn't read '%s'\n", stPath);
+    fclose(fin);
+    close();
+    return false;
+  }
+  fclose(fin);
+#endif
+
+  phdr = (const DHACTREE_HEADER_T*)pFile;
+  if((0 != memcmp(phdr->stMagic, stTreeMagic, sizeof(stTreeMagic))) ||
+     (0x01020304 != phdr->byteOrderMark) ||
+     (DHACTREE_VERSION != phdr->version) ||
+     (phdr->numNodes < 1) || (phdr->numItems < 1) || (phdr->numKeys < 0) ||
+     (phdr->fileLen != fileLen) ||
+     (getLayout(phdr->numNodes, phdr->numItems, phdr->numKeys, rgOffsets) !=
+      fileLen) ||
+     (0 != memcmp(rgOffsets, phdr->rgOffsets, sizeof(rgOffsets)))){
+    fprintf(stderr, "DHACTree::open() '%s' is corrupt or not a version %d "
+	    "tree written on this machine\n", stPath, DHACTREE_VERSION);
+    close();
+    return false;
+  }
+  setPointers();
+  if(!isConsistent()){
+    fprintf(stderr, "DHACTree::open() '%s' is corrupt\n", stPath);
+    close();
+    return false;
+  }
+  return true;
+}
+
+///free (or unmap) the tree
+void DHACTree::close(){
+  if(NULL != pFile){
+#ifndef _WIN32
+    if(fMapped)
+      munmap(pFile, fileLen);
+    else
+#endif
+      free(pFile);
+  }
+  pFile = NULL;
+  fileLen = 0;
+  fMapped = false;
+  rgParent = rgFirstChild = rgNumChildren = rgCenterIdx = NULL;
+  rgFirstWord = rgNumWordsHere = rgNumWords = NULL;
+  rgNumDescendantNodes = rgClustID = NULL;
+  rgMaxDistFromCenter = rgSumDistFromCenter = NULL;
+  rgMaxDistFromCenterFv = rgMaxDistFromDescendantsMeanFv = NULL;
+  rgCenterAspectRatio = rgFvCenter = rgFvMean = NULL;
+  rgChildren = rgWords = rgKeyIdxs = NULL;
+}
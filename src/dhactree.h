@@ -0,0 +1,190 @@
+#ifndef DHACTREE_H
+#define DHACTREE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "dinttypes.h"
+
+///Binary journal of the merges done by hierarchical agglomerative clustering
+/** Each merge of nodes i and j (i < j, both indexes into the list of
+    nodes that are left, and j is removed from the list) is appended
+    as a fixed-size DHACMERGE_RECORD_T after a DHACMERGE_HEADER_T, and
+    flushed, so an interrupted clustering run can replay the merges it
+    already did instead of recomputing them.  A partial record at the
+    end of the file (from a crash in the middle of a write) is
+    dropped by open().
+
+    The header records the number of items being clustered and the
+    DCostMatrix::getChecksum() of the costs, so a journal isn't
+    replayed against a different set of words or a recomputed matrix.
+*/
+#define DHACMERGE_VERSION 1
+
+typedef struct{
+  char stMagic[8];//"DHACMERG"
+  D_uint32 byteOrderMark;//0x01020304 as written by this machine
+  D_uint32 version;//DHACMERGE_VERSION
+  D_sint32 numItems;//number of items (words) being clustered
+  D_uint32 reserved;
+  D_uint64 costChecksum;//DCostMatrix::getChecksum() of the costs used
+} DHACMERGE_HEADER_T;
+
+typedef struct{
+  D_sint32 i, j;//nodes merged (indexes into the nodes left, i < j)
+  double dist;//distance between them when they were merged
+} DHACMERGE_RECORD_T;
+
+class DHACMergeJournal{
+public:
+  DHACMergeJournal();
+  ~DHACMergeJournal();
+  bool open(const char *stPath, int numItems, D_uint64 costChecksum);
+  bool append(int i, int j, double dist);
+  void close();
+  bool isOpen() const;
+  int getNumMerges() const;
+  const DHACMERGE_RECORD_T* getMerges() const;
+  D_uint64 getChecksum() const;
+
+  static bool isMergeJournal(const char *stPath);
+
+private:
+  DHACMergeJournal(const DHACMergeJournal &src);//not copyable
+  const DHACMergeJournal& operator=(const DHACMergeJournal &src);
+
+  FILE *fjournal;
+  int _numItems;
+  int numMerges;
+  DHACMERGE_RECORD_T *rgMerges;//numItems-1 allocated (the most possible)
+};
+
+
+///A finished HAC tree as flat arrays that can be saved and mapped
+/** Building the tree means replaying every merge and then computing
+    the key-word feature vectors of every node from the cost matrix,
+    even when the tree is the same as last time.  DHACTree holds the
+    whole tree as one array per field (node 0 is the root), which
+    save() writes to a single file and open() maps read-only, so a
+    later run gets the tree back without touching the cost matrix.
+
+    The words of a node and all of its descendants are the range
+    rgWords[rgFirstWord[n] .. rgFirstWord[n]+rgNumWords[n]-1], with
+    the node's own words (rgNumWordsHere[n] of them) first, so the
+    words have to be stored in depth-first order.  The children of
+    node n are rgChildren[rgFirstChild[n] .. +rgNumChildren[n]-1].
+    rgFvCenter and rgFvMean hold numKeys values per node.
+
+    The header records the DCostMatrix::getChecksum() of the costs and
+    the DHACMergeJournal::getChecksum() of the merges the tree was
+    built from, so a caller can tell that a saved tree is out of date
+    when either one has changed (or the merge journal is gone).
+
+    create() allocates the arrays (in the same layout as the file) for
+    the caller to fill in.  After open() the arrays point into the
+    read-only mapping and must not be written.  Like the other mapped
+    files, everything is in native byte order.
+*/
+#define DHACTREE_VERSION 2
+#define DHACTREE_ALIGNMENT 16
+#define DHACTREE_NUM_ARRAYS 19
+
+typedef struct{
+  char stMagic[8];//"DHACTREE"
+  D_uint32 byteOrderMark;//0x01020304 as written by this machine
+  D_uint32 version;//DHACTREE_VERSION
+  D_sint32 numNodes;
+  D_sint32 numItems;
+  D_sint32 numKeys;
+  D_uint32 reserved;
+  D_uint64 costChecksum;//DCostMatrix::getChecksum() of the costs used
+  D_uint64 mergeChecksum;//DHACMergeJournal::getChecksum() of the merges
+  D_uint64 fileLen;//total length of the file in bytes
+  D_uint64 rgOffsets[DHACTREE_NUM_ARRAYS];//where each array starts
+} DHACTREE_HEADER_T;
+
+class DHACTree{
+public:
+  DHACTree();
+  ~DHACTree();
+  bool create(int numItems, int numNodes, int numKeys);
+  bool save(const char *stPath, D_uint64 costChecksum,
+	    D_uint64 mergeChecksum) const;
+  bool open(const char *stPath);
+  void close();
+  bool isOpen() const;
+  int getNumNodes() const;
+  int getNumItems() const;
+  int getNumKeys() const;
+  D_uint64 getCostChecksum() const;
+  D_uint64 getMergeChecksum() const;
+
+  //one value per node
+  D_sint32 *rgParent;//-1 for the root
+  D_sint32 *rgFirstChild;//index into rgChildren
+  D_sint32 *rgNumChildren;
+  D_sint32 *rgCenterIdx;//item (word) that is the center of the node
+  D_sint32 *rgFirstWord;//index into rgWords
+  D_sint32 *rgNumWordsHere;//words at this node itself
+  D_sint32 *rgNumWords;//words at this node and all of its descendants
+  D_sint32 *rgNumDescendantNodes;
+  D_sint32 *rgClustID;
+  double *rgMaxDistFromCenter;
+  double *rgSumDistFromCenter;
+  double *rgMaxDistFromCenterFv;
+  double *rgMaxDistFromDescendantsMeanFv;
+  double *rgCenterAspectRatio;
+  //numKeys values per node
+  double *rgFvCenter;
+  double *rgFvMean;
+  //the rest
+  D_sint32 *rgChildren;//numNodes-1 (every node but the root is a child)
+  D_sint32 *rgWords;//numItems, depth-first
+  D_sint32 *rgKeyIdxs;//numKeys items used for the feature vectors
+
+private:
+  DHACTree(const DHACTree &src);//not copyable
+  const DHACTree& operator=(const DHACTree &src);
+  static D_uint64 getLayout(int numNodes, int numItems, int numKeys,
+			    D_uint64 *rgOffsets);
+  void setPointers();
+  bool isConsistent() const;
+
+  D_uint8 *pFile;//header and arrays (allocated by create() or mapped)
+  size_t fileLen;
+  bool fMapped;
+};
+
+
+inline bool DHACMergeJournal::isOpen() const{
+  return (NULL != fjournal);
+}
+inline int DHACMergeJournal::getNumMerges() const{
+  return numMerges;
+}
+///all of the merges so far (read by open() and added by append())
+inline const DHACMERGE_RECORD_T* DHACMergeJournal::getMerges() const{
+  return rgMerges;
+}
+
+inline bool DHACTree::isOpen() const{
+  return (NULL != pFile);
+}
+inline int DHACTree::getNumNodes() const{
+  return (NULL == pFile) ? 0 : ((const DHACTREE_HEADER_T*)pFile)->numNodes;
+}
+inline int DHACTree::getNumItems() const{
+  return (NULL == pFile) ? 0 : ((const DHACTREE_HEADER_T*)pFile)->numItems;
+}
+inline int DHACTree::getNumKeys() const{
+  return (NULL == pFile) ? 0 : ((const DHACTREE_HEADER_T*)pFile)->numKeys;
+}
+inline D_uint64 DHACTree::getCostChecksum() const{
+  return (NULL == pFile) ? 0 :
+    ((const DHACTREE_HEADER_T*)pFile)->costChecksum;
+}
+inline D_uint64 DHACTree::getMergeChecksum() const{
+  return (NULL == pFile) ? 0 :
+    ((const DHACTREE_HEADER_T*)pFile)->mergeChecksum;
+}
+
+#endif
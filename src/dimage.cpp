@@ -8,6 +8,10 @@
 #include <complex>
 #include <math.h>
 #include "drect.h"
+#ifndef WIN32
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
 int DImage::_data_alignment = 16; // by default, 8-byte aligned
 int DImage::_drawTextFileNum = 0;
 //TODO:The methods do not necessarily protect against using the source
@@ -151,6 +155,8 @@ void DImage::_internal_DImage_assign(DImage &dst, const DImage &src,
   dst._imgType = src._imgType;
   dst._fInterleaved = src._fInterleaved;
   dst._allocMethod = src._allocMethod;
+  if(AllocationMethod_mapped == dst._allocMethod)//the copy gets its own buffer
+    dst._allocMethod = AllocationMethod_malloc;
   dst._dataSize = src._dataSize;
   dst._sampleSize = src._sampleSize;
   
@@ -204,6 +210,16 @@ void DImage::copyComments(DImage &src){
  */
 bool DImage::create(int w, int h, DImageType imgType, int numChannels,
 		    D_AllocationMethod allocMeth){
+  return create_(w, h, imgType, numChannels, allocMeth, NULL);
+}
+
+/// create() that uses pMappedBuf (from DImageIO) as the buffer if not NULL
+/** pMappedBuf must be at least as large as the image and points into
+ * a mapping that deallocateBuffer() can munmap() (see setDataBuffer()).
+ * Nothing is allocated in that case.
+ */
+bool DImage::create_(int w, int h, DImageType imgType, int numChannels,
+		     D_AllocationMethod allocMeth, D_uint8 *pMappedBuf){
   size_t bufSize;
   bool retVal = true;
 
@@ -252,7 +268,13 @@ bool DImage::create(int w, int h, DImageType imgType, int numChannels,
   // the buffer is aligned to fit the users needs (for example, if Altivec SIMD
   // instructions are used, data blocks must be aligned to 16-byte boundaries).
   deallocateBuffer();
-  if(AllocationMethod_daligned == allocMeth)
+  if(NULL != pMappedBuf)
+    allocMeth = AllocationMethod_mapped;
+  else if(AllocationMethod_mapped == allocMeth)//only DImageIO can map a buffer
+    allocMeth = AllocationMethod_malloc;
+  if(NULL != pMappedBuf)
+    this->pData = pMappedBuf;
+  else if(AllocationMethod_daligned == allocMeth)
     this->pData = (D_uint8*)daligned_malloc(bufSize, DImage::_data_alignment);
   else if(AllocationMethod_malloc == allocMeth)
     this->pData = (D_uint8*)malloc(bufSize);
@@ -415,6 +437,14 @@ bool DImage::save(const char *stPath, DFileFormat fmt, bool fSaveProps,
  * passed in and that the memory is not deallocated elsewhere.  If the
  * user wishes to deallocate the memory elsewhere, the data should be
  * copied instead of directly passing in a pointer to the memory.
+ *
+ * AllocationMethod_mapped is meant for DImageIO, which uses it when
+ * loading with set_alloc_method(AllocationMethod_mapped).  In that
+ * case pBuf must be inside the first page of a mapping that ends at
+ * the end of the image data, since that is what gets munmap()ed.
+ * DMorphInkStore also uses it for images that point into its own
+ * mapping, but takes the buffer back with releaseDataBuffer() so
+ * that it is never deallocated here.
  */
 void DImage::setDataBuffer(void *pBuf, D_AllocationMethod allocMeth){
   deallocateBuffer();
@@ -447,6 +477,16 @@ void DImage::deallocateBuffer(){
       daligned_free(pData);
     else if(AllocationMethod_new == _allocMethod)
       delete [] (D_uint8*)pData;
+#ifndef WIN32
+    else if(AllocationMethod_mapped == _allocMethod){
+      //the mapping starts at the page boundary before the pixels
+      size_t pageMask;
+      D_uint8 *pMapStart;
+      pageMask = (size_t)sysconf(_SC_PAGESIZE) - 1;
+      pMapStart = (D_uint8*)((size_t)pData & ~pageMask);
+      munmap(pMapStart, (size_t)(pData - pMapStart) + _dataSize);
+    }
+#endif
     else
       fprintf(stderr,"DImage::deallocateBuffer() unrecognized _allocMethod\n");
     pData = NULL;
@@ -7784,6 +7824,19 @@ std::string DImage::getPropertyValByIndex(unsigned int propNum){
   for(unsigned int i = 0; i < propNum; ++i, ++iter);
   return (*iter).second;
 }
+std::string DImage::getPropertyNameByIndex(unsigned int propNum){
+  std::string s;
+  std::map<const std::string, std::string>::iterator iter = mapProps.begin();
+#ifdef DEBUG
+  if(propNum >= mapProps.size()){
+    fprintf(stderr, "DImage::getPropertyNameByIndex() propNum out of range\n");
+    abort();
+    return s;
+  }
+#endif
+  for(unsigned int i = 0; i < propNum; ++i, ++iter);
+  return (*iter).first;
+}
 int DImage::getNumProperties() const{
   return mapProps.size();
 }
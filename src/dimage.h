@@ -278,6 +278,7 @@ public:
   void setProperty(const std::string propName, std::string propVal);
   std::string getPropertyVal(std::string propName);
   std::string getPropertyValByIndex(unsigned int propNum);
+  std::string getPropertyNameByIndex(unsigned int propNum);
   int getNumProperties() const;
   void clearProperties();
 
@@ -317,6 +318,8 @@ public:
   std::complex<double>* dataPointer_cmplx() const;
     
 private:
+  bool create_(int w, int h, DImageType imgType, int numChannels,
+	       D_AllocationMethod allocMeth, D_uint8 *pMappedBuf);
   int _w; // width 
   int _h; // height
   int _actualW; // the real allocated width (not the logical width) of image
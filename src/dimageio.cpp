@@ -38,8 +38,14 @@ extern "C" {
 #ifndef WIN32
 #include <unistd.h>
 #include <time.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #endif
 
+#include "dthresholder.h"
+#include "dthreadpool.h"
+
 D_AllocationMethod DImageIO::_allocMethod = AllocationMethod_malloc;
 
 
@@ -173,6 +179,36 @@ bool DImageIO::readDataBlock(FILE *fin, D_uint8 *rgBuff, size_t len){
   }
   return true;
 }
+///map len bytes of the file starting at offs instead of reading them
+/**The mapping is private and writable (copy-on-write), so the image
+   can be modified like any other without changing the file.  The
+   returned pointer is freed by DImage::deallocateBuffer() when it is
+   given to a DImage as AllocationMethod_mapped.  Returns NULL if the
+   file is too short or can't be mapped, so the caller can fall back
+   to readDataBlock().*/
+D_uint8* DImageIO::mapDataBlock(FILE *fin, long offs, size_t len){
+#ifdef WIN32
+  return NULL;
+#else
+  struct stat st;
+  long pageMask;
+  long mapOffs;
+  void *pMap;
+
+  if((offs < 0) || (len < 1) || (0 != fstat(fileno(fin), &st)) ||
+     ((long long)st.st_size < ((long long)offs + (long long)len)))
+    return NULL;
+  //mmap() offsets must be page aligned, so start at the page before offs
+  pageMask = sysconf(_SC_PAGESIZE) - 1;
+  mapOffs = offs & ~pageMask;
+  pMap = mmap(NULL, (size_t)(offs - mapOffs) + len, PROT_READ | PROT_WRITE,
+	      MAP_PRIVATE, fileno(fin), (off_t)mapOffs);
+  if(MAP_FAILED == pMap)
+    return NULL;
+  return ((D_uint8*)pMap) + (offs - mapOffs);
+#endif
+}
+
 bool DImageIO::writeDataBlock(FILE *fout, D_uint8 *rgBuff, size_t len){
   size_t bytesWrote;
   size_t bytesWroteTotal = 0;
@@ -333,6 +369,14 @@ bool DImageIO::load_image_pgm_raw(DImage *pImg, FILE *fin){
     return false;
   }
   
+  if((AllocationMethod_mapped == DImageIO::_allocMethod) && (hdr.max < 256)){
+    D_uint8 *pMapped;//8-bit samples can be used straight from the file
+    pMapped = DImageIO::mapDataBlock(fin, hdr.dataOffs,
+				     (size_t)hdr.w * hdr.h);
+    if(NULL != pMapped)
+      return pImg->create_(hdr.w, hdr.h, DImage::DImage_u8, 1,
+			   AllocationMethod_mapped, pMapped);
+  }
   if(hdr.max < 256){
     pImg->create(hdr.w, hdr.h, DImage::DImage_u8,
 		 1, DImageIO::_allocMethod);
@@ -377,6 +421,14 @@ bool DImageIO::load_image_ppm_raw(DImage *pImg, FILE *fin){
     return false;
   }
 
+  if((AllocationMethod_mapped == DImageIO::_allocMethod) && (hdr.max < 256)){
+    D_uint8 *pMapped;//8-bit samples can be used straight from the file
+    pMapped = DImageIO::mapDataBlock(fin, hdr.dataOffs,
+				     (size_t)hdr.w * hdr.h * 3);
+    if(NULL != pMapped)
+      return pImg->create_(hdr.w, hdr.h, DImage::DImage_RGB, 3,
+			   AllocationMethod_mapped, pMapped);
+  }
   if(hdr.max < 256){
     pImg->create(hdr.w, hdr.h, DImage::DImage_RGB, 3, DImageIO::_allocMethod);
     numBytes = hdr.w * hdr.h * 3; // "*3" is because RGB
@@ -837,6 +889,102 @@ bool DImageIO::load_image_pnm(DImage *pImg, const char *stPath){
   return retVal;
 }
 
+typedef struct{
+  const char *stPattern;//printf-style path with one %d for the file number
+  int first;//file number of rgImgs[0]
+  int numImgs;
+  int numThreads;
+  DImage *rgImgs;
+  bool fThreshold;
+  bool fAllOK;//set to false (by any thread) if a load fails
+} DIMAGEIO_LOADMANY_PARMS_T;
+
+/*ask the OS to start reading a file that we will load soon*/
+static void prefetchImageFile(const char *stPath){
+#if !defined(WIN32) && defined(POSIX_FADV_WILLNEED)
+  int fd;
+  fd = open(stPath, O_RDONLY);
+  if(fd >= 0){
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    close(fd);
+  }
+#endif
+}
+
+/*DThreadPool function that loads (and thresholds) one image for loadMany()*/
+static void loadManyItem(void *params, int itemIdx, int threadNum){
+  DIMAGEIO_LOADMANY_PARMS_T *pparms;
+  DImage *pImg;
+  char stPath[1025];
+
+  pparms = (DIMAGEIO_LOADMANY_PARMS_T*)params;
+  //DThreadPool deals items round-robin, so this is this thread's next file
+  if((itemIdx + pparms->numThreads) < pparms->numImgs){
+    snprintf(stPath, sizeof(stPath), pparms->stPattern,
+	     pparms->first + itemIdx + pparms->numThreads);
+    prefetchImageFile(stPath);
+  }
+  snprintf(stPath, sizeof(stPath), pparms->stPattern,
+	   pparms->first + itemIdx);
+  pImg = &(pparms->rgImgs[itemIdx]);
+  if(!pImg->load(stPath)){
+    fprintf(stderr, "DImageIO::loadMany() couldn't load '%s'\n", stPath);
+    pparms->fAllOK = false;
+    return;
+  }
+  if(pparms->fThreshold){
+    std::string strThresh;
+    strThresh = pImg->getPropertyVal(std::string("threshold"));
+    if((strThresh.size() < 1) && (3 == pImg->getNumComments()))
+      strThresh = pImg->getCommentByIndex(0);//old #threshval #label #page
+    if(strThresh.size() < 1){
+      fprintf(stderr, "DImageIO::loadMany() '%s' has no threshold property\n",
+	      stPath);
+      pparms->fAllOK = false;
+      return;
+    }
+    DThresholder::threshImage_(*pImg, *pImg, atoi(strThresh.c_str()));
+  }
+}
+
+///load the numbered image files first..last into rgImgs[0..last-first]
+/**stPattern is a printf-style path with one integer conversion for
+   the file number (e.g. "/data/w_%08d.pgm").  The files are loaded
+   by numThreads threads (one per CPU if numThreads < 1), and each
+   thread asks the OS to read ahead its next file while it decodes
+   the current one.  The properties and comments of each file end up
+   in the DImage the same as with DImage::load().
+
+   If fThreshold is true, each image is also thresholded in place
+   (DThresholder::threshImage_()) using its "threshold" property, or
+   its first comment for the older files that have only the three
+   comments #threshval, #label, #pageNum.
+
+   Returns false (after trying all of the files) if any of them
+   couldn't be loaded or had no threshold.*/
+bool DImageIO::loadMany(const char *stPattern, int first, int last,
+			DImage *rgImgs, int numThreads, bool fThreshold){
+  DIMAGEIO_LOADMANY_PARMS_T parms;
+
+  if(last < first)
+    return true;
+  DThreadPool pool(numThreads);
+  parms.stPattern = stPattern;
+  parms.first = first;
+  parms.numImgs = last - first + 1;
+  parms.numThreads = pool.getNumThreads();
+  parms.rgImgs = rgImgs;
+  parms.fThreshold = fThreshold;
+  parms.fAllOK = true;
+  for(int i=0; (i < parms.numThreads) && (i < parms.numImgs); ++i){
+    char stPath[1025];
+    snprintf(stPath, sizeof(stPath), stPattern, first + i);
+    prefetchImageFile(stPath);
+  }
+  pool.run(parms.numImgs, loadManyItem, (void*)&parms);
+  return parms.fAllOK;
+}
+
 bool DImageIO::load_image_gif(DImage *pImg,  const char *stPath){
 #ifdef WIN32
   fprintf(stderr,"NYI! (%s:%d)\n", __FILE__, __LINE__);
@@ -1163,10 +1311,18 @@ int DImageIO::write_img_comments_pnm(DImage *pImg, FILE *fout){
  *  should be used to set the number of bytes to align to.  This may
  *  be the case when using code that manipulates your images by using
  *  SIMD instructions (AltiVec, SSE, SSE2, etc.), for example.
+ *
+ *  With AllocationMethod_mapped, raw 8-bit PGM and PPM files are
+ *  mmap()ed and the DImage uses the pixels right out of the mapping
+ *  (copy-on-write) instead of reading them into a new buffer.  This
+ *  saves a copy (and the second copy of the file in the page cache)
+ *  for large images like page scans.  Other formats, 16-bit files,
+ *  and images created or copied from a mapped one are malloc()ed.
  */
 void DImageIO::set_alloc_method(D_AllocationMethod allocMeth){
-  if((allocMeth >= AllocationMethod_daligned) &&
-     (allocMeth <= AllocationMethod_new)){
+  if(((allocMeth >= AllocationMethod_daligned) &&
+      (allocMeth <= AllocationMethod_new)) ||
+     (AllocationMethod_mapped == allocMeth)){
     DImageIO::_allocMethod = allocMeth;
   }
   else
@@ -43,6 +43,10 @@ public:
 			      int quality=75, bool fProgressive=false,
 			      bool fOptimize=false);
 
+  static bool loadMany(const char *stPattern, int first, int last,
+		       DImage *rgImgs, int numThreads = -1,
+		       bool fThreshold = false);
+
   static void set_alloc_method(D_AllocationMethod allocMeth);
   static bool get_image_width_height_chan(const char *stPath,
 					  int *width, int *height, int *chan);
@@ -62,11 +66,15 @@ private:
   static void clear_pnm_header_comments(D_PNM_HEADER_S *hdr);
   static void extractCommentProps(DImage *pImg, D_PNM_HEADER_S *hdr);
   static bool readDataBlock(FILE *fin, D_uint8 *rgBuff, size_t len);
+  static D_uint8* mapDataBlock(FILE *fin, long offs, size_t len);
   static bool writeDataBlock(FILE *fout, D_uint8 *rgBuff, size_t len);
   static int readComments(D_PNM_HEADER_S *hdr, FILE *fin);
   static int write_img_props_pnm(DImage *pImg, FILE *fout);
   static int write_img_comments_pnm(DImage *pImg, FILE *fout);
   static D_AllocationMethod _allocMethod;
+
+  friend class DImageStripReader;
+  friend class DImageStripWriter;
 };
 
 
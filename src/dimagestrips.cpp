@@ -0,0 +1,819 @@
+#include "dimagestrips.h"
+#include "dimageio.h"
+#include <string.h>
+#include <string>
+
+#ifndef D_NOTIFF
+#include "tiffio.h"
+#endif /*D_NOTIFF*/
+
+#ifndef D_NOPNG
+#include "png.h"
+#endif /*D_NOPNG*/
+
+//attempt to fix undef long_jmp problem (same as in DImageIO)
+#ifndef D_NOPNG
+#if (PNG_LIBPNG_VER < 10400 || PNG_LIBPNG_VER >= 10500)
+#define DSTRIPS_PNG_SETJMP(p) setjmp(png_jmpbuf(p))
+#else
+#define DSTRIPS_PNG_SETJMP(p) setjmp((p)->jmpbuf)
+#endif
+#endif
+
+/*number of bytes in one row of an interleaved image of type imgType*/
+static size_t getInterleavedRowBytes(DImage::DImageType imgType, int w){
+  switch(imgType){
+    case DImage::DImage_u8:
+      return (size_t)w;
+    case DImage::DImage_u16:
+      return (size_t)w * 2;
+    case DImage::DImage_RGB:
+      return (size_t)w * 3;
+    case DImage::DImage_RGB_16:
+      return (size_t)w * 6;
+    default:
+      break;
+  }
+  return 0;
+}
+
+/*number of channels of an interleaved image of type imgType*/
+static int getInterleavedNumChannels(DImage::DImageType imgType){
+  if((DImage::DImage_RGB == imgType) || (DImage::DImage_RGB_16 == imgType))
+    return 3;
+  return 1;
+}
+
+DImageStripReader::DImageStripReader(){
+  _fmt = DImage::DFileFormat_unknown;
+  fin = NULL;
+  pPng = NULL;
+  pPngInfo = NULL;
+  pTif = NULL;
+  rgTifRow = NULL;
+  _w = _h = 0;
+  _numChan = 0;
+  _imgType = DImage::DImage_u8;
+  _rowBytes = 0;
+  _nextRow = 0;
+}
+
+DImageStripReader::~DImageStripReader(){
+  close();
+}
+
+///open stPath and read its header (closing any file that was open)
+/**Returns false (with a message on stderr) if the file can't be
+   opened or is in a format or layout that can't be read in strips.*/
+bool DImageStripReader::open(const char *stPath){
+  DImage::DFileFormat fmt;
+
+  close();
+  fmt = DImage::getImageFileFormat(stPath);
+  switch(fmt){
+    case DImage::DFileFormat_pgm:
+    case DImage::DFileFormat_ppm:
+      if(!openPNM(stPath))
+	return false;
+      break;
+    case DImage::DFileFormat_png:
+      if(!openPNG(stPath))
+	return false;
+      break;
+    case DImage::DFileFormat_tiff:
+      if(!openTIFF(stPath))
+	return false;
+      break;
+    default:
+      fprintf(stderr, "DImageStripReader::open() '%s' isn't a raw PNM, PNG, "
+	      "or TIFF file\n", stPath);
+      return false;
+  }
+  _fmt = fmt;
+  _numChan = getInterleavedNumChannels(_imgType);
+  _rowBytes = getInterleavedRowBytes(_imgType, _w);
+  _nextRow = 0;
+  return true;
+}
+
+bool DImageStripReader::openPNM(const char *stPath){
+  DImageIO::D_PNM_HEADER_S hdr;
+  bool fHeaderOK;
+
+  fin = fopen(stPath, "rb");
+  if(!fin){
+    fprintf(stderr, "DImageStripReader::open() couldn't open '%s'\n", stPath);
+    return false;
+  }
+  fHeaderOK = DImageIO::read_pnm_header(&hdr, fin);
+  if(fHeaderOK)
+    DImageIO::extractCommentProps(&imgProps, &hdr);
+  DImageIO::clear_pnm_header_comments(&hdr);
+  if((!fHeaderOK) || ((5 != hdr.type) && (6 != hdr.type)) ||
+     (hdr.w < 1) || (hdr.h < 1)){
+    fprintf(stderr, "DImageStripReader::open() bad header in '%s'\n", stPath);
+    fclose(fin);
+    fin = NULL;
+    return false;
+  }
+  _w = hdr.w;
+  _h = hdr.h;
+  if(5 == hdr.type)
+    _imgType = (hdr.max < 256) ? DImage::DImage_u8 : DImage::DImage_u16;
+  else
+    _imgType = (hdr.max < 256) ? DImage::DImage_RGB : DImage::DImage_RGB_16;
+  if(0 != fseek(fin, hdr.dataOffs, SEEK_SET)){
+    fprintf(stderr, "DImageStripReader::open() fseek failed\n");
+    fclose(fin);
+    fin = NULL;
+    return false;
+  }
+  return true;
+}
+
+bool DImageStripReader::openPNG(const char *stPath){
+#ifdef D_NOPNG
+  fprintf(stderr, "DImageStripReader::open() PNG support is not compiled\n");
+  return false;
+#else
+  png_structp png_ptr;
+  png_infop info_ptr;
+  png_uint_32 width, height;
+  int bit_depth, color_type, interlace_type;
+
+  fin = fopen(stPath, "rb");
+  if(!fin){
+    fprintf(stderr, "DImageStripReader::open() couldn't open '%s'\n", stPath);
+    return false;
+  }
+  png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL,NULL);
+  if(!png_ptr){
+    fclose(fin);
+    fin = NULL;
+    return false;
+  }
+  info_ptr = png_create_info_struct(png_ptr);
+  if(!info_ptr){
+    png_destroy_read_struct(&png_ptr, (png_infopp)NULL, (png_infopp)NULL);
+    fclose(fin);
+    fin = NULL;
+    return false;
+  }
+  if(DSTRIPS_PNG_SETJMP(png_ptr)){
+    png_destroy_read_struct(&png_ptr, &info_ptr, (png_infopp)NULL);
+    fclose(fin);
+    fin = NULL;
+    fprintf(stderr, "DImageStripReader::open() error reading '%s'\n", stPath);
+    return false;
+  }
+  png_init_io(png_ptr, fin);
+  png_read_info(png_ptr, info_ptr);
+  png_get_IHDR(png_ptr, info_ptr, &width, &height, &bit_depth, &color_type,
+	       &interlace_type, NULL, NULL);
+  if((PNG_INTERLACE_NONE != interlace_type) ||
+     (PNG_COLOR_TYPE_PALETTE == color_type)){
+    fprintf(stderr, "DImageStripReader::open() can't read interlaced or "
+	    "palette PNG '%s' in strips\n", stPath);
+    png_destroy_read_struct(&png_ptr, &info_ptr, (png_infopp)NULL);
+    fclose(fin);
+    fin = NULL;
+    return false;
+  }
+  //same transforms (and so the same pixels) as DImageIO::load_image_png()
+  png_set_strip_alpha(png_ptr);
+  png_set_packing(png_ptr);
+  png_read_update_info(png_ptr, info_ptr);
+  _w = (int)width;
+  _h = (int)height;
+  if((PNG_COLOR_TYPE_GRAY == color_type) ||
+     (PNG_COLOR_TYPE_GRAY_ALPHA == color_type))
+    _imgType = (16 == bit_depth) ? DImage::DImage_u16 : DImage::DImage_u8;
+  else
+    _imgType = (16 == bit_depth) ? DImage::DImage_RGB_16 : DImage::DImage_RGB;
+  pPng = (void*)png_ptr;
+  pPngInfo = (void*)info_ptr;
+  return true;
+#endif
+}
+
+bool DImageStripReader::openTIFF(const char *stPath){
+#ifdef D_NOTIFF
+  fprintf(stderr, "DImageStripReader::open() TIFF support is not compiled\n");
+  return false;
+#else
+  TIFF *tif;
+  uint32 w, h;
+  uint16 sampsPerPxl = 1, bitsPerSamp = 1, planar = PLANARCONFIG_CONTIG;
+  uint16 photometric = PHOTOMETRIC_MINISBLACK;
+  uint16 compression = COMPRESSION_NONE, orientation = ORIENTATION_TOPLEFT;
+  bool fGray, fRGB;
+
+  tif = TIFFOpen(stPath, "r");
+  if(NULL == tif){
+    fprintf(stderr, "DImageStripReader::open() couldn't open '%s'\n", stPath);
+    return false;
+  }
+  TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &w);
+  TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &h);
+  TIFFGetFieldDefaulted(tif, TIFFTAG_SAMPLESPERPIXEL, &sampsPerPxl);
+  TIFFGetFieldDefaulted(tif, TIFFTAG_BITSPERSAMPLE, &bitsPerSamp);
+  TIFFGetFieldDefaulted(tif, TIFFTAG_PLANARCONFIG, &planar);
+  TIFFGetFieldDefaulted(tif, TIFFTAG_COMPRESSION, &compression);
+  TIFFGetFieldDefaulted(tif, TIFFTAG_ORIENTATION, &orientation);
+  TIFFGetField(tif, TIFFTAG_PHOTOMETRIC, &photometric);
+  //DImageIO::load_image_tiff() converts everything to 8-bit gray/RGB with
+  //TIFFReadRGBAImage(). Only take the files whose scanlines already hold
+  //those same values: 1-bit or 8-bit gray, 8-bit RGB, and JPEG-compressed
+  //YCbCr, which libjpeg converts to RGB for us the same way TIFFRGBAImage
+  //does. Palette, CMYK, alpha, 16-bit, and flipped files are rejected
+  //rather than returned as raw samples that wouldn't match DImage::load().
+  fGray = (1 == sampsPerPxl) &&
+    ((1 == bitsPerSamp) || (8 == bitsPerSamp)) &&
+    ((PHOTOMETRIC_MINISBLACK == photometric) ||
+     (PHOTOMETRIC_MINISWHITE == photometric));
+  fRGB = (3 == sampsPerPxl) && (8 == bitsPerSamp) &&
+    ((PHOTOMETRIC_RGB == photometric) ||
+     ((PHOTOMETRIC_YCBCR == photometric) &&
+      (COMPRESSION_JPEG == compression)));
+  if(TIFFIsTiled(tif) || (PLANARCONFIG_CONTIG != planar) ||
+     (ORIENTATION_TOPLEFT != orientation) || ((!fGray) && (!fRGB))){
+    fprintf(stderr, "DImageStripReader::open() can't read '%s' in strips "
+	    "(only top-left 1-bit or 8-bit gray and 8-bit RGB or JPEG YCbCr "
+	    "strip TIFFs)\n", stPath);
+    TIFFClose(tif);
+    return false;
+  }
+  if(PHOTOMETRIC_YCBCR == photometric)
+    TIFFSetField(tif, TIFFTAG_JPEGCOLORMODE, JPEGCOLORMODE_RGB);
+  _w = (int)w;
+  _h = (int)h;
+  _imgType = fGray ? DImage::DImage_u8 : DImage::DImage_RGB;
+  rgTifRow = (D_uint8*)malloc(TIFFScanlineSize(tif) + 3*(size_t)_w);
+  D_CHECKPTR(rgTifRow);
+  pTif = (void*)tif;
+  return true;
+#endif
+}
+
+///close the file (if one is open)
+void DImageStripReader::close(){
+#ifndef D_NOPNG
+  if(NULL != pPng){
+    png_structp png_ptr = (png_structp)pPng;
+    png_infop info_ptr = (png_infop)pPngInfo;
+    png_destroy_read_struct(&png_ptr, &info_ptr, (png_infopp)NULL);
+  }
+#endif
+#ifndef D_NOTIFF
+  if(NULL != pTif)
+    TIFFClose((TIFF*)pTif);
+#endif
+  if(NULL != rgTifRow)
+    free(rgTifRow);
+  if(NULL != fin)
+    fclose(fin);
+  fin = NULL;
+  pPng = pPngInfo = NULL;
+  pTif = NULL;
+  rgTifRow = NULL;
+  _fmt = DImage::DFileFormat_unknown;
+  _w = _h = 0;
+  _numChan = 0;
+  _rowBytes = 0;
+  _nextRow = 0;
+  imgProps.clearProperties();
+  imgProps.clearComments();
+}
+
+///read the next numRows rows into pDst (numRows*getRowBytes() bytes)
+/**Returns false if the file is not open, there aren't numRows rows
+   left, or there is a read error.*/
+bool DImageStripReader::readRowData(void *pDst, int numRows){
+  D_uint8 *p8;
+
+  if((!isOpen()) || (numRows < 0) || ((_nextRow + numRows) > _h)){
+    fprintf(stderr, "DImageStripReader::readRowData() can't read %d rows "
+	    "starting at row %d\n", numRows, _nextRow);
+    return false;
+  }
+  p8 = (D_uint8*)pDst;
+  if((DImage::DFileFormat_pgm == _fmt) || (DImage::DFileFormat_ppm == _fmt)){
+    if(!DImageIO::readDataBlock(fin, p8, _rowBytes * numRows)){
+      fprintf(stderr, "DImageStripReader::readRowData() premature EOF\n");
+      return false;
+    }
+  }
+#ifndef D_NOPNG
+  else if(DImage::DFileFormat_png == _fmt){
+    png_structp png_ptr = (png_structp)pPng;
+    if(DSTRIPS_PNG_SETJMP(png_ptr)){
+      fprintf(stderr, "DImageStripReader::readRowData() PNG error\n");
+      return false;
+    }
+    for(int r = 0; r < numRows; ++r)
+      png_read_row(png_ptr, (png_bytep)(p8 + r*_rowBytes), NULL);
+  }
+#endif
+#ifndef D_NOTIFF
+  else if(DImage::DFileFormat_tiff == _fmt){
+    TIFF *tif = (TIFF*)pTif;
+    uint16 sampsPerPxl = 1, bitsPerSamp = 1;
+    uint16 photometric = PHOTOMETRIC_MINISBLACK;
+    TIFFGetFieldDefaulted(tif, TIFFTAG_SAMPLESPERPIXEL, &sampsPerPxl);
+    TIFFGetFieldDefaulted(tif, TIFFTAG_BITSPERSAMPLE, &bitsPerSamp);
+    TIFFGetField(tif, TIFFTAG_PHOTOMETRIC, &photometric);
+    for(int r = 0; r < numRows; ++r){
+      D_uint8 *pRow = p8 + r*_rowBytes;
+      if(TIFFReadScanline(tif, rgTifRow, _nextRow + r, 0) < 0){
+	fprintf(stderr, "DImageStripReader::readRowData() TIFF error\n");
+	return false;
+      }
+      if(1 == bitsPerSamp){//unpack to 0/255 (1 bits are black if MINISWHITE)
+	D_uint8 valOne, valZero;
+	valOne = (PHOTOMETRIC_MINISWHITE == photometric) ? 0 : 255;
+	valZero = 255 - valOne;
+	for(int x = 0; x < _w; ++x)
+	  pRow[x] = (rgTifRow[x>>3] & (0x80 >> (x&7))) ? valOne : valZero;
+      }
+      else if(1 == sampsPerPxl){
+	if(PHOTOMETRIC_MINISWHITE == photometric){
+	  for(int x = 0; x < _w; ++x)
+	    pRow[x] = 255 - rgTifRow[x];
+	}
+	else
+	  memcpy(pRow, rgTifRow, _w);
+      }
+      else//RGB (JPEG YCbCr is converted to RGB by libtiff)
+	memcpy(pRow, rgTifRow, 3*(size_t)_w);
+    }
+  }
+#endif
+  else
+    return false;
+  _nextRow += numRows;
+  return true;
+}
+
+///read the next numRows rows into imgStrip (fewer if near the bottom)
+/**imgStrip is created as width() x numRows (or however many rows are
+   left) of type getImageType().  Returns false at the end of the
+   image or if there is an error.*/
+bool DImageStripReader::readRows(DImage &imgStrip, int numRows){
+  if(numRows > (_h - _nextRow))
+    numRows = _h - _nextRow;
+  if(numRows < 1)
+    return false;
+  imgStrip.create(_w, numRows, _imgType, _numChan);
+  return readRowData(imgStrip.dataPointer_u8(), numRows);
+}
+
+///copy the properties and comments from the file header into img
+void DImageStripReader::getProperties(DImage &img) const{
+  img.copyProperties(*((DImage*)&imgProps));
+  img.copyComments(*((DImage*)&imgProps));
+}
+
+
+DImageStripWriter::DImageStripWriter(){
+  _fmt = DImage::DFileFormat_unknown;
+  fout = NULL;
+  pPng = NULL;
+  pPngInfo = NULL;
+  pTif = NULL;
+  _w = _h = 0;
+  _imgType = DImage::DImage_u8;
+  _rowBytes = 0;
+  _nextRow = 0;
+  fErr = false;
+}
+
+DImageStripWriter::~DImageStripWriter(){
+  close();
+}
+
+///create stPath for a w x h image of type imgType and write its header
+/**fmt can be DFileFormat_pnm (P5 or P6 depending on imgType),
+   DFileFormat_png, or DFileFormat_tiff.  Only DImage_u8, DImage_u16,
+   DImage_RGB, and DImage_RGB_16 can be written (8-bit only for TIFF).*/
+bool DImageStripWriter::open(const char *stPath, int w, int h,
+			     DImage::DImageType imgType,
+			     DImage::DFileFormat fmt, DImage *pImgProps){
+  close();
+  _rowBytes = getInterleavedRowBytes(imgType, w);
+  if((w < 1) || (h < 1) || (0 == _rowBytes)){
+    fprintf(stderr, "DImageStripWriter::open() can't write a %dx%d image of "
+	    "type %d\n", w, h, (int)imgType);
+    return false;
+  }
+  _w = w;
+  _h = h;
+  _imgType = imgType;
+  _nextRow = 0;
+  fErr = false;
+  if(DImage::DFileFormat_pnm == fmt){
+    bool fRGB;
+    fout = fopen(stPath, "wb");
+    if(!fout){
+      fprintf(stderr, "DImageStripWriter::open() couldn't open '%s' for "
+	      "writing\n", stPath);
+      return false;
+    }
+    fRGB = (3 == getInterleavedNumChannels(imgType));
+    fprintf(fout, fRGB ? "P6\n" : "P5\n");
+    if(NULL != pImgProps){
+      DImageIO::write_img_props_pnm(pImgProps, fout);
+      DImageIO::write_img_comments_pnm(pImgProps, fout);
+    }
+    fprintf(fout, "%d %d\n", w, h);
+    if((DImage::DImage_u8 == imgType) || (DImage::DImage_RGB == imgType))
+      fprintf(fout, "255\n");
+    else
+      fprintf(fout, "65535\n");
+  }
+  else if(DImage::DFileFormat_png == fmt){
+    if(!openPNG(stPath, pImgProps))
+      return false;
+  }
+  else if(DImage::DFileFormat_tiff == fmt){
+    if(!openTIFF(stPath))
+      return false;
+  }
+  else{
+    fprintf(stderr, "DImageStripWriter::open() can only write PNM, PNG, or "
+	    "TIFF files\n");
+    return false;
+  }
+  _fmt = fmt;
+  return true;
+}
+
+bool DImageStripWriter::openPNG(const char *stPath, DImage *pImgProps){
+#ifdef D_NOPNG
+  fprintf(stderr, "DImageStripWriter::open() PNG support is not compiled\n");
+  return false;
+#else
+  png_structp png_ptr;
+  png_infop info_ptr;
+  int bit_depth, color_type;
+  int numComments = 0;
+  png_text *rgText = NULL;
+  char stKey[80];
+  std::string *rgstrComments = NULL;
+
+  sprintf(stKey, "Comment");
+  bit_depth = ((DImage::DImage_u16 == _imgType) ||
+	       (DImage::DImage_RGB_16 == _imgType)) ? 16 : 8;
+  color_type = (3 == getInterleavedNumChannels(_imgType)) ?
+    PNG_COLOR_TYPE_RGB : PNG_COLOR_TYPE_GRAY;
+  fout = fopen(stPath, "wb");
+  if(!fout){
+    fprintf(stderr, "DImageStripWriter::open() couldn't open '%s' for "
+	    "writing\n", stPath);
+    return false;
+  }
+  png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+  if(!png_ptr){
+    fclose(fout);
+    fout = NULL;
+    return false;
+  }
+  info_ptr = png_create_info_struct(png_ptr);
+  if(!info_ptr){
+    png_destroy_write_struct(&png_ptr, (png_infopp)NULL);
+    fclose(fout);
+    fout = NULL;
+    return false;
+  }
+  if(NULL != pImgProps)
+    numComments = pImgProps->getNumComments();
+  if(numComments > 0){
+    rgText = new png_text[numComments];
+    D_CHECKPTR(rgText);
+    rgstrComments = new std::string[numComments];
+    D_CHECKPTR(rgstrComments);
+  }
+  if(DSTRIPS_PNG_SETJMP(png_ptr)){
+    png_destroy_write_struct(&png_ptr, &info_ptr);
+    fclose(fout);
+    fout = NULL;
+    if(NULL != rgText)
+      delete [] rgText;
+    if(NULL != rgstrComments)
+      delete [] rgstrComments;
+    return false;
+  }
+  png_init_io(png_ptr, fout);
+  png_set_IHDR(png_ptr, info_ptr, _w, _h, bit_depth, color_type,
+	       PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT,
+	       PNG_FILTER_TYPE_DEFAULT);
+  for(int cnum = 0; cnum < numComments; ++cnum){
+    rgstrComments[cnum] = pImgProps->getCommentByIndex(cnum);
+    memset(&rgText[cnum], 0, sizeof(png_text));
+    rgText[cnum].compression = PNG_TEXT_COMPRESSION_NONE;
+    rgText[cnum].key = stKey;
+    rgText[cnum].text = (char*)rgstrComments[cnum].c_str();
+    rgText[cnum].text_length = rgstrComments[cnum].length();
+  }
+  if(numComments > 0)
+    png_set_text(png_ptr, info_ptr, rgText, numComments);
+  png_write_info(png_ptr, info_ptr);
+  // for little-endian machines, make sure data bytes are swapped correctly:
+  if(D_LITTLE_ENDIAN && (bit_depth > 8))
+    png_set_swap(png_ptr);
+  if(NULL != rgText)
+    delete [] rgText;
+  if(NULL != rgstrComments)
+    delete [] rgstrComments;
+  pPng = (void*)png_ptr;
+  pPngInfo = (void*)info_ptr;
+  return true;
+#endif
+}
+
+bool DImageStripWriter::openTIFF(const char *stPath){
+#ifdef D_NOTIFF
+  fprintf(stderr, "DImageStripWriter::open() TIFF support is not compiled\n");
+  return false;
+#else
+  TIFF *tif;
+  int numChan;
+
+  if((DImage::DImage_u8 != _imgType) && (DImage::DImage_RGB != _imgType)){
+    fprintf(stderr, "DImageStripWriter::open() only 8-bit TIFF supported\n");
+    return false;
+  }
+  tif = TIFFOpen(stPath, "w");
+  if(NULL == tif){
+    fprintf(stderr, "DImageStripWriter::open() couldn't open '%s' for "
+	    "writing\n", stPath);
+    return false;
+  }
+  numChan = getInterleavedNumChannels(_imgType);
+  TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, (uint32)_w);
+  TIFFSetField(tif, TIFFTAG_IMAGELENGTH, (uint32)_h);
+  TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, (uint16)numChan);
+  TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, (uint16)8);
+  TIFFSetField(tif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+  TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, (3 == numChan) ?
+	       PHOTOMETRIC_RGB : PHOTOMETRIC_MINISBLACK);
+  TIFFSetField(tif, TIFFTAG_COMPRESSION, COMPRESSION_NONE);
+  TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, TIFFDefaultStripSize(tif, 0));
+  pTif = (void*)tif;
+  return true;
+#endif
+}
+
+///write numRows rows of pixel data (numRows*width*bytes per pixel bytes)
+bool DImageStripWriter::writeRowData(const void *pSrc, int numRows){
+  const D_uint8 *p8;
+
+  if((DImage::DFileFormat_unknown == _fmt) || fErr || (numRows < 0) ||
+     ((_nextRow + numRows) > _h)){
+    fprintf(stderr, "DImageStripWriter::writeRowData() can't write %d rows "
+	    "starting at row %d\n", numRows, _nextRow);
+    fErr = true;
+    return false;
+  }
+  p8 = (const D_uint8*)pSrc;
+  if(DImage::DFileFormat_pnm == _fmt){
+    if(!DImageIO::writeDataBlock(fout, (D_uint8*)p8, _rowBytes * numRows))
+      fErr = true;
+  }
+#ifndef D_NOPNG
+  else if(DImage::DFileFormat_png == _fmt){
+    png_structp png_ptr = (png_structp)pPng;
+    if(DSTRIPS_PNG_SETJMP(png_ptr)){
+      fErr = true;
+    }
+    else{
+      for(int r = 0; r < numRows; ++r)
+	png_write_row(png_ptr, (png_bytep)(p8 + r*_rowBytes));
+    }
+  }
+#endif
+#ifndef D_NOTIFF
+  else if(DImage::DFileFormat_tiff == _fmt){
+    for(int r = 0; (r < numRows) && (!fErr); ++r){
+      if(TIFFWriteScanline((TIFF*)pTif, (void*)(p8 + r*_rowBytes),
+			   _nextRow + r, 0) < 0)
+	fErr = true;
+    }
+  }
+#endif
+  if(fErr){
+    fprintf(stderr, "DImageStripWriter::writeRowData() write error\n");
+    return false;
+  }
+  _nextRow += numRows;
+  return true;
+}
+
+///write rows firstRow..firstRow+numRows-1 of imgStrip (all rows if numRows<0)
+/**imgStrip must be the width and type given to open().*/
+bool DImageStripWriter::writeRows(const DImage &imgStrip, int firstRow,
+				  int numRows){
+  if(numRows < 0)
+    numRows = imgStrip.height() - firstRow;
+  if((imgStrip.width() != _w) || (imgStrip.getImageType() != _imgType) ||
+     (firstRow < 0) || ((firstRow + numRows) > imgStrip.height())){
+    fprintf(stderr, "DImageStripWriter::writeRows() strip doesn't match the "
+	    "image being written\n");
+    fErr = true;
+    return false;
+  }
+  return writeRowData(imgStrip.dataPointer_u8() + firstRow*_rowBytes,
+		      numRows);
+}
+
+///finish writing the file
+/**Returns false if there was an error or fewer than height rows were
+   written.*/
+bool DImageStripWriter::close(){
+  bool fOK;
+
+  if(DImage::DFileFormat_unknown == _fmt)
+    return false;
+  fOK = (!fErr) && (_nextRow == _h);
+  if(!fOK)
+    fprintf(stderr, "DImageStripWriter::close() only %d of %d rows were "
+	    "written\n", _nextRow, _h);
+#ifndef D_NOPNG
+  if(NULL != pPng){
+    png_structp png_ptr = (png_structp)pPng;
+    png_infop info_ptr = (png_infop)pPngInfo;
+    if(fOK){
+      if(DSTRIPS_PNG_SETJMP(png_ptr))
+	fOK = false;
+      else
+	png_write_end(png_ptr, info_ptr);
+    }
+    png_destroy_write_struct(&png_ptr, &info_ptr);
+  }
+#endif
+#ifndef D_NOTIFF
+  if(NULL != pTif)
+    TIFFClose((TIFF*)pTif);
+#endif
+  if(NULL != fout){
+    if(0 != fclose(fout))
+      fOK = false;
+  }
+  fout = NULL;
+  pPng = pPngInfo = NULL;
+  pTif = NULL;
+  _fmt = DImage::DFileFormat_unknown;
+  return fOK;
+}
+
+
+DImageStripIterator::DImageStripIterator(int h, int stripRows, int haloRows){
+  if((stripRows < 1) || (haloRows < 0) || (h < 0)){
+    fprintf(stderr, "DImageStripIterator::DImageStripIterator() "
+	    "stripRows(%d) must be > 0, haloRows(%d) >= 0, and h(%d) >= 0\n",
+	    stripRows, haloRows, h);
+    abort();
+  }
+  _h = h;
+  _stripRows = stripRows;
+  _haloRows = haloRows;
+  _y0 = _y1 = _inStart = _inEnd = 0;
+}
+
+///move to the next strip (the first one on the first call)
+/**Returns false when there are no strips left.*/
+bool DImageStripIterator::next(){
+  if(_y1 >= _h)
+    return false;
+  _y0 = _y1;
+  _y1 = (_y0 + _stripRows < _h) ? (_y0 + _stripRows) : _h;
+  _inStart = (_y0 - _haloRows > 0) ? (_y0 - _haloRows) : 0;
+  _inEnd = (_y1 + _haloRows < _h) ? (_y1 + _haloRows) : _h;
+  return true;
+}
+
+///copy the current strip and its halo rows from imgSrc into imgStrip
+void DImageStripIterator::getStrip(DImage &imgStrip,
+				   const DImage &imgSrc) const{
+  imgSrc.copy_(imgStrip, 0, _inStart, imgSrc.width(), _inEnd - _inStart);
+}
+
+///paste the non-halo rows of imgResult (a processed strip) into imgDst
+/**imgResult must have the same number of rows as the strip with its
+   halo, and imgDst must already be created with the full image size.*/
+void DImageStripIterator::putStrip(DImage &imgDst,
+				   const DImage &imgResult) const{
+  imgDst.pasteFromImage(0, _y0, imgResult, 0, _y0 - _inStart,
+			imgResult.width(), _y1 - _y0);
+}
+
+///apply func to stSrcPath one strip at a time and write the result to stDstPath
+/**Only a strip of the input (stripRows + up to 2*haloRows rows) and
+   the matching output strip are in memory at any time.  The output
+   has the type of whatever func produces, and the properties and
+   comments of the source (PNM header).  Returns false if either file
+   can't be opened or func produces a strip of the wrong size.*/
+bool DImageStrips::processFile(const char *stSrcPath, const char *stDstPath,
+			       int stripRows, int haloRows,
+			       DImageStripFunc func, void *params,
+			       DImage::DFileFormat fmtDst){
+  DImageStripReader reader;
+  DImageStripWriter writer;
+  DImage rgImgIn[2];//the current input strip and the previous one
+  DImage imgOut;
+  DImage imgProps;
+  int cur = 0;
+  int bufStart = 0, bufEnd = 0;//rows held by rgImgIn[1-cur]
+  int w, h;
+  size_t rowBytes;
+  bool fOK = true;
+
+  if((stripRows < 1) || (haloRows < 0)){
+    fprintf(stderr, "DImageStrips::processFile() stripRows(%d) must be > 0 "
+	    "and haloRows(%d) >= 0\n", stripRows, haloRows);
+    return false;
+  }
+  if(!reader.open(stSrcPath))
+    return false;
+  reader.getProperties(imgProps);
+  w = reader.width();
+  h = reader.height();
+  rowBytes = reader.getRowBytes();
+  DImageStripIterator it(h, stripRows, haloRows);
+  while(fOK && it.next()){
+    int inStart, inEnd, numKept;
+    DImage &imgIn = rgImgIn[cur];
+    DImage &imgPrev = rgImgIn[1-cur];
+    inStart = it.getStripFirstRow();
+    inEnd = inStart + it.getStripNumRows();
+    //reuse the rows that overlap the previous strip, read the rest
+    numKept = (bufEnd > inStart) ? (bufEnd - inStart) : 0;
+    imgIn.create(w, inEnd - inStart, reader.getImageType(),
+		 reader.numChannels());
+    if(numKept > 0)
+      memcpy(imgIn.dataPointer_u8(),
+	     imgPrev.dataPointer_u8() + (inStart - bufStart)*rowBytes,
+	     numKept * rowBytes);
+    if(!reader.readRowData(imgIn.dataPointer_u8() + numKept*rowBytes,
+			   inEnd - inStart - numKept)){
+      fOK = false;
+      break;
+    }
+    bufStart = inStart;
+    bufEnd = inEnd;
+    cur = 1 - cur;
+
+    (*func)(imgOut, imgIn, params);
+    if((imgOut.width() != w) || (imgOut.height() != (inEnd - inStart))){
+      fprintf(stderr, "DImageStrips::processFile() func returned a %dx%d "
+	      "strip for a %dx%d input strip\n", imgOut.width(),
+	      imgOut.height(), w, inEnd - inStart);
+      fOK = false;
+      break;
+    }
+    if(0 == it.getFirstRow()){
+      if(!writer.open(stDstPath, w, h, imgOut.getImageType(), fmtDst,
+		      &imgProps)){
+	fOK = false;
+	break;
+      }
+    }
+    fOK = writer.writeRows(imgOut, it.getHaloAbove(), it.getNumRows());
+  }
+  if(!writer.close())
+    fOK = false;
+  return fOK;
+}
+
+///apply func to imgSrc one strip at a time, putting the result in imgDst
+/**The result is the same as func(imgDst, imgSrc, params) (if
+   haloRows is at least the vertical radius of func's neighborhood),
+   but the temporaries func allocates are only strip-sized.  imgDst
+   must not be imgSrc.*/
+void DImageStrips::processImage(DImage &imgDst, const DImage &imgSrc,
+				int stripRows, int haloRows,
+				DImageStripFunc func, void *params){
+  DImage imgIn, imgOut;
+  int w, h;
+
+  if((stripRows < 1) || (haloRows < 0) || (&imgDst == &imgSrc)){
+    fprintf(stderr, "DImageStrips::processImage() stripRows(%d) must be > 0, "
+	    "haloRows(%d) >= 0, and imgDst!=imgSrc\n", stripRows, haloRows);
+    abort();
+  }
+  w = imgSrc.width();
+  h = imgSrc.height();
+  DImageStripIterator it(h, stripRows, haloRows);
+  while(it.next()){
+    it.getStrip(imgIn, imgSrc);
+    (*func)(imgOut, imgIn, params);
+    if((imgOut.width() != w) || (imgOut.height() != imgIn.height())){
+      fprintf(stderr, "DImageStrips::processImage() func returned a %dx%d "
+	      "strip for a %dx%d input strip\n", imgOut.width(),
+	      imgOut.height(), w, imgIn.height());
+      abort();
+    }
+    if(0 == it.getFirstRow())
+      imgDst.create(w, h, imgOut.getImageType(), imgOut.numChannels());
+    it.putStrip(imgDst, imgOut);
+  }
+}
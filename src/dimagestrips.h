@@ -0,0 +1,229 @@
+#ifndef DIMAGESTRIPS_H
+#define DIMAGESTRIPS_H
+
+#include <stdio.h>
+#include "dimage.h"
+
+///Reads an image file a strip (a group of whole rows) at a time
+/** DImage::load() always reads the whole image, which for a 5000x7000
+    RGB page scan is 100MB before any processing is done.
+    DImageStripReader reads the header when the file is opened and
+    then returns the rows in order, top to bottom, as many at a time
+    as the caller asks for, so only one strip has to be in memory.
+
+    Raw PNM (P5/P6), non-interlaced PNG, and (unless D_NOTIFF is
+    defined) TIFF files stored in strips are supported.  The pixels
+    are the same as DImage::load() would give for the same rows.  For
+    TIFF that means only top-left 1-bit or 8-bit gray, 8-bit RGB, and
+    JPEG-compressed YCbCr (converted to RGB) files; open() fails for
+    the others (palette, CMYK, alpha, 16-bit, ...), which DImage::load()
+    converts through TIFFReadRGBAImage().  The
+    properties and comments in a PNM header are available from
+    getProperties().
+*/
+class DImageStripReader{
+public:
+  DImageStripReader();
+  ~DImageStripReader();
+  bool open(const char *stPath);
+  void close();
+  bool isOpen() const;
+  int width() const;
+  int height() const;
+  int numChannels() const;
+  DImage::DImageType getImageType() const;
+  int getNextRow() const;
+  size_t getRowBytes() const;
+  bool readRows(DImage &imgStrip, int numRows);
+  bool readRowData(void *pDst, int numRows);
+  void getProperties(DImage &img) const;
+
+private:
+  DImageStripReader(const DImageStripReader &src);//not copyable
+  const DImageStripReader& operator=(const DImageStripReader &src);
+  bool openPNM(const char *stPath);
+  bool openPNG(const char *stPath);
+  bool openTIFF(const char *stPath);
+
+  DImage::DFileFormat _fmt;
+  FILE *fin;
+  void *pPng;//png_structp (when reading PNG)
+  void *pPngInfo;//png_infop
+  void *pTif;//TIFF* (when reading TIFF)
+  D_uint8 *rgTifRow;//one row in TIFF layout, converted to ours in place
+  int _w, _h;
+  int _numChan;
+  DImage::DImageType _imgType;
+  size_t _rowBytes;//bytes per row in the DImage layout
+  int _nextRow;//the next row readRowData() will return
+  DImage imgProps;//properties and comments only (no image data)
+};
+
+///Writes an image file a strip at a time, top to bottom
+/** The size and type are given to open() and then writeRows() is
+    called with the rows in order until all height rows have been
+    written.  close() finishes the file and returns false if it was
+    closed early or anything failed.  Raw PNM (P5 for DImage_u8 and
+    DImage_u16, P6 for DImage_RGB and DImage_RGB_16), PNG, and TIFF
+    (unless D_NOTIFF) can be written.  If pImgProps is given to open(),
+    its properties and comments are saved in PNM headers and its
+    comments in PNG text chunks, the same as DImage::save().
+*/
+class DImageStripWriter{
+public:
+  DImageStripWriter();
+  ~DImageStripWriter();
+  bool open(const char *stPath, int w, int h, DImage::DImageType imgType,
+	    DImage::DFileFormat fmt = DImage::DFileFormat_pnm,
+	    DImage *pImgProps = NULL);
+  bool writeRows(const DImage &imgStrip, int firstRow = 0, int numRows = -1);
+  bool writeRowData(const void *pSrc, int numRows);
+  bool close();
+  int getNextRow() const;
+
+private:
+  DImageStripWriter(const DImageStripWriter &src);//not copyable
+  const DImageStripWriter& operator=(const DImageStripWriter &src);
+  bool openPNG(const char *stPath, DImage *pImgProps);
+  bool openTIFF(const char *stPath);
+
+  DImage::DFileFormat _fmt;
+  FILE *fout;
+  void *pPng;//png_structp
+  void *pPngInfo;//png_infop
+  void *pTif;//TIFF*
+  int _w, _h;
+  DImage::DImageType _imgType;
+  size_t _rowBytes;
+  int _nextRow;
+  bool fErr;
+};
+
+///Steps through the strips of an image of height h, top to bottom
+/** Each strip is stripRows rows (fewer for the last one) plus up to
+    haloRows rows of context above and below it (fewer at the top and
+    bottom of the image).  After each call to next() that returns
+    true, getStrip() copies the strip and its halo out of the source
+    image, and putStrip() pastes the non-halo rows of a result the
+    same size as that strip into the destination.  For example:
+
+    \code
+    DImageStripIterator it(imgSrc.height(), 256, radiusY);
+    while(it.next()){
+      it.getStrip(imgIn, imgSrc);
+      ...filter imgIn into imgOut...
+      it.putStrip(imgDst, imgOut);
+    }
+    \endcode
+
+    Only whole-width strips are supported (not 2-D tiles), which is
+    what the row-at-a-time readers and writers can stream.
+*/
+class DImageStripIterator{
+public:
+  DImageStripIterator(int h, int stripRows, int haloRows);
+  bool next();
+  int getFirstRow() const;
+  int getNumRows() const;
+  int getHaloAbove() const;
+  int getHaloBelow() const;
+  int getStripFirstRow() const;
+  int getStripNumRows() const;
+  void getStrip(DImage &imgStrip, const DImage &imgSrc) const;
+  void putStrip(DImage &imgDst, const DImage &imgResult) const;
+
+private:
+  int _h;
+  int _stripRows;
+  int _haloRows;
+  int _y0, _y1;//the non-halo rows of the current strip are [_y0,_y1)
+  int _inStart, _inEnd;//the rows including the halo are [_inStart,_inEnd)
+};
+
+///function called by DImageStrips for each strip of an image
+/**imgSrc is a strip of the source image including its halo rows.
+   The function must fill imgDst with a result the same width and
+   height as imgSrc (like most of the neighborhood filters do). Only
+   the non-halo rows of imgDst are kept.*/
+typedef void (*DImageStripFunc)(DImage &imgDst, const DImage &imgSrc,
+				void *params);
+
+///Run a neighborhood operation over an image one strip at a time
+/** Filters like DMedianFilter, DVarianceFilter, DMaxFilter, and the
+    thresholders allocate padded copies and full-size temporaries
+    (sometimes as doubles) of their input, so filtering a whole page
+    at once needs several times the memory of the page.  These
+    functions call func on one strip of stripRows rows at a time,
+    plus haloRows rows above and below it (fewer at the top and
+    bottom of the image), and keep only the middle rows of each
+    result.  As long as haloRows is at least the vertical radius of
+    the operation, the output is exactly the same as running func on
+    the whole image, but the temporaries are only strip-sized.
+
+    processFile() also streams the input and output through
+    DImageStripReader and DImageStripWriter, so peak memory is a few
+    strips of (stripRows + 2*haloRows) rows regardless of the size of
+    the page.  processImage() works on a DImage that is already in
+    memory and just bounds the temporaries.
+*/
+class DImageStrips{
+public:
+  static bool processFile(const char *stSrcPath, const char *stDstPath,
+			  int stripRows, int haloRows,
+			  DImageStripFunc func, void *params,
+			  DImage::DFileFormat fmtDst=DImage::DFileFormat_pnm);
+  static void processImage(DImage &imgDst, const DImage &imgSrc,
+			   int stripRows, int haloRows,
+			   DImageStripFunc func, void *params);
+};
+
+inline bool DImageStripReader::isOpen() const{
+  return (DImage::DFileFormat_unknown != _fmt);
+}
+inline int DImageStripReader::width() const{
+  return _w;
+}
+inline int DImageStripReader::height() const{
+  return _h;
+}
+inline int DImageStripReader::numChannels() const{
+  return _numChan;
+}
+inline DImage::DImageType DImageStripReader::getImageType() const{
+  return _imgType;
+}
+inline int DImageStripReader::getNextRow() const{
+  return _nextRow;
+}
+inline size_t DImageStripReader::getRowBytes() const{
+  return _rowBytes;
+}
+inline int DImageStripWriter::getNextRow() const{
+  return _nextRow;
+}
+///first (non-halo) row of the current strip
+inline int DImageStripIterator::getFirstRow() const{
+  return _y0;
+}
+///number of (non-halo) rows in the current strip
+inline int DImageStripIterator::getNumRows() const{
+  return _y1 - _y0;
+}
+///number of halo rows above the current strip
+inline int DImageStripIterator::getHaloAbove() const{
+  return _y0 - _inStart;
+}
+///number of halo rows below the current strip
+inline int DImageStripIterator::getHaloBelow() const{
+  return _inEnd - _y1;
+}
+///first row of the current strip including its halo
+inline int DImageStripIterator::getStripFirstRow() const{
+  return _inStart;
+}
+///number of rows in the current strip including its halo
+inline int DImageStripIterator::getStripNumRows() const{
+  return _inEnd - _inStart;
+}
+
+#endif
@@ -2,6 +2,7 @@
 #include "dimage.h"
 #include "dprogress.h"
 #include "dinstancecounter.h"
+#include "dimagestrips.h"
 #include <string.h>
 
 #ifndef D_NOTHREADS
@@ -513,14 +514,16 @@ void DMedianFilter::filterImage_(DImage &imgDst, const DImage &imgSrc,
       fprintf(stderr, "DMedianFilter::filterImage_() out of memory\n");
       exit(1);
     }
-    if(DMedFilt_Huang_circle == filtType){
-      fill_circle_kern_offsets(_radiusX, _radiusY, rgKern,
-			       rgRightEdge, &numKernPxls);
-    }
-    else{
-      fill_square_kern_offsets(_radiusX, _radiusY, rgKern,
-			       rgRightEdge, &numKernPxls);
-    }
+  }
+  //fill the kernel every time (not just when it is allocated) so
+  //numKernPxls is set when the same filter is used on several images
+  if(DMedFilt_Huang_circle == filtType){
+    fill_circle_kern_offsets(_radiusX, _radiusY, rgKern,
+			     rgRightEdge, &numKernPxls);
+  }
+  else{
+    fill_square_kern_offsets(_radiusX, _radiusY, rgKern,
+			     rgRightEdge, &numKernPxls);
   }
   
   switch(imgSrc.getImageType()){
@@ -798,6 +801,33 @@ void DMedianFilter::medianFilterImage(DImage &imgDst, const DImage &imgSrc,
   mfilt.filterImage_(imgDst, imgSrc, fAlreadyPadded, pProg);
 }
 
+///DImageStripFunc that median filters one strip (params is the DMedianFilter)
+void DMedianFilter::filterStrip(DImage &imgDst, const DImage &imgSrc,
+				void *params){
+  ((DMedianFilter*)params)->filterImage_(imgDst, imgSrc, false, NULL);
+}
+
+///Median filter the image file stSrcPath into stDstPath a strip at a time
+/** Only stripRows rows of the image (plus radiusY rows above and
+    below) are in memory and filtered at once, using
+    DImageStrips::processFile(), so a whole page scan never has to be
+    loaded.  The result is the same as loading the image, calling
+    medianFilterImage(), and saving the result.  Returns false if
+    either file can't be opened (see DImageStripReader for the
+    formats that can be read this way).*/
+bool DMedianFilter::medianFilterFile(const char *stSrcPath,
+				     const char *stDstPath,
+				     int radiusX, int radiusY,
+				     DMedFiltType filtType, int stripRows,
+				     int numThreads,
+				     DImage::DFileFormat fmtDst){
+  DMedianFilter mfilt(radiusX, radiusY, filtType);
+  mfilt.setNumThreads(numThreads);
+  return DImageStrips::processFile(stSrcPath, stDstPath, stripRows, radiusY,
+				   DMedianFilter::filterStrip, (void*)&mfilt,
+				   fmtDst);
+}
+
 ///this is part-implemented only for some debug/comparison work.  do not use it
 // void DMedianFilter::medianFilter_separable_u8(DImage &imgDst,
 // 					      const DImage &imgSrc,
@@ -45,6 +45,12 @@ public:
 				int radiusX = 1, int radiusY = 1,
 				DMedFiltType filtType = DMedFilt_default,
 				DProgress *pProg = NULL, int numThreads = 1);
+  static bool medianFilterFile(const char *stSrcPath, const char *stDstPath,
+			       int radiusX = 1, int radiusY = 1,
+			       DMedFiltType filtType = DMedFilt_default,
+			       int stripRows = 256, int numThreads = 1,
+			       DImage::DFileFormat fmtDst =
+			       DImage::DFileFormat_pnm);
 
 private:
   DMedFiltType _medFiltType;
@@ -75,6 +81,8 @@ private:
 				     int progStart = 0, int progMax = 1,
 				     int threadNumber = 0, int numThreads = 1);
   static void* DMedianFilter_Huang8threadWrap(void* params);
+  static void filterStrip(DImage &imgDst, const DImage &imgSrc,
+			  void *params);
 
 
   /// copy constructor is private so nobody can use it
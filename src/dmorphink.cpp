@@ -6,11 +6,16 @@
 #include "dmedialaxis.h"
 #include "dtimer.h"
 #include "dwordfeatures.h"
+#include "dthreadpool.h"
+#include "darena.h"
 #include <string.h>
 #include <queue>
 #include <stdlib.h>
 
 #include <signal.h>
+#if MORPHINK_SIMD
+#include <immintrin.h>
+#endif
 
 #define SUBSAMPLE 1
 #define SAVE_IMAGES 1
@@ -54,7 +59,17 @@ DMorphInk::DMorphInk(){
   rgMA0quadW = NULL;
   rgMA0quadH = NULL;
   rgTempMA0idx = NULL;
+  rgIncrTerms = NULL;
+  rgIncrVtxW = rgIncrRowX = rgIncrRowY = NULL;
+  rgIncrRowW = rgIncrOtherX = rgIncrOtherY = NULL;
+  incrNumVarying = 0;
+  incrFixedCost = 0.;
 #endif
+  rgMA0QuadStart = NULL;
+  rgMA0QuadIdx = NULL;
+  ma0QuadStartCapacity = 0;
+  ma0QuadIdxCapacity = 0;
+  fMA0QuadBucketsValid = false;
   rgTempMA0X = NULL;
   rgTempMA0Y = NULL;
   lenMA0=0;
@@ -62,6 +77,9 @@ DMorphInk::DMorphInk(){
 
   pimg0 = NULL;
   pimg1 = NULL;
+  pimgDist1 = &imgDist1;
+  pprep0 = NULL;
+  pprep1 = NULL;
   w0 = h0 = w1 = h1 = 0;
   meshLevel = 0;
   initialColSpacing = 0;
@@ -72,21 +90,27 @@ DMorphInk::DMorphInk(){
   warpCostDPhoriz = 0.;
   fOnlyDoOneDirection = false;
   fOnlyDoCoarseAlignment = false;
+  fOnlyDoDPCost = false;
   fFaintMesh = false;
+  pBatchPool = NULL;
+  rgBatchWorkers = NULL;
+  cascadeDPScale = 0.;//the estimated cascade stages are opt-in
+  cascadeCoarseScale = 0.;
+#if MORPHINK_SIMD
+  fUseSIMD = __builtin_cpu_supports("avx2");
+#else
+  fUseSIMD = false;
+#endif
 }
 
 DMorphInk::~DMorphInk(){
-  if(numPointRows>0){
-    free(rgPoints0X);
-    free(rgPoints0Y);
-    free(rgPlacePoints0);
-    free(rgPoints1X);
-    free(rgPoints1Y);
-    free(rgPointsDPX);
-    free(rgPointsDPY);
-    free(rgPointsPrevX);
-    free(rgPointsPrevY);
+  if(NULL != pBatchPool){
+    delete pBatchPool;
+    delete [] rgBatchWorkers;
+    pBatchPool = NULL;
+    rgBatchWorkers = NULL;
   }
+  //(the mesh arrays belong to arenaMesh, which frees them)
   checkFreeMA0Data();
   if (rgMA1X != NULL)
   {
@@ -94,6 +118,16 @@ DMorphInk::~DMorphInk(){
 	free(rgMA1Y);
 	rgMA1X=NULL;
   }
+  if(NULL != rgMA0QuadStart)
+    free(rgMA0QuadStart);
+  if(NULL != rgMA0QuadIdx)
+    free(rgMA0QuadIdx);
+#if NEW_WARP
+  if(NULL != rgIncrTerms)
+    free(rgIncrTerms);
+  rgIncrTerms = NULL;
+#endif
+  rgMA0QuadStart = rgMA0QuadIdx = NULL;
   rgPoints0X = rgPoints0Y = rgPoints1X = rgPoints1Y =
     rgPointsDPX = rgPointsDPY = rgPointsPrevX = rgPointsPrevY = NULL;
   rgPlacePoints0 = NULL;
@@ -122,6 +156,9 @@ void DMorphInk::init(const DImage &src0, const DImage &src1, bool fMakeCopies,
 		     int initialMeshSpacing, int bandRadius,
 		     double nonDiagonalDPcost, bool D_N_C){
 
+  pprep0 = NULL;
+  pprep1 = NULL;
+  pimgDist1 = &imgDist1;
   if(fMakeCopies){
     img0tmp = src0;
     img1tmp = src1;
@@ -192,35 +229,35 @@ void DMorphInk::init(const DImage &src0, const DImage &src1, bool fMakeCopies,
   	setUpMAImg0();
 
   //make lists of MA0 pixels
-  /*rgMA0X = (double*)malloc(sizeof(double)*(1+lenMA0));
+  /*rgMA0X = (DMorphReal*)malloc(sizeof(DMorphReal)*(1+lenMA0));
   D_CHECKPTR(rgMA0X);
-  rgMA0Y = (double*)malloc(sizeof(double)*(1+lenMA0));
+  rgMA0Y = (DMorphReal*)malloc(sizeof(DMorphReal)*(1+lenMA0));
   D_CHECKPTR(rgMA0Y);
 #if NEW_WARP
   rgMA0r = (int*)malloc(sizeof(double)*(1+lenMA0));
   D_CHECKPTR(rgMA0r);
   rgMA0c = (int*)malloc(sizeof(double)*(1+lenMA0));
   D_CHECKPTR(rgMA0c);
-  rgMA0s = (double*)malloc(sizeof(double)*(1+lenMA0));
+  rgMA0s = (DMorphReal*)malloc(sizeof(DMorphReal)*(1+lenMA0));
   D_CHECKPTR(rgMA0s);
-  rgMA0t = (double*)malloc(sizeof(double)*(1+lenMA0));
+  rgMA0t = (DMorphReal*)malloc(sizeof(DMorphReal)*(1+lenMA0));
   D_CHECKPTR(rgMA0t);
-  rgMA0quadW = (double*)malloc(sizeof(double)*(1+lenMA0));
+  rgMA0quadW = (DMorphReal*)malloc(sizeof(DMorphReal)*(1+lenMA0));
   D_CHECKPTR(rgMA0quadW);
-  rgMA0quadH = (double*)malloc(sizeof(double)*(1+lenMA0));
+  rgMA0quadH = (DMorphReal*)malloc(sizeof(DMorphReal)*(1+lenMA0));
   D_CHECKPTR(rgMA0quadH);
   rgTempMA0idx = (int*)malloc(sizeof(double)*(1+lenMA0));
   D_CHECKPTR(rgTempMA0idx);
 #endif
 
-  rgTempMA0X = (double*)malloc(sizeof(double)*lenMA0);
+  rgTempMA0X = (DMorphReal*)malloc(sizeof(DMorphReal)*lenMA0);
   D_CHECKPTR(rgTempMA0X);
-  rgTempMA0Y = (double*)malloc(sizeof(double)*lenMA0);
+  rgTempMA0Y = (DMorphReal*)malloc(sizeof(DMorphReal)*lenMA0);
   D_CHECKPTR(rgTempMA0Y);
 
-  rgDPMA0X = (double*)malloc(sizeof(double)*(1+lenMA0));
+  rgDPMA0X = (DMorphReal*)malloc(sizeof(DMorphReal)*(1+lenMA0));
   D_CHECKPTR(rgDPMA0X);
-  rgDPMA0Y = (double*)malloc(sizeof(double)*(1+lenMA0));
+  rgDPMA0Y = (DMorphReal*)malloc(sizeof(DMorphReal)*(1+lenMA0));
   D_CHECKPTR(rgDPMA0Y);*/
   //D_uint8 *p0;
   //p0 = imgMA0.dataPointer_u8();
@@ -235,9 +272,9 @@ void DMorphInk::init(const DImage &src0, const DImage &src1, bool fMakeCopies,
   //}
   
   //make lists of MA1 pixels
-  rgMA1X = (double*)malloc(sizeof(double)*(1+lenMA1));
+  rgMA1X = (DMorphReal*)malloc(sizeof(DMorphReal)*(1+lenMA1));
   D_CHECKPTR(rgMA1X);
-  rgMA1Y = (double*)malloc(sizeof(double)*(1+lenMA1));
+  rgMA1Y = (DMorphReal*)malloc(sizeof(DMorphReal)*(1+lenMA1));
   D_CHECKPTR(rgMA1Y);
   D_uint8 *p1;
   p1 = imgMA1.dataPointer_u8();
@@ -284,6 +321,60 @@ void DMorphInk::init(const DImage &src0, const DImage &src1, bool fMakeCopies,
 }
 
 
+///same as init() except the per-image data comes from prep0 and prep1
+/**Only the work that depends on both images (DP alignment, mesh
+   setup) is done here.  The distance map and medial axis of prep1
+   are used directly (not copied), so prep0 and prep1 must stay valid
+   until this DMorphInk is re-initialized or destroyed.  If D_N_C is
+   true, the medial axis of image0 is still computed for each pair
+   because it comes from the DP-warped version of image0.*/
+void DMorphInk::init(const DMorphInkPrepared &prep0,
+		     const DMorphInkPrepared &prep1,
+		     int initialMeshSpacing, int bandRadius,
+		     double nonDiagonalDPcost, bool D_N_C){
+  if((!prep0.isPrepared()) || (!prep1.isPrepared())){
+    fprintf(stderr, "DMorphInk::init() called with a DMorphInkPrepared that "
+	    "hasn't been prepared\n");
+    abort();
+  }
+  pprep0 = &prep0;
+  pprep1 = &prep1;
+  pimg0 = (DImage*)prep0.pimg;
+  pimg1 = (DImage*)prep1.pimg;
+  w0 = prep0.w;
+  h0 = prep0.h;
+  w1 = prep1.w;
+  h1 = prep1.h;
+
+  //don't leave memory hanging if we call init() more than once:
+  checkFreeMA0Data();
+  if (rgMA1X != NULL)
+  {
+  	free(rgMA1X);
+	free(rgMA1Y);
+	rgMA1X=NULL;
+  }
+
+  //MA1 points and distance map come straight from prep1
+  lenMA1 = prep1.lenMA;
+  rgMA1X = (DMorphReal*)malloc(sizeof(DMorphReal)*(1+lenMA1));
+  D_CHECKPTR(rgMA1X);
+  rgMA1Y = (DMorphReal*)malloc(sizeof(DMorphReal)*(1+lenMA1));
+  D_CHECKPTR(rgMA1Y);
+  for(int i=0; i < lenMA1; ++i){//(DMorphReal may be float)
+    rgMA1X[i] = prep1.rgMAX[i];
+    rgMA1Y[i] = prep1.rgMAY[i];
+  }
+  pimgDist1 = &(prep1.imgDistMA);
+
+  if (!D_N_C)
+  	setUpMAImg0(prep0);
+
+  resetMeshes(initialMeshSpacing,initialMeshSpacing,
+	      bandRadius,nonDiagonalDPcost,D_N_C);
+}
+
+
 void DMorphInk::setUpMAImg0()
 {
 	w0 = pimg0->width();
@@ -300,49 +391,68 @@ void DMorphInk::setUpMAImg0()
 
 
 	//make lists of MA0 pixels
+	allocMA0Data();
+	D_uint8 *p0;
+	p0 = imgMA0.dataPointer_u8();
+	for(int y=0, idx=0, ma_pt=0; y < h0; ++y){
+		for(int x=0; x<w0; ++x, ++idx){
+			if(p0[idx] > 0){
+				rgMA0X[ma_pt] = x;
+				rgMA0Y[ma_pt] = y;
+				++ma_pt;//MedialAxis point
+			}
+		}
+	}
+}
+
+///same as setUpMAImg0() but copies the MA0 points from prep0
+void DMorphInk::setUpMAImg0(const DMorphInkPrepared &prep0)
+{
+	w0 = prep0.w;
+	h0 = prep0.h;
+	lenMA0 = prep0.lenMA;
+	allocMA0Data();
+	for(int i=0; i < lenMA0; ++i){
+	  rgMA0X[i] = prep0.rgMAX[i];
+	  rgMA0Y[i] = prep0.rgMAY[i];
+	}
+}
+
+///(re)allocate the MA0 arrays for lenMA0 points
+void DMorphInk::allocMA0Data()
+{
 	checkFreeMA0Data();
 	
-	rgMA0X = (double*)malloc(sizeof(double)*(1+lenMA0));
+	rgMA0X = (DMorphReal*)malloc(sizeof(DMorphReal)*(1+lenMA0));
 	D_CHECKPTR(rgMA0X);
-	rgMA0Y = (double*)malloc(sizeof(double)*(1+lenMA0));
+	rgMA0Y = (DMorphReal*)malloc(sizeof(DMorphReal)*(1+lenMA0));
 	D_CHECKPTR(rgMA0Y);
 	#if NEW_WARP
 	rgMA0r = (int*)malloc(sizeof(double)*(1+lenMA0));
 	D_CHECKPTR(rgMA0r);
 	rgMA0c = (int*)malloc(sizeof(double)*(1+lenMA0));
 	D_CHECKPTR(rgMA0c);
-	rgMA0s = (double*)malloc(sizeof(double)*(1+lenMA0));
+	rgMA0s = (DMorphReal*)malloc(sizeof(DMorphReal)*(1+lenMA0));
 	D_CHECKPTR(rgMA0s);
-	rgMA0t = (double*)malloc(sizeof(double)*(1+lenMA0));
+	rgMA0t = (DMorphReal*)malloc(sizeof(DMorphReal)*(1+lenMA0));
 	D_CHECKPTR(rgMA0t);
-	rgMA0quadW = (double*)malloc(sizeof(double)*(1+lenMA0));
+	rgMA0quadW = (DMorphReal*)malloc(sizeof(DMorphReal)*(1+lenMA0));
 	D_CHECKPTR(rgMA0quadW);
-	rgMA0quadH = (double*)malloc(sizeof(double)*(1+lenMA0));
+	rgMA0quadH = (DMorphReal*)malloc(sizeof(DMorphReal)*(1+lenMA0));
 	D_CHECKPTR(rgMA0quadH);
 	rgTempMA0idx = (int*)malloc(sizeof(double)*(1+lenMA0));
 	D_CHECKPTR(rgTempMA0idx);
 	#endif
 
-	rgTempMA0X = (double*)malloc(sizeof(double)*lenMA0);
+	rgTempMA0X = (DMorphReal*)malloc(sizeof(DMorphReal)*lenMA0);
 	D_CHECKPTR(rgTempMA0X);
-	rgTempMA0Y = (double*)malloc(sizeof(double)*lenMA0);
+	rgTempMA0Y = (DMorphReal*)malloc(sizeof(DMorphReal)*lenMA0);
 	D_CHECKPTR(rgTempMA0Y);
 
-	rgDPMA0X = (double*)malloc(sizeof(double)*(1+lenMA0));
+	rgDPMA0X = (DMorphReal*)malloc(sizeof(DMorphReal)*(1+lenMA0));
 	D_CHECKPTR(rgDPMA0X);
-	rgDPMA0Y = (double*)malloc(sizeof(double)*(1+lenMA0));
+	rgDPMA0Y = (DMorphReal*)malloc(sizeof(DMorphReal)*(1+lenMA0));
 	D_CHECKPTR(rgDPMA0Y);
-	D_uint8 *p0;
-	p0 = imgMA0.dataPointer_u8();
-	for(int y=0, idx=0, ma_pt=0; y < h0; ++y){
-		for(int x=0; x<w0; ++x, ++idx){
-			if(p0[idx] > 0){
-				rgMA0X[ma_pt] = x;
-				rgMA0Y[ma_pt] = y;
-				++ma_pt;//MedialAxis point
-			}
-		}
-	}
 }
 
 void DMorphInk::checkFreeMA0Data()
@@ -382,18 +492,10 @@ void DMorphInk::checkFreeMA0Data()
 void DMorphInk::resetMeshes(int columnSpacing, int rowSpacing,
 			    int bandRadius, double nonDiagonalDPcost, bool D_N_C) {
 		
-  // release memory if already being used
-  if(numPointRows>0){
-    free(rgPoints0X);
-    free(rgPoints0Y);
-    free(rgPlacePoints0);
-    free(rgPoints1X);
-    free(rgPoints1Y);
-    free(rgPointsDPX);
-    free(rgPointsDPY);
-    free(rgPointsPrevX);
-    free(rgPointsPrevY);
-  }
+  // release memory if already being used (the mesh arrays and the DP
+  // buffers all come from the arenas, so nothing is actually freed)
+  arenaMesh.reset();
+  arenaScratch.reset();
   	    
   //////////Brian moved
   //do DP x-alignment of img0 to img1 to decide how to set warp1 x-coords
@@ -401,26 +503,46 @@ void DMorphInk::resetMeshes(int columnSpacing, int rowSpacing,
   
   DProfile prof1, prof2;
 
-  DFeatureVector fv1, fv2;
-  fv1 = DWordFeatures::extractWordFeatures(*pimg0,true,false,true,true,127);
-  fv2 = DWordFeatures::extractWordFeatures(*pimg1,true,false,true,true,127);
+  DFeatureVector fv1tmp, fv2tmp;
+  const DFeatureVector *pfv1, *pfv2;
+  if((NULL != pprep0) && (pimg0 == pprep0->pimg))
+    pfv1 = &(pprep0->fvWord);
+  else{
+    fv1tmp = DWordFeatures::extractWordFeatures(*pimg0,true,false,true,true,127);
+    pfv1 = &fv1tmp;
+  }
+  if((NULL != pprep1) && (pimg1 == pprep1->pimg))
+    pfv2 = &(pprep1->fvWord);
+  else{
+    fv2tmp = DWordFeatures::extractWordFeatures(*pimg1,true,false,true,true,127);
+    pfv2 = &fv2tmp;
+  }
+  const DFeatureVector &fv1 = *pfv1;
+  const DFeatureVector &fv2 = *pfv2;
   double dblDPcost;
   int pathLen;
   int *rgPath;
   int *rgPrev;
   double *rgTable;
-  rgPath = (int*)malloc(sizeof(int)*(w0+2)*(w1+2));
-  D_CHECKPTR(rgPath);
-  rgPrev = (int*)malloc(sizeof(int)*(w0+2)*(w1+2));
-  D_CHECKPTR(rgPrev);
-  rgTable = (double*)malloc(sizeof(double)*(w0+2)*(w1+2));
-  D_CHECKPTR(rgTable);
+  int *rgBandRows;
+  int numBandCells;
+  //only the Sakoe-Chiba band of the DP table is stored (see findDPAlignmentBanded)
+  numBandCells = DDynamicProgramming::getBandedTableSize(fv1.vectLen,
+							 fv2.vectLen,
+							 bandRadius);
+  rgPath = (int*)arenaScratch.alloc(sizeof(int)*(fv1.vectLen+fv2.vectLen+2));
+  rgPrev = (int*)arenaScratch.alloc(sizeof(int)*numBandCells);
+  rgTable = (double*)arenaScratch.alloc(sizeof(double)*numBandCells);
+  rgBandRows = (int*)arenaScratch.alloc(sizeof(int)*3*(fv1.vectLen+1));
 
   // printf("fv1.vectLen=%d fv2.vectLen=%d\n", fv1.vectLen, fv2.vectLen);
 
-  dblDPcost = DDynamicProgramming::findDPAlignment(fv1, fv2, bandRadius,1000.,
-						   nonDiagonalDPcost, &pathLen,
-						   rgPath, rgPrev, rgTable);
+  dblDPcost = DDynamicProgramming::findDPAlignmentBanded(fv1, fv2, bandRadius,
+							 1000.,
+							 nonDiagonalDPcost,
+							 &pathLen, rgPath,
+							 rgPrev, rgTable,
+							 rgBandRows);
   // {
   //   DDynamicProgramming::debugImages(w0,w1,pathLen,rgPath,rgPrev,rgTable);
   //   // features of w0:
@@ -448,8 +570,11 @@ void DMorphInk::resetMeshes(int columnSpacing, int rowSpacing,
   	//This shouldn't cause a memory leak. *crosses fingers*
 	img0tmpDP = DDynamicProgramming::piecewiseLinearWarpDImage(*pimg0, w1,
 							       pathLen, rgPath, false);
-	pimg0 = &img0tmpDP;		     
-	setUpMAImg0();
+	pimg0 = &img0tmpDP;
+	//the medial axis isn't needed until after the vertical warp below, so
+	//just update the size here instead of calling setUpMAImg0() twice
+	w0 = pimg0->width();
+	h0 = pimg0->height();
 #if SAVE_IMAGES
 	{					    
 	  pimg0->save("/tmp/dpwarp_horz.pgm");
@@ -460,8 +585,7 @@ void DMorphInk::resetMeshes(int columnSpacing, int rowSpacing,
   else
   {
 	  
-	  rgXMappings0to1 = (double*)malloc(sizeof(double)*(w0+1));
-	  D_CHECKPTR(rgXMappings0to1);
+	  rgXMappings0to1 = (double*)arenaScratch.alloc(sizeof(double)*(w0+1));
 	  DDynamicProgramming::getCoord0MappingsToCoord1(w0,w1,rgXMappings0to1,pathLen,rgPath);
 #if SAVE_IMAGES
 	  {
@@ -477,11 +601,19 @@ void DMorphInk::resetMeshes(int columnSpacing, int rowSpacing,
   //do DP y-alignment of img0 to img1 to decide how to set warp1 y-coords
   //The features are built JUST ON THE VERTICAL PROFILE
   DProfile Vprof1, Vprof2;
-  Vprof1.getImageVerticalProfile(*pimg0);
-  Vprof2.getImageVerticalProfile(*pimg1);
+  bool fPreparedVProf1, fPreparedVProf2;//use the profiles from pprep0/1
+  fPreparedVProf1 = (NULL != pprep0) && (pimg0 == pprep0->pimg);
+  fPreparedVProf2 = (NULL != pprep1) && (pimg1 == pprep1->pimg);
+#if NORMALIZE_VERT_PROF
+  fPreparedVProf1 = fPreparedVProf2 = false;
+#endif
+  if(!fPreparedVProf1)
+    Vprof1.getImageVerticalProfile(*pimg0);
+  if(!fPreparedVProf2)
+    Vprof2.getImageVerticalProfile(*pimg1);
   double *pVProf1, *pVProf2;
-  pVProf1 = Vprof1.dataPointer();
-  pVProf2 = Vprof2.dataPointer();
+  pVProf1 = fPreparedVProf1 ? pprep0->fvVProf.pDbl : Vprof1.dataPointer();
+  pVProf2 = fPreparedVProf2 ? pprep1->fvVProf.pDbl : Vprof2.dataPointer();
 
 #if NORMALIZE_VERT_PROF
   {
@@ -511,16 +643,20 @@ void DMorphInk::resetMeshes(int columnSpacing, int rowSpacing,
 #endif
 
   DFeatureVector Vfv1, Vfv2;
-  Vfv1.setData_dbl(pVProf1, h0, 1, true, true, true);
-  Vfv2.setData_dbl(pVProf2, h1, 1, true, true, true);
+  //(prepared profiles are used in place instead of being copied)
+  Vfv1.setData_dbl(pVProf1, h0, 1, true, !fPreparedVProf1, true);
+  Vfv2.setData_dbl(pVProf2, h1, 1, true, !fPreparedVProf2, true);
   double dblDPcostV;
   int pathLenV;
   int *rgPathV;
   int *rgPrevV;
   double *rgTableV;
-  rgPathV = (int*)malloc(sizeof(int)*(h0+2)*(h1+2));
-  rgPrevV = (int*)malloc(sizeof(int)*(h0+2)*(h1+2));
-  rgTableV = (double*)malloc(sizeof(double)*(h0+2)*(h1+2));
+  //The vertical profiles aren't normalized, so the in-band cost is often
+  //over bandCost and findDPAlignmentBanded() would just fall back to the
+  //full table.  h0*h1 is small anyway.
+  rgPathV = (int*)arenaScratch.alloc(sizeof(int)*(h0+2)*(h1+2));
+  rgPrevV = (int*)arenaScratch.alloc(sizeof(int)*(h0+2)*(h1+2));
+  rgTableV = (double*)arenaScratch.alloc(sizeof(double)*(h0+2)*(h1+2));
   dblDPcostV = DDynamicProgramming::findDPAlignment(Vfv1, Vfv2,
 						    bandRadius*2/3+1, 1000.,
 						    nonDiagonalDPcost,&pathLenV,
@@ -599,24 +735,15 @@ void DMorphInk::resetMeshes(int columnSpacing, int rowSpacing,
   
   
   //allocate memory
-  rgPoints0X = (double*)malloc(sizeof(double)*numPoints);
-  D_CHECKPTR(rgPoints0X);
-  rgPoints0Y = (double*)malloc(sizeof(double)*numPoints);
-  D_CHECKPTR(rgPoints0Y);
-  rgPlacePoints0 = (bool*)malloc(sizeof(bool)*numPoints);
-  D_CHECKPTR(rgPlacePoints0);
-  rgPoints1X = (double*)malloc(sizeof(double)*numPoints);
-  D_CHECKPTR(rgPoints1X);
-  rgPoints1Y = (double*)malloc(sizeof(double)*numPoints);
-  D_CHECKPTR(rgPoints1Y);
-  rgPointsDPX = (double*)malloc(sizeof(double)*numPoints);
-  D_CHECKPTR(rgPointsDPX);
-  rgPointsDPY = (double*)malloc(sizeof(double)*numPoints);
-  D_CHECKPTR(rgPointsDPY);
-  rgPointsPrevX = (double*)malloc(sizeof(double)*numPoints);
-  D_CHECKPTR(rgPointsPrevX);
-  rgPointsPrevY = (double*)malloc(sizeof(double)*numPoints);
-  D_CHECKPTR(rgPointsPrevY);
+  rgPoints0X = (DMorphReal*)arenaMesh.alloc(sizeof(DMorphReal)*numPoints);
+  rgPoints0Y = (DMorphReal*)arenaMesh.alloc(sizeof(DMorphReal)*numPoints);
+  rgPlacePoints0 = (bool*)arenaMesh.alloc(sizeof(bool)*numPoints);
+  rgPoints1X = (DMorphReal*)arenaMesh.alloc(sizeof(DMorphReal)*numPoints);
+  rgPoints1Y = (DMorphReal*)arenaMesh.alloc(sizeof(DMorphReal)*numPoints);
+  rgPointsDPX = (DMorphReal*)arenaMesh.alloc(sizeof(DMorphReal)*numPoints);
+  rgPointsDPY = (DMorphReal*)arenaMesh.alloc(sizeof(DMorphReal)*numPoints);
+  rgPointsPrevX = (DMorphReal*)arenaMesh.alloc(sizeof(DMorphReal)*numPoints);
+  rgPointsPrevY = (DMorphReal*)arenaMesh.alloc(sizeof(DMorphReal)*numPoints);
   // ma0prevPosX = (double*)malloc(sizeof(double)*lenMA0);
   // D_CHECKPTR(ma0prevPosX);
   // ma0prevPosY = (double*)malloc(sizeof(double)*lenMA0);
@@ -662,8 +789,7 @@ void DMorphInk::resetMeshes(int columnSpacing, int rowSpacing,
   else
   {
 	  
-	  rgYMappings0to1 = (double*)malloc(sizeof(double)*(h0+1));
-	  D_CHECKPTR(rgYMappings0to1);
+	  rgYMappings0to1 = (double*)arenaScratch.alloc(sizeof(double)*(h0+1));
 	  DDynamicProgramming::getCoord0MappingsToCoord1(h0,h1,rgYMappings0to1,pathLenV,
 							 rgPathV);
 
@@ -707,18 +833,7 @@ void DMorphInk::resetMeshes(int columnSpacing, int rowSpacing,
 
   //assign the Medial Axis points their corresponding quad indexes
   //assignMA0qidxs();
-  // free memory used for DP warping, etc.
-  free(rgPath);
-  free(rgPrev);
-  free(rgTable);
-  free(rgPathV);
-  free(rgPrevV);
-  free(rgTableV);
-  if (!D_N_C)
-  {
-	  free(rgXMappings0to1);
-	  free(rgYMappings0to1);
-  }
+  // (memory used for DP warping, etc. is left in arenaScratch for next time)
   
   
   this->initialColSpacing = columnSpacing;
@@ -755,6 +870,7 @@ void DMorphInk::resetMeshes(int columnSpacing, int rowSpacing,
   }  
 #endif //SPEED_TEST
 
+  fMA0QuadBucketsValid = false;//quads changed, so rebuild before next use
 #if NEW_WARP
   for(int i=0; i < lenMA0; ++i){
     //this code is what used to happen in warpPoint.  now we
@@ -863,13 +979,35 @@ void DMorphInk::morphOneWay(	const DImage &srcFrom,
 							int meshSpacingStatic,
 				  			int numRefinementsStatic, 
 				  			double meshDiv) {
-	int numImprovesPerRefinement = 3;//2.3328103658311496
 	int meshSpacing = (int)(srcFrom.height() / meshDiv);
 	if(meshSpacing < 4)
 	  	meshSpacing = 4;
 	if(-1 != meshSpacingStatic)
 	 	meshSpacing = meshSpacingStatic;
 	init(srcFrom, srcTo, false, meshSpacing, bandWidthDP,nonDiagonalCostDP,DIVIDE_N_CONQ);
+	morphOneWayAfterInit(meshSpacing, numRefinementsStatic);
+}
+
+///same as morphOneWay() above, but with prepared images
+void DMorphInk::morphOneWay(const DMorphInkPrepared &prepFrom,
+			    const DMorphInkPrepared &prepTo,
+			    int bandWidthDP,
+			    double nonDiagonalCostDP,
+			    int meshSpacingStatic,
+			    int numRefinementsStatic,
+			    double meshDiv) {
+	int meshSpacing = (int)(prepFrom.h / meshDiv);
+	if(meshSpacing < 4)
+	  	meshSpacing = 4;
+	if(-1 != meshSpacingStatic)
+	 	meshSpacing = meshSpacingStatic;
+	init(prepFrom, prepTo, meshSpacing, bandWidthDP,nonDiagonalCostDP,DIVIDE_N_CONQ);
+	morphOneWayAfterInit(meshSpacing, numRefinementsStatic);
+}
+
+///the part of morphOneWay() that comes after init()
+void DMorphInk::morphOneWayAfterInit(int meshSpacing, int numRefinementsStatic){
+	int numImprovesPerRefinement = 3;//2.3328103658311496
 	if(fOnlyDoCoarseAlignment){
 	}
 	else{
@@ -1008,6 +1146,10 @@ double DMorphInk::getWordMorphCost(const DImage &src0,
   double cost = 0.;
   double cost2 = 0.;
 
+  if(fOnlyDoDPCost)
+    return getWordDPCost(src0, src1, bandWidthDP, nonDiagonalCostDP,
+			 lengthMismatchPenalty);
+
   double lenPen = 0.;
   double wLong = 0., wShort=0.;
   if(src0.width() > src1.width()){
@@ -1056,6 +1198,61 @@ printf("Cost one way: %f, the other way:%f\n",cost,cost2);
   // return cost;
 }
 
+///same as getWordMorphCost() above, but uses pre-computed per-image data
+/**prep0 and prep1 should each have been prepared once (see
+   DMorphInkPrepared::prepare()) so that the distance maps, medial
+   axes, and word features aren't recomputed for every pair.  The
+   returned cost is the same as the DImage version would return.*/
+double DMorphInk::getWordMorphCost(const DMorphInkPrepared &prep0,
+				   const DMorphInkPrepared &prep1,
+				   int bandWidthDP,
+				   double nonDiagonalCostDP,
+				   int meshSpacingStatic,
+				   int numRefinementsStatic,
+				   double meshDiv,
+				   double lengthMismatchPenalty){
+  double cost = 0.;
+  double cost2 = 0.;
+
+  if(fOnlyDoDPCost)
+    return getWordDPCost(prep0, prep1, bandWidthDP, nonDiagonalCostDP,
+			 lengthMismatchPenalty);
+
+  double lenPen = 0.;
+  double wLong = 0., wShort=0.;
+  if(prep0.w > prep1.w){
+    wLong = prep0.w;
+    wShort = prep1.w;
+  }
+  else{
+    wLong = prep1.w;
+    wShort = prep0.w;
+  }
+  lenPen = lengthMismatchPenalty*(wLong-wShort)/wLong;
+
+  //get cost to morph from prep0 to prep1
+  morphOneWay(prep0, prep1, bandWidthDP, nonDiagonalCostDP,
+	      meshSpacingStatic, numRefinementsStatic, meshDiv);
+  cost = getCost() + lenPen;
+  warpCostDPfull = warpCostDP + warpCostDPv;
+  warpCostDPhoriz = warpCostDP;
+
+  if(fOnlyDoOneDirection)
+    return cost;
+
+  //get cost to morph from prep1 to prep0
+  morphOneWay(prep1, prep0, bandWidthDP, nonDiagonalCostDP,
+	      meshSpacingStatic, numRefinementsStatic, meshDiv);
+  cost2 = getCost() + lenPen;
+  warpCostDPfull += warpCostDP + warpCostDPv;
+  warpCostDPhoriz += warpCostDP;
+
+#if SAVE_IMAGES
+printf("Cost one way: %f, the other way:%f\n",cost,cost2);
+#endif
+  return cost + cost2;
+}
+
 
 ///same as getWordMorphCost except that it forces numImprovesPerRefinement to 1 and numRefinements to 0 for a fast pass at the data.
 double DMorphInk::getWordMorphCostFast(const DImage &src0,
@@ -1067,11 +1264,13 @@ double DMorphInk::getWordMorphCostFast(const DImage &src0,
 				       double meshDiv,
 				       double lengthMismatchPenalty){
   int meshSpacing;
-  int numRefinements;
-  int numImprovesPerRefinement = 3;
   double cost = 0.;
   double cost2 = 0.;
 
+  if(fOnlyDoDPCost)
+    return getWordDPCost(src0, src1, bandWidthDP, nonDiagonalCostDP,
+			 lengthMismatchPenalty);
+
   double lenPen = 0.;
   double wLong = 0., wShort=0.;
   if(src0.width() > src1.width()){
@@ -1093,34 +1292,7 @@ double DMorphInk::getWordMorphCostFast(const DImage &src0,
   if(-1 != meshSpacingStatic)
     meshSpacing = meshSpacingStatic;
   init(src0, src1, false, meshSpacing, bandWidthDP,nonDiagonalCostDP,false);
-
-  if(fOnlyDoCoarseAlignment){
-  }
-  else{
-    numRefinements = 0;
-    while(meshSpacing > 16){
-      meshSpacing /=2;
-      ++numRefinements;
-    }
-    if(-1 != numRefinementsStatic)
-      numRefinements = numRefinementsStatic;
-#if SPEED_TEST3
-    numImprovesPerRefinement = 1;
-    numRefinements = 0;
-#endif
-    for(int ref=0; ref <= numRefinements; ++ref){
-      for(int imp=0; imp < numImprovesPerRefinement; ++imp){
-#if SPEED_TEST2
-	improveMorphFast();
-#else
-	improveMorph();
-#endif
-      }
-      if(ref < numRefinements){
-	refineMeshes();
-      }
-    }
-  }
+  morphFastAfterInit(meshSpacing, numRefinementsStatic);
   cost = getCost() + lenPen;
   warpCostDPfull = warpCostDP + warpCostDPv;
   warpCostDPhoriz = warpCostDP;
@@ -1137,44 +1309,606 @@ double DMorphInk::getWordMorphCostFast(const DImage &src0,
     meshSpacing = meshSpacingStatic;
 
   init(src1, src0, false, meshSpacing, bandWidthDP,nonDiagonalCostDP, false);
+  morphFastAfterInit(meshSpacing, numRefinementsStatic);
+  cost2 = getCost() + lenPen;
+  warpCostDPfull += warpCostDP + warpCostDPv;
+  warpCostDPhoriz += warpCostDP;
+
+
+  return cost + cost2;
+  // return cost;
+}
+
+///same as getWordMorphCostFast() above, but uses pre-computed per-image data
+/**Since the fast pass doesn't use divide-and-conquer, nothing that
+   depends on only one of the images is recomputed here.*/
+double DMorphInk::getWordMorphCostFast(const DMorphInkPrepared &prep0,
+				       const DMorphInkPrepared &prep1,
+				       int bandWidthDP,
+				       double nonDiagonalCostDP,
+				       int meshSpacingStatic,
+				       int numRefinementsStatic,
+				       double meshDiv,
+				       double lengthMismatchPenalty){
+  int meshSpacing;
+  double cost = 0.;
+  double cost2 = 0.;
+
+  if(fOnlyDoDPCost)
+    return getWordDPCost(prep0, prep1, bandWidthDP, nonDiagonalCostDP,
+			 lengthMismatchPenalty);
 
-  if(fOnlyDoCoarseAlignment){
+  double lenPen = 0.;
+  double wLong = 0., wShort=0.;
+  if(prep0.w > prep1.w){
+    wLong = prep0.w;
+    wShort = prep1.w;
   }
   else{
-    numRefinements = 0;
-    while(meshSpacing > 16){
-      meshSpacing /=2;
-      ++numRefinements;
-    }
-    if(-1 != numRefinementsStatic)
-      numRefinements = numRefinementsStatic;
+    wLong = prep1.w;
+    wShort = prep0.w;
+  }
+  lenPen = lengthMismatchPenalty*(wLong-wShort)/wLong;
+
+  //get cost to morph from prep0 to prep1
+  meshSpacing = (int)(prep0.h / meshDiv);
+  if(meshSpacing < 4)
+    meshSpacing = 4;
+  if(-1 != meshSpacingStatic)
+    meshSpacing = meshSpacingStatic;
+  init(prep0, prep1, meshSpacing, bandWidthDP,nonDiagonalCostDP,false);
+  morphFastAfterInit(meshSpacing, numRefinementsStatic);
+  cost = getCost() + lenPen;
+  warpCostDPfull = warpCostDP + warpCostDPv;
+  warpCostDPhoriz = warpCostDP;
+
+  if(fOnlyDoOneDirection)
+    return cost;
+
+  //get cost to morph from prep1 to prep0
+  meshSpacing = (int)(prep1.h / meshDiv);
+  if(meshSpacing < 4)
+    meshSpacing = 4;
+  if(-1 != meshSpacingStatic)
+    meshSpacing = meshSpacingStatic;
+  init(prep1, prep0, meshSpacing, bandWidthDP,nonDiagonalCostDP,false);
+  morphFastAfterInit(meshSpacing, numRefinementsStatic);
+  cost2 = getCost() + lenPen;
+  warpCostDPfull += warpCostDP + warpCostDPv;
+  warpCostDPhoriz += warpCostDP;
+
+  return cost + cost2;
+}
+
+///the improve/refine loop used by getWordMorphCostFast() after init()
+void DMorphInk::morphFastAfterInit(int meshSpacing, int numRefinementsStatic){
+  int numRefinements;
+  int numImprovesPerRefinement = 3;
+
+  if(fOnlyDoCoarseAlignment)
+    return;
+  numRefinements = 0;
+  while(meshSpacing > 16){
+    meshSpacing /=2;
+    ++numRefinements;
+  }
+  if(-1 != numRefinementsStatic)
+    numRefinements = numRefinementsStatic;
 #if SPEED_TEST3
-    numImprovesPerRefinement = 1;
-    numRefinements = 0;
+  numImprovesPerRefinement = 1;
+  numRefinements = 0;
 #endif
-    for(int ref=0; ref <= numRefinements; ++ref){
-      for(int imp=0; imp < numImprovesPerRefinement; ++imp){
+  for(int ref=0; ref <= numRefinements; ++ref){
+    for(int imp=0; imp < numImprovesPerRefinement; ++imp){
 #if SPEED_TEST2
-	improveMorphFast();
+      improveMorphFast();
 #else
-	improveMorph();
+      improveMorph();
 #endif
-      }
-      if(ref < numRefinements){
-	refineMeshes();
-      }
+    }
+    if(ref < numRefinements){
+      refineMeshes();
+    }
+  }
+}
+
+
+
+//findDPCostOnly() for getWordDPCost_() and getWordMorphCostCascade(), but if
+//there is an upperBound, the LB_Improved bound is checked first and returned
+//(without doing the DP) if it is already more than upperBound.  The bound
+//only holds for a nonDiagonalCostDP that isn't negative.  rgRows, rgLens,
+//and rgD are the scratch buffers of findDPCostOnly()
+static double getDPCostBounded(const DFeatureVector &fv0,
+			       const DFeatureVector &fv1,
+			       int bandWidthDP, double nonDiagonalCostDP,
+			       double upperBound, double *rgRows, int *rgLens,
+			       double *rgD){
+  if((upperBound < HUGE_VAL) && (nonDiagonalCostDP >= 0.)){
+    double lb;
+    lb = DDynamicProgramming::getLowerBoundImproved(fv0, fv1, bandWidthDP,
+						    upperBound);
+    if(lb > upperBound)
+      return lb;
+  }
+  return DDynamicProgramming::findDPCostOnly(fv0, fv1, bandWidthDP,
+					     nonDiagonalCostDP, upperBound,
+					     NULL, rgRows, rgLens, NULL, rgD);
+}
+
+///Same cost as getWordMorphCost(), but gives up once it exceeds threshold
+/**This is for searches that only care about a candidate whose cost is
+   at or below threshold (the current k-th best cost, for example).
+   The comparison is done in stages, cheapest first, and stops at the
+   first stage whose bound is greater than threshold:
+
+   CascadeLength:  2*lenPen (lenPen if fOnlyDoOneDirection) since
+                   getCost() is never negative
+   CascadeDP:      that plus cascadeDPScale*warpCostDP (checked with the
+                   LB_Improved bound and then
+                   DDynamicProgramming::findDPCostOnly() before init(),
+                   so a rejected candidate never gets meshes at all)
+   CascadeCoarse:  that plus cascadeCoarseScale*getCost() of the
+                   unrefined mesh
+   CascadeOneWay:  full cost of the first direction plus lenPen for
+                   the second direction
+
+   The length and one-way bounds never exceed the real cost, so with
+   the defaults (cascadeDPScale and cascadeCoarseScale both 0., which
+   skips the DP and coarse stages) a candidate at or under threshold is
+   never rejected.  The DP and coarse stages are NOT bounds, just
+   approximations: the real cost (less the length penalties) is assumed
+   to be at least cascadeDPScale times the DP cost and at least
+   cascadeCoarseScale times the coarse mesh cost.  Those ratios depend
+   on the data (on one set of stroke-drawn test words the smallest were
+   11.4 and 0.55 for the fast cost, 13.8 and 0.77 for the full cost,
+   but a word that morphs to another at cost 0 has a ratio of 0), so a
+   caller that turns these stages on has to accept that they can
+   reject a candidate that is really under threshold.
+
+   If fOnlyDoDPCost is true, getWordDPCost() is used (with threshold
+   as its upperBound) in place of stages 2-4.
+
+   If the candidate is rejected, the bound that exceeded threshold is
+   returned (and *pStage says which stage it was).  If it was rejected
+   at CascadeDP, warpCostDP may only be a lower bound of the DP cost.  Otherwise *pStage
+   is CascadeNotRejected and the return value is exactly what
+   getWordMorphCost() (or getWordMorphCostFast() if fFast) returns.*/
+double DMorphInk::getWordMorphCostCascade(const DMorphInkPrepared &prep0,
+					  const DMorphInkPrepared &prep1,
+					  double threshold,
+					  DMorphCascadeStage *pStage,
+					  bool fFast,
+					  int bandWidthDP,
+					  double nonDiagonalCostDP,
+					  int meshSpacingStatic,
+					  int numRefinementsStatic,
+					  double meshDiv,
+					  double lengthMismatchPenalty){
+  int meshSpacing;
+  double cost = 0.;
+  double cost2 = 0.;
+  double bound;
+  bool D_N_C;
+  DMorphCascadeStage stageTmp;
+
+  if(NULL == pStage)
+    pStage = &stageTmp;
+  (*pStage) = CascadeNotRejected;
+  D_N_C = fFast ? false : DIVIDE_N_CONQ;
+
+  double lenPen = 0.;
+  double wLong = 0., wShort=0.;
+  if(prep0.w > prep1.w){
+    wLong = prep0.w;
+    wShort = prep1.w;
+  }
+  else{
+    wLong = prep1.w;
+    wShort = prep0.w;
+  }
+  lenPen = lengthMismatchPenalty*(wLong-wShort)/wLong;
+
+  //stage 1: length mismatch penalty
+  bound = fOnlyDoOneDirection ? lenPen : (2. * lenPen);
+  if(bound > threshold){
+    (*pStage) = CascadeLength;
+    return bound;
+  }
+
+  if(fOnlyDoDPCost){
+    cost = getWordDPCost(prep0, prep1, bandWidthDP, nonDiagonalCostDP,
+			 lengthMismatchPenalty, threshold);
+    if(cost > threshold)
+      (*pStage) = CascadeDP;
+    return cost;
+  }
+
+  //stage 2: DP alignment cost (without the path, so it can give up as
+  //soon as the cost is sure to be too high)
+  if(cascadeDPScale > 0.){
+    double dpCost;
+    double *rgRows, *rgD;
+    int *rgLens;
+    int maxLen;
+    //(resetMeshes() resets arenaScratch again, so nothing here is kept)
+    maxLen = (prep0.fvWord.vectLen > prep1.fvWord.vectLen) ?
+      prep0.fvWord.vectLen : prep1.fvWord.vectLen;
+    arenaScratch.reset();
+    rgRows = (double*)arenaScratch.alloc(sizeof(double) * 2 * (maxLen+1));
+    rgLens = (int*)arenaScratch.alloc(sizeof(int) * 2 * (maxLen+1));
+    rgD = (double*)arenaScratch.alloc(sizeof(double) * (maxLen+1));
+    dpCost = getDPCostBounded(prep0.fvWord, prep1.fvWord, bandWidthDP,
+			      nonDiagonalCostDP,
+			      (threshold - bound) / cascadeDPScale,
+			      rgRows, rgLens, rgD);
+    if((bound + cascadeDPScale * dpCost) > threshold){
+      warpCostDP = warpCostDPhoriz = warpCostDPfull = dpCost;
+      warpCostDPv = 0.;
+      (*pStage) = CascadeDP;
+      return bound + cascadeDPScale * dpCost;
     }
   }
+
+  meshSpacing = (int)(prep0.h / meshDiv);
+  if(meshSpacing < 4)
+    meshSpacing = 4;
+  if(-1 != meshSpacingStatic)
+    meshSpacing = meshSpacingStatic;
+  init(prep0, prep1, meshSpacing, bandWidthDP,nonDiagonalCostDP,D_N_C);
+  warpCostDPfull = warpCostDP + warpCostDPv;
+  warpCostDPhoriz = warpCostDP;
+
+  //stage 3: coarse mesh before any improvement or refinement
+  if(0. != cascadeCoarseScale){
+    double coarseBound;
+    coarseBound = bound + cascadeCoarseScale * getCost();
+    if(coarseBound > threshold){
+      (*pStage) = CascadeCoarse;
+      return coarseBound;
+    }
+  }
+
+  //stage 4: full morph in the first direction
+  if(fFast)
+    morphFastAfterInit(meshSpacing, numRefinementsStatic);
+  else
+    morphOneWayAfterInit(meshSpacing, numRefinementsStatic);
+  cost = getCost() + lenPen;
+  if(fOnlyDoOneDirection)
+    return cost;
+  if((cost + lenPen) > threshold){
+    (*pStage) = CascadeOneWay;
+    return cost + lenPen;
+  }
+
+  //full morph in the second direction
+  meshSpacing = (int)(prep1.h / meshDiv);
+  if(meshSpacing < 4)
+    meshSpacing = 4;
+  if(-1 != meshSpacingStatic)
+    meshSpacing = meshSpacingStatic;
+  init(prep1, prep0, meshSpacing, bandWidthDP,nonDiagonalCostDP,D_N_C);
+  if(fFast)
+    morphFastAfterInit(meshSpacing, numRefinementsStatic);
+  else
+    morphOneWayAfterInit(meshSpacing, numRefinementsStatic);
   cost2 = getCost() + lenPen;
   warpCostDPfull += warpCostDP + warpCostDPv;
   warpCostDPhoriz += warpCostDP;
 
+  return cost + cost2;
+}
+
+///same as getWordMorphCostCascade() above, but prepares both images first
+/**When comparing a word to many others, prepare each image once and
+   use the DMorphInkPrepared version instead.*/
+double DMorphInk::getWordMorphCostCascade(const DImage &src0,
+					  const DImage &src1,
+					  double threshold,
+					  DMorphCascadeStage *pStage,
+					  bool fFast,
+					  int bandWidthDP,
+					  double nonDiagonalCostDP,
+					  int meshSpacingStatic,
+					  int numRefinementsStatic,
+					  double meshDiv,
+					  double lengthMismatchPenalty){
+  DMorphInkPrepared prep0(src0, false);
+  DMorphInkPrepared prep1(src1, false);
+  return getWordMorphCostCascade(prep0, prep1, threshold, pStage, fFast,
+				 bandWidthDP, nonDiagonalCostDP,
+				 meshSpacingStatic, numRefinementsStatic,
+				 meshDiv, lengthMismatchPenalty);
+}
 
+
+///cost of just the horizontal DP alignment of the words, in both directions
+/**This is what getWordMorphCost() would return if each morph cost
+   were replaced by that direction's warpCostDP: the two costs (or
+   only the first if fOnlyDoOneDirection) plus the length mismatch
+   penalty for each.  No meshes, medial axes, or distance maps are
+   used, and the DP is done by DDynamicProgramming::findDPCostOnly(),
+   which keeps only two rows of the table.
+
+   If the cost is going to be more than upperBound, the DP is skipped
+   (when the LB_Improved bound of
+   DDynamicProgramming::getLowerBoundImproved() is already more than
+   upperBound) or gives up early, and the returned value is only a
+   lower bound that is greater than upperBound (not the real cost).  warpCostDP, warpCostDPhoriz,
+   and warpCostDPfull are set the same way getWordMorphCost() sets
+   them (warpCostDPv is 0. since there is no vertical DP).*/
+double DMorphInk::getWordDPCost(const DMorphInkPrepared &prep0,
+				const DMorphInkPrepared &prep1,
+				int bandWidthDP,
+				double nonDiagonalCostDP,
+				double lengthMismatchPenalty,
+				double upperBound){
+  return getWordDPCost_(prep0.fvWord, prep1.fvWord, prep0.w, prep1.w,
+			bandWidthDP, nonDiagonalCostDP, lengthMismatchPenalty,
+			upperBound);
+}
+
+///same as getWordDPCost() above, but extracts the word features first
+double DMorphInk::getWordDPCost(const DImage &src0, const DImage &src1,
+				int bandWidthDP,
+				double nonDiagonalCostDP,
+				double lengthMismatchPenalty,
+				double upperBound){
+  DFeatureVector fv0, fv1;
+  fv0 = DWordFeatures::extractWordFeatures(*((DImage*)&src0),
+					   true,false,true,true,127);
+  fv1 = DWordFeatures::extractWordFeatures(*((DImage*)&src1),
+					   true,false,true,true,127);
+  return getWordDPCost_(fv0, fv1, src0.width(), src1.width(),
+			bandWidthDP, nonDiagonalCostDP, lengthMismatchPenalty,
+			upperBound);
+}
+
+double DMorphInk::getWordDPCost_(const DFeatureVector &fv0,
+				 const DFeatureVector &fv1,
+				 int w0, int w1, int bandWidthDP,
+				 double nonDiagonalCostDP,
+				 double lengthMismatchPenalty,
+				 double upperBound){
+  double cost = 0.;
+  double cost2 = 0.;
+  double *rgRows, *rgD;
+  int *rgLens;
+  int maxLen;
+
+  double lenPen = 0.;
+  double wLong = 0., wShort=0.;
+  if(w0 > w1){
+    wLong = w0;
+    wShort = w1;
+  }
+  else{
+    wLong = w1;
+    wShort = w0;
+  }
+  lenPen = lengthMismatchPenalty*(wLong-wShort)/wLong;
+
+  warpCostDPv = 0.;
+  if(fOnlyDoOneDirection)
+    upperBound -= lenPen;
+  else
+    upperBound -= 2. * lenPen;//the second direction costs at least lenPen
+
+  //the same two rows are used for both directions (and come from
+  //arenaScratch, so nothing is malloc'ed once it is big enough)
+  maxLen = (fv0.vectLen > fv1.vectLen) ? fv0.vectLen : fv1.vectLen;
+  arenaScratch.reset();
+  rgRows = (double*)arenaScratch.alloc(sizeof(double) * 2 * (maxLen+1));
+  rgLens = (int*)arenaScratch.alloc(sizeof(int) * 2 * (maxLen+1));
+  rgD = (double*)arenaScratch.alloc(sizeof(double) * (maxLen+1));
+
+  warpCostDP = getDPCostBounded(fv0, fv1, bandWidthDP, nonDiagonalCostDP,
+				upperBound, rgRows, rgLens, rgD);
+  cost = warpCostDP + lenPen;
+  warpCostDPfull = warpCostDPhoriz = warpCostDP;
+  if(fOnlyDoOneDirection || (warpCostDP > upperBound))
+    return fOnlyDoOneDirection ? cost : (cost + lenPen);
+
+  warpCostDP = getDPCostBounded(fv1, fv0, bandWidthDP, nonDiagonalCostDP,
+				upperBound - cost + lenPen, rgRows, rgLens, rgD);
+  cost2 = warpCostDP + lenPen;
+  warpCostDPfull += warpCostDP;
+  warpCostDPhoriz += warpCostDP;
   return cost + cost2;
-  // return cost;
 }
 
 
+typedef struct{
+  DMorphInk *rgWorkers;//one per pool thread
+  const DImage *pimgOne;//NULL if using prepared images
+  const DImage *rgImgs;
+  const DMorphInkPrepared *pprepOne;//NULL if using DImages
+  const DMorphInkPrepared *rgPreps;
+  double *rgCosts;
+  const DMorphInkBatchOptions *pOpts;
+} MORPHINK_BATCH_PARMS_T;
+
+///compare the "one" image to item itemIdx of the "many" (called by the pool)
+void DMorphInk::computeCostsOneToMany_itemFunc(void *params, int itemIdx,
+					       int threadNum){
+  MORPHINK_BATCH_PARMS_T *pparms;
+  const DMorphInkBatchOptions *pOpts;
+  DMorphInk *pmobj;
+  int idx;
+  double cost;
+
+  pparms = (MORPHINK_BATCH_PARMS_T*)params;
+  pOpts = pparms->pOpts;
+  pmobj = &(pparms->rgWorkers[threadNum]);
+  idx = (NULL == pOpts->rgIdxs) ? itemIdx : pOpts->rgIdxs[itemIdx];
+  if(NULL != pOpts->rgThresholds){
+    DMorphCascadeStage stage;
+    if(NULL != pparms->pprepOne)
+      cost = pmobj->getWordMorphCostCascade(*(pparms->pprepOne),
+					    pparms->rgPreps[idx],
+					    pOpts->rgThresholds[itemIdx],
+					    &stage, pOpts->fFast,
+					    pOpts->bandWidthDP,
+					    pOpts->nonDiagonalCostDP,
+					    pOpts->meshSpacingStatic,
+					    pOpts->numRefinementsStatic,
+					    pOpts->meshDiv,
+					    pOpts->lengthMismatchPenalty);
+    else
+      cost = pmobj->getWordMorphCostCascade(*(pparms->pimgOne),
+					    pparms->rgImgs[idx],
+					    pOpts->rgThresholds[itemIdx],
+					    &stage, pOpts->fFast,
+					    pOpts->bandWidthDP,
+					    pOpts->nonDiagonalCostDP,
+					    pOpts->meshSpacingStatic,
+					    pOpts->numRefinementsStatic,
+					    pOpts->meshDiv,
+					    pOpts->lengthMismatchPenalty);
+    if(NULL != pOpts->rgCascadeStage)
+      pOpts->rgCascadeStage[itemIdx] = (int)stage;
+  }
+  else if(NULL != pparms->pprepOne){
+    if(pOpts->fFast)
+      cost = pmobj->getWordMorphCostFast(*(pparms->pprepOne),
+					 pparms->rgPreps[idx],
+					 pOpts->bandWidthDP,
+					 pOpts->nonDiagonalCostDP,
+					 pOpts->meshSpacingStatic,
+					 pOpts->numRefinementsStatic,
+					 pOpts->meshDiv,
+					 pOpts->lengthMismatchPenalty);
+    else
+      cost = pmobj->getWordMorphCost(*(pparms->pprepOne),
+				     pparms->rgPreps[idx],
+				     pOpts->bandWidthDP,
+				     pOpts->nonDiagonalCostDP,
+				     pOpts->meshSpacingStatic,
+				     pOpts->numRefinementsStatic,
+				     pOpts->meshDiv,
+				     pOpts->lengthMismatchPenalty);
+  }
+  else{
+    if(pOpts->fFast)
+      cost = pmobj->getWordMorphCostFast(*(pparms->pimgOne),
+					 pparms->rgImgs[idx],
+					 pOpts->bandWidthDP,
+					 pOpts->nonDiagonalCostDP,
+					 pOpts->meshSpacingStatic,
+					 pOpts->numRefinementsStatic,
+					 pOpts->meshDiv,
+					 pOpts->lengthMismatchPenalty);
+    else
+      cost = pmobj->getWordMorphCost(*(pparms->pimgOne),
+				     pparms->rgImgs[idx],
+				     pOpts->bandWidthDP,
+				     pOpts->nonDiagonalCostDP,
+				     pOpts->meshSpacingStatic,
+				     pOpts->numRefinementsStatic,
+				     pOpts->meshDiv,
+				     pOpts->lengthMismatchPenalty);
+  }
+  pparms->rgCosts[itemIdx] = cost;
+  if(NULL != pOpts->rgWarpCostDP)
+    pOpts->rgWarpCostDP[itemIdx] = pmobj->warpCostDP;
+}
+
+///Computes the morph cost from imgOne to each of the n images in rgImgs
+/**rgCosts[i] gets the same value getWordMorphCost(imgOne, rgImgs[i])
+   would return (or getWordMorphCostFast() if opts.fFast is true).  If
+   opts.rgIdxs is not NULL, rgCosts[i] is the cost to
+   rgImgs[opts.rgIdxs[i]] instead, which is handy for re-checking a
+   top-N list.  If opts.rgThresholds is not NULL,
+   getWordMorphCostCascade() is used with rgThresholds[i] as the
+   threshold for comparison i (and the stage it stopped at goes in
+   opts.rgCascadeStage[i] if that isn't NULL).  fOnlyDoOneDirection,
+   fOnlyDoCoarseAlignment, cascadeDPScale, and cascadeCoarseScale are
+   taken from this object.
+
+   The comparisons are done by a pool of opts.numThreads threads that
+   is created by the first call and kept (along with one DMorphInk
+   workspace per thread) until this object is destroyed, so calling
+   this once per test word doesn't create and join threads each time.
+   The work is balanced by estimated cost (the pixel areas of the
+   two images) and threads that run out of work steal from the
+   others.  This object's own morph state is not changed.*/
+void DMorphInk::computeCostsOneToMany(const DImage &imgOne,
+				      const DImage *rgImgs,
+				      int n, double *rgCosts,
+				      const DMorphInkBatchOptions &opts){
+  computeCostsOneToMany_(&imgOne, rgImgs, NULL, NULL, n, rgCosts, opts);
+}
+
+///same as computeCostsOneToMany() above, but with prepared images
+void DMorphInk::computeCostsOneToMany(const DMorphInkPrepared &prepOne,
+				      const DMorphInkPrepared *rgPreps,
+				      int n, double *rgCosts,
+				      const DMorphInkBatchOptions &opts){
+  computeCostsOneToMany_(NULL, NULL, &prepOne, rgPreps, n, rgCosts, opts);
+}
+
+void DMorphInk::computeCostsOneToMany_(const DImage *pimgOne,
+				       const DImage *rgImgs,
+				       const DMorphInkPrepared *pprepOne,
+				       const DMorphInkPrepared *rgPreps,
+				       int n, double *rgCosts,
+				       const DMorphInkBatchOptions &opts){
+  MORPHINK_BATCH_PARMS_T parms;
+  double *rgEstCosts;//estimated relative cost of each comparison
+  double areaOne;
+
+  if(n < 1)
+    return;
+  if((NULL != pBatchPool) && (opts.numThreads > 0) &&
+     (opts.numThreads != pBatchPool->getNumThreads())){
+    delete pBatchPool;
+    delete [] rgBatchWorkers;
+    pBatchPool = NULL;
+    rgBatchWorkers = NULL;
+  }
+  if(NULL == pBatchPool){
+    pBatchPool = new DThreadPool(opts.numThreads);
+    D_CHECKPTR(pBatchPool);
+    rgBatchWorkers = new DMorphInk[pBatchPool->getNumThreads()];
+    D_CHECKPTR(rgBatchWorkers);
+  }
+  for(int t=0, numThreads=pBatchPool->getNumThreads(); t < numThreads; ++t){
+    rgBatchWorkers[t].fOnlyDoOneDirection = fOnlyDoOneDirection;
+    rgBatchWorkers[t].fOnlyDoCoarseAlignment = fOnlyDoCoarseAlignment;
+    rgBatchWorkers[t].fOnlyDoDPCost = fOnlyDoDPCost;
+    rgBatchWorkers[t].cascadeDPScale = cascadeDPScale;
+    rgBatchWorkers[t].cascadeCoarseScale = cascadeCoarseScale;
+  }
+
+  rgEstCosts = (double*)malloc(sizeof(double)*n);
+  D_CHECKPTR(rgEstCosts);
+  if(NULL != pprepOne)
+    areaOne = (double)(pprepOne->w) * (pprepOne->h);
+  else
+    areaOne = (double)(pimgOne->width()) * (pimgOne->height());
+  for(int i=0; i < n; ++i){
+    int idx;
+    idx = (NULL == opts.rgIdxs) ? i : opts.rgIdxs[i];
+    if(NULL != pprepOne)
+      rgEstCosts[i] = areaOne + (double)(rgPreps[idx].w) * (rgPreps[idx].h);
+    else
+      rgEstCosts[i] = areaOne +
+	(double)(rgImgs[idx].width()) * (rgImgs[idx].height());
+  }
+
+  parms.rgWorkers = rgBatchWorkers;
+  parms.pimgOne = pimgOne;
+  parms.rgImgs = rgImgs;
+  parms.pprepOne = pprepOne;
+  parms.rgPreps = rgPreps;
+  parms.rgCosts = rgCosts;
+  parms.pOpts = &opts;
+  pBatchPool->run(n, DMorphInk::computeCostsOneToMany_itemFunc,
+		  (void*)&parms, rgEstCosts);
+  free(rgEstCosts);
+}
+
 
 /**Calculates total cost as the avg distance MedialAxis0 pixels travel
 (from their original DP-warped positions) plus the avg cost for MA1
@@ -1184,8 +1918,6 @@ double DMorphInk::getCost(){
   double costBackwards = 0.;
   //int w, h;
   double costTotal = 0.;
-  DImage imgWarped;
-  DImage imgWarpedDist;
   D_uint8 *p8;
   signed int *ps32;
   int xpMin, xpMax, ypMin, ypMax;
@@ -1195,7 +1927,7 @@ double DMorphInk::getCost(){
   xpMax = 0;
   ypMin = h1;
   ypMax = 0;
-  ps32 = (signed int*)imgDist1.dataPointer_u32();
+  ps32 = (signed int*)pimgDist1->dataPointer_u32();
   for(int i=0; i < lenMA0; ++i){
     double xp,yp;
 #if NEW_WARP
@@ -1262,11 +1994,11 @@ double DMorphInk::getCost(){
     ypMax = h1;
   wDM = xpMax - xpMin+1;
   hDM = ypMax - ypMin+1;
-  // imgWarped.create(w1+40,h1+40,DImage::DImage_u8);
-  // imgWarped.create(w1,h1,DImage::DImage_u8);
-  imgWarped.create(wDM,hDM,DImage::DImage_u8);
-  imgWarped.fill(255);
-  p8 = imgWarped.dataPointer_u8();
+  //the warped MA0 image and its distance map are scratch buffers that are
+  //reused for every call instead of DImages that get allocated every time
+  arenaScratch.reset();
+  p8 = (D_uint8*)arenaScratch.alloc(sizeof(D_uint8)*wDM*hDM);
+  memset(p8, 255, sizeof(D_uint8)*wDM*hDM);
   for(int i=0; i < lenMA0; ++i){
     double xp,yp;
 #if NEW_WARP
@@ -1304,9 +2036,9 @@ double DMorphInk::getCost(){
     // }
   }
 
-  DDistanceMap::getDistFromInkBitonal_(imgWarpedDist, imgWarped,1000,-1000);
-
-  ps32 = (signed int*)imgWarpedDist.dataPointer_u32();
+  ps32 = (signed int*)arenaScratch.alloc(sizeof(D_sint32)*wDM*hDM);
+  DDistanceMap::getDistFromInkBitonalBuf((D_sint32*)ps32, p8, wDM, hDM,
+					 1000,-1000);
   int numMA1pixels;
   numMA1pixels =0;
   for(int i=0; i < lenMA1; ++i){
@@ -1340,6 +2072,303 @@ double DMorphInk::getCost(){
 
 
 
+///bucket the (SUBSAMPLEd) MA0 points by the mesh quad they are in
+/**The quad of each point is found the same way the improveMorph
+   functions always have (dividing by curColSpacing and curRowSpacing)
+   so each vertex gets exactly the same points it used to get by
+   checking all lenMA0 of them.  This is called when needed by
+   gatherMA0PointsForVertex() after the meshes are reset or refined.*/
+void DMorphInk::buildMA0QuadBuckets(){
+  int numQuads;
+  int numPts;
+
+  numQuads = numPointRows * numPointCols;
+  numPts = (lenMA0 + SUBSAMPLE - 1) / SUBSAMPLE;
+  if((numQuads+1) > ma0QuadStartCapacity){
+    if(NULL != rgMA0QuadStart)
+      free(rgMA0QuadStart);
+    rgMA0QuadStart = (int*)malloc(sizeof(int)*(numQuads+1));
+    D_CHECKPTR(rgMA0QuadStart);
+    ma0QuadStartCapacity = numQuads+1;
+  }
+  if((numPts+1) > ma0QuadIdxCapacity){
+    if(NULL != rgMA0QuadIdx)
+      free(rgMA0QuadIdx);
+    rgMA0QuadIdx = (int*)malloc(sizeof(int)*(numPts+1));
+    D_CHECKPTR(rgMA0QuadIdx);
+#if NEW_WARP
+    if(NULL != rgIncrTerms)
+      free(rgIncrTerms);
+    rgIncrTerms = (DMorphReal*)malloc(sizeof(DMorphReal)*6*(numPts+1));
+    D_CHECKPTR(rgIncrTerms);
+    rgIncrVtxW = rgIncrTerms;
+    rgIncrRowX = rgIncrVtxW + (numPts+1);
+    rgIncrRowY = rgIncrRowX + (numPts+1);
+    rgIncrRowW = rgIncrRowY + (numPts+1);
+    rgIncrOtherX = rgIncrRowW + (numPts+1);
+    rgIncrOtherY = rgIncrOtherX + (numPts+1);
+#endif
+    ma0QuadIdxCapacity = numPts+1;
+  }
+
+  //counting sort of the point indexes by quad (keeps them in index order)
+  for(int q=0; q <= numQuads; ++q)
+    rgMA0QuadStart[q] = 0;
+  for(int i=0; i < lenMA0; i+=SUBSAMPLE){
+    int maRow, maCol;
+    maCol = (int)(rgMA0X[i] / curColSpacing);
+    maRow = (int)(rgMA0Y[i] / curRowSpacing);
+    if((maRow<0) || (maRow>=numPointRows) || (maCol<0) || (maCol>=numPointCols))
+      continue;//no vertex would ever pick this point
+    ++(rgMA0QuadStart[maRow*numPointCols+maCol+1]);
+  }
+  for(int q=0; q < numQuads; ++q)
+    rgMA0QuadStart[q+1] += rgMA0QuadStart[q];
+  for(int i=0; i < lenMA0; i+=SUBSAMPLE){
+    int maRow, maCol;
+    maCol = (int)(rgMA0X[i] / curColSpacing);
+    maRow = (int)(rgMA0Y[i] / curRowSpacing);
+    if((maRow<0) || (maRow>=numPointRows) || (maCol<0) || (maCol>=numPointCols))
+      continue;
+    rgMA0QuadIdx[rgMA0QuadStart[maRow*numPointCols+maCol]] = i;
+    ++(rgMA0QuadStart[maRow*numPointCols+maCol]);
+  }
+  for(int q=numQuads; q > 0; --q)//each start was advanced to the next's start
+    rgMA0QuadStart[q] = rgMA0QuadStart[q-1];
+  rgMA0QuadStart[0] = 0;
+  fMA0QuadBucketsValid = true;
+}
+
+///put the MedialAxis0 points within the four quads of control point r,c in the temp arrays
+void DMorphInk::gatherMA0PointsForVertex(int r, int c){
+  if(!fMA0QuadBucketsValid)
+    buildMA0QuadBuckets();
+  tempMA0len = 0;
+  for(int qr=r-1; qr <= r; ++qr){
+    if((qr < 0) || (qr >= numPointRows))
+      continue;
+    for(int qc=c-1; qc <= c; ++qc){
+      int q;
+      if((qc < 0) || (qc >= numPointCols))
+	continue;
+      q = qr*numPointCols+qc;
+      for(int k=rgMA0QuadStart[q]; k < rgMA0QuadStart[q+1]; ++k){
+#if NEW_WARP
+	rgTempMA0idx[tempMA0len] = rgMA0QuadIdx[k];
+#else
+	rgTempMA0X[tempMA0len] = rgMA0X[rgMA0QuadIdx[k]];
+	rgTempMA0Y[tempMA0len] = rgMA0Y[rgMA0QuadIdx[k]];
+#endif
+	++tempMA0len;
+      }
+    }
+  }
+}
+
+#if NEW_WARP
+///precompute what getVertexPositionCostIncr() needs to move vertex r,c
+/**Call after gatherMA0PointsForVertex(r,c).  For each gathered point
+   whose (warp) quad has r,c as a corner, warpPointNew() computes
+   xp = (1-t)*Xtop + t*Xbot with Xtop = (1-s)*P00 + s*P01 (and the
+   same for Xbot and y).  Only one of the four P's is the vertex, so
+   the other row and the other vertex of the vertex's row are
+   weighted once here.  Points whose quad doesn't include the vertex
+   don't move at all, so their cost is just summed once.  Only valid
+   until a different control point is moved.*/
+void DMorphInk::setUpIncrementalVertexCost(int r, int c){
+  int idxVertex;
+  signed int *psDist;
+  int n;
+
+  idxVertex = r*numPointCols+c;
+  psDist = (signed int*)pimgDist1->dataPointer_u32();
+  incrFixedCost = 0.;
+  incrNumVarying = 0;
+  for(int k=0; k < tempMA0len; ++k){
+    int i, qIdx, corner;
+    double s, t, oneMs, oneMt;
+    i = rgTempMA0idx[k];
+    qIdx = rgMA0r[i]*numPointCols+rgMA0c[i];
+    s = rgMA0s[i];
+    t = rgMA0t[i];
+    oneMs = 1.-s;
+    oneMt = 1.-t;
+    corner = idxVertex - qIdx;
+    if((0 == corner) || (1 == corner) ||
+       (numPointCols == corner) || ((numPointCols+1) == corner)){
+      bool fTop, fLeft;
+      int rowIdx, otherRowIdx;
+      fTop = (corner <= 1);
+      fLeft = ((0 == corner) || (numPointCols == corner));
+      rowIdx = fTop ? qIdx : (qIdx+numPointCols);
+      otherRowIdx = fTop ? (qIdx+numPointCols) : qIdx;
+      n = incrNumVarying;
+      rgIncrVtxW[n] = fLeft ? oneMs : s;
+      rgIncrRowX[n] = fLeft ? (s*rgPoints1X[rowIdx+1]) : (oneMs*rgPoints1X[rowIdx]);
+      rgIncrRowY[n] = fLeft ? (s*rgPoints1Y[rowIdx+1]) : (oneMs*rgPoints1Y[rowIdx]);
+      rgIncrRowW[n] = fTop ? oneMt : t;
+      rgIncrOtherX[n] = (fTop ? t : oneMt) *
+	((oneMs)*rgPoints1X[otherRowIdx] + s*rgPoints1X[otherRowIdx+1]);
+      rgIncrOtherY[n] = (fTop ? t : oneMt) *
+	((oneMs)*rgPoints1Y[otherRowIdx] + s*rgPoints1Y[otherRowIdx+1]);
+      ++incrNumVarying;
+    }
+    else{//not affected by this vertex
+      double xp, yp;
+      int ixp, iyp;
+      int addDistX, addDistY;
+      warpPointNew(s, t, qIdx, &xp, &yp);
+      ixp=(int)xp;
+      iyp=(int)yp;
+      addDistX = addDistY = 0;
+      if(ixp < 0){
+	addDistX = 0-ixp;
+	ixp = 0;
+      }
+      else if(ixp >  (w1-1)){
+	addDistX = ixp-w1+1;
+	ixp = w1-1;
+      }
+      if(iyp < 0){
+	addDistY = 0-iyp;
+	iyp = 0;
+      }
+      else if(iyp > (h1-1)){
+	addDistY = iyp-h1+1;
+	iyp = h1-1;
+      }
+      incrFixedCost += psDist[w1*iyp+ixp] + addDistX + addDistY;
+    }
+  }
+}
+#endif
+
+#if MORPHINK_SIMD && MORPHINK_FLOAT
+///AVX2 version of getVertexPositionCostIncr(), 8 (float) points at a time
+/**Same as the double version below, but with MORPHINK_FLOAT the terms
+   are floats, so 8 points fit in each register.  The float math is done
+   in the same order as the scalar getIncrPointCost() (and without FMA,
+   see below), so the two versions still agree exactly.*/
+__attribute__((target("avx2")))
+double DMorphInk::getVertexPositionCostIncr_avx2(double x1, double y1){
+  const signed int *psDist;
+  double sumCost;
+  double rgLaneSums[4];
+  int i;
+  __m256 vX1, vY1;
+  __m256d vSum;
+  __m256i vZero, vWm1, vHm1, vW;
+
+  psDist = (const signed int*)pimgDist1->dataPointer_u32();
+  vX1 = _mm256_set1_ps((float)x1);
+  vY1 = _mm256_set1_ps((float)y1);
+  vSum = _mm256_setzero_pd();
+  vZero = _mm256_setzero_si256();
+  vWm1 = _mm256_set1_epi32(w1-1);
+  vHm1 = _mm256_set1_epi32(h1-1);
+  vW = _mm256_set1_epi32(w1);
+  for(i=0; (i+8) <= incrNumVarying; i+=8){
+    __m256 vVtxW, vRowW, vXp, vYp;
+    __m256i vIxp, vIyp, vCx, vCy, vAdd, vCost;
+    vVtxW = _mm256_loadu_ps(rgIncrVtxW+i);
+    vRowW = _mm256_loadu_ps(rgIncrRowW+i);
+    vXp = _mm256_add_ps(_mm256_mul_ps(vRowW,
+				      _mm256_add_ps(_mm256_mul_ps(vVtxW,vX1),
+						    _mm256_loadu_ps(rgIncrRowX+i))),
+			_mm256_loadu_ps(rgIncrOtherX+i));
+    vYp = _mm256_add_ps(_mm256_mul_ps(vRowW,
+				      _mm256_add_ps(_mm256_mul_ps(vVtxW,vY1),
+						    _mm256_loadu_ps(rgIncrRowY+i))),
+			_mm256_loadu_ps(rgIncrOtherY+i));
+    vIxp = _mm256_cvttps_epi32(vXp);//truncates like (int)
+    vIyp = _mm256_cvttps_epi32(vYp);
+    vCx = _mm256_min_epi32(_mm256_max_epi32(vIxp, vZero), vWm1);
+    vCy = _mm256_min_epi32(_mm256_max_epi32(vIyp, vZero), vHm1);
+    vAdd = _mm256_add_epi32(_mm256_abs_epi32(_mm256_sub_epi32(vIxp, vCx)),
+			    _mm256_abs_epi32(_mm256_sub_epi32(vIyp, vCy)));
+    vCost = _mm256_i32gather_epi32((const int*)psDist,
+				   _mm256_add_epi32(_mm256_mullo_epi32(vCy,vW),
+						    vCx), 4);
+    vCost = _mm256_add_epi32(vCost, vAdd);
+    vSum = _mm256_add_pd(vSum,
+			 _mm256_cvtepi32_pd(_mm256_castsi256_si128(vCost)));
+    vSum = _mm256_add_pd(vSum,
+			 _mm256_cvtepi32_pd(_mm256_extracti128_si256(vCost,1)));
+  }
+  _mm256_storeu_pd(rgLaneSums, vSum);
+  sumCost = incrFixedCost + ((rgLaneSums[0] + rgLaneSums[1]) +
+			     (rgLaneSums[2] + rgLaneSums[3]));
+  for(; i < incrNumVarying; ++i)
+    sumCost += getIncrPointCost(i, x1, y1, psDist);
+  if(sumCost > 0)
+    sumCost = sumCost/(tempMA0len);
+  return sumCost;
+}
+#elif MORPHINK_SIMD
+///AVX2 version of getVertexPositionCostIncr(), 4 points at a time
+/**Only called if the constructor found AVX2 (fUseSIMD).  The warp is
+   the same double precision multiplies and adds as the scalar version,
+   the clamping to the distance map and the
+   out-of-bounds compensation are done with integer min/max, and the
+   distance map values are fetched with a gather.  The per-point costs
+   are whole numbers, so adding them up in 4 lanes gives exactly the
+   same total as the scalar loop.  That needs both versions to round
+   after each multiply: the library is built with -ffp-contract=off so
+   the compiler doesn't fuse either one into FMAs (with -march=native
+   it otherwise may).*/
+__attribute__((target("avx2")))
+double DMorphInk::getVertexPositionCostIncr_avx2(double x1, double y1){
+  const signed int *psDist;
+  double sumCost;
+  double rgLaneSums[4];
+  int i;
+  __m256d vX1, vY1, vSum;
+  __m128i vZero, vWm1, vHm1, vW;
+
+  psDist = (const signed int*)pimgDist1->dataPointer_u32();
+  vX1 = _mm256_set1_pd(x1);
+  vY1 = _mm256_set1_pd(y1);
+  vSum = _mm256_setzero_pd();
+  vZero = _mm_setzero_si128();
+  vWm1 = _mm_set1_epi32(w1-1);
+  vHm1 = _mm_set1_epi32(h1-1);
+  vW = _mm_set1_epi32(w1);
+  for(i=0; (i+4) <= incrNumVarying; i+=4){
+    __m256d vVtxW, vRowW, vXp, vYp;
+    __m128i vIxp, vIyp, vCx, vCy, vAdd, vCost;
+    vVtxW = _mm256_loadu_pd(rgIncrVtxW+i);
+    vRowW = _mm256_loadu_pd(rgIncrRowW+i);
+    vXp = _mm256_add_pd(_mm256_mul_pd(vRowW,
+				      _mm256_add_pd(_mm256_mul_pd(vVtxW,vX1),
+						    _mm256_loadu_pd(rgIncrRowX+i))),
+			_mm256_loadu_pd(rgIncrOtherX+i));
+    vYp = _mm256_add_pd(_mm256_mul_pd(vRowW,
+				      _mm256_add_pd(_mm256_mul_pd(vVtxW,vY1),
+						    _mm256_loadu_pd(rgIncrRowY+i))),
+			_mm256_loadu_pd(rgIncrOtherY+i));
+    vIxp = _mm256_cvttpd_epi32(vXp);//truncates like (int)
+    vIyp = _mm256_cvttpd_epi32(vYp);
+    vCx = _mm_min_epi32(_mm_max_epi32(vIxp, vZero), vWm1);
+    vCy = _mm_min_epi32(_mm_max_epi32(vIyp, vZero), vHm1);
+    //how far off the distmap it was (0 if it wasn't)
+    vAdd = _mm_add_epi32(_mm_abs_epi32(_mm_sub_epi32(vIxp, vCx)),
+			 _mm_abs_epi32(_mm_sub_epi32(vIyp, vCy)));
+    vCost = _mm_i32gather_epi32((const int*)psDist,
+				_mm_add_epi32(_mm_mullo_epi32(vCy, vW), vCx), 4);
+    vSum = _mm256_add_pd(vSum, _mm256_cvtepi32_pd(_mm_add_epi32(vCost,vAdd)));
+  }
+  _mm256_storeu_pd(rgLaneSums, vSum);
+  sumCost = incrFixedCost + ((rgLaneSums[0] + rgLaneSums[1]) +
+			     (rgLaneSums[2] + rgLaneSums[3]));
+  for(; i < incrNumVarying; ++i)
+    sumCost += getIncrPointCost(i, x1, y1, psDist);
+  if(sumCost > 0)
+    sumCost = sumCost/(tempMA0len);
+  return sumCost;
+}
+#endif
+
+
 /**Iterates through each point within a rectangular region around the
    current control point looking for lowest cost position to place the
    control point. */
@@ -1376,30 +2405,15 @@ void DMorphInk::improveMorph(){
 #endif 	//SPEED_TEST
 
       	//decide which MedialAxis0 pixels are within the four quads of this ctl pt
-      	tempMA0len = 0;
-      	// for(int i=0; i < lenMA0; ++i){
-      	for(int i=0; i < lenMA0; i+=SUBSAMPLE){
-			int maRow;
-			int maCol;
-			maCol = (int)(rgMA0X[i] / curColSpacing);
-			maRow = (int)(rgMA0Y[i] / curRowSpacing);
-			//is medial axis point within the four quads this control pt affects?
-			//if((maRow>=(r-1)) && (maRow<=r) && (maCol>=(c-1)) && (maCol<=c)){
-			if(((maRow==(r-1)) || (maRow==r)) && ((maCol==(c-1)) || (maCol==c))){
+      	gatherMA0PointsForVertex(r, c);
 #if NEW_WARP
-	  			rgTempMA0idx[tempMA0len] = i;
-#else//also need these if debugging
-	  			rgTempMA0X[tempMA0len] = rgMA0X[i];
-	  			rgTempMA0Y[tempMA0len] = rgMA0Y[i];
+      setUpIncrementalVertexCost(r, c);
 #endif
-	  			++tempMA0len;
-			}
-      	}
 
 
       	Vcost = bestCost =
 #if NEW_WARP
-		getVertexPositionCostNew(r, c, curControlX, curControlY);
+		getVertexPositionCostIncr(curControlX, curControlY);
 #else
 		getVertexPositionCost(r, c, curControlX, curControlY);
 #endif
@@ -1475,7 +2489,7 @@ void DMorphInk::improveMorph(){
 			for(int tx=minX; tx <= maxX; ++tx){
 	 		 	double curCost;
 #if NEW_WARP
-	  			curCost = getVertexPositionCostNew(r, c, tx, ty);
+	  			curCost = getVertexPositionCostIncr(tx, ty);
 #else
 	  			curCost = getVertexPositionCost(r, c, tx, ty);
 #endif
@@ -1542,30 +2556,15 @@ void DMorphInk::improveMorphOnlyOnNewPoints(){
 #endif 	//SPEED_TEST
 
       	//decide which MedialAxis0 pixels are within the four quads of this ctl pt
-      	tempMA0len = 0;
-      	// for(int i=0; i < lenMA0; ++i){
-      	for(int i=0; i < lenMA0; i+=SUBSAMPLE){
-			int maRow;
-			int maCol;
-			maCol = (int)(rgMA0X[i] / curColSpacing);
-			maRow = (int)(rgMA0Y[i] / curRowSpacing);
-			//is medial axis point within the four quads this control pt affects?
-			//if((maRow>=(r-1)) && (maRow<=r) && (maCol>=(c-1)) && (maCol<=c)){
-			if(((maRow==(r-1)) || (maRow==r)) && ((maCol==(c-1)) || (maCol==c))){
+      	gatherMA0PointsForVertex(r, c);
 #if NEW_WARP
-	  			rgTempMA0idx[tempMA0len] = i;
-#else//also need these if debugging
-	  			rgTempMA0X[tempMA0len] = rgMA0X[i];
-	  			rgTempMA0Y[tempMA0len] = rgMA0Y[i];
+      setUpIncrementalVertexCost(r, c);
 #endif
-	  			++tempMA0len;
-			}
-      	}
 
 
       	Vcost = bestCost =
 #if NEW_WARP
-		getVertexPositionCostNew(r, c, curControlX, curControlY);
+		getVertexPositionCostIncr(curControlX, curControlY);
 #else
 		getVertexPositionCost(r, c, curControlX, curControlY);
 #endif
@@ -1641,7 +2640,7 @@ void DMorphInk::improveMorphOnlyOnNewPoints(){
 			for(int tx=minX; tx <= maxX; ++tx){
 	 		 	double curCost;
 #if NEW_WARP
-	  			curCost = getVertexPositionCostNew(r, c, tx, ty);
+	  			curCost = getVertexPositionCostIncr(tx, ty);
 #else
 	  			curCost = getVertexPositionCost(r, c, tx, ty);
 #endif
@@ -1718,30 +2717,15 @@ void DMorphInk::improveMorphFast(){
 #endif //SPEED_TEST
 
       //decide which MedialAxis0 pixels are within the four quads of this ctl pt
-      tempMA0len = 0;
-      // for(int i=0; i < lenMA0; ++i){
-      for(int i=0; i < lenMA0; i+=SUBSAMPLE){
-	int maRow;
-	int maCol;
-	maCol = (int)(rgMA0X[i] / curColSpacing);
-	maRow = (int)(rgMA0Y[i] / curRowSpacing);
-	//is medial axis point within the four quads this control pt affects?
-	//	if((maRow>=(r-1)) && (maRow<=r) && (maCol>=(c-1)) && (maCol<=c)){
-	if(((maRow==(r-1)) || (maRow==r)) && ((maCol==(c-1)) || (maCol==c))){
+      gatherMA0PointsForVertex(r, c);
 #if NEW_WARP
-	  rgTempMA0idx[tempMA0len] = i;
-#else
-	  rgTempMA0X[tempMA0len] = rgMA0X[i];
-	  rgTempMA0Y[tempMA0len] = rgMA0Y[i];
+      setUpIncrementalVertexCost(r, c);
 #endif
-	  ++tempMA0len;
-	}
-      }
 
 
       Vcost = bestCost =
 #if NEW_WARP
-	getVertexPositionCostNew(r, c, Vx, Vy);
+	getVertexPositionCostIncr(Vx, Vy);
 #else
 	getVertexPositionCost(r, c, Vx, Vy);
 #endif
@@ -1809,7 +2793,7 @@ void DMorphInk::improveMorphFast(){
 	  for(int tx=minX; tx <= maxX; tx+=searchSkipTmp){
 	    double curCost;
 #if NEW_WARP
-	    curCost = getVertexPositionCostNew(r, c, tx, ty);
+	    curCost = getVertexPositionCostIncr(tx, ty);
 #else
 	    curCost = getVertexPositionCost(r, c, tx, ty);
 #endif
@@ -1881,25 +2865,7 @@ void DMorphInk::improveMorphSimAnn(){
 	      	curControlY = rgPoints1Y[r*numPointCols+c];
 
 	      	//decide which MedialAxis0 pixels are within the four quads of this ctl pt
-	      	tempMA0len = 0;
-	      	// for(int i=0; i < lenMA0; ++i){
-	      	for(int i=0; i < lenMA0; i+=SUBSAMPLE){
-				int maRow;
-				int maCol;
-				maCol = (int)(rgMA0X[i] / curColSpacing);
-				maRow = (int)(rgMA0Y[i] / curRowSpacing);
-				//is medial axis point within the four quads this control pt affects?
-				//if((maRow>=(r-1)) && (maRow<=r) && (maCol>=(c-1)) && (maCol<=c)){
-				if(((maRow==(r-1)) || (maRow==r)) && ((maCol==(c-1)) || (maCol==c))){
-#if NEW_WARP
-		  			rgTempMA0idx[tempMA0len] = i;
-#else//also need these if debugging
-		  			rgTempMA0X[tempMA0len] = rgMA0X[i];
-		  			rgTempMA0Y[tempMA0len] = rgMA0Y[i];
-#endif
-		  			++tempMA0len;
-				}
-	      	}
+	      	gatherMA0PointsForVertex(r, c);
 
 
 	      	Vcost = bestCost =
@@ -2093,10 +3059,10 @@ double DMorphInk::acceptProbability(double newCost, double oldCost, double temp)
 void DMorphInk::refineMeshes(){
   int numPointColsNew;
   int numPointRowsNew;
-  double *rgPoints0Xnew;//x-coords of mesh0 quad vertices (row-major order)
-  double *rgPoints0Ynew;//y-coords
-  double *rgPoints1Xnew;//same, but for mesh1
-  double *rgPoints1Ynew;//y-coords for mesh1
+  DMorphReal *rgPoints0Xnew;//x-coords of mesh0 quad vertices (row-major order)
+  DMorphReal *rgPoints0Ynew;//y-coords
+  DMorphReal *rgPoints1Xnew;//same, but for mesh1
+  DMorphReal *rgPoints1Ynew;//y-coords for mesh1
   // everything should stay the same except for numPointRows, numPointCols, and
 
   //  fprintf(stderr,"refineMeshes()\n");
@@ -2121,18 +3087,14 @@ void DMorphInk::refineMeshes(){
   if(fSplitLastRow)
     ++numPointRowsNew;
 
-  rgPoints0Xnew =
-    (double*)malloc(sizeof(double)*numPointColsNew*numPointRowsNew);
-  D_CHECKPTR(rgPoints0Xnew);
-  rgPoints0Ynew =
-    (double*)malloc(sizeof(double)*numPointColsNew*numPointRowsNew);
-  D_CHECKPTR(rgPoints0Ynew);
-  rgPoints1Xnew =
-    (double*)malloc(sizeof(double)*numPointColsNew*numPointRowsNew);
-  D_CHECKPTR(rgPoints1Xnew);
-  rgPoints1Ynew =
-    (double*)malloc(sizeof(double)*numPointColsNew*numPointRowsNew);
-  D_CHECKPTR(rgPoints1Ynew);
+  rgPoints0Xnew = (DMorphReal*)
+    arenaMesh.alloc(sizeof(DMorphReal)*numPointColsNew*numPointRowsNew);
+  rgPoints0Ynew = (DMorphReal*)
+    arenaMesh.alloc(sizeof(DMorphReal)*numPointColsNew*numPointRowsNew);
+  rgPoints1Xnew = (DMorphReal*)
+    arenaMesh.alloc(sizeof(DMorphReal)*numPointColsNew*numPointRowsNew);
+  rgPoints1Ynew = (DMorphReal*)
+    arenaMesh.alloc(sizeof(DMorphReal)*numPointColsNew*numPointRowsNew);
 
   for(int r=0; r < numPointRowsNew; ++r){
     for(int c=0; c < numPointColsNew; ++c){
@@ -2327,11 +3289,7 @@ void DMorphInk::refineMeshes(){
   numPointCols = numPointColsNew;
   numPointRows = numPointRowsNew;
 
-  free(rgPoints0X);
-  free(rgPoints0Y);
-  free(rgPoints1X);
-  free(rgPoints1Y);
-
+  //(the old arrays stay in arenaMesh until the next resetMeshes())
   rgPoints0X = rgPoints0Xnew;
   rgPoints0Y = rgPoints0Ynew;
   rgPoints1X = rgPoints1Xnew;
@@ -2341,9 +3299,7 @@ void DMorphInk::refineMeshes(){
   ++meshLevel;
 
 
-  free(rgPlacePoints0);
-  rgPlacePoints0 = (bool*)malloc(sizeof(bool)*numPointCols*numPointRows);
-  D_CHECKPTR(rgPlacePoints0);
+  rgPlacePoints0 = (bool*)arenaMesh.alloc(sizeof(bool)*numPointCols*numPointRows);
 #if SPEED_TEST
   for(int i=0; i < numPointCols*numPointRows; ++i)
     rgPlacePoints0[i]=false;
@@ -2373,6 +3329,7 @@ void DMorphInk::refineMeshes(){
 
 
 
+  fMA0QuadBucketsValid = false;//quads changed, so rebuild before next use
 #if NEW_WARP
   for(int i=0; i < lenMA0; ++i){
     //this code is what used to happen in warpPoint.  now we
@@ -2500,7 +3457,7 @@ DImage DMorphInk::getMorphAtTime(double dblTime, bool fWarpOnly,
 				 bool fOverlayImg1, bool fShowMedialAxis0,
 				 bool fShowMedialAxis1, bool fNoMorph){
   int w, h;
-  double *rgXs, *rgYs;//the warped mesh at time=dblTime
+  DMorphReal *rgXs, *rgYs;//the warped mesh at time=dblTime
   DImage imgMorphed;
   D_uint8 *pSrc0, *pSrc1;
   D_uint8 *pDst;
@@ -2541,9 +3498,9 @@ DImage DMorphInk::getMorphAtTime(double dblTime, bool fWarpOnly,
   imgQidx.fill(255);
 
   // define rgXs and rgYs as the intermediate mesh point locations at t=dblTime
-  rgXs = (double*)malloc(sizeof(double)*numPointRows*numPointCols);
+  rgXs = (DMorphReal*)malloc(sizeof(DMorphReal)*numPointRows*numPointCols);
   D_CHECKPTR(rgXs);
-  rgYs = (double*)malloc(sizeof(double)*numPointRows*numPointCols);
+  rgYs = (DMorphReal*)malloc(sizeof(DMorphReal)*numPointRows*numPointCols);
   D_CHECKPTR(rgYs);
   for(int r=0, qidx=0; r < numPointRows; ++r){
     for(int c=0; c < numPointCols; ++c,++qidx){
@@ -2661,7 +3618,7 @@ DImage DMorphInk::getMorphAtTime(double dblTime, bool fWarpOnly,
 
 DImage DMorphInk::getImageWithMesh(int meshNum){
   DImage imgRet;
-  double *rgXs, *rgYs;
+  DMorphReal *rgXs, *rgYs;
 
   if(0 == meshNum){
     imgRet = (*pimg0);
@@ -2710,7 +3667,7 @@ DImage DMorphInk::getImageWithMesh(int meshNum){
 
 DImage DMorphInk::getMedialAxisWithMesh(int meshNum){
   DImage imgRet;
-  double *rgXs, *rgYs;
+  DMorphReal *rgXs, *rgYs;
 
   if(0 == meshNum){
     imgRet.create(w0,h0,DImage::DImage_RGB);
@@ -2769,7 +3726,7 @@ DImage DMorphInk::getMedialAxisWithMesh(int meshNum){
 
 DImage DMorphInk::getWarpedMedialAxis0_A0prime(){
   DImage imgRet;
-  double *rgXs, *rgYs;
+  DMorphReal *rgXs, *rgYs;
   int w, h;
   w = w0;
   h = h0;
@@ -2795,7 +3752,7 @@ DImage DMorphInk::getWarpedMedialAxis0_A0prime(){
 
 DImage DMorphInk::getBothMedialAxes(bool fWarpPoints0, bool fShowGreenDistance){
   DImage imgRet;
-  double *rgXs, *rgYs;
+  DMorphReal *rgXs, *rgYs;
   int w, h;
   w = w0;
   h = h0;
@@ -3056,19 +4013,13 @@ DImage DMorphInk::getBothMedialAxes(bool fWarpPoints0, bool fShowGreenDistance){
 void DMorphInk::setPreviousPoints(){
   int numPoints;
   numPoints = numPointCols*numPointRows;
-  if(NULL != rgPointsPrevX)
-    free(rgPointsPrevX);
-  if(NULL != rgPointsPrevY)
-    free(rgPointsPrevY);
   if(NULL != ma0prevPosX)
     free(ma0prevPosX);
   if(NULL != ma0prevPosY)
     free(ma0prevPosY);
 
-  rgPointsPrevX = (double*)malloc(sizeof(double)*numPoints);
-  D_CHECKPTR(rgPointsPrevX);
-  rgPointsPrevY = (double*)malloc(sizeof(double)*numPoints);
-  D_CHECKPTR(rgPointsPrevY);
+  rgPointsPrevX = (DMorphReal*)arenaMesh.alloc(sizeof(DMorphReal)*numPoints);
+  rgPointsPrevY = (DMorphReal*)arenaMesh.alloc(sizeof(DMorphReal)*numPoints);
   if(lenMA0 < 1)
     fprintf(stderr,"setPreviousPoints() warning: lenMA0 < 1! (%d)\n",lenMA0);
   ma0prevPosX = (double*)malloc(sizeof(double)* lenMA0);
@@ -3102,7 +4053,7 @@ DImage DMorphInk::getMorphOverlayAtTime(double dblTime,
 					bool fStartAtDP,
 					bool fStartAtPreviousEnd){
   int w, h;
-  double *rgXs, *rgYs;//the warped mesh at time=dblTime
+  DMorphReal *rgXs, *rgYs;//the warped mesh at time=dblTime
   DImage imgMorphed;
   D_uint8 *pSrc0, *pSrc1;
   D_uint8 *pDst;
@@ -3144,9 +4095,9 @@ DImage DMorphInk::getMorphOverlayAtTime(double dblTime,
 
 
   // define rgXs and rgYs as the intermediate mesh point locations at t=dblTime
-  rgXs = (double*)malloc(sizeof(double)*numPointRows*numPointCols);
+  rgXs = (DMorphReal*)malloc(sizeof(DMorphReal)*numPointRows*numPointCols);
   D_CHECKPTR(rgXs);
-  rgYs = (double*)malloc(sizeof(double)*numPointRows*numPointCols);
+  rgYs = (DMorphReal*)malloc(sizeof(DMorphReal)*numPointRows*numPointCols);
   D_CHECKPTR(rgYs);
   for(int r=0, qidx=0; r < numPointRows; ++r){
     for(int c=0; c < numPointCols; ++c,++qidx){
@@ -3519,7 +4470,7 @@ DImage DMorphInk::getMovementHeatmapAtTime(double dblTime,
 					   bool fStartAtDP,
 					   bool fStartAtPreviousEnd){
   int w, h;
-  double *rgXs, *rgYs;//the warped mesh at time=dblTime
+  DMorphReal *rgXs, *rgYs;//the warped mesh at time=dblTime
   DImage imgHeatmap;
   D_uint8 *pDst;
   double *rgPoints0Xcopy = NULL;
@@ -3559,9 +4510,9 @@ DImage DMorphInk::getMovementHeatmapAtTime(double dblTime,
 
 
   // define rgXs and rgYs as the intermediate mesh point locations at t=dblTime
-  rgXs = (double*)malloc(sizeof(double)*numPointRows*numPointCols);
+  rgXs = (DMorphReal*)malloc(sizeof(DMorphReal)*numPointRows*numPointCols);
   D_CHECKPTR(rgXs);
-  rgYs = (double*)malloc(sizeof(double)*numPointRows*numPointCols);
+  rgYs = (DMorphReal*)malloc(sizeof(DMorphReal)*numPointRows*numPointCols);
   D_CHECKPTR(rgYs);
   for(int r=0, qidx=0; r < numPointRows; ++r){
     for(int c=0; c < numPointCols; ++c,++qidx){
@@ -3791,7 +4742,7 @@ DImage DMorphInk::getMovementHeatmapAtTime(double dblTime,
 
 DImage DMorphInk::getBothMedialAxesWithMesh(bool fWarpPoints0, int mesh0or1){
   DImage imgRet;
-  double *rgXs, *rgYs;
+  DMorphReal *rgXs, *rgYs;
   int w, h;
   int scale = 8;
 
@@ -3822,9 +4773,9 @@ DImage DMorphInk::getBothMedialAxesWithMesh(bool fWarpPoints0, int mesh0or1){
 
     numPoints = numMeshPointCols * numMeshPointRows;
 
-    rgXs = (double*)malloc(sizeof(double)*numPoints);
+    rgXs = (DMorphReal*)malloc(sizeof(DMorphReal)*numPoints);
     D_CHECKPTR(rgXs);
-    rgYs = (double*)malloc(sizeof(double)*numPoints);
+    rgYs = (DMorphReal*)malloc(sizeof(DMorphReal)*numPoints);
     D_CHECKPTR(rgYs);
 
     //set the x,y position of each control point in mesh0
@@ -3848,9 +4799,9 @@ DImage DMorphInk::getBothMedialAxesWithMesh(bool fWarpPoints0, int mesh0or1){
 
     numPoints = numMeshPointCols * numMeshPointRows;
 
-    rgXs = (double*)malloc(sizeof(double)*numPoints);
+    rgXs = (DMorphReal*)malloc(sizeof(DMorphReal)*numPoints);
     D_CHECKPTR(rgXs);
-    rgYs = (double*)malloc(sizeof(double)*numPoints);
+    rgYs = (DMorphReal*)malloc(sizeof(DMorphReal)*numPoints);
     D_CHECKPTR(rgYs);
 
     //set the x,y position of each control point in mesh0
@@ -4021,7 +4972,7 @@ DImage DMorphInk::getBothMedialAxesWithMesh(bool fWarpPoints0, int mesh0or1){
 DImage DMorphInk::getWarpedMedialAxesWithSmoothMesh(bool fShowMA0,
 						    bool fShowMA1){
   DImage imgRet;
-  double *rgXs, *rgYs;
+  DMorphReal *rgXs, *rgYs;
   int w3, h3;
   int scale = 20;
   double invScale = 1./5.;
@@ -3,6 +3,8 @@
 
 #include "dimage.h"
 #include "dmath.h"
+#include "dmorphinkprepared.h"
+#include "darena.h"
 #include <stdio.h>
 
 #define SPEED_TEST 1
@@ -16,8 +18,65 @@
 
 #define NEW_WARP 1 /*attempt at faster warpPoint function & re-tooling for it*/
 
+//MORPHINK_FLOAT 1 keeps the meshes, medial axis points and warp parameters
+//in float instead of double (half the memory traffic, twice the SIMD width).
+//The distance maps are integers, so costs change very little (see DMorphReal)
+#ifndef MORPHINK_FLOAT
+#define MORPHINK_FLOAT 0
+#endif
+
+//AVX2 version of getVertexPositionCostIncr() (chosen at run time if the CPU
+//supports it). Needs gcc's target attribute, so only on x86 with gcc/clang
+#if NEW_WARP && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(D_NOSIMD)
+#define MORPHINK_SIMD 1
+#else
+#define MORPHINK_SIMD 0
+#endif
+
 //#define COMPENSATE_FOR_OOB_DISTMAP 1 //we now do this all the time
 
+class DThreadPool;//forward declaration
+
+///type used for the mesh vertices, MA coords, and s,t warp params
+#if MORPHINK_FLOAT
+typedef float DMorphReal;
+#else
+typedef double DMorphReal;
+#endif
+
+///options for DMorphInk::computeCostsOneToMany()
+/**The defaults are the same as the defaults for getWordMorphCost().*/
+struct DMorphInkBatchOptions{
+  DMorphInkBatchOptions();
+  bool fFast;//use getWordMorphCostFast() instead of getWordMorphCost()
+  int bandWidthDP;
+  double nonDiagonalCostDP;
+  int meshSpacingStatic;
+  int numRefinementsStatic;
+  double meshDiv;
+  double lengthMismatchPenalty;
+  int numThreads;//worker threads (-1 for one per CPU)
+  const int *rgIdxs;//if not NULL, compare to rg[rgIdxs[i]] instead of rg[i]
+  double *rgWarpCostDP;//if not NULL, gets warpCostDP of each comparison
+  const double *rgThresholds;//if not NULL, use getWordMorphCostCascade()
+  int *rgCascadeStage;//if not NULL, gets the stage each comparison stopped at
+};
+
+inline DMorphInkBatchOptions::DMorphInkBatchOptions(){
+  fFast = false;
+  bandWidthDP = 15;
+  nonDiagonalCostDP = 0.;
+  meshSpacingStatic = -1;
+  numRefinementsStatic = -1;
+  meshDiv = 4.0;
+  lengthMismatchPenalty = 0.;
+  numThreads = -1;
+  rgIdxs = NULL;
+  rgWarpCostDP = NULL;
+  rgThresholds = NULL;
+  rgCascadeStage = NULL;
+}
+
 //#define CHECK_OLD_WARP 1 /*I fixed the difference between warpPoint and warpPointAtTime after the dissertation.  They both use >0. now instead of warpPoint using >=1.0 like it used to.*/
 
 
@@ -50,10 +109,42 @@
 
 class DMorphInk{
 private:
+  DMorphInk(const DMorphInk &src);//not copyable (owns pBatchPool)
+  const DMorphInk& operator=(const DMorphInk &src);
   void setUpMAImg0();
+  void setUpMAImg0(const DMorphInkPrepared &prep0);
+  void allocMA0Data();
   void checkFreeMA0Data();
+  void morphOneWayAfterInit(int meshSpacing, int numRefinementsStatic);
+  void morphFastAfterInit(int meshSpacing, int numRefinementsStatic);
+  void computeCostsOneToMany_(const DImage *pimgOne, const DImage *rgImgs,
+			      const DMorphInkPrepared *pprepOne,
+			      const DMorphInkPrepared *rgPreps,
+			      int n, double *rgCosts,
+			      const DMorphInkBatchOptions &opts);
+  static void computeCostsOneToMany_itemFunc(void *params, int itemIdx,
+					     int threadNum);
+  double getWordDPCost_(const DFeatureVector &fv0, const DFeatureVector &fv1,
+			int w0, int w1, int bandWidthDP,
+			double nonDiagonalCostDP, double lengthMismatchPenalty,
+			double upperBound);
+  DThreadPool *pBatchPool;//created by the first computeCostsOneToMany() call
+  DMorphInk *rgBatchWorkers;//one DMorphInk workspace per pool thread
+  //reused memory so each comparison doesn't malloc/free the same arrays:
+  DArena arenaMesh;//mesh arrays (rgPoints0X, etc.), reset by resetMeshes()
+  DArena arenaScratch;//temporary DP tables (resetMeshes) and images (getCost)
   
 public:
+  ///stage at which getWordMorphCostCascade() stopped
+  enum DMorphCascadeStage{
+    CascadeNotRejected = 0,//went through every stage (cost is exact)
+    CascadeLength,//rejected by the length (width) mismatch penalty
+    CascadeDP,//rejected by the DP warp cost (see cascadeDPScale)
+    CascadeCoarse,//rejected by the unrefined mesh cost (see cascadeCoarseScale)
+    CascadeOneWay,//rejected after the full morph in the first direction
+    CascadeNumStages
+  };
+
   DMorphInk();
   ~DMorphInk();
   void morphOneWay(	const DImage &srcFrom, 
@@ -63,6 +154,13 @@ public:
 				int meshSpacingStatic,
 				int numRefinementsStatic, 
 				double meshDiv);
+  void morphOneWay(const DMorphInkPrepared &prepFrom,
+		   const DMorphInkPrepared &prepTo,
+		   int bandWidthDP,
+		   double nonDiagonalCostDP,
+		   int meshSpacingStatic,
+		   int numRefinementsStatic,
+		   double meshDiv);
   void saveCurrentMorph(int iteration);
   void saveCurrentMAImagesAndControlPoints(int id);
   double getWordMorphCost(const DImage &src0, const DImage &src1,
@@ -79,10 +177,73 @@ public:
 					   int numRefinementsStatic=-1,
 					   double meshDiv=4.0,
 					   double lengthMismatchPenalty=0.0);
+  double getWordMorphCost(const DMorphInkPrepared &prep0,
+			  const DMorphInkPrepared &prep1,
+			  int bandWidthDP = 15,
+			  double nonDiagonalCostDP=0.,
+			  int meshSpacingStatic=-1,
+			  int numRefinementsStatic=-1,
+			  double meshDiv=4.0,
+			  double lengthMismatchPenalty=0.0);
+  double getWordMorphCostFast(const DMorphInkPrepared &prep0,
+			      const DMorphInkPrepared &prep1,
+			      int bandWidthDP = 15,
+			      double nonDiagonalCostDP=0.,
+			      int meshSpacingStatic=-1,
+			      int numRefinementsStatic=-1,
+			      double meshDiv=4.0,
+			      double lengthMismatchPenalty=0.0);
+
+  double getWordMorphCostCascade(const DMorphInkPrepared &prep0,
+				 const DMorphInkPrepared &prep1,
+				 double threshold,
+				 DMorphCascadeStage *pStage = NULL,
+				 bool fFast = false,
+				 int bandWidthDP = 15,
+				 double nonDiagonalCostDP=0.,
+				 int meshSpacingStatic=-1,
+				 int numRefinementsStatic=-1,
+				 double meshDiv=4.0,
+				 double lengthMismatchPenalty=0.0);
+  double getWordMorphCostCascade(const DImage &src0, const DImage &src1,
+				 double threshold,
+				 DMorphCascadeStage *pStage = NULL,
+				 bool fFast = false,
+				 int bandWidthDP = 15,
+				 double nonDiagonalCostDP=0.,
+				 int meshSpacingStatic=-1,
+				 int numRefinementsStatic=-1,
+				 double meshDiv=4.0,
+				 double lengthMismatchPenalty=0.0);
+
+  double getWordDPCost(const DImage &src0, const DImage &src1,
+		       int bandWidthDP = 15,
+		       double nonDiagonalCostDP=0.,
+		       double lengthMismatchPenalty=0.0,
+		       double upperBound=HUGE_VAL);
+  double getWordDPCost(const DMorphInkPrepared &prep0,
+		       const DMorphInkPrepared &prep1,
+		       int bandWidthDP = 15,
+		       double nonDiagonalCostDP=0.,
+		       double lengthMismatchPenalty=0.0,
+		       double upperBound=HUGE_VAL);
+
+  void computeCostsOneToMany(const DImage &imgOne, const DImage *rgImgs,
+			     int n, double *rgCosts,
+			     const DMorphInkBatchOptions &opts =
+			     DMorphInkBatchOptions());
+  void computeCostsOneToMany(const DMorphInkPrepared &prepOne,
+			     const DMorphInkPrepared *rgPreps,
+			     int n, double *rgCosts,
+			     const DMorphInkBatchOptions &opts =
+			     DMorphInkBatchOptions());
 
   void init(const DImage &src0, const DImage &src1, bool fMakeCopies = true,
 	    int initialMeshSpacing=50, int bandRadius=15,
 	    double nonDiagonalDPcost = 0.,bool D_N_C=DIVIDE_N_CONQ);
+  void init(const DMorphInkPrepared &prep0, const DMorphInkPrepared &prep1,
+	    int initialMeshSpacing=50, int bandRadius=15,
+	    double nonDiagonalDPcost = 0.,bool D_N_C=DIVIDE_N_CONQ);
 	    
   void resetMeshes(int columnSpacing, int rowSpacing,int bandRadius=15,
 		   double nonDiagonalDPcost = 0.,bool D_N_C=DIVIDE_N_CONQ);
@@ -95,8 +256,16 @@ public:
   		double get_new_temp(int time);
   double getVertexPositionCost(int r, int c, double x1, double y1);
   bool warpPoint(double x, double y, double *xp, double *yp, bool fDebugPrint=false);
+  void buildMA0QuadBuckets();
+  void gatherMA0PointsForVertex(int r, int c);
 #if NEW_WARP
   double getVertexPositionCostNew(int r, int c, double x1, double y1);
+  void setUpIncrementalVertexCost(int r, int c);
+  double getVertexPositionCostIncr(double x1, double y1);
+  int getIncrPointCost(int i, double x1, double y1, const signed int *psDist);
+#if MORPHINK_SIMD
+  double getVertexPositionCostIncr_avx2(double x1, double y1);
+#endif
   void warpPointNew(double s, double t, int meshPointIdx,double *xp, double *yp
 		    /*debug: ,double x,double y, int ii=-1, int l=-1,
 		    int rgTempMA0idx_i=-1, int r=-1, int c=-1*/);
@@ -166,44 +335,76 @@ public:
 
   bool fOnlyDoOneDirection;
   bool fOnlyDoCoarseAlignment;
+  //getWordMorphCost(), getWordMorphCostFast(), and getWordMorphCostCascade()
+  //return getWordDPCost() (no meshes at all) if this is true
+  bool fOnlyDoDPCost;
+  //if not 0., getWordMorphCostCascade() also rejects a candidate when this
+  //times warpCostDP or this times the unrefined mesh cost is over the
+  //threshold.  These are approximations, not bounds, so they can reject a
+  //candidate that is really under it.  Both default to 0. (off).
+  double cascadeDPScale;
+  double cascadeCoarseScale;
+  //use the AVX2 vertex cost kernel (set by the constructor if the CPU has it)
+  bool fUseSIMD;
 
   //private:
   int numPointRows;//numPointRows and numPointCols may differ, but must be kept
   int numPointCols;//consistent between the two meshes
   
-  double *rgPoints0X;//x-coords of mesh0 quad vertices (row-major order)
-  double *rgPoints0Y;//y-coords
-  double *rgPoints1X;//same, but for mesh1
-  double *rgPoints1Y;//y-coords for mesh1
-  double *rgPointsDPX;//rgPoints1X copied right after coarse alignment with DP
-  double *rgPointsDPY;//rgPoints1Y copied right after coarse alignment with DP
-  double *rgPointsPrevX;
-  double *rgPointsPrevY;
+  DMorphReal *rgPoints0X;//x-coords of mesh0 quad vertices (row-major order)
+  DMorphReal *rgPoints0Y;//y-coords
+  DMorphReal *rgPoints1X;//same, but for mesh1
+  DMorphReal *rgPoints1Y;//y-coords for mesh1
+  DMorphReal *rgPointsDPX;//rgPoints1X copied right after coarse alignment with DP
+  DMorphReal *rgPointsDPY;//rgPoints1Y copied right after coarse alignment with DP
+  DMorphReal *rgPointsPrevX;
+  DMorphReal *rgPointsPrevY;
   double *ma0prevPosX;//prev positions of each medial axis pixel from ma0
   double *ma0prevPosY;//set to -999. if warpPointAtTime returns false
-  double *rgMA0X;//x-coords for medial axis 0
-  double *rgMA0Y;//y-coords for medial axis 0
-  double *rgMA1X;//x-coords for medial axis 1
-  double *rgMA1Y;//y-coords for medial axis 1
+  DMorphReal *rgMA0X;//x-coords for medial axis 0
+  DMorphReal *rgMA0Y;//y-coords for medial axis 0
+  DMorphReal *rgMA1X;//x-coords for medial axis 1
+  DMorphReal *rgMA1Y;//y-coords for medial axis 1
 #if NEW_WARP
   //these arrays hold values that used to be calculated for every warpPoint call
   int *rgMA0r;
   int *rgMA0c;
-  double *rgMA0s;
-  double *rgMA0t;
-  double *rgMA0quadW;
-  double *rgMA0quadH;
+  DMorphReal *rgMA0s;
+  DMorphReal *rgMA0t;
+  DMorphReal *rgMA0quadW;
+  DMorphReal *rgMA0quadH;
   //this array holds the indexes for rgMA0 points that are in 4 adjacent quads
   //instead of copying everything into rgTempMA0X/Y, etc, we now just
   //copy the indexes and look them up in the original full arrays rgMA0X, etc.
   int *rgTempMA0idx;
+  //for the vertex being moved, each of its rgTempMA0idx points that it
+  //affects has 6 terms so that its warped x,y can be updated for a new
+  //vertex position with a few multiplies (see setUpIncrementalVertexCost).
+  //The terms are kept in 6 separate arrays (all in the rgIncrTerms buffer)
+  //so the AVX2 kernel can load 4 points of each term at once
+  DMorphReal *rgIncrTerms;
+  DMorphReal *rgIncrVtxW;//weight of the vertex within its row of the quad
+  DMorphReal *rgIncrRowX;//weighted x of the other vertex in the same row
+  DMorphReal *rgIncrRowY;//weighted y of the other vertex in the same row
+  DMorphReal *rgIncrRowW;//weight of the vertex's row
+  DMorphReal *rgIncrOtherX;//weighted x of the other row
+  DMorphReal *rgIncrOtherY;//weighted y of the other row
+  int incrNumVarying;//number of points in rgIncrTerms
+  double incrFixedCost;//summed cost of the points the vertex doesn't move
 #endif
-
-  double *rgDPMA0X;//DP-warped coords of MedialAxis0
-  double *rgDPMA0Y;//DP-warped coords of MedialAxis0
-
-  double *rgTempMA0X;//used by improveMorph,getVertexPositionCost2 
-  double *rgTempMA0Y;//used by improveMorph,getVertexPositionCost2 
+  //the (SUBSAMPLEd) MA0 points in quad q (as the improveMorph functions
+  //assign them) are rgMA0QuadIdx[rgMA0QuadStart[q]..rgMA0QuadStart[q+1]-1]
+  int *rgMA0QuadStart;
+  int *rgMA0QuadIdx;
+  int ma0QuadStartCapacity;//allocated length of rgMA0QuadStart
+  int ma0QuadIdxCapacity;//allocated length of rgMA0QuadIdx (and rgIncrTerms/6)
+  bool fMA0QuadBucketsValid;//false once the mesh or MA0 points change
+
+  DMorphReal *rgDPMA0X;//DP-warped coords of MedialAxis0
+  DMorphReal *rgDPMA0Y;//DP-warped coords of MedialAxis0
+
+  DMorphReal *rgTempMA0X;//used by improveMorph,getVertexPositionCost2 
+  DMorphReal *rgTempMA0Y;//used by improveMorph,getVertexPositionCost2 
   int tempMA0len;//used by improveMorph,getVertexPositionCost2 
   int lenMA0;//number of MA0 (medial axis 0) points
   int lenMA1;//number of MA1 (medial axis 1) points
@@ -212,6 +413,8 @@ public:
   //for Divide and Conq
   DImage img0tmpDP;
   DImage imgDist0, imgDist1;//distance maps (DImage_u32) for each image
+  const DImage *pimgDist1;//imgDist1, or the prepared one if init() got one
+  const DMorphInkPrepared *pprep0, *pprep1;//NULL unless init() was prepared
   DImage imgMA0, imgMA1;//medialAxis images
   DImage imgInk0;//medial axis (or all ink) in image0
   int w0, h0, w1, h1; //width,height of the two images (don't have to be equal)
@@ -471,7 +674,7 @@ inline double DMorphInk::getVertexPositionCost(int r, int c,
   int idxVertex;
 
   idxVertex = r*numPointCols+c;//index in control point arrays of this vertex
-  psDist = (signed int*)imgDist1.dataPointer_u32();
+  psDist = (signed int*)pimgDist1->dataPointer_u32();
 
   for(int i=0; i < tempMA0len; ++i){
     double xp, yp;
@@ -610,7 +813,7 @@ inline double DMorphInk::getVertexPositionCostNew(int r, int c,
   int idxVertex;
 
   idxVertex = r*numPointCols+c;//index in control point arrays of this vertex
-  psDist = (signed int*)imgDist1.dataPointer_u32();
+  psDist = (signed int*)pimgDist1->dataPointer_u32();
 
   for(int i=0; i < tempMA0len; ++i){
     double xp, yp;
@@ -672,6 +875,65 @@ inline double DMorphInk::getVertexPositionCostNew(int r, int c,
 
   return sumCost;
 }
+
+///cost (clamped distance map value) of incremental point i when the vertex is at x1,y1
+inline int DMorphInk::getIncrPointCost(int i, double x1, double y1,
+				       const signed int *psDist){
+  DMorphReal xp, yp;
+  int ixp, iyp;
+  xp = rgIncrRowW[i]*(rgIncrVtxW[i]*(DMorphReal)x1 + rgIncrRowX[i]) +
+    rgIncrOtherX[i];
+  yp = rgIncrRowW[i]*(rgIncrVtxW[i]*(DMorphReal)y1 + rgIncrRowY[i]) +
+    rgIncrOtherY[i];
+  ixp=(int)xp;
+  iyp=(int)yp;
+
+  int addDistX, addDistY; // if the position is off the distmap, compensate
+  addDistX = addDistY = 0;
+  if(ixp < 0){
+    addDistX = 0-ixp;
+    ixp = 0;
+  }
+  else if(ixp >  (w1-1)){
+    addDistX = ixp-w1+1;
+    ixp = w1-1;
+  }
+  if(iyp < 0){
+    addDistY = 0-iyp;
+    iyp = 0;
+  }
+  else if(iyp > (h1-1)){
+    addDistY = iyp-h1+1;
+    iyp = h1-1;
+  }
+  return psDist[w1*iyp+ixp] + addDistX + addDistY;
+}
+
+///same as getVertexPositionCostNew() for the vertex given to setUpIncrementalVertexCost()
+/**Only the points whose quads contain the vertex are warped again, and
+   only the vertex's share of the bilinear interpolation is recomputed
+   (the rest was computed once by setUpIncrementalVertexCost()).  The
+   multiplies and adds are done in the same order as warpPointNew()
+   and the costs are integer-valued, so the result is identical.  If
+   fUseSIMD is set, the AVX2 version does the work 4 points at a time
+   (also identical, as long as this is compiled with -ffp-contract=off
+   like the library).*/
+inline double DMorphInk::getVertexPositionCostIncr(double x1, double y1){
+  double sumCost;
+  const signed int *psDist;
+
+#if MORPHINK_SIMD
+  if(fUseSIMD)
+    return getVertexPositionCostIncr_avx2(x1, y1);
+#endif
+  psDist = (const signed int*)pimgDist1->dataPointer_u32();
+  sumCost = incrFixedCost;
+  for(int i=0; i < incrNumVarying; ++i)
+    sumCost += getIncrPointCost(i, x1, y1, psDist);
+  if(sumCost > 0)
+    sumCost = sumCost/(tempMA0len);
+  return sumCost;
+}
 #endif //NEW_WARP
 
 
@@ -0,0 +1,107 @@
+#include "dmorphinkprepared.h"
+#include "dprofile.h"
+#include "ddistancemap.h"
+#include "dmedialaxis.h"
+#include "dwordfeatures.h"
+#include <string.h>
+#include <stdlib.h>
+
+DMorphInkPrepared::DMorphInkPrepared(){
+  pimg = NULL;
+  w = h = 0;
+  lenMA = 0;
+  rgMAX = NULL;
+  rgMAY = NULL;
+  fMapped = false;
+}
+
+DMorphInkPrepared::DMorphInkPrepared(const DImage &src, bool fMakeCopy){
+  pimg = NULL;
+  w = h = 0;
+  lenMA = 0;
+  rgMAX = NULL;
+  rgMAY = NULL;
+  fMapped = false;
+  prepare(src, fMakeCopy);
+}
+
+DMorphInkPrepared::~DMorphInkPrepared(){
+  clear();
+}
+
+///release everything computed by prepare()
+void DMorphInkPrepared::clear(){
+  if(fMapped){//the store owns the buffers, so just let go of them
+    imgCopy.releaseDataBuffer();
+    imgDistMA.releaseDataBuffer();
+  }
+  else if(NULL != rgMAX){
+    free(rgMAX);
+    free(rgMAY);
+  }
+  rgMAX = rgMAY = NULL;
+  fMapped = false;
+  lenMA = 0;
+  w = h = 0;
+  pimg = NULL;
+  imgCopy.deallocateBuffer();
+  imgDistMA.deallocateBuffer();
+  fvWord.clearData();
+  fvVProf.clearData();
+}
+
+///compute the per-image data that DMorphInk::init() and resetMeshes() use
+/**This does the same work for a single image that DMorphInk::init()
+   does for image1 (Zhang skeleton, the list of skeleton points, and
+   the distance map from the skeleton), plus the word features and
+   vertical profile used for the DP alignment in resetMeshes().  The
+   results are identical to what DMorphInk computes for itself, so
+   the costs from the prepared overloads match the DImage versions.*/
+void DMorphInkPrepared::prepare(const DImage &src, bool fMakeCopy){
+  DImage *pSrc;
+  DImage imgMA;
+
+  clear();
+  if(fMakeCopy){
+    imgCopy = src;
+    pimg = &imgCopy;
+  }
+  else
+    pimg = &src;
+  pSrc = (DImage*)pimg;
+  w = pimg->width();
+  h = pimg->height();
+  if((w < 1) || (h < 1)){
+    fprintf(stderr, "DMorphInkPrepared::prepare() called with image width %d "
+	    "or height %d less than 1\n", w, h);
+    abort();
+  }
+
+  //medial axis (skeleton) and the list of its points
+  imgMA = DMedialAxis::getMZhangSkeletonFromBinaryImage(*pSrc,true,&lenMA);
+  rgMAX = (double*)malloc(sizeof(double)*(1+lenMA));
+  D_CHECKPTR(rgMAX);
+  rgMAY = (double*)malloc(sizeof(double)*(1+lenMA));
+  D_CHECKPTR(rgMAY);
+  D_uint8 *p8;
+  p8 = imgMA.dataPointer_u8();
+  for(int y=0, idx=0, ma_pt=0; y < h; ++y){
+    for(int x=0; x<w; ++x, ++idx){
+      if(p8[idx] > 0){
+	rgMAX[ma_pt] = x;
+	rgMAY[ma_pt] = y;
+	++ma_pt;//MedialAxis point
+      }
+    }
+  }
+
+  //distance map from the medial axis (this is what DMorphInk uses as imgDist1)
+  imgMA.invertGrayscale();
+  DDistanceMap::getDistFromInkBitonal_(imgDistMA, imgMA,1000,-1000);
+
+  //features for the horizontal and vertical DP alignments
+  fvWord = DWordFeatures::extractWordFeatures(*pSrc,true,false,true,true,127);
+  DProfile vprof;
+  vprof.getImageVerticalProfile(*pimg);
+  fvVProf.setData_dbl(vprof.dataPointer(), h, 1, true, true, true);
+}
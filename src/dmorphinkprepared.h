@@ -0,0 +1,65 @@
+#ifndef DMORPHINKPREPARED_H
+#define DMORPHINKPREPARED_H
+
+#include "dimage.h"
+#include "dfeaturevector.h"
+
+//bump this whenever prepare() computes something different (DMorphInkStore
+//files record it and are rejected if it doesn't match)
+#define DMORPHINKPREPARED_VERSION 1
+
+///Per-image data used by DMorphInk that doesn't depend on the other word
+/** DMorphInk::init() computes a skeleton, a distance map, and the
+    word-profile features for both images every time two words are
+    compared.  When comparing each word against many others (N test
+    words against M training words, or the NxN training matrix), all
+    of that is identical from one pair to the next.  Call prepare()
+    once for each word image (at load time) and then pass the
+    DMorphInkPrepared objects to the DMorphInk::getWordMorphCost() or
+    DMorphInk::getWordMorphCostFast() overloads so that only the
+    alignment and mesh optimization are done for each pair.
+
+    The source image must be bitonal DImage_u8 data (0 is ink), the
+    same as what DMorphInk expects.  If fMakeCopy is false, the
+    caller must keep the source image alive (and unchanged) for as
+    long as this object is used.
+
+    Note that when DMorphInk is using divide-and-conquer
+    (D_N_C=true), the skeleton of the "from" image is computed from
+    the DP-warped version of that image, so that part still has to be
+    done for each pair.  Everything on the "to" side is reused.
+
+    The prepared data for a whole training set can also be saved to
+    (and loaded back from) a single file with DMorphInkStore.  In that
+    case fMapped is true and the arrays point into the store's memory
+    instead of being allocated here.
+*/
+class DMorphInkPrepared{
+public:
+  DMorphInkPrepared();
+  DMorphInkPrepared(const DImage &src, bool fMakeCopy = true);
+  ~DMorphInkPrepared();
+  void prepare(const DImage &src, bool fMakeCopy = true);
+  void clear();
+  bool isPrepared() const;
+
+  const DImage *pimg;//the source image (or imgCopy if a copy was made)
+  DImage imgCopy;
+  int w, h;//width, height of the source image
+  int lenMA;//number of medial axis (skeleton) points
+  double *rgMAX;//x-coords of the medial axis points (row-major order)
+  double *rgMAY;//y-coords of the medial axis points
+  DImage imgDistMA;//distance map (DImage_u32) from the medial axis
+  DFeatureVector fvWord;//word-level features (profile, upper, lower, trans)
+  DFeatureVector fvVProf;//vertical profile (1 dimension, h long)
+  bool fMapped;//data points into a DMorphInkStore file (not owned by us)
+private:
+  DMorphInkPrepared(const DMorphInkPrepared &src);//not copyable
+  const DMorphInkPrepared& operator=(const DMorphInkPrepared &src);
+};
+
+inline bool DMorphInkPrepared::isPrepared() const{
+  return (NULL != pimg);
+}
+
+#endif
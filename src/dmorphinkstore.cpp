@@ -0,0 +1,514 @@
+#include "dmorphinkstore.h"
+#include "ddefs.h"
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+static const char stStoreMagic[8] = {'D','M','I','S','T','O','R','E'};
+
+/*round up to a multiple of DMORPHINKSTORE_ALIGNMENT*/
+static D_uint64 alignStoreOffset(D_uint64 off){
+  return (off + DMORPHINKSTORE_ALIGNMENT - 1) &
+    ~((D_uint64)DMORPHINKSTORE_ALIGNMENT - 1);
+}
+
+/*write len bytes from pData at file offset off (zero-padding from *pPos)*/
+static bool writeStoreBytes(FILE *fout, D_uint64 *pPos, D_uint64 off,
+			    const void *pData, D_uint64 len){
+  static const D_uint8 rgZeros[DMORPHINKSTORE_ALIGNMENT] = {0};
+  if(off < (*pPos))
+    return false;
+  if(off > (*pPos)){
+    if(1 != fwrite(rgZeros, (size_t)(off - (*pPos)), 1, fout))
+      return false;
+  }
+  if((len > 0) && (1 != fwrite(pData, (size_t)len, 1, fout)))
+    return false;
+  (*pPos) = off + len;
+  return true;
+}
+
+/*size in bytes of the data of a DFeatureVector*/
+static D_uint64 getFVDataLen(const DFeatureVector &fv){
+  return (D_uint64)fv.vectLen * fv.dimensions *
+    (fv.fDataIsDouble ? sizeof(double) : sizeof(float));
+}
+
+/*storage flags for a DFeatureVector*/
+static D_uint32 getFVFlags(const DFeatureVector &fv){
+  return (fv.fDataIsDouble ? DMORPHINKSTORE_FV_DOUBLE : 0) |
+    (fv.fDataGroupedByDim ? DMORPHINKSTORE_FV_GROUPED : 0);
+}
+
+/*true if count items of itemSize bytes at offset off fit in fileLen bytes
+  and off is aligned (the arithmetic can't overflow)*/
+static bool storeRangeOK(D_uint64 off, D_uint64 count, D_uint64 itemSize,
+			 D_uint64 fileLen){
+  if((0 != (off % DMORPHINKSTORE_ALIGNMENT)) || (off > fileLen))
+    return false;
+  return (count <= ((fileLen - off) / itemSize));
+}
+
+/*size and modification time of source image srcNum (stSrcPattern is a
+  printf pattern for the file names). false if it can't be stat'ed*/
+static bool getSourceStamp(const char *stSrcPattern, int srcNum,
+			   D_uint64 *pSize, D_uint64 *pMTime,
+			   D_uint32 *pMTimeNsec, char *stFile, int fileLen){
+  if(snprintf(stFile, fileLen, stSrcPattern, srcNum) >= fileLen)
+    return false;
+#ifndef _WIN32
+  struct stat st;
+  if(0 != stat(stFile, &st))
+    return false;
+#ifdef __linux__
+  (*pMTimeNsec) = (D_uint32)st.st_mtim.tv_nsec;
+#else
+  (*pMTimeNsec) = 0;
+#endif
+#else
+  struct _stat64 st;
+  if(0 != _stat64(stFile, &st))
+    return false;
+  (*pMTimeNsec) = 0;
+#endif
+  (*pSize) = (D_uint64)st.st_size;
+  (*pMTime) = (D_uint64)st.st_mtime;
+  return true;
+}
+
+/*point fv at len*dims values at pData without copying them*/
+static void setFVFromStore(DFeatureVector &fv, void *pData, int len, int dims,
+			   D_uint32 flags){
+  bool fGrouped;
+  fGrouped = (0 != (flags & DMORPHINKSTORE_FV_GROUPED));
+  if(flags & DMORPHINKSTORE_FV_DOUBLE)
+    fv.setData_dbl((double*)pData, len, dims, fGrouped, false, fGrouped);
+  else
+    fv.setData_flt((float*)pData, len, dims, fGrouped, false, fGrouped);
+}
+
+DMorphInkStore::DMorphInkStore(){
+  pFile = NULL;
+  fileLen = 0;
+  numWords = 0;
+  rgEntries = NULL;
+}
+
+DMorphInkStore::~DMorphInkStore(){
+  close();
+}
+
+///save the prepared data (and image properties) of numWords words to stPath
+/**Each rgPrep[i] must have been prepared from a single-channel
+   DImage_u8 image that is still alive, since the pixels, properties,
+   and comments are taken from rgPrep[i].pimg.  stSource should say
+   where the word images came from and how they were thresholded
+   (for example "w_%08d.pgm thresholded at each image's threshold"),
+   and must be shorter than DMORPHINKSTORE_SOURCE_LEN.  open() only
+   accepts the file with the same string.  If stSrcPattern is not
+   NULL, it is the printf pattern of the source image of each word
+   (rgPrep[i] is from file number srcFirstNum+i), and the size and
+   modification time of each of those files is recorded for open() to
+   check.  Returns false if the file couldn't be written (or a source
+   file couldn't be stat'ed).*/
+bool DMorphInkStore::write(const char *stPath, const DMorphInkPrepared *rgPrep,
+			   int numWords, const char *stSource,
+			   const char *stSrcPattern, int srcFirstNum){
+  DMORPHINKSTORE_HEADER_T hdr;
+  DMORPHINKSTORE_ENTRY_T *rgEnt;
+  std::string *rgStrings;
+  D_uint64 off, pos;
+  FILE *fout;
+  bool fOK = true;
+
+  if(numWords < 0){
+    fprintf(stderr, "DMorphInkStore::write() numWords(%d) < 0\n", numWords);
+    return false;
+  }
+  if(strlen(stSource) >= DMORPHINKSTORE_SOURCE_LEN){
+    fprintf(stderr, "DMorphInkStore::write() stSource is longer than %d\n",
+	    DMORPHINKSTORE_SOURCE_LEN-1);
+    return false;
+  }
+  rgEnt = (DMORPHINKSTORE_ENTRY_T*)
+    calloc(numWords+1, sizeof(DMORPHINKSTORE_ENTRY_T));
+  D_CHECKPTR(rgEnt);
+  rgStrings = new std::string[numWords+1];
+  D_CHECKPTR(rgStrings);
+
+  //lay out the file: header, entries, then the arrays for each word
+  off = sizeof(DMORPHINKSTORE_HEADER_T) +
+    (D_uint64)numWords * sizeof(DMORPHINKSTORE_ENTRY_T);
+  for(int i=0; i < numWords; ++i){
+    const DMorphInkPrepared &prep = rgPrep[i];
+    DImage *pimg;
+    D_uint64 wh;
+    if((!prep.isPrepared()) || prep.fMapped ||
+       (DImage::DImage_u8 != prep.pimg->getImageType()) ||
+       (1 != prep.pimg->numChannels()) ||
+       (DImage::DImage_u32 != prep.imgDistMA.getImageType()) ||
+       (prep.imgDistMA.width() != prep.w) ||
+       (prep.imgDistMA.height() != prep.h)){
+      fprintf(stderr, "DMorphInkStore::write() word %d isn't prepared from a "
+	      "DImage_u8 image\n", i);
+      free(rgEnt);
+      delete [] rgStrings;
+      return false;
+    }
+    pimg = (DImage*)prep.pimg;
+    for(int p=0; p < pimg->getNumProperties(); ++p){
+      rgStrings[i] += pimg->getPropertyNameByIndex(p);
+      rgStrings[i] += '\0';
+      rgStrings[i] += pimg->getPropertyValByIndex(p);
+      rgStrings[i] += '\0';
+    }
+    for(int c=0; c < pimg->getNumComments(); ++c){
+      rgStrings[i] += pimg->getCommentByIndex(c);
+      rgStrings[i] += '\0';
+    }
+    wh = (D_uint64)prep.w * prep.h;
+    rgEnt[i].w = prep.w;
+    rgEnt[i].h = prep.h;
+    rgEnt[i].lenMA = prep.lenMA;
+    rgEnt[i].fvWordLen = prep.fvWord.vectLen;
+    rgEnt[i].fvWordDims = prep.fvWord.dimensions;
+    rgEnt[i].fvWordFlags = getFVFlags(prep.fvWord);
+    rgEnt[i].fvVProfLen = prep.fvVProf.vectLen;
+    rgEnt[i].fvVProfFlags = getFVFlags(prep.fvVProf);
+    rgEnt[i].numProps = pimg->getNumProperties();
+    rgEnt[i].numComments = pimg->getNumComments();
+    rgEnt[i].offPixels = off = alignStoreOffset(off);
+    off += wh;
+    rgEnt[i].offDistMA = off = alignStoreOffset(off);
+    off += wh * sizeof(D_uint32);
+    rgEnt[i].offMAX = off = alignStoreOffset(off);
+    off += (D_uint64)prep.lenMA * sizeof(double);
+    rgEnt[i].offMAY = off = alignStoreOffset(off);
+    off += (D_uint64)prep.lenMA * sizeof(double);
+    rgEnt[i].offFvWord = off = alignStoreOffset(off);
+    off += getFVDataLen(prep.fvWord);
+    rgEnt[i].offFvVProf = off = alignStoreOffset(off);
+    off += getFVDataLen(prep.fvVProf);
+    rgEnt[i].offStrings = off = alignStoreOffset(off);
+    rgEnt[i].stringsLen = rgStrings[i].size();
+    off += rgStrings[i].size();
+    if(NULL != stSrcPattern){
+      char stFile[1025];
+      if(!getSourceStamp(stSrcPattern, srcFirstNum+i, &(rgEnt[i].srcSize),
+			 &(rgEnt[i].srcMTime), &(rgEnt[i].srcMTimeNsec),
+			 stFile, sizeof(stFile))){
+	fprintf(stderr, "DMorphInkStore::write() couldn't stat source file "
+		"'%s'\n", stFile);
+	free(rgEnt);
+	delete [] rgStrings;
+	return false;
+      }
+    }
+  }
+
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.stMagic, stStoreMagic, sizeof(hdr.stMagic));
+  hdr.byteOrderMark = 0x01020304;
+  hdr.version = DMORPHINKSTORE_VERSION;
+  hdr.numWords = numWords;
+  hdr.prepVersion = DMORPHINKPREPARED_VERSION;
+  hdr.fileLen = off;
+  strcpy(hdr.stSource, stSource);
+
+  fout = fopen(stPath, "wb");
+  if(!fout){
+    fprintf(stderr, "DMorphInkStore::write() couldn't open '%s'\n", stPath);
+    free(rgEnt);
+    delete [] rgStrings;
+    return false;
+  }
+  pos = 0;
+  fOK = writeStoreBytes(fout, &pos, 0, &hdr, sizeof(hdr)) &&
+    writeStoreBytes(fout, &pos, pos, rgEnt,
+		    (D_uint64)numWords * sizeof(DMORPHINKSTORE_ENTRY_T));
+  for(int i=0; fOK && (i < numWords); ++i){
+    const DMorphInkPrepared &prep = rgPrep[i];
+    D_uint64 wh;
+    wh = (D_uint64)prep.w * prep.h;
+    fOK = writeStoreBytes(fout, &pos, rgEnt[i].offPixels,
+			  prep.pimg->dataPointer_u8(), wh) &&
+      writeStoreBytes(fout, &pos, rgEnt[i].offDistMA,
+		      prep.imgDistMA.dataPointer_u32(), wh*sizeof(D_uint32)) &&
+      writeStoreBytes(fout, &pos, rgEnt[i].offMAX, prep.rgMAX,
+		      (D_uint64)prep.lenMA * sizeof(double)) &&
+      writeStoreBytes(fout, &pos, rgEnt[i].offMAY, prep.rgMAY,
+		      (D_uint64)prep.lenMA * sizeof(double)) &&
+      writeStoreBytes(fout, &pos, rgEnt[i].offFvWord,
+		      prep.fvWord.fDataIsDouble ? (void*)prep.fvWord.pDbl :
+		      (void*)prep.fvWord.pFlt, getFVDataLen(prep.fvWord)) &&
+      writeStoreBytes(fout, &pos, rgEnt[i].offFvVProf,
+		      prep.fvVProf.fDataIsDouble ? (void*)prep.fvVProf.pDbl :
+		      (void*)prep.fvVProf.pFlt, getFVDataLen(prep.fvVProf)) &&
+      writeStoreBytes(fout, &pos, rgEnt[i].offStrings,
+		      rgStrings[i].data(), rgStrings[i].size());
+  }
+  if(0 != fclose(fout))
+    fOK = false;
+  if(!fOK)
+    fprintf(stderr, "DMorphInkStore::write() error writing '%s'\n", stPath);
+  free(rgEnt);
+  delete [] rgStrings;
+  return fOK;
+}
+
+///map the store file stPath into memory (closing any open store first)
+/**Only the header and the per-word entries are checked (none of the
+   word data is touched until it is used): every array must be aligned
+   and lie inside the file.  Returns false (with a message on stderr)
+   if the file can't be opened, isn't a store written by this version
+   of the code, or was written with a different stSource (see
+   write()).  If stSrcPattern is not NULL, each word's source file
+   (number srcFirstNum+i, see write()) is stat'ed as well, and false
+   is returned if any of them is missing or has a different size or
+   modification time than when the store was written.*/
+bool DMorphInkStore::open(const char *stPath, const char *stSource,
+			  const char *stSrcPattern, int srcFirstNum){
+  const DMORPHINKSTORE_HEADER_T *phdr;
+
+  close();
+#ifndef _WIN32
+  int fd;
+  struct stat st;
+  void *pMap;
+  fd = ::open(stPath, O_RDONLY);
+  if(fd < 0){
+    fprintf(stderr, "DMorphInkStore::open() couldn't open '%s'\n", stPath);
+    return false;
+  }
+  if((0 != fstat(fd, &st)) || (st.st_size < (off_t)sizeof(*phdr))){
+    fprintf(stderr, "DMorphInkStore::open() '%s' is too short\n", stPath);
+    ::close(fd);
+    return false;
+  }
+  //private and writable so that an accidental write changes only our copy
+  pMap = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+	      fd, 0);
+  ::close(fd);
+  if(MAP_FAILED == pMap){
+    fprintf(stderr, "DMorphInkStore::open() couldn't map '%s'\n", stPath);
+    return false;
+  }
+  pFile = (D_uint8*)pMap;
+  fileLen = (size_t)st.st_size;
+#else
+  FILE *fin;
+  long len;
+  fin = fopen(stPath, "rb");
+  if(!fin){
+    fprintf(stderr, "DMorphInkStore::open() couldn't open '%s'\n", stPath);
+    return false;
+  }
+  fseek(fin, 0, SEEK_END);
+  len = ftell(fin);
+  fseek(fin, 0, SEEK_SET);
+  if(len < (long)sizeof(*phdr)){
+    fprintf(stderr, "DMorphInkStore::open() '%s' is too short\n", stPath);
+    fclose(fin);
+    return false;
+  }
+  pFile = (D_uint8*)malloc(len);
+  D_CHECKPTR(pFile);
+  fileLen = (size_t)len;
+  if(1 != fread(pFile, fileLen, 1, fin)){
+    fprintf(stderr, "DMorphInkStore::open() couldn't read '%s'\n", stPath);
+    fclose(fin);
+    close();
+    return false;
+  }
+  fclose(fin);
+#endif
+
+  phdr = (const DMORPHINKSTORE_HEADER_T*)pFile;
+  if((0 != memcmp(phdr->stMagic, stStoreMagic, sizeof(stStoreMagic))) ||
+     (0x01020304 != phdr->byteOrderMark) ||
+     (DMORPHINKSTORE_VERSION != phdr->version) ||
+     (phdr->fileLen != (D_uint64)fileLen) ||
+     (fileLen < sizeof(*phdr) +
+      (D_uint64)phdr->numWords * sizeof(DMORPHINKSTORE_ENTRY_T))){
+    fprintf(stderr, "DMorphInkStore::open() '%s' is not a version %d store "
+	    "written on this machine\n", stPath, DMORPHINKSTORE_VERSION);
+    close();
+    return false;
+  }
+  if((DMORPHINKPREPARED_VERSION != phdr->prepVersion) ||
+     (NULL == memchr(phdr->stSource, '\0', DMORPHINKSTORE_SOURCE_LEN)) ||
+     (0 != strcmp(phdr->stSource, stSource))){
+    fprintf(stderr, "DMorphInkStore::open() '%s' was prepared differently "
+	    "(wanted '%s' version %d)\n", stPath, stSource,
+	    DMORPHINKPREPARED_VERSION);
+    close();
+    return false;
+  }
+  if(phdr->numWords > 0x7fffffff){
+    fprintf(stderr, "DMorphInkStore::open() '%s' numWords is corrupt\n",
+	    stPath);
+    close();
+    return false;
+  }
+  numWords = (int)phdr->numWords;
+  rgEntries = (const DMORPHINKSTORE_ENTRY_T*)(pFile + sizeof(*phdr));
+  for(int i=0; i < numWords; ++i){
+    const DMORPHINKSTORE_ENTRY_T &e = rgEntries[i];
+    D_uint64 wh;
+    D_uint64 fvWordSize, fvVProfSize;
+    wh = (D_uint64)e.w * e.h;
+    fvWordSize = (e.fvWordFlags & DMORPHINKSTORE_FV_DOUBLE) ?
+      sizeof(double) : sizeof(float);
+    fvVProfSize = (e.fvVProfFlags & DMORPHINKSTORE_FV_DOUBLE) ?
+      sizeof(double) : sizeof(float);
+    if((e.w < 1) || (e.h < 1) || (e.w > 0x7fffffff) || (e.h > 0x7fffffff) ||
+       (e.lenMA > 0x7fffffff) ||
+       (e.fvWordLen > 0x7fffffff) || (e.fvVProfLen > 0x7fffffff) ||
+       (e.fvWordDims < 1) || (e.fvWordDims > 0x7fffffff) ||
+       (0 != (e.fvWordFlags & ~(D_uint32)(DMORPHINKSTORE_FV_DOUBLE |
+					  DMORPHINKSTORE_FV_GROUPED))) ||
+       (0 != (e.fvVProfFlags & ~(D_uint32)(DMORPHINKSTORE_FV_DOUBLE |
+					   DMORPHINKSTORE_FV_GROUPED))) ||
+       (!storeRangeOK(e.offPixels, wh, 1, fileLen)) ||
+       (!storeRangeOK(e.offDistMA, wh, sizeof(D_uint32), fileLen)) ||
+       (!storeRangeOK(e.offMAX, e.lenMA, sizeof(double), fileLen)) ||
+       (!storeRangeOK(e.offMAY, e.lenMA, sizeof(double), fileLen)) ||
+       (!storeRangeOK(e.offFvWord, (D_uint64)e.fvWordLen * e.fvWordDims,
+		      fvWordSize, fileLen)) ||
+       (!storeRangeOK(e.offFvVProf, e.fvVProfLen, fvVProfSize, fileLen)) ||
+       (!storeRangeOK(e.offStrings, e.stringsLen, 1, fileLen))){
+      fprintf(stderr, "DMorphInkStore::open() '%s' entry %d is corrupt\n",
+	      stPath, i);
+      close();
+      return false;
+    }
+    if(NULL != stSrcPattern){
+      char stFile[1025];
+      D_uint64 srcSize, srcMTime;
+      D_uint32 srcMTimeNsec;
+      if((!getSourceStamp(stSrcPattern, srcFirstNum+i, &srcSize, &srcMTime,
+			  &srcMTimeNsec, stFile, sizeof(stFile))) ||
+	 (srcSize != e.srcSize) || (srcMTime != e.srcMTime) ||
+	 (srcMTimeNsec != e.srcMTimeNsec)){
+	fprintf(stderr, "DMorphInkStore::open() '%s' is out of date: source "
+		"file '%s' is missing or has changed\n", stPath, stFile);
+	close();
+	return false;
+      }
+    }
+  }
+  return true;
+}
+
+///unmap the store file
+/**Any DMorphInkPrepared filled in by getPrepared() must not be used
+   after this (clear() them first).*/
+void DMorphInkStore::close(){
+  if(NULL != pFile){
+#ifndef _WIN32
+    munmap(pFile, fileLen);
+#else
+    free(pFile);
+#endif
+  }
+  pFile = NULL;
+  fileLen = 0;
+  numWords = 0;
+  rgEntries = NULL;
+}
+
+void DMorphInkStore::checkWordIdx(int wordIdx) const{
+  if((wordIdx < 0) || (wordIdx >= numWords)){
+    fprintf(stderr, "DMorphInkStore: wordIdx %d out of range (numWords=%d)\n",
+	    wordIdx, numWords);
+    abort();
+  }
+}
+
+///make prep use the prepared data of word wordIdx (without copying it)
+/**The result is the same as calling prep.prepare() on the word image
+   that was saved, but all of the arrays point into the store.  The two
+   images are marked AllocationMethod_mapped so that a copy of them gets
+   its own buffer, and prep.clear() lets go of them without unmapping
+   anything (only close() does that).*/
+void DMorphInkStore::getPrepared(int wordIdx, DMorphInkPrepared &prep) const{
+  const DMORPHINKSTORE_ENTRY_T *pe;
+
+  checkWordIdx(wordIdx);
+  pe = &(rgEntries[wordIdx]);
+  prep.clear();
+  prep.w = pe->w;
+  prep.h = pe->h;
+  prep.imgCopy.create(prep.w, prep.h, DImage::DImage_u8, 1);
+  prep.imgCopy.setDataBuffer(pFile + pe->offPixels, AllocationMethod_mapped);
+  prep.pimg = &(prep.imgCopy);
+  prep.imgDistMA.create(prep.w, prep.h, DImage::DImage_u32, 1);
+  prep.imgDistMA.setDataBuffer(pFile + pe->offDistMA,AllocationMethod_mapped);
+  prep.lenMA = pe->lenMA;
+  prep.rgMAX = (double*)(pFile + pe->offMAX);
+  prep.rgMAY = (double*)(pFile + pe->offMAY);
+  setFVFromStore(prep.fvWord, pFile + pe->offFvWord, pe->fvWordLen,
+		 pe->fvWordDims, pe->fvWordFlags);
+  setFVFromStore(prep.fvVProf, pFile + pe->offFvVProf, pe->fvVProfLen, 1,
+		 pe->fvVProfFlags);
+  prep.fMapped = true;
+}
+
+/*the nul-terminated string at *ppch (which must end before pEnd), moving
+  *ppch past it.  Returns false if there is no nul before pEnd*/
+static bool getStoreString(const char **ppch, const char *pEnd,
+			   std::string &str){
+  const char *pNul;
+  if((*ppch) >= pEnd)
+    return false;
+  pNul = (const char*)memchr(*ppch, '\0', (size_t)(pEnd - (*ppch)));
+  if(NULL == pNul)
+    return false;
+  str.assign(*ppch, (size_t)(pNul - (*ppch)));
+  (*ppch) = pNul + 1;
+  return true;
+}
+
+///replace the properties and comments of img with those of word wordIdx
+/**Only the properties and comments are set. The image data is left
+   alone, so this can be used on an empty DImage to get at the labels
+   with the usual getPropertyVal()/getCommentByIndex() calls.  The
+   strings never run past the word's part of the file.  If they are
+   corrupt, img only gets the ones before that (and a message is
+   printed on stderr).*/
+void DMorphInkStore::getProperties(int wordIdx, DImage &img) const{
+  const DMORPHINKSTORE_ENTRY_T *pe;
+  const char *pch, *pEnd;
+  std::string stName, stVal;
+
+  checkWordIdx(wordIdx);
+  pe = &(rgEntries[wordIdx]);
+  img.clearProperties();
+  img.clearComments();
+  pch = (const char*)(pFile + pe->offStrings);
+  pEnd = pch + pe->stringsLen;
+  for(D_uint32 p=0; p < pe->numProps; ++p){
+    if((!getStoreString(&pch, pEnd, stName)) ||
+       (!getStoreString(&pch, pEnd, stVal))){
+      fprintf(stderr, "DMorphInkStore::getProperties() word %d properties "
+	      "are corrupt\n", wordIdx);
+      return;
+    }
+    img.setProperty(stName, stVal);
+  }
+  for(D_uint32 c=0; c < pe->numComments; ++c){
+    if(!getStoreString(&pch, pEnd, stVal)){
+      fprintf(stderr, "DMorphInkStore::getProperties() word %d comments "
+	      "are corrupt\n", wordIdx);
+      return;
+    }
+    img.addComment(stVal);
+  }
+}
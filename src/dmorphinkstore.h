@@ -0,0 +1,116 @@
+#ifndef DMORPHINKSTORE_H
+#define DMORPHINKSTORE_H
+
+#include <stdlib.h>
+#include "dimage.h"
+#include "dinttypes.h"
+#include "dmorphinkprepared.h"
+
+///One file holding the DMorphInkPrepared data for a whole set of words
+/** Loading a large training set one PGM at a time (fopen, header and
+    comment parsing, thresholding) and then calling
+    DMorphInkPrepared::prepare() on every word takes minutes for tens
+    of thousands of words.  write() saves everything prepare()
+    computed (bitonal pixels, skeleton points, distance map from the
+    skeleton, word features, vertical profile) plus the properties and
+    comments of each word image into a single file.  open() maps that
+    file into memory, and getPrepared() just points a DMorphInkPrepared
+    at the right place in the mapping, so nothing is parsed, computed,
+    or copied when the words are loaded.  The pages are read from disk
+    by the OS the first time they are actually used.
+
+    File layout (everything in native byte order, so the file should
+    be rebuilt rather than moved between machines with different
+    endianness): a DMORPHINKSTORE_HEADER_T, then numWords
+    DMORPHINKSTORE_ENTRY_T records, then the data arrays of each word.
+    Every array starts on a DMORPHINKSTORE_ALIGNMENT byte boundary and
+    the entries hold the file offset of each one.  The strings of a
+    word are the property names and values followed by the comments,
+    each one nul-terminated.
+
+    The store must stay open for as long as any DMorphInkPrepared
+    filled in by getPrepared() is being used.  The header records
+    DMORPHINKPREPARED_VERSION and a source string from the caller
+    that says which images the words were prepared from and how they
+    were thresholded, and open() rejects a store whose version or
+    source doesn't match, so two programs that load the same words
+    differently can't use each other's store.  If write() and open()
+    are given the printf pattern of the source image file names, each
+    entry also records the size and modification time of its source
+    file, and open() rejects the store if any of them has changed (so a
+    word that was re-thresholded, relabeled, or regenerated isn't
+    silently taken from the old store).  If the file layout changes,
+    bump DMORPHINKSTORE_VERSION.
+*/
+#define DMORPHINKSTORE_VERSION 3
+#define DMORPHINKSTORE_ALIGNMENT 16
+#define DMORPHINKSTORE_SOURCE_LEN 256
+
+typedef struct{
+  char stMagic[8];//"DMISTORE"
+  D_uint32 byteOrderMark;//0x01020304 as written by this machine
+  D_uint32 version;//DMORPHINKSTORE_VERSION
+  D_uint32 numWords;
+  D_uint32 prepVersion;//DMORPHINKPREPARED_VERSION
+  D_uint64 fileLen;//total length of the file in bytes
+  char stSource[DMORPHINKSTORE_SOURCE_LEN];//nul-terminated (see write())
+} DMORPHINKSTORE_HEADER_T;
+
+typedef struct{
+  D_uint32 w, h;//word image width and height
+  D_uint32 lenMA;//number of skeleton points
+  D_uint32 fvWordLen, fvWordDims;
+  D_uint32 fvWordFlags;//DMORPHINKSTORE_FV_DOUBLE | DMORPHINKSTORE_FV_GROUPED
+  D_uint32 fvVProfLen;
+  D_uint32 fvVProfFlags;
+  D_uint32 numProps, numComments;
+  D_uint64 offPixels;//w*h D_uint8 (bitonal, 0 is ink)
+  D_uint64 offDistMA;//w*h D_uint32
+  D_uint64 offMAX, offMAY;//lenMA doubles each
+  D_uint64 offFvWord, offFvVProf;
+  D_uint64 offStrings;
+  D_uint64 stringsLen;
+  D_uint64 srcSize;//size of the source image file (0 if not recorded)
+  D_uint64 srcMTime;//its modification time (seconds)
+  D_uint32 srcMTimeNsec;//and nanoseconds, where the OS has them
+  D_uint32 reserved;
+} DMORPHINKSTORE_ENTRY_T;
+
+#define DMORPHINKSTORE_FV_DOUBLE 1
+#define DMORPHINKSTORE_FV_GROUPED 2
+
+class DMorphInkStore{
+public:
+  DMorphInkStore();
+  ~DMorphInkStore();
+  static bool write(const char *stPath, const DMorphInkPrepared *rgPrep,
+		    int numWords, const char *stSource,
+		    const char *stSrcPattern = NULL, int srcFirstNum = 0);
+  bool open(const char *stPath, const char *stSource,
+	    const char *stSrcPattern = NULL, int srcFirstNum = 0);
+  void close();
+  bool isOpen() const;
+  int getNumWords() const;
+  void getPrepared(int wordIdx, DMorphInkPrepared &prep) const;
+  void getProperties(int wordIdx, DImage &img) const;
+
+private:
+  DMorphInkStore(const DMorphInkStore &src);//not copyable
+  const DMorphInkStore& operator=(const DMorphInkStore &src);
+  void checkWordIdx(int wordIdx) const;
+
+  D_uint8 *pFile;//the mapped (or read, on Windows) file
+  size_t fileLen;
+  int numWords;
+  const DMORPHINKSTORE_ENTRY_T *rgEntries;//points into pFile
+};
+
+inline bool DMorphInkStore::isOpen() const{
+  return (NULL != pFile);
+}
+
+inline int DMorphInkStore::getNumWords() const{
+  return numWords;
+}
+
+#endif
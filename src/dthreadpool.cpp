@@ -0,0 +1,264 @@
+#include "dthreadpool.h"
+#include "ddefs.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct{
+  int itemIdx;
+  double cost;
+} DTHREADPOOL_ITEM_COST_T;
+
+/*comparison function for qsort()ing items in nonincreasing cost order */
+static int compareItemCostsDecreasing(const void *p1, const void *p2){
+  const DTHREADPOOL_ITEM_COST_T *pi1, *pi2;
+  pi1 = (const DTHREADPOOL_ITEM_COST_T*)p1;
+  pi2 = (const DTHREADPOOL_ITEM_COST_T*)p2;
+  if((pi1->cost) > (pi2->cost))
+    return -1;
+  else if((pi1->cost) < (pi2->cost))
+    return 1;
+  return (pi1->itemIdx) - (pi2->itemIdx);
+}
+
+///create the pool and start its worker threads
+/**If numThreads is less than 1, one thread per CPU is used.*/
+DThreadPool::DThreadPool(int numThreads){
+#ifdef D_NOTHREADS
+  numThreads = 1;
+#else
+  if(numThreads < 1)
+    numThreads = getNumCPUs();
+  if(numThreads < 1)
+    numThreads = 1;
+#endif
+  _numThreads = numThreads;
+  _fShutdown = false;
+  _func = NULL;
+  _params = NULL;
+  rgItems = NULL;
+  itemsCapacity = 0;
+  rgQueueHead = (int*)malloc(sizeof(int)*_numThreads);
+  D_CHECKPTR(rgQueueHead);
+  rgQueueTail = (int*)malloc(sizeof(int)*_numThreads);
+  D_CHECKPTR(rgQueueTail);
+  for(int t=0; t < _numThreads; ++t)
+    rgQueueHead[t] = rgQueueTail[t] = 0;
+
+#ifndef D_NOTHREADS
+  rgThreadID = new pthread_t[_numThreads];
+  D_CHECKPTR(rgThreadID);
+  rgQueueMutexes = new pthread_mutex_t[_numThreads];
+  D_CHECKPTR(rgQueueMutexes);
+  rgWorkerParms = new WORKER_PARAMS_T[_numThreads];
+  D_CHECKPTR(rgWorkerParms);
+  if((0 != sem_init(&semStart, 0, 0)) || (0 != sem_init(&semDone, 0, 0))){
+    fprintf(stderr, "DThreadPool::DThreadPool() failed to init semaphores\n");
+    exit(1);
+  }
+  for(int t=0; t < _numThreads; ++t){
+    pthread_mutex_init(&rgQueueMutexes[t], NULL);
+  }
+  for(int t=0; t < _numThreads; ++t){
+    rgWorkerParms[t].pPool = this;
+    rgWorkerParms[t].threadNum = t;
+    if(0 != pthread_create(&rgThreadID[t], NULL,
+			   DThreadPool::DThreadPool_workerThreadWrap,
+			   &rgWorkerParms[t])){
+      fprintf(stderr, "DThreadPool::DThreadPool() failed to spawn thread "
+	      "#%d. Exiting.\n", t);
+      exit(1);
+    }
+  }
+#endif
+}
+
+///tell the worker threads to exit and wait for them
+DThreadPool::~DThreadPool(){
+#ifndef D_NOTHREADS
+  _fShutdown = true;
+  for(int t=0; t < _numThreads; ++t)
+    sem_post(&semStart);
+  for(int t=0; t < _numThreads; ++t){
+    if(pthread_join(rgThreadID[t],NULL))
+      fprintf(stderr, "DThreadPool::~DThreadPool() failed to join "
+	      "thread %d\n", t);
+  }
+  for(int t=0; t < _numThreads; ++t)
+    pthread_mutex_destroy(&rgQueueMutexes[t]);
+  sem_destroy(&semStart);
+  sem_destroy(&semDone);
+  delete [] rgThreadID;
+  delete [] rgQueueMutexes;
+  delete [] rgWorkerParms;
+#endif
+  if(NULL != rgItems)
+    free(rgItems);
+  free(rgQueueHead);
+  free(rgQueueTail);
+}
+
+///call func(params, itemIdx, threadNum) for each itemIdx 0..numItems-1
+/**Blocks until every item has been processed.  rgItemCosts (if not
+   NULL) holds an estimate of how long each item will take (only the
+   relative values matter) and is used to balance the initial
+   assignment of items to workers.*/
+void DThreadPool::run(int numItems, DThreadPoolFunc func, void *params,
+		      const double *rgItemCosts){
+  if(numItems < 1)
+    return;
+  _func = func;
+  _params = params;
+#ifdef D_NOTHREADS
+  for(int i=0; i < numItems; ++i)
+    func(params, i, 0);
+#else
+  dealItems(numItems, rgItemCosts);
+  for(int t=0; t < _numThreads; ++t)
+    sem_post(&semStart);
+  for(int t=0; t < _numThreads; ++t)
+    sem_wait(&semDone);
+#endif
+  _func = NULL;
+  _params = NULL;
+}
+
+///fill the worker queues for a new job
+void DThreadPool::dealItems(int numItems, const double *rgItemCosts){
+  int *rgAssigned;//which worker each (sorted) item was assigned to
+  int *rgCount;//number of items assigned to each worker
+  double *rgLoad;//estimated work assigned to each worker
+  DTHREADPOOL_ITEM_COST_T *rgSorted;
+
+  if(numItems > itemsCapacity){
+    if(NULL != rgItems)
+      free(rgItems);
+    rgItems = (int*)malloc(sizeof(int)*numItems);
+    D_CHECKPTR(rgItems);
+    itemsCapacity = numItems;
+  }
+  rgSorted = (DTHREADPOOL_ITEM_COST_T*)
+    malloc(sizeof(DTHREADPOOL_ITEM_COST_T)*numItems);
+  D_CHECKPTR(rgSorted);
+  rgAssigned = (int*)malloc(sizeof(int)*numItems);
+  D_CHECKPTR(rgAssigned);
+  rgCount = (int*)malloc(sizeof(int)*_numThreads);
+  D_CHECKPTR(rgCount);
+  rgLoad = (double*)malloc(sizeof(double)*_numThreads);
+  D_CHECKPTR(rgLoad);
+
+  for(int i=0; i < numItems; ++i){
+    rgSorted[i].itemIdx = i;
+    rgSorted[i].cost = (NULL == rgItemCosts) ? 1. : rgItemCosts[i];
+  }
+  if(NULL != rgItemCosts)
+    qsort((void*)rgSorted, numItems, sizeof(DTHREADPOOL_ITEM_COST_T),
+	  compareItemCostsDecreasing);
+  for(int t=0; t < _numThreads; ++t){
+    rgCount[t] = 0;
+    rgLoad[t] = 0.;
+  }
+  //greedy: each item goes to the worker with the least work so far
+  for(int i=0; i < numItems; ++i){
+    int tMin = 0;
+    for(int t=1; t < _numThreads; ++t){
+      if(rgLoad[t] < rgLoad[tMin])
+	tMin = t;
+    }
+    rgAssigned[i] = tMin;
+    rgLoad[tMin] += rgSorted[i].cost;
+    ++(rgCount[tMin]);
+  }
+  //lay the queues out end to end in rgItems, keeping the sorted order
+  for(int t=0, pos=0; t < _numThreads; ++t){
+    rgQueueHead[t] = rgQueueTail[t] = pos;
+    pos += rgCount[t];
+  }
+  for(int i=0; i < numItems; ++i){
+    int t = rgAssigned[i];
+    rgItems[rgQueueTail[t]] = rgSorted[i].itemIdx;
+    ++(rgQueueTail[t]);
+  }
+
+  free(rgSorted);
+  free(rgAssigned);
+  free(rgCount);
+  free(rgLoad);
+}
+
+///get the next item for worker threadNum, stealing if its queue is empty
+/**Returns false when there is no work left in any queue.*/
+bool DThreadPool::getNextItem(int threadNum, int *itemIdx){
+#ifdef D_NOTHREADS
+  return false;
+#else
+  pthread_mutex_lock(&rgQueueMutexes[threadNum]);
+  if(rgQueueHead[threadNum] < rgQueueTail[threadNum]){
+    (*itemIdx) = rgItems[rgQueueHead[threadNum]];
+    ++(rgQueueHead[threadNum]);
+    pthread_mutex_unlock(&rgQueueMutexes[threadNum]);
+    return true;
+  }
+  pthread_mutex_unlock(&rgQueueMutexes[threadNum]);
+
+  while(true){
+    int victim = -1;
+    int maxLeft = 0;
+    for(int t=0; t < _numThreads; ++t){
+      int numLeft;
+      if(t == threadNum)
+	continue;
+      pthread_mutex_lock(&rgQueueMutexes[t]);
+      numLeft = rgQueueTail[t] - rgQueueHead[t];
+      pthread_mutex_unlock(&rgQueueMutexes[t]);
+      if(numLeft > maxLeft){
+	maxLeft = numLeft;
+	victim = t;
+      }
+    }
+    if(victim < 0)
+      return false;//nothing left anywhere
+    //steal the back half (the cheapest items) of the victim's queue
+    int stealFirst, stealEnd;
+    pthread_mutex_lock(&rgQueueMutexes[victim]);
+    stealEnd = rgQueueTail[victim];
+    stealFirst = stealEnd - (stealEnd - rgQueueHead[victim] + 1) / 2;
+    if(stealFirst >= stealEnd){//somebody else got there first. try again
+      pthread_mutex_unlock(&rgQueueMutexes[victim]);
+      continue;
+    }
+    rgQueueTail[victim] = stealFirst;
+    pthread_mutex_unlock(&rgQueueMutexes[victim]);
+
+    pthread_mutex_lock(&rgQueueMutexes[threadNum]);
+    (*itemIdx) = rgItems[stealFirst];
+    rgQueueHead[threadNum] = stealFirst + 1;
+    rgQueueTail[threadNum] = stealEnd;
+    pthread_mutex_unlock(&rgQueueMutexes[threadNum]);
+    return true;
+  }
+#endif
+}
+
+#ifndef D_NOTHREADS
+///each worker thread runs this until the pool is destroyed
+void* DThreadPool::DThreadPool_workerThreadWrap(void *params){
+  WORKER_PARAMS_T *pparms;
+  DThreadPool *pPool;
+  int threadNum;
+  int itemIdx;
+
+  pparms = (WORKER_PARAMS_T*)params;
+  pPool = pparms->pPool;
+  threadNum = pparms->threadNum;
+  while(true){
+    sem_wait(&(pPool->semStart));
+    if(pPool->_fShutdown)
+      break;
+    while(pPool->getNextItem(threadNum, &itemIdx)){
+      pPool->_func(pPool->_params, itemIdx, threadNum);
+    }
+    sem_post(&(pPool->semDone));
+  }
+  return NULL;
+}
+#endif
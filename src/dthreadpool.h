@@ -0,0 +1,77 @@
+#ifndef DTHREADPOOL_H
+#define DTHREADPOOL_H
+
+#include <stdlib.h>
+#ifndef D_NOTHREADS
+#include "dthreads.h"
+#endif
+
+///function called by DThreadPool workers once for each item of a job
+/**itemIdx is 0..numItems-1 and threadNum is the worker (0..numThreads-1)
+   that is processing the item.  A given threadNum is only ever used by
+   one thread at a time, so it can be used to index per-thread
+   workspace (such as one DMorphInk object per worker).*/
+typedef void (*DThreadPoolFunc)(void *params, int itemIdx, int threadNum);
+
+///A persistent pool of worker threads that share jobs by work stealing
+/** The worker threads are created once (in the constructor) and
+    then wait between jobs, so run() can be called many times (once
+    per test word, for example) without paying for pthread_create()
+    and pthread_join() each time.
+
+    When run() is called, the items are dealt out to the workers up
+    front.  If rgItemCosts is given, the items are sorted by
+    estimated cost and each one goes to whichever worker has the
+    least estimated work so far, so the expensive items are spread
+    out.  Each worker takes items from the front of its own queue
+    (most expensive first).  When a worker's queue is empty, it steals
+    the back half of the queue of the worker with the most items left,
+    so threads that happen to get the quicker items don't sit idle
+    while others are still busy.
+
+    run() blocks until all of the items are done and should only be
+    called from one thread at a time.  If compiled with D_NOTHREADS,
+    run() just processes the items in order in the calling thread.
+*/
+class DThreadPool{
+public:
+  DThreadPool(int numThreads = -1);
+  ~DThreadPool();
+  int getNumThreads() const;
+  void run(int numItems, DThreadPoolFunc func, void *params,
+	   const double *rgItemCosts = NULL);
+
+private:
+  DThreadPool(const DThreadPool &src);//not copyable
+  const DThreadPool& operator=(const DThreadPool &src);
+  bool getNextItem(int threadNum, int *itemIdx);
+  void dealItems(int numItems, const double *rgItemCosts);
+#ifndef D_NOTHREADS
+  static void* DThreadPool_workerThreadWrap(void *params);
+#endif
+
+  int _numThreads;
+  bool _fShutdown;
+  DThreadPoolFunc _func;//function and params for the current job
+  void *_params;
+  int *rgItems;//item indexes, each worker's queue is a range of this array
+  int itemsCapacity;//allocated length of rgItems
+  int *rgQueueHead;//next item for each worker is rgItems[rgQueueHead[t]]
+  int *rgQueueTail;//one past the last item of each worker's queue
+#ifndef D_NOTHREADS
+  pthread_t *rgThreadID;
+  pthread_mutex_t *rgQueueMutexes;//one mutex for each worker's queue
+  sem_t semStart;//posted once per worker when a job is ready (or shutdown)
+  sem_t semDone;//posted by a worker each time it runs out of work
+  struct WORKER_PARAMS_T{
+    DThreadPool *pPool;
+    int threadNum;
+  } *rgWorkerParms;
+#endif
+};
+
+inline int DThreadPool::getNumThreads() const{
+  return _numThreads;
+}
+
+#endif
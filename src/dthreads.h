@@ -33,6 +33,7 @@ typedef void pthread_attr_t;
 #define sem_init(A,B,C) (-1 * (NULL == \
                         ((*(A)) = (CreateSemaphore(NULL,(C),9999999,NULL)))))//kbw,me
 #define pthread_mutex_init(A,B) ((*(A) = (CreateMutex(NULL, FALSE, "A"))),0)//kbw,me
+#define sem_destroy(A) (!CloseHandle( *(A) ))
 
 // this may not work, I haven't tried it.  It may not even compile
 inline int pthread_create(pthread_t *thread, pthread_attr_t *attr,
@@ -45,6 +46,14 @@ inline int pthread_create(pthread_t *thread, pthread_attr_t *attr,
   return 0;
 }
 
+// this may not work, I haven't tried it.  It may not even compile
+inline int pthread_join(pthread_t thread, void **value_ptr){
+  if(WAIT_FAILED == WaitForSingleObject(thread, INFINITE))
+    return 1;
+  CloseHandle(thread);
+  return 0;
+}
+
 // this may not work, I haven't tried it.  It may not even compile
 inline int pthread_mutex_destroy(pthread_mutex_t mtx){
   return !(closehandle(mtx));
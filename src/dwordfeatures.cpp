@@ -3,6 +3,180 @@
 
 
 
+//columns of the image done at a time by getRawWordFeatures() (so the
+//per-column bits and counts stay in cache)
+#define DWORDFEATURES_BLOCK_COLS 256
+//upper/lower profile value of a column with no ink (before filling in)
+#define DWORDFEATURES_NO_INK 999999
+
+//fill in the columns that have no ink from their neighbors
+/**(The original interpolation computed its weight with integer
+   division, so it has always just copied the value from the left, or
+   from the right for columns at the left edge.  That is kept so the
+   features don't change.)  If no column has ink, the values are left
+   as DWORDFEATURES_NO_INK. */
+static void fillNoInkColumns(int *rgVals, int w, const char *stName){
+  for(int x=0; x < w; ++x){
+    if(DWORDFEATURES_NO_INK == rgVals[x]){
+      int idxNext, val;
+      idxNext = x+1;
+      while((idxNext < w) && (DWORDFEATURES_NO_INK == rgVals[idxNext]))
+	++idxNext;
+      if(x > 0)
+	val = rgVals[x-1];
+      else if(idxNext < w)
+	val = rgVals[idxNext];
+      else{//this shouldn't happen.  There must be no ink!
+	fprintf(stderr, "WARNING: DWordFeatures::extractWordFeatures() "
+		"found no ink for %s profile!\n", stName);
+	return;
+      }
+      for(int i=x; i < idxNext; ++i)
+	rgVals[i] = val;
+      x = idxNext-1;
+    }
+  }
+}
+
+//Compute all four features (before normalization) in one pass through img
+/**rgRaw must have 4*w ints and gets the profile, upper profile, lower
+   profile, and transition counts (w of each), all as integers.  The
+   ink/background decision for each pixel is packed into 64-bit words
+   down each column (64 rows per word), so after the single pass over
+   the image the per-column features are just popcount (ink count and
+   transitions) and ctz/clz (first and last ink row) on a few words.
+   The grayscale profile (if fUseGrayscaleProf) is added up in the same
+   pass.  The image is done in blocks of DWORDFEATURES_BLOCK_COLS
+   columns. */
+static void getRawWordFeatures(const D_uint8 *p8, int w, int h,
+			       bool fUseGrayscaleProf, bool fInkIsBlack,
+			       D_uint8 tval, int *rgRaw){
+  int *pProf, *pUpper, *pLower, *pTrans;
+  int numWords;//64-bit words per column
+  D_uint64 *rgBits;//ink bits of the current block (word wi of column x is
+                   //at wi*bw+x, so each row's loop is over consecutive words)
+
+  pProf = rgRaw;
+  pUpper = &(rgRaw[w]);
+  pLower = &(rgRaw[w*2]);
+  pTrans = &(rgRaw[w*3]);
+  numWords = (h + 63) / 64;
+  if(numWords < 1)
+    numWords = 1;
+  rgBits = (D_uint64*)malloc(sizeof(D_uint64)*numWords*DWORDFEATURES_BLOCK_COLS);
+  D_CHECKPTR(rgBits);
+
+  for(int x0=0; x0 < w; x0 += DWORDFEATURES_BLOCK_COLS){
+    int bw;//width of this block
+    bw = w - x0;
+    if(bw > DWORDFEATURES_BLOCK_COLS)
+      bw = DWORDFEATURES_BLOCK_COLS;
+    memset(rgBits, 0, sizeof(D_uint64)*numWords*bw);
+    for(int x=0; x < bw; ++x)
+      pProf[x0+x] = 0;
+
+    for(int y=0; y < h; ++y){
+      const D_uint8 *pRow;
+      D_uint64 *pBits;
+      int *pProfBlock;
+      int shift;
+      pRow = &(p8[y*w+x0]);
+      pBits = &(rgBits[(y >> 6)*bw]);
+      pProfBlock = &(pProf[x0]);
+      shift = y & 63;
+      if(fInkIsBlack){
+	if(fUseGrayscaleProf){
+	  for(int x=0; x < bw; ++x){
+	    pBits[x] |= ((D_uint64)(pRow[x] <= tval)) << shift;
+	    pProfBlock[x] += 255 - (int)(pRow[x]);
+	  }
+	}
+	else{
+	  for(int x=0; x < bw; ++x)
+	    pBits[x] |= ((D_uint64)(pRow[x] <= tval)) << shift;
+	}
+      }
+      else{
+	if(fUseGrayscaleProf){
+	  for(int x=0; x < bw; ++x){
+	    pBits[x] |= ((D_uint64)(pRow[x] > tval)) << shift;
+	    pProfBlock[x] += (int)(pRow[x]);
+	  }
+	}
+	else{
+	  for(int x=0; x < bw; ++x)
+	    pBits[x] |= ((D_uint64)(pRow[x] > tval)) << shift;
+	}
+      }
+    }
+
+    for(int x=0; x < bw; ++x){
+      D_uint64 carry;//ink bit of the row just above the current word
+      int count, first, last, trans;
+      carry = 0;
+      count = trans = 0;
+      first = last = -1;
+      for(int wi=0; wi < numWords; ++wi){
+	D_uint64 bits;
+	bits = rgBits[wi*bw + x];
+	if(0 != bits){
+	  count += __builtin_popcountll(bits);
+	  if(first < 0)
+	    first = wi*64 + __builtin_ctzll(bits);
+	  last = wi*64 + 63 - __builtin_clzll(bits);
+	  //background to ink (going down): ink here but not in the row above
+	  trans += __builtin_popcountll(bits & ~((bits << 1) | carry));
+	}
+	carry = bits >> 63;
+      }
+      if(!fUseGrayscaleProf)
+	pProf[x0+x] = count;
+      pUpper[x0+x] = (first < 0) ? DWORDFEATURES_NO_INK : first;
+      pLower[x0+x] = (last < 0) ? DWORDFEATURES_NO_INK : (h - last);
+      pTrans[x0+x] = trans;
+    }
+  }
+  free(rgBits);
+
+  fillNoInkColumns(pUpper, w, "upper");
+  fillNoInkColumns(pLower, w, "lower");
+}
+
+//check the options that extractWordFeatures() and extractWordFeatures_flt()
+//don't implement
+static void checkWordFeatureOptions(const DImage &img, bool fUseGrayscaleProf,
+				    bool fUseMyTransitions, bool fRangeIs255){
+  if(DImage::DImage_u8 != img.getImageType()){
+    fprintf(stderr, "DWordFeatures::extractWordFeatures() only supports 8-bit "
+	    "grayscale data\n");
+    exit(1);
+  }
+  if(fUseGrayscaleProf && (!fRangeIs255)){
+    fprintf(stderr,"DWordFeatures::extractWordFeatures() if "
+	    "fUseGrayscaleProf is true, then fRangeIs255 should be too!\n");
+    exit(1);
+  }
+  if(!fRangeIs255){
+    fprintf(stderr, "DWordFeatures::extractWordFeatures() NYI for fRangeIs255=false\n");
+    exit(1);
+  }
+  if(fUseMyTransitions){
+    fprintf(stderr, "DWordFeatures::extractWordFeatures() NYI for fUseMyTransitions=true\n");
+    exit(1);
+  }
+}
+
+//largest value in rgVals (or 0 if none are positive)
+static int getMaxRawFeature(const int *rgVals, int w){
+  int maxVal = 0;
+  for(int x=0; x < w; ++x){
+    if(rgVals[x] > maxVal)
+      maxVal = rgVals[x];
+  }
+  return maxVal;
+}
+
+
 ///Extract word-level features based on those used by Rath, Manmatha
 /**This method assumes that img has already been properly prepared
    including: deskewed, sized, background removed, noise removed,slant
@@ -30,280 +204,45 @@ DFeatureVector DWordFeatures::extractWordFeatures(DImage &img,
 						  double weight_trans){
   int w, h;
   DFeatureVector fv;
+  double *pProf, *pUpper, *pLower, *pTrans;//start of each feature within data
+  int *rgRaw;
+  int maxProf, maxUpper, maxLower;
+
+  checkWordFeatureOptions(img, fUseGrayscaleProf, fUseMyTransitions,
+			  fRangeIs255);
   w = img.width();
   h = img.height();
-  double *pProf, *pUpper, *pLower, *pTrans;//start of each feature within data
-  D_uint8 *p8;
-  
-  if(DImage::DImage_u8 != img.getImageType()){
-    fprintf(stderr, "DWordFeatures::extractWordFeatures() only supports 8-bit "
-	    "grayscale data\n");
-    exit(1);
-  }
   //passing NULL in here means to allocate space, but leave it uninitialized
   fv.setData_dbl(NULL/*allocate*/, w, 4, true, true, true);
   pProf = fv.pDbl;
   pUpper = &(pProf[w]);
   pLower = &(pProf[w*2]);
   pTrans = &(pProf[w*3]);
-  memset(pProf,0,sizeof(double)*w*4);
-
-  p8 = img.dataPointer_u8();
-
-  //TODO: instead of making four passes through the image (one for each feature,
-  //I could combine them all into a single loop.  I'll leave it separate for
-  //now for debug purposes and because this isn't a bottleneck anyway.
-
-
-  // Feature 0: Profile
-  if(fUseGrayscaleProf){
-    if(!fRangeIs255){
-      fprintf(stderr,"DWordFeatures::extractWordFeatures() if "
-	      "fUseGrayscaleProf is true, then fRangeIs255 should be too!\n");
-      exit(1);
-    }
-    if(fInkIsBlack){
-      for(int y=0, idx=0; y < h; ++y){
-	for(int x=0; x < w; ++x, ++idx){
-	  pProf[x] += 255.-(double)(p8[idx]);
-	}
-      }
-    }//if fInkIsBlack
-    else{
-      for(int y=0, idx=0; y < h; ++y){
-	for(int x=0; x < w; ++x, ++idx){
-	  pProf[x] += (double)(p8[idx]);
-	}
-      }
-    }
-  }//if fUseGrayscaleProf
-  else{
-    if(fRangeIs255){
-      if(fInkIsBlack){
-	for(int y=0, idx=0; y < h; ++y){
-	  for(int x=0; x < w; ++x, ++idx){
-	    if(p8[idx] <= tval)
-	      pProf[x] += 1;
-	  }
-	}
-      }
-      else{
-	for(int y=0, idx=0; y < h; ++y){
-	  for(int x=0; x < w; ++x, ++idx){
-	    if(p8[idx] > tval)
-	      pProf[x] += 1;
-	  }
-	}
-      }
-    }//end if fRangeIs255
-    else{
-      fprintf(stderr, "DWordFeatures::extractWordFeatures() NYI for fRangeIs255=false\n");
-      exit(1);
-    }
-  }
-  
-
-  // Feature 1: Upper Profile
-  for(int x=0; x < w; ++x)
-    pUpper[x] = 999999.;
-
-  if(fRangeIs255){
-    if(fInkIsBlack){
-      for(int y=0, idx=0; y < h; ++y){
-	for(int x=0; x < w; ++x, ++idx){
-	  if((p8[idx] <= tval)&&(y<pUpper[x]))
-	    pUpper[x] = y;
-	}
-      }
-    }
-    else{
-      for(int y=0, idx=0; y < h; ++y){
-	for(int x=0; x < w; ++x, ++idx){
-	  if((p8[idx] > tval)&&(y<pUpper[x]))
-	    pUpper[x] = y;
-	}
-      }
-    }
-  }//end if fRangeIs255
-  else{
-    fprintf(stderr, "DWordFeatures::extractWordFeatures() NYI for fRangeIs255=false\n");
-    exit(1);
-  }
-  // interpolate values where there is no ink in the column
-  {
-    int idxPrev, idxNext;
-    for(int x=0; x < w; ++x){
-      if(pUpper[x] == 999999.){
-	idxPrev = x-1;
-	idxNext = x+1;
-	double prevVal, nextVal;//values to interpolate
-	if(x>0)
-	  prevVal = pUpper[x-1];
-	while((idxNext < w)&& (pUpper[idxNext] == 999999.))
-	  ++idxNext;
-	if(idxNext >= w){//we went past the right end
-	  if(idxPrev<0){//this shouldn't happen.  There must be no ink!
-	    fprintf(stderr, "WARNING: DWordFeatures::extractWordFeatures() "
-		    "found no ink for upper profile!\n");
-	    break;
-	  }
-	  nextVal = prevVal;
-	}
-	else
-	  nextVal = pUpper[idxNext];
-	if(x<=0)
-	  prevVal = nextVal;
-	for(int i= idxPrev+1; i < idxNext; ++i){
-	  double s;// distance along the segment between idxPrev and idxNext
-	  s = (i-idxPrev) / (idxNext-idxPrev);
-	  pUpper[i] = (1.0-s)*prevVal + s*nextVal;
-	}
-	x=idxNext-1;
-      }
-    }
-  }
-
-
-
-
-  // Feature 3: Lower Profile
-  for(int x=0; x < w; ++x)
-    pLower[x] = 999999.;
-
-  if(fRangeIs255){
-    if(fInkIsBlack){
-      for(int y=0, idx=0; y < h; ++y){
-	for(int x=0; x < w; ++x, ++idx){
-	  if((p8[idx] <= tval)&&((h-y)<pLower[x]))
-	    pLower[x] = (h-y);
-	}
-      }
-    }
-    else{
-      for(int y=0, idx=0; y < h; ++y){
-	for(int x=0; x < w; ++x, ++idx){
-	  if((p8[idx] > tval)&&((h-y)<pLower[x]))
-	    pLower[x] = (h-y);
-	}
-      }
-    }
-  }//end if fRangeIs255
-  else{
-    fprintf(stderr, "DWordFeatures::extractWordFeatures() NYI for fRangeIs255=false\n");
-    exit(1);
-  }
-  // interpolate values where there is no ink in the column
-  {
-    int idxPrev, idxNext;
-    for(int x=0; x < w; ++x){
-      if(pLower[x] == 999999.){
-	idxPrev = x-1;
-	idxNext = x+1;
-	double prevVal, nextVal;//values to interpolate
-	if(x>0)
-	  prevVal = pLower[x-1];
-	while((idxNext < w)&& (pLower[idxNext] == 999999.))
-	  ++idxNext;
-	if(idxNext >= w){//we went past the right end
-	  if(idxPrev<0){//this shouldn't happen.  There must be no ink!
-	    fprintf(stderr, "WARNING: DWordFeatures::extractWordFeatures() "
-		    "found no ink for upper profile!\n");
-	    break;
-	  }
-	  nextVal = prevVal;
-	}
-	else
-	  nextVal = pLower[idxNext];
-	if(x<=0)
-	  prevVal = nextVal;
-	for(int i= idxPrev+1; i < idxNext; ++i){
-	  double s;// distance along the segment between idxPrev and idxNext
-	  s = (i-idxPrev) / (idxNext-idxPrev);
-	  pLower[i] = (1.0-s)*prevVal + s*nextVal;
-	}
-	x=idxNext-1;
-      }
-    }
-  }
-
-
-  // Feature 3: Background to Ink Transition Counts
-  if(!fUseMyTransitions){//use Rath and Manmatha's instead
-    if(fRangeIs255){
-      if(fInkIsBlack){
-	for(int x=0; x < w; ++x){//first row
-	  if(p8[x] <= tval)
-	    pTrans[x] = 1.0;
-	}
-	for(int y=1, idx=w; y < h; ++y){
-	  for(int x=0; x < w; ++x, ++idx){
-	    if((p8[idx] <= tval)&&(p8[idx-w]>tval))
-	      pTrans[x] += 1.0;
-	  }
-	}
-      }
-      else{
-	for(int x=0; x < w; ++x){//first row
-	  if(p8[x] > tval)
-	    pTrans[x] = 1.0;
-	}
-	for(int y=1, idx=w; y < h; ++y){
-	  for(int x=0; x < w; ++x, ++idx){
-	    if((p8[idx] > tval)&&(p8[idx-w]<=tval))
-	      pTrans[x] += 1.0;
-	  }
-	}
-      }
-    }//end if fRangeIs255
-    else{
-      fprintf(stderr, "DWordFeatures::extractWordFeatures() NYI for fRangeIs255=false\n");
-      exit(1);
-    }
-  }
-  else{
-    fprintf(stderr, "DWordFeatures::extractWordFeatures() NYI for fUseMyTransitions=true\n");
-    exit(1);
-  }
-
-  
+  rgRaw = (int*)malloc(sizeof(int)*w*4);
+  D_CHECKPTR(rgRaw);
+  getRawWordFeatures(img.dataPointer_u8(), w, h, fUseGrayscaleProf,
+		     fInkIsBlack, tval, rgRaw);
 
   //normalize the features and weight them appropriately----------
   //Rath/Manmatha normalized the grayscale profile, the upper profile,
   //and lower profile from 0 to 1 (based on max values), and divided
   //the transition counts by 6.
-  double maxProf, maxUpper, maxLower;
-  maxProf = maxUpper = maxLower = 0.;
+  maxProf = getMaxRawFeature(rgRaw, w);
+  maxUpper = getMaxRawFeature(&(rgRaw[w]), w);
+  maxLower = getMaxRawFeature(&(rgRaw[w*2]), w);
   for(int x=0; x < w; ++x){
-    if(pProf[x] > maxProf)
-      maxProf = pProf[x];
-  }
-  if(maxProf > 0.){
-    for(int x=0; x < w; ++x){
+    pProf[x] = (double)(rgRaw[x]);
+    if(maxProf > 0)
       pProf[x] /= maxProf;
-    }
-  }
-  for(int x=0; x < w; ++x){
-    if(pUpper[x] > maxUpper)
-      maxUpper = pUpper[x];
-  }
-  if(maxUpper > 0.){
-    for(int x=0; x < w; ++x){
+    pUpper[x] = (double)(rgRaw[w+x]);
+    if(maxUpper > 0)
       pUpper[x] /= maxUpper;
-    }
-  }
-  for(int x=0; x < w; ++x){
-    if(pLower[x] > maxLower)
-      maxLower = pLower[x];
-  }
-  if(maxLower > 0.){
-    for(int x=0; x < w; ++x){
+    pLower[x] = (double)(rgRaw[w*2+x]);
+    if(maxLower > 0)
       pLower[x] /= maxLower;
-    }
+    pTrans[x] = rgRaw[w*3+x] / 6.;
   }
-  for(int x=0; x < w; ++x){
-    pTrans[x] /= 6.;
-  }
-
+  free(rgRaw);
 
   return fv;
 }
@@ -311,18 +250,59 @@ DFeatureVector DWordFeatures::extractWordFeatures(DImage &img,
 
 ///same as extractWordFeatures() but creates DFeatureVectors with float data
 /**The main reason one might wish to use float instead of double data is that
-   if dealing with large numbers of feature vectors (comparing each word to a big training set, for example), the amount of memory required is smaller.*/
+   if dealing with large numbers of feature vectors (comparing each word to a big training set, for example), the amount of memory required is smaller.
+   The features are computed as integers and normalized straight into
+   the float data, so each value is the float nearest the double that
+   extractWordFeatures() gives.*/
 DFeatureVector DWordFeatures::extractWordFeatures_flt(DImage &img,
 						      bool fUseGrayscaleProf,
 						      bool fUseMyTransitions,
 						      bool fInkIsBlack,
 						      bool fRangeIs255,
+						      D_uint8 tval,
 						      float weight_prof,
 						      float weight_upper,
 						      float weight_lower,
 						      float weight_trans){
-  fprintf(stderr,"DWordFeatures::extractWordFeatures_flt() NYI!\n");
-  exit(1);
+  int w, h;
+  DFeatureVector fv;
+  float *pProf, *pUpper, *pLower, *pTrans;//start of each feature within data
+  int *rgRaw;
+  int maxProf, maxUpper, maxLower;
+
+  checkWordFeatureOptions(img, fUseGrayscaleProf, fUseMyTransitions,
+			  fRangeIs255);
+  w = img.width();
+  h = img.height();
+  fv.setData_flt(NULL/*allocate*/, w, 4, true, true, true);
+  pProf = fv.pFlt;
+  pUpper = &(pProf[w]);
+  pLower = &(pProf[w*2]);
+  pTrans = &(pProf[w*3]);
+  rgRaw = (int*)malloc(sizeof(int)*w*4);
+  D_CHECKPTR(rgRaw);
+  getRawWordFeatures(img.dataPointer_u8(), w, h, fUseGrayscaleProf,
+		     fInkIsBlack, tval, rgRaw);
+
+  maxProf = getMaxRawFeature(rgRaw, w);
+  maxUpper = getMaxRawFeature(&(rgRaw[w]), w);
+  maxLower = getMaxRawFeature(&(rgRaw[w*2]), w);
+  for(int x=0; x < w; ++x){
+    //(a float divided by a float is the same as the double result rounded)
+    pProf[x] = (float)(rgRaw[x]);
+    if(maxProf > 0)
+      pProf[x] /= (float)maxProf;
+    pUpper[x] = (float)(rgRaw[w+x]);
+    if(maxUpper > 0)
+      pUpper[x] /= (float)maxUpper;
+    pLower[x] = (float)(rgRaw[w*2+x]);
+    if(maxLower > 0)
+      pLower[x] /= (float)maxLower;
+    pTrans[x] = (float)(rgRaw[w*3+x]) / 6.f;
+  }
+  free(rgRaw);
+
+  return fv;
 }
 
 /**create a feature vector from the first few coefficients of the four word-level features like Manmatha did so the features can be quickly compared and easily clustered instead of having to do dynamic warping between all pairs, etc.*/
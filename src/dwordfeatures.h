@@ -17,10 +17,11 @@ public:
 					    double weight_lower=1.,
 					    double weight_trans=1.);
   static DFeatureVector extractWordFeatures_flt(DImage &img,
-						bool fUseGrayscaleProf=false,
-						bool fUseMyTransitions=true,
+						bool fUseGrayscaleProf=true,
+						bool fUseMyTransitions=false,
 						bool fInkIsBlack=true,
 						bool fRangeIs255=true,
+						D_uint8 tval=127,
 						float weight_prof=1.,
 						float weight_upper=1.,
 						float weight_lower=1.,